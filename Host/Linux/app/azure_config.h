@@ -0,0 +1,51 @@
+/* Copyright (c) Microsoft Corporation.
+   Licensed under the MIT License. */
+
+#ifndef _AZURE_CONFIG_H
+#define _AZURE_CONFIG_H
+
+// ----------------------------------------------------------------------------
+// Azure IoT Dynamic Provisioning Service
+//    Define this to use the DPS service, otherwise direct IoT Hub
+// ----------------------------------------------------------------------------
+//#define ENABLE_DPS
+
+// ----------------------------------------------------------------------------
+// Azure IoT DPS connection config
+//    IOT_DPS_ID_SCOPE:        The DPS ID Scope
+//    IOT_DPS_REGISTRATION_ID: The DPS device Registration Id
+// ----------------------------------------------------------------------------
+#define IOT_DPS_ID_SCOPE        ""
+#define IOT_DPS_REGISTRATION_ID ""
+
+// ----------------------------------------------------------------------------
+// Azure IoT Hub connection config
+//    IOT_HUB_HOSTNAME:  The Azure IoT Hub hostname, or the loopback hub (see readme.md)
+//    IOT_HUB_DEVICE_ID: The Azure IoT Hub device id
+// ----------------------------------------------------------------------------
+#define IOT_HUB_HOSTNAME  "loopback-hub.local"
+#define IOT_HUB_DEVICE_ID "host-device"
+
+// ----------------------------------------------------------------------------
+// Azure IoT DPS Self-Signed X509Certificate
+//    Define this to connect to DPS or Iot Hub using a X509 certificate
+// ----------------------------------------------------------------------------
+//#define ENABLE_X509
+
+// ----------------------------------------------------------------------------
+// Azure IoT device SAS key
+//    The SAS Primary key generated by Azure IoT, the loopback hub accepts any key
+// ----------------------------------------------------------------------------
+#define IOT_DEVICE_SAS_KEY "bG9vcGJhY2staHViLWRldmljZS1rZXk="
+
+// ----------------------------------------------------------------------------
+// Telemetry benchmark
+//    Define this to publish TELEMETRY_BENCHMARK_MESSAGES back to back once
+//    connected, print the pipeline statistics and exit non-zero if the p99
+//    latency of a whole publish exceeds TELEMETRY_BENCHMARK_P99_LIMIT_US
+// ----------------------------------------------------------------------------
+//#define ENABLE_TELEMETRY_BENCHMARK
+#define TELEMETRY_BENCHMARK_MESSAGES     1000
+#define TELEMETRY_BENCHMARK_P99_LIMIT_US 20000
+
+#endif // _AZURE_CONFIG_H
@@ -0,0 +1,297 @@
+/* Copyright (c) Microsoft Corporation.
+   Licensed under the MIT License. */
+
+#include "nx_client.h"
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "nx_api.h"
+#include "nx_azure_iot_hub_client.h"
+#include "nx_azure_iot_json_reader.h"
+#include "nx_azure_iot_provisioning_client.h"
+
+#include "azure_iot_nx_client.h"
+#include "azure_iot_store_file.h"
+#include "azure_iot_telemetry_spill_file.h"
+#include "networking.h"
+#include "sensor_registry.h"
+
+#include "azure_config.h"
+#include "azure_device_x509_cert_config.h"
+#include "azure_pnp_info.h"
+#include "gsg_dispatch.h"
+
+#define IOT_MODEL_ID "dtmi:azurertos:devkit:gsghostlinux;1"
+
+#define TELEMETRY_TEMPERATURE       "temperature"
+#define TELEMETRY_PRESSURE          "pressure"
+#define TELEMETRY_HUMIDITY          "humidity"
+#define TELEMETRY_INTERVAL_PROPERTY "telemetryInterval"
+#define LED_STATE_PROPERTY          "ledState"
+
+static AZURE_IOT_NX_CONTEXT azure_iot_nx_client;
+
+static int32_t telemetry_interval = 10;
+static bool telemetry_interval_desired;
+
+// Sampled on the telemetry timer, a window covers one reading
+static SENSOR_REGISTRY sensor_registry;
+
+static UINT append_device_info_properties(NX_AZURE_IOT_JSON_WRITER* json_writer)
+{
+    if (nx_azure_iot_json_writer_append_property_with_string_value(json_writer,
+            (UCHAR*)DEVICE_INFO_MANUFACTURER_PROPERTY_NAME,
+            sizeof(DEVICE_INFO_MANUFACTURER_PROPERTY_NAME) - 1,
+            (UCHAR*)DEVICE_INFO_MANUFACTURER_PROPERTY_VALUE,
+            sizeof(DEVICE_INFO_MANUFACTURER_PROPERTY_VALUE) - 1) ||
+        nx_azure_iot_json_writer_append_property_with_string_value(json_writer,
+            (UCHAR*)DEVICE_INFO_MODEL_PROPERTY_NAME,
+            sizeof(DEVICE_INFO_MODEL_PROPERTY_NAME) - 1,
+            (UCHAR*)DEVICE_INFO_MODEL_PROPERTY_VALUE,
+            sizeof(DEVICE_INFO_MODEL_PROPERTY_VALUE) - 1) ||
+        nx_azure_iot_json_writer_append_property_with_string_value(json_writer,
+            (UCHAR*)DEVICE_INFO_SW_VERSION_PROPERTY_NAME,
+            sizeof(DEVICE_INFO_SW_VERSION_PROPERTY_NAME) - 1,
+            (UCHAR*)DEVICE_INFO_SW_VERSION_PROPERTY_VALUE,
+            sizeof(DEVICE_INFO_SW_VERSION_PROPERTY_VALUE) - 1) ||
+        nx_azure_iot_json_writer_append_property_with_string_value(json_writer,
+            (UCHAR*)DEVICE_INFO_OS_NAME_PROPERTY_NAME,
+            sizeof(DEVICE_INFO_OS_NAME_PROPERTY_NAME) - 1,
+            (UCHAR*)DEVICE_INFO_OS_NAME_PROPERTY_VALUE,
+            sizeof(DEVICE_INFO_OS_NAME_PROPERTY_VALUE) - 1) ||
+        nx_azure_iot_json_writer_append_property_with_string_value(json_writer,
+            (UCHAR*)DEVICE_INFO_PROCESSOR_ARCHITECTURE_PROPERTY_NAME,
+            sizeof(DEVICE_INFO_PROCESSOR_ARCHITECTURE_PROPERTY_NAME) - 1,
+            (UCHAR*)DEVICE_INFO_PROCESSOR_ARCHITECTURE_PROPERTY_VALUE,
+            sizeof(DEVICE_INFO_PROCESSOR_ARCHITECTURE_PROPERTY_VALUE) - 1) ||
+        nx_azure_iot_json_writer_append_property_with_string_value(json_writer,
+            (UCHAR*)DEVICE_INFO_PROCESSOR_MANUFACTURER_PROPERTY_NAME,
+            sizeof(DEVICE_INFO_PROCESSOR_MANUFACTURER_PROPERTY_NAME) - 1,
+            (UCHAR*)DEVICE_INFO_PROCESSOR_MANUFACTURER_PROPERTY_VALUE,
+            sizeof(DEVICE_INFO_PROCESSOR_MANUFACTURER_PROPERTY_VALUE) - 1) ||
+        nx_azure_iot_json_writer_append_property_with_double_value(json_writer,
+            (UCHAR*)DEVICE_INFO_TOTAL_STORAGE_PROPERTY_NAME,
+            sizeof(DEVICE_INFO_TOTAL_STORAGE_PROPERTY_NAME) - 1,
+            DEVICE_INFO_TOTAL_STORAGE_PROPERTY_VALUE,
+            2) ||
+        nx_azure_iot_json_writer_append_property_with_double_value(json_writer,
+            (UCHAR*)DEVICE_INFO_TOTAL_MEMORY_PROPERTY_NAME,
+            sizeof(DEVICE_INFO_TOTAL_MEMORY_PROPERTY_NAME) - 1,
+            DEVICE_INFO_TOTAL_MEMORY_PROPERTY_VALUE,
+            2))
+    {
+        return NX_NOT_SUCCESSFUL;
+    }
+
+    return NX_AZURE_IOT_SUCCESS;
+}
+
+// Simulated sensor, wander around typical indoor values so the payload size varies like a real device
+static UINT simulated_read(float* values, UINT max_samples)
+{
+    values[0] = 45.0f + (rand() % 100) / 10.0f;
+    values[1] = 23.5f + (rand() % 100) / 50.0f;
+    values[2] = 1001.2f + (rand() % 100) / 20.0f;
+
+    return 1;
+}
+
+static const SENSOR_CHANNEL_DESCRIPTOR simulated_channels[] = {
+    {TELEMETRY_HUMIDITY, "percent", "percent", 0},
+    {TELEMETRY_TEMPERATURE, "degreeCelsius", "degreeCelsius", 1},
+    {TELEMETRY_PRESSURE, "hectopascal", "hectopascal", 2},
+};
+
+static const SENSOR_DESCRIPTOR sensors[] = {
+    {"simulated", simulated_channels, 3, 0, simulated_read},
+};
+
+static UINT append_device_telemetry(NX_AZURE_IOT_JSON_WRITER* json_writer)
+{
+    return sensor_registry_append_json(&sensor_registry, json_writer, 0, sensor_registry.channel_count);
+}
+
+static void set_led_state(bool level)
+{
+    // No LED on the host, just report the state change
+    printf("LED is turned %s\r\n", level ? "ON" : "OFF");
+}
+
+UINT gsg_set_led_state_command(AZURE_IOT_NX_CONTEXT* nx_context, bool value)
+{
+    set_led_state(value);
+    azure_iot_nx_client_publish_bool_property(nx_context, NULL, LED_STATE_PROPERTY, value);
+
+    return 200;
+}
+
+UINT gsg_telemetry_interval_set(AZURE_IOT_NX_CONTEXT* nx_context, int32_t value)
+{
+    // Answered here with the twin version, properties_complete_cb only reports the default when there was none
+    telemetry_interval_desired = true;
+
+    if (value < 1)
+    {
+        printf("Rejecting %s of %d\r\n", TELEMETRY_INTERVAL_PROPERTY, (INT)value);
+        return 400;
+    }
+
+    printf("Updating %s to %d\r\n", TELEMETRY_INTERVAL_PROPERTY, (INT)value);
+    telemetry_interval = value;
+    azure_nx_client_periodic_interval_set(nx_context, telemetry_interval);
+
+    return 200;
+}
+
+// Take a reading and send it out
+static void telemetry_publish(AZURE_IOT_NX_CONTEXT* nx_context)
+{
+    sensor_registry_sample(&sensor_registry);
+    sensor_registry_collect(&sensor_registry);
+
+    azure_iot_nx_client_publish_telemetry(nx_context, NULL, append_device_telemetry);
+
+    sensor_registry_reset(&sensor_registry, 0, sensor_registry.channel_count);
+}
+
+static ULONG monotonic_clock_us()
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (ULONG)(ts.tv_sec * 1000000 + ts.tv_nsec / 1000);
+}
+
+#ifdef ENABLE_TELEMETRY_BENCHMARK
+static void telemetry_benchmark_run(AZURE_IOT_NX_CONTEXT* nx_context)
+{
+    AZURE_IOT_TELEMETRY_STATS* stats = azure_iot_nx_client_telemetry_stats_get(nx_context);
+    UINT status;
+    UINT i;
+
+    printf("\r\nRunning telemetry benchmark (%d messages)\r\n", TELEMETRY_BENCHMARK_MESSAGES);
+
+    azure_iot_telemetry_stats_reset(stats);
+
+    for (i = 0; i < TELEMETRY_BENCHMARK_MESSAGES; i++)
+    {
+        telemetry_publish(nx_context);
+    }
+
+    azure_iot_telemetry_stats_print(stats);
+
+    // Bulk record throughput is the payload over the time spent in the TLS/MQTT send
+    printf("TLS profile %s: connect %lu ms, %lu payload bytes/s\r\n",
+        AZURE_IOT_TLS_PROFILE_NAME,
+        nx_context->azure_iot_connect_ticks * 1000 / TX_TIMER_TICKS_PER_SECOND,
+        stats->stage[AZURE_IOT_TELEMETRY_STAGE_SEND].total == 0
+            ? 0
+            : (ULONG)(stats->payload_bytes * 1000000ULL / stats->stage[AZURE_IOT_TELEMETRY_STAGE_SEND].total));
+
+    status = azure_iot_telemetry_stats_check(
+        stats, AZURE_IOT_TELEMETRY_STAGE_TOTAL, TELEMETRY_BENCHMARK_P99_LIMIT_US);
+
+    if (stats->failures > 0)
+    {
+        printf("ERROR: %lu telemetry messages failed\r\n", stats->failures);
+        status = NX_NOT_SUCCESSFUL;
+    }
+
+    printf("Telemetry benchmark %s\r\n", status == NX_SUCCESS ? "PASSED" : "FAILED");
+
+    exit(status == NX_SUCCESS ? 0 : 1);
+}
+#endif
+
+static void properties_complete_cb(AZURE_IOT_NX_CONTEXT* nx_context)
+{
+    // Device twin processing is done, send out property updates
+    azure_iot_nx_client_publish_properties(nx_context, DEVICE_INFO_COMPONENT_NAME, append_device_info_properties);
+    azure_iot_nx_client_publish_bool_property(nx_context, NULL, LED_STATE_PROPERTY, false);
+
+    if (!telemetry_interval_desired)
+    {
+        azure_iot_nx_client_publish_int_writable_property(
+            nx_context, NULL, TELEMETRY_INTERVAL_PROPERTY, telemetry_interval);
+    }
+
+#ifdef ENABLE_TELEMETRY_BENCHMARK
+    telemetry_benchmark_run(nx_context);
+#endif
+
+    printf("\r\nStarting Main loop\r\n");
+}
+
+static void telemetry_cb(AZURE_IOT_NX_CONTEXT* nx_context)
+{
+    telemetry_publish(nx_context);
+}
+
+UINT azure_iot_nx_client_entry(
+    NX_IP* ip_ptr, NX_PACKET_POOL* pool_ptr, NX_DNS* dns_ptr, UINT (*unix_time_callback)(ULONG* unix_time))
+{
+    UINT status;
+
+    if ((status = sensor_registry_init(&sensor_registry, sensors, sizeof(sensors) / sizeof(sensors[0]), 0)))
+    {
+        printf("ERROR: sensor_registry_init failed (0x%08x)\r\n", status);
+        return status;
+    }
+
+    if ((status = azure_iot_nx_client_create(&azure_iot_nx_client,
+             ip_ptr,
+             pool_ptr,
+             dns_ptr,
+             unix_time_callback,
+             IOT_MODEL_ID,
+             sizeof(IOT_MODEL_ID) - 1)))
+    {
+        printf("ERROR: azure_iot_nx_client_create failed (0x%08x)\r\n", status);
+        return status;
+    }
+
+    // Time the telemetry pipeline with the host clock rather than the ThreadX tick
+    azure_iot_nx_client_telemetry_stats_clock_set(&azure_iot_nx_client, monotonic_clock_us);
+
+    // Register the callbacks, commands and writable properties are dispatched by the table generated from the model
+    azure_iot_nx_client_register_dispatch_table(&azure_iot_nx_client, &gsg_dispatch_table);
+    azure_iot_nx_client_register_properties_complete_callback(&azure_iot_nx_client, properties_complete_cb);
+    azure_iot_nx_client_register_timer_callback(&azure_iot_nx_client, telemetry_cb, telemetry_interval);
+
+    // Setup authentication
+#ifdef ENABLE_X509
+    if ((status = azure_iot_nx_client_cert_set(&azure_iot_nx_client,
+             (UCHAR*)iot_x509_device_cert,
+             iot_x509_device_cert_len,
+             (UCHAR*)iot_x509_private_key,
+             iot_x509_private_key_len)))
+    {
+        printf("ERROR: azure_iot_nx_client_cert_set (0x%08x)\r\n", status);
+        return status;
+    }
+#else
+    if ((status = azure_iot_nx_client_sas_set(&azure_iot_nx_client, IOT_DEVICE_SAS_KEY)))
+    {
+        printf("ERROR: azure_iot_nx_client_sas_set (0x%08x)\r\n", status);
+        return status;
+    }
+#endif
+
+    // Keep telemetry published during an outage on disk once the RAM queue is full
+    azure_iot_nx_client_telemetry_spill_set(&azure_iot_nx_client, &azure_iot_telemetry_spill_file);
+
+    // Enter the main loop
+#ifdef ENABLE_DPS
+    azure_iot_nx_client_store_set(&azure_iot_nx_client, &azure_iot_store_file);
+    azure_iot_nx_client_dps_run(&azure_iot_nx_client, IOT_DPS_ID_SCOPE, IOT_DPS_REGISTRATION_ID, network_connect);
+#else
+    azure_iot_nx_client_hub_run(&azure_iot_nx_client, IOT_HUB_HOSTNAME, IOT_HUB_DEVICE_ID, network_connect);
+#endif
+
+    return NX_SUCCESS;
+}
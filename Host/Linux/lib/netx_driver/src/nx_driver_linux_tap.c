@@ -0,0 +1,324 @@
+/* Copyright (c) Microsoft Corporation.
+   Licensed under the MIT License. */
+
+// NetX Duo driver for a Linux TAP device. The host bridges or routes the TAP interface, so the
+// simulated device sees an ordinary Ethernet segment with DHCP, DNS and the loopback hub on it.
+
+#include "nx_driver_linux_tap.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <linux/if.h>
+#include <linux/if_tun.h>
+#include <sys/ioctl.h>
+
+#define NX_DRIVER_RECEIVE_THREAD_STACK_SIZE 4096
+#define NX_DRIVER_RECEIVE_THREAD_PRIORITY   2
+
+// Poll interval when the TAP device has nothing queued
+#define NX_DRIVER_RECEIVE_IDLE_TICKS 1
+
+UCHAR _nx_driver_hardware_address[] = NX_DRIVER_ETHERNET_MAC;
+
+static struct
+{
+    CHAR* device_name;
+    int fd;
+
+    NX_IP* ip_ptr;
+    NX_INTERFACE* interface_ptr;
+    UINT link_enabled;
+
+    TX_THREAD receive_thread;
+    ULONG receive_thread_stack[NX_DRIVER_RECEIVE_THREAD_STACK_SIZE / sizeof(ULONG)];
+
+    UCHAR transmit_buffer[NX_DRIVER_ETHERNET_MTU];
+} tap_driver = {.device_name = NX_DRIVER_LINUX_TAP_DEVICE, .fd = -1};
+
+static int tap_open(CHAR* device_name)
+{
+    struct ifreq ifr;
+    int fd;
+
+    if ((fd = open("/dev/net/tun", O_RDWR | O_NONBLOCK)) < 0)
+    {
+        printf("ERROR: Unable to open /dev/net/tun (%s)\r\n", strerror(errno));
+        return -1;
+    }
+
+    memset(&ifr, 0, sizeof(ifr));
+    ifr.ifr_flags = IFF_TAP | IFF_NO_PI;
+    strncpy(ifr.ifr_name, device_name, IFNAMSIZ - 1);
+
+    if (ioctl(fd, TUNSETIFF, &ifr) < 0)
+    {
+        printf("ERROR: Unable to attach to %s (%s)\r\n", device_name, strerror(errno));
+        close(fd);
+        return -1;
+    }
+
+    return fd;
+}
+
+static VOID tap_packet_transfer(NX_PACKET* packet_ptr)
+{
+    USHORT packet_type;
+
+    packet_ptr->nx_packet_ip_interface = tap_driver.interface_ptr;
+
+    packet_type = (USHORT)((packet_ptr->nx_packet_prepend_ptr[12] << 8) | packet_ptr->nx_packet_prepend_ptr[13]);
+
+    // Clean off the Ethernet header
+    packet_ptr->nx_packet_prepend_ptr += NX_DRIVER_ETHERNET_FRAME_SIZE;
+    packet_ptr->nx_packet_length -= NX_DRIVER_ETHERNET_FRAME_SIZE;
+
+    switch (packet_type)
+    {
+        case NX_DRIVER_ETHERNET_IP:
+        case NX_DRIVER_ETHERNET_IPV6:
+            _nx_ip_packet_deferred_receive(tap_driver.ip_ptr, packet_ptr);
+            break;
+
+        case NX_DRIVER_ETHERNET_ARP:
+            _nx_arp_packet_deferred_receive(tap_driver.ip_ptr, packet_ptr);
+            break;
+
+        case NX_DRIVER_ETHERNET_RARP:
+            _nx_rarp_packet_deferred_receive(tap_driver.ip_ptr, packet_ptr);
+            break;
+
+        default:
+            nx_packet_release(packet_ptr);
+            break;
+    }
+}
+
+static VOID tap_receive_thread_entry(ULONG parameter)
+{
+    NX_PACKET* packet_ptr = NX_NULL;
+    ssize_t length;
+
+    while (true)
+    {
+        if (!tap_driver.link_enabled)
+        {
+            tx_thread_sleep(NX_DRIVER_RECEIVE_IDLE_TICKS);
+            continue;
+        }
+
+        if (packet_ptr == NX_NULL &&
+            nx_packet_allocate(tap_driver.ip_ptr->nx_ip_default_packet_pool, &packet_ptr, NX_RECEIVE_PACKET, NX_NO_WAIT))
+        {
+            // Pool is exhausted, let the stack drain it and leave the frames queued in the kernel
+            packet_ptr = NX_NULL;
+            tx_thread_sleep(NX_DRIVER_RECEIVE_IDLE_TICKS);
+            continue;
+        }
+
+        // Offset by 2 so the IP header that follows the 14 byte Ethernet header is word aligned
+        packet_ptr->nx_packet_prepend_ptr = packet_ptr->nx_packet_data_start + 2;
+
+        length = read(tap_driver.fd,
+            packet_ptr->nx_packet_prepend_ptr,
+            (size_t)(packet_ptr->nx_packet_data_end - packet_ptr->nx_packet_prepend_ptr));
+
+        if (length <= NX_DRIVER_ETHERNET_FRAME_SIZE)
+        {
+            // Nothing queued (EAGAIN), interrupted by the ThreadX scheduler (EINTR) or a runt frame.
+            // Keep the packet for the next attempt.
+            tx_thread_sleep(NX_DRIVER_RECEIVE_IDLE_TICKS);
+            continue;
+        }
+
+        packet_ptr->nx_packet_length     = (ULONG)length;
+        packet_ptr->nx_packet_append_ptr = packet_ptr->nx_packet_prepend_ptr + length;
+
+        tap_packet_transfer(packet_ptr);
+        packet_ptr = NX_NULL;
+    }
+}
+
+static VOID tap_packet_send(NX_IP_DRIVER* driver_req_ptr)
+{
+    NX_PACKET* packet_ptr       = driver_req_ptr->nx_ip_driver_packet;
+    NX_INTERFACE* interface_ptr = driver_req_ptr->nx_ip_driver_interface;
+    UCHAR* frame                = tap_driver.transmit_buffer;
+    ULONG frame_length;
+    USHORT packet_type;
+
+    if (!tap_driver.link_enabled)
+    {
+        driver_req_ptr->nx_ip_driver_status = NX_NOT_ENABLED;
+        nx_packet_transmit_release(packet_ptr);
+        return;
+    }
+
+    if (packet_ptr->nx_packet_length > NX_DRIVER_ETHERNET_MTU - NX_DRIVER_ETHERNET_FRAME_SIZE)
+    {
+        driver_req_ptr->nx_ip_driver_status = NX_INVALID_PACKET;
+        nx_packet_transmit_release(packet_ptr);
+        return;
+    }
+
+    if (driver_req_ptr->nx_ip_driver_command == NX_LINK_ARP_SEND ||
+        driver_req_ptr->nx_ip_driver_command == NX_LINK_ARP_RESPONSE_SEND)
+    {
+        packet_type = NX_DRIVER_ETHERNET_ARP;
+    }
+    else if (driver_req_ptr->nx_ip_driver_command == NX_LINK_RARP_SEND)
+    {
+        packet_type = NX_DRIVER_ETHERNET_RARP;
+    }
+    else if (packet_ptr->nx_packet_ip_version == NX_IP_VERSION_V6)
+    {
+        packet_type = NX_DRIVER_ETHERNET_IPV6;
+    }
+    else
+    {
+        packet_type = NX_DRIVER_ETHERNET_IP;
+    }
+
+    // Build the Ethernet header, NetX supplies the broadcast address for broadcast and ARP requests
+    frame[0]  = (UCHAR)(driver_req_ptr->nx_ip_driver_physical_address_msw >> 8);
+    frame[1]  = (UCHAR)(driver_req_ptr->nx_ip_driver_physical_address_msw);
+    frame[2]  = (UCHAR)(driver_req_ptr->nx_ip_driver_physical_address_lsw >> 24);
+    frame[3]  = (UCHAR)(driver_req_ptr->nx_ip_driver_physical_address_lsw >> 16);
+    frame[4]  = (UCHAR)(driver_req_ptr->nx_ip_driver_physical_address_lsw >> 8);
+    frame[5]  = (UCHAR)(driver_req_ptr->nx_ip_driver_physical_address_lsw);
+    frame[6]  = (UCHAR)(interface_ptr->nx_interface_physical_address_msw >> 8);
+    frame[7]  = (UCHAR)(interface_ptr->nx_interface_physical_address_msw);
+    frame[8]  = (UCHAR)(interface_ptr->nx_interface_physical_address_lsw >> 24);
+    frame[9]  = (UCHAR)(interface_ptr->nx_interface_physical_address_lsw >> 16);
+    frame[10] = (UCHAR)(interface_ptr->nx_interface_physical_address_lsw >> 8);
+    frame[11] = (UCHAR)(interface_ptr->nx_interface_physical_address_lsw);
+    frame[12] = (UCHAR)(packet_type >> 8);
+    frame[13] = (UCHAR)(packet_type);
+
+    // Flatten the packet (it may be chained) behind the header
+    nx_packet_data_retrieve(packet_ptr, frame + NX_DRIVER_ETHERNET_FRAME_SIZE, &frame_length);
+    frame_length += NX_DRIVER_ETHERNET_FRAME_SIZE;
+
+    if (write(tap_driver.fd, frame, frame_length) != (ssize_t)frame_length)
+    {
+        driver_req_ptr->nx_ip_driver_status = NX_TX_QUEUE_DEPTH;
+    }
+
+    nx_packet_transmit_release(packet_ptr);
+}
+
+static VOID tap_initialize(NX_IP_DRIVER* driver_req_ptr)
+{
+    NX_INTERFACE* interface_ptr = driver_req_ptr->nx_ip_driver_interface;
+    UINT status;
+
+    if ((tap_driver.fd = tap_open(tap_driver.device_name)) < 0)
+    {
+        driver_req_ptr->nx_ip_driver_status = NX_NOT_SUCCESSFUL;
+        return;
+    }
+
+    tap_driver.ip_ptr        = driver_req_ptr->nx_ip_driver_ptr;
+    tap_driver.interface_ptr = interface_ptr;
+
+    interface_ptr->nx_interface_ip_mtu_size = NX_DRIVER_ETHERNET_MTU - NX_DRIVER_ETHERNET_FRAME_SIZE;
+    interface_ptr->nx_interface_physical_address_msw =
+        (ULONG)((_nx_driver_hardware_address[0] << 8) | _nx_driver_hardware_address[1]);
+    interface_ptr->nx_interface_physical_address_lsw =
+        (ULONG)((_nx_driver_hardware_address[2] << 24) | (_nx_driver_hardware_address[3] << 16) |
+                (_nx_driver_hardware_address[4] << 8) | _nx_driver_hardware_address[5]);
+    interface_ptr->nx_interface_address_mapping_needed = NX_TRUE;
+
+    if ((status = tx_thread_create(&tap_driver.receive_thread,
+             "TAP receive",
+             tap_receive_thread_entry,
+             0,
+             tap_driver.receive_thread_stack,
+             NX_DRIVER_RECEIVE_THREAD_STACK_SIZE,
+             NX_DRIVER_RECEIVE_THREAD_PRIORITY,
+             NX_DRIVER_RECEIVE_THREAD_PRIORITY,
+             TX_NO_TIME_SLICE,
+             TX_AUTO_START)))
+    {
+        printf("ERROR: Unable to create the TAP receive thread (0x%08x)\r\n", status);
+        close(tap_driver.fd);
+        tap_driver.fd                       = -1;
+        driver_req_ptr->nx_ip_driver_status = NX_NOT_SUCCESSFUL;
+        return;
+    }
+
+    printf("\tTAP device: %s\r\n", tap_driver.device_name);
+}
+
+static VOID tap_uninitialize(NX_IP_DRIVER* driver_req_ptr)
+{
+    tap_driver.link_enabled = NX_FALSE;
+
+    tx_thread_terminate(&tap_driver.receive_thread);
+    tx_thread_delete(&tap_driver.receive_thread);
+
+    if (tap_driver.fd >= 0)
+    {
+        close(tap_driver.fd);
+        tap_driver.fd = -1;
+    }
+}
+
+VOID nx_driver_linux_tap_device_set(CHAR* device_name)
+{
+    tap_driver.device_name = device_name;
+}
+
+VOID nx_driver_linux_tap(NX_IP_DRIVER* driver_req_ptr)
+{
+    driver_req_ptr->nx_ip_driver_status = NX_SUCCESS;
+
+    switch (driver_req_ptr->nx_ip_driver_command)
+    {
+        case NX_LINK_INTERFACE_ATTACH:
+            break;
+
+        case NX_LINK_INITIALIZE:
+            tap_initialize(driver_req_ptr);
+            break;
+
+        case NX_LINK_UNINITIALIZE:
+            tap_uninitialize(driver_req_ptr);
+            break;
+
+        case NX_LINK_ENABLE:
+            tap_driver.link_enabled                                      = NX_TRUE;
+            driver_req_ptr->nx_ip_driver_interface->nx_interface_link_up = NX_TRUE;
+            break;
+
+        case NX_LINK_DISABLE:
+            tap_driver.link_enabled                                      = NX_FALSE;
+            driver_req_ptr->nx_ip_driver_interface->nx_interface_link_up = NX_FALSE;
+            break;
+
+        case NX_LINK_PACKET_SEND:
+        case NX_LINK_PACKET_BROADCAST:
+        case NX_LINK_ARP_SEND:
+        case NX_LINK_ARP_RESPONSE_SEND:
+        case NX_LINK_RARP_SEND:
+            tap_packet_send(driver_req_ptr);
+            break;
+
+        case NX_LINK_MULTICAST_JOIN:
+        case NX_LINK_MULTICAST_LEAVE:
+            // The TAP device delivers every frame on the segment, nothing to filter
+            break;
+
+        case NX_LINK_GET_STATUS:
+            *(driver_req_ptr->nx_ip_driver_return_ptr) = driver_req_ptr->nx_ip_driver_interface->nx_interface_link_up;
+            break;
+
+        default:
+            driver_req_ptr->nx_ip_driver_status = NX_UNHANDLED_COMMAND;
+            break;
+    }
+}
@@ -0,0 +1,30 @@
+/* Copyright (c) Microsoft Corporation.
+   Licensed under the MIT License. */
+
+#ifndef _NX_DRIVER_LINUX_TAP_H
+#define _NX_DRIVER_LINUX_TAP_H
+
+#include "nx_api.h"
+
+// Ethernet frame types
+#define NX_DRIVER_ETHERNET_IP   0x0800
+#define NX_DRIVER_ETHERNET_IPV6 0x86dd
+#define NX_DRIVER_ETHERNET_ARP  0x0806
+#define NX_DRIVER_ETHERNET_RARP 0x8035
+
+#define NX_DRIVER_ETHERNET_MTU        1514
+#define NX_DRIVER_ETHERNET_FRAME_SIZE 14
+
+// Default TAP device, override with nx_driver_linux_tap_device_set before network_init
+#define NX_DRIVER_LINUX_TAP_DEVICE "tap0"
+
+// Locally administered MAC address of the simulated device
+#define NX_DRIVER_ETHERNET_MAC {0x02, 0x00, 0x5e, 0x10, 0x00, 0x01}
+
+extern UCHAR _nx_driver_hardware_address[];
+
+VOID nx_driver_linux_tap(NX_IP_DRIVER* driver_req_ptr);
+
+VOID nx_driver_linux_tap_device_set(CHAR* device_name);
+
+#endif // _NX_DRIVER_LINUX_TAP_H
@@ -0,0 +1,30 @@
+/**************************************************************************/
+/*                                                                        */
+/*       Copyright (c) Microsoft Corporation. All rights reserved.        */
+/*                                                                        */
+/*       This software is licensed under the Microsoft Software License   */
+/*       Terms for Microsoft Azure RTOS. Full text of the license can be  */
+/*       found in the LICENSE file at https://aka.ms/AzureRTOS_EULA       */
+/*       and in the root directory of this software.                      */
+/*                                                                        */
+/**************************************************************************/
+
+#ifndef NX_USER_H
+#define NX_USER_H
+
+#define NX_SECURE_ENABLE
+#define NX_SECURE_ENABLE_ECC_CIPHERSUITE
+#define NX_SECURE_ENABLE_AEAD_CIPHER
+#define NX_ENABLE_EXTENDED_NOTIFY_SUPPORT
+#define NX_ENABLE_IP_PACKET_FILTER
+#define NX_DISABLE_IPV6
+
+#define NXD_MQTT_CLOUD_ENABLE
+
+#define NX_SNTP_CLIENT_MIN_SERVER_STRATUM 3
+
+/* The TAP device only carries the Ethernet header, keep the same headroom as the boards.  */
+#define NX_PHYSICAL_HEADER              16
+#define NX_PHYSICAL_TRAILER             4
+
+#endif /* NX_USER_H */
@@ -0,0 +1,103 @@
+# Copyright (c) Microsoft Corporation.
+# Licensed under the MIT License.
+
+"""Run a host binary against a loopback hub of its own and check what the hub sees.
+
+    loopback_run.py [--hub-arg ARG]... [--expect REGEX]... [--send REGEX COMMAND]... -- binary [args]
+
+The broker and the TAP device must be set up as in readme.md, and no other loopback hub may be running.
+The run passes once the hub has printed lines matching each --expect in order, without any once the binary
+exits with 0. --send types COMMAND into the hub console when the binary first prints a line matching REGEX.
+"""
+
+import argparse
+import os
+import queue
+import re
+import subprocess
+import sys
+import threading
+import time
+
+HUB = os.path.join(os.path.dirname(os.path.abspath(__file__)), "..", "tools", "loopback_hub", "loopback_hub.py")
+
+
+def read_lines(name, stream, lines):
+    for line in stream:
+        lines.put((name, line.rstrip()))
+    lines.put((name, None))
+
+
+def start(name, command, lines, **kwargs):
+    process = subprocess.Popen(command, stdout=subprocess.PIPE, stderr=subprocess.STDOUT, text=True,
+                               errors="replace", **kwargs)
+    threading.Thread(target=read_lines, args=(name, process.stdout, lines), daemon=True).start()
+    return process
+
+
+def run(args):
+    lines = queue.Queue()
+    expects = [re.compile(expect) for expect in args.expect]
+    sends = [(re.compile(pattern), command) for pattern, command in args.send]
+    deadline = time.time() + args.timeout
+    binary = None
+
+    hub = start("hub", [sys.executable, "-u", HUB] + args.hub_arg, lines, stdin=subprocess.PIPE)
+
+    try:
+        while time.time() < deadline:
+            try:
+                name, line = lines.get(timeout=1)
+            except queue.Empty:
+                continue
+
+            if line is None:
+                if name == "hub":
+                    print("FAIL: the loopback hub exited")
+                    return 1
+                if not expects:
+                    return binary.wait()
+                print("FAIL: the binary exited before the hub saw {}".format(expects[0].pattern))
+                return 1
+
+            print("[{}] {}".format(name, line))
+
+            # Start the device once the hub listens, so none of its requests go unanswered
+            if name == "hub" and binary is None and line.startswith("Loopback hub ready"):
+                binary = start("device", args.command, lines)
+
+            elif name == "hub" and expects and expects[0].search(line):
+                expects.pop(0)
+                if not expects:
+                    print("PASS")
+                    return 0
+
+            elif name == "device":
+                for pattern, command in [send for send in sends if send[0].search(line)]:
+                    hub.stdin.write(command + "\n")
+                    hub.stdin.flush()
+                    sends.remove((pattern, command))
+
+        print("FAIL: timed out after {} seconds{}".format(
+            args.timeout, ", waiting for {}".format(expects[0].pattern) if expects else ""))
+        return 1
+
+    finally:
+        for process in (binary, hub):
+            if process is not None and process.poll() is None:
+                process.terminate()
+                process.wait()
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("--hub-arg", action="append", default=[], help="argument for loopback_hub.py")
+    parser.add_argument("--expect", action="append", default=[], help="hub output to wait for, in order")
+    parser.add_argument("--send", action="append", nargs=2, default=[], metavar=("REGEX", "COMMAND"))
+    parser.add_argument("--timeout", type=int, default=90)
+    parser.add_argument("command", nargs="+")
+    sys.exit(run(parser.parse_args()))
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,13 @@
+/* Copyright (c) Microsoft Corporation.
+   Licensed under the MIT License. */
+
+#ifndef _SHA256_REFERENCE_H
+#define _SHA256_REFERENCE_H
+
+#include "sha256.h"
+
+void sha256_reference_init(sha256_t* p);
+void sha256_reference_update(sha256_t* p, const unsigned char* data, size_t size);
+void sha256_reference_final(sha256_t* p, unsigned char* digest);
+
+#endif // _SHA256_REFERENCE_H
@@ -0,0 +1,259 @@
+/* Copyright (c) Microsoft Corporation.
+   Licensed under the MIT License. */
+
+// Several hub connections in one image. Each context connects to its own hub hostname of the loopback hub,
+// which the broker keeps apart with a mount point (see tools/loopback_hub/mosquitto.conf). Once all are
+// connected the hub drops the first one, which must reconnect while the others keep their connection.
+//
+//     test_contexts [tap device]
+//
+// Run through loopback_run.py, which has the hub kick host-device-1 when all contexts are connected.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "tx_api.h"
+
+#include "nx_driver_linux_tap.h"
+
+#include "azure_iot_nx_client.h"
+#include "networking.h"
+#include "sntp_client.h"
+
+// One hub hostname each, the same count as setup_tap.sh, make_certs.sh and mosquitto.conf
+#define TEST_CONTEXT_COUNT 4
+
+#define TEST_MODEL_ID "dtmi:azurertos:devkit:gsghostlinux;1"
+
+// The loopback hub accepts any key
+#define TEST_DEVICE_SAS_KEY "bG9vcGJhY2staHViLWRldmljZS1rZXk="
+
+#define TEST_THREAD_STACK_SIZE     4096
+#define TEST_CONTEXT_PRIORITY      4
+#define TEST_MONITOR_PRIORITY      3
+#define TEST_POLL_TICKS            (TX_TIMER_TICKS_PER_SECOND / 10)
+#define TEST_CONNECT_TIMEOUT_TICKS (60 * TX_TIMER_TICKS_PER_SECOND)
+#define TEST_TELEMETRY_INTERVAL    5
+
+typedef struct TEST_CONTEXT_STRUCT
+{
+    AZURE_IOT_NX_CONTEXT nx_context;
+    CHAR hostname[AZURE_IOT_HOST_NAME_SIZE];
+    CHAR device_id[AZURE_IOT_DEVICE_ID_SIZE];
+
+    TX_THREAD thread;
+    ULONG thread_stack[TEST_THREAD_STACK_SIZE / sizeof(ULONG)];
+} TEST_CONTEXT;
+
+static TEST_CONTEXT test_contexts[TEST_CONTEXT_COUNT];
+
+static TX_THREAD monitor_thread;
+static ULONG monitor_thread_stack[TEST_THREAD_STACK_SIZE / sizeof(ULONG)];
+
+// The link, DHCP lease and DNS servers are shared, so only one context at a time may bring them up again
+static TX_MUTEX network_mutex;
+
+static UINT test_network_connect()
+{
+    ULONG actual_status;
+    UINT status = NX_SUCCESS;
+
+    tx_mutex_get(&network_mutex, TX_WAIT_FOREVER);
+
+    // Another context may have done it already
+    if (nx_ip_status_check(&nx_ip, NX_IP_ADDRESS_RESOLVED, &actual_status, NX_NO_WAIT))
+    {
+        status = network_connect();
+    }
+
+    tx_mutex_put(&network_mutex);
+
+    return status;
+}
+
+static UINT append_telemetry(NX_AZURE_IOT_JSON_WRITER* json_writer)
+{
+    return nx_azure_iot_json_writer_append_property_with_int32_value(
+        json_writer, (UCHAR*)"ticks", sizeof("ticks") - 1, (int32_t)tx_time_get());
+}
+
+static VOID telemetry_cb(AZURE_IOT_NX_CONTEXT* nx_context)
+{
+    azure_iot_nx_client_publish_telemetry(nx_context, NX_NULL, append_telemetry);
+}
+
+static VOID context_thread_entry(ULONG index)
+{
+    TEST_CONTEXT* context = &test_contexts[index];
+    UINT status;
+
+    if ((status = azure_iot_nx_client_create(&context->nx_context,
+             &nx_ip,
+             &nx_pool,
+             &nx_dns_client,
+             sntp_time,
+             TEST_MODEL_ID,
+             sizeof(TEST_MODEL_ID) - 1)) ||
+        (status = azure_iot_nx_client_sas_set(&context->nx_context, TEST_DEVICE_SAS_KEY)) ||
+        (status = azure_iot_nx_client_register_timer_callback(
+             &context->nx_context, telemetry_cb, TEST_TELEMETRY_INTERVAL)))
+    {
+        printf("FAIL: context %lu could not be created (0x%08x)\r\n", index, status);
+        exit(1);
+    }
+
+    azure_iot_nx_client_hub_run(&context->nx_context, context->hostname, context->device_id, test_network_connect);
+}
+
+static bool context_connected(UINT index)
+{
+    return test_contexts[index].nx_context.azure_iot_connection_status == NX_SUCCESS;
+}
+
+// The connection and its configuration of one context must not move when another reconnects
+static bool context_undisturbed(UINT index, ULONG disconnect_ticks)
+{
+    AZURE_IOT_NX_CONTEXT* nx_context = &test_contexts[index].nx_context;
+
+    return context_connected(index) && nx_context->azure_iot_retry_count == 0 &&
+           nx_context->azure_iot_disconnect_ticks == disconnect_ticks &&
+           strcmp(nx_context->azure_iot_hub_hostname, test_contexts[index].hostname) == 0 &&
+           strcmp(nx_context->azure_iot_hub_device_id, test_contexts[index].device_id) == 0;
+}
+
+static VOID monitor_thread_entry(ULONG parameter)
+{
+    ULONG disconnect_ticks[TEST_CONTEXT_COUNT];
+    ULONG start;
+    ULONG connected_ticks[TEST_CONTEXT_COUNT] = {0};
+    UINT connected = 0;
+    UINT status;
+    UINT index;
+
+    if ((status = network_init(nx_driver_linux_tap)) || (status = network_connect()))
+    {
+        printf("FAIL: network could not be brought up (0x%08x)\r\n", status);
+        exit(1);
+    }
+
+    start = tx_time_get();
+
+    for (index = 0; index < TEST_CONTEXT_COUNT; index++)
+    {
+        tx_thread_create(&test_contexts[index].thread,
+            "Test context",
+            context_thread_entry,
+            index,
+            test_contexts[index].thread_stack,
+            TEST_THREAD_STACK_SIZE,
+            TEST_CONTEXT_PRIORITY,
+            TEST_CONTEXT_PRIORITY,
+            TX_NO_TIME_SLICE,
+            TX_AUTO_START);
+    }
+
+    // Connect all of them at once, the time to the last connection shows how the handshakes scale
+    while (connected < TEST_CONTEXT_COUNT)
+    {
+        if (tx_time_get() - start > TEST_CONNECT_TIMEOUT_TICKS)
+        {
+            printf("FAIL: only %u of %u contexts connected\r\n", connected, TEST_CONTEXT_COUNT);
+            exit(1);
+        }
+
+        tx_thread_sleep(TEST_POLL_TICKS);
+
+        for (index = 0; index < TEST_CONTEXT_COUNT; index++)
+        {
+            if (connected_ticks[index] == 0 && context_connected(index))
+            {
+                connected_ticks[index] = tx_time_get() - start;
+                connected++;
+
+                printf("Context %u connected to %s as %s after %lu ms, handshake %lu ms\r\n",
+                    index,
+                    test_contexts[index].hostname,
+                    test_contexts[index].device_id,
+                    connected_ticks[index] * 1000 / TX_TIMER_TICKS_PER_SECOND,
+                    test_contexts[index].nx_context.azure_iot_connect_ticks * 1000 / TX_TIMER_TICKS_PER_SECOND);
+            }
+        }
+    }
+
+    for (index = 0; index < TEST_CONTEXT_COUNT; index++)
+    {
+        disconnect_ticks[index] = test_contexts[index].nx_context.azure_iot_disconnect_ticks;
+    }
+
+    // loopback_run.py has the hub drop the first context on this line
+    printf("All %u contexts connected in %lu ms\r\n",
+        TEST_CONTEXT_COUNT,
+        (tx_time_get() - start) * 1000 / TX_TIMER_TICKS_PER_SECOND);
+
+    start = tx_time_get();
+
+    while (test_contexts[0].nx_context.azure_iot_disconnect_ticks == disconnect_ticks[0] || !context_connected(0))
+    {
+        if (tx_time_get() - start > TEST_CONNECT_TIMEOUT_TICKS)
+        {
+            printf("FAIL: context 0 was not dropped and connected again\r\n");
+            exit(1);
+        }
+
+        tx_thread_sleep(TEST_POLL_TICKS);
+
+        for (index = 1; index < TEST_CONTEXT_COUNT; index++)
+        {
+            if (!context_undisturbed(index, disconnect_ticks[index]))
+            {
+                printf("FAIL: context %u was disturbed by the reconnect of context 0\r\n", index);
+                exit(1);
+            }
+        }
+    }
+
+    printf("PASS: context 0 reconnected after %lu ms, the other %u stayed connected\r\n",
+        test_contexts[0].nx_context.azure_iot_outage_ticks * 1000 / TX_TIMER_TICKS_PER_SECOND,
+        TEST_CONTEXT_COUNT - 1);
+    exit(0);
+}
+
+void tx_application_define(void* first_unused_memory)
+{
+    tx_mutex_create(&network_mutex, "Test network", TX_INHERIT);
+
+    tx_thread_create(&monitor_thread,
+        "Test monitor",
+        monitor_thread_entry,
+        0,
+        monitor_thread_stack,
+        TEST_THREAD_STACK_SIZE,
+        TEST_MONITOR_PRIORITY,
+        TEST_MONITOR_PRIORITY,
+        TX_NO_TIME_SLICE,
+        TX_AUTO_START);
+}
+
+int main(int argc, char** argv)
+{
+    UINT index;
+
+    // Line buffered, so loopback_run.py sees each line as it is printed
+    setvbuf(stdout, NULL, _IOLBF, 0);
+
+    for (index = 0; index < TEST_CONTEXT_COUNT; index++)
+    {
+        snprintf(test_contexts[index].hostname, AZURE_IOT_HOST_NAME_SIZE, "hub-%u.loopback-hub.local", index + 1);
+        snprintf(test_contexts[index].device_id, AZURE_IOT_DEVICE_ID_SIZE, "host-device-%u", index + 1);
+    }
+
+    if (argc > 1)
+    {
+        nx_driver_linux_tap_device_set(argv[1]);
+    }
+
+    tx_kernel_enter();
+
+    return 0;
+}
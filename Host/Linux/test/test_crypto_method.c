@@ -0,0 +1,294 @@
+/* Copyright (c) Microsoft Corporation.
+   Licensed under the MIT License. */
+
+// Crypto methods registered with azure_iot_crypto_method_register are the ones TLS sessions use. Registers
+// counting wrappers of the software AES and SHA-256 methods, connects to the loopback hub and checks that the
+// handshake and the record layer of the session went through them.
+//
+//     test_crypto_method [tap device]
+//
+// Run through loopback_run.py, which starts the loopback hub.
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "tx_api.h"
+
+#include "nx_driver_linux_tap.h"
+
+#include "azure_iot_ciphersuites.h"
+#include "azure_iot_nx_client.h"
+#include "networking.h"
+#include "sntp_client.h"
+
+#define TEST_HUB_HOSTNAME  "loopback-hub.local"
+#define TEST_HUB_DEVICE_ID "host-device"
+#define TEST_MODEL_ID      "dtmi:azurertos:devkit:gsghostlinux;1"
+
+// The loopback hub accepts any key
+#define TEST_DEVICE_SAS_KEY "bG9vcGJhY2staHViLWRldmljZS1rZXk="
+
+#define TEST_THREAD_STACK_SIZE     4096
+#define TEST_CLIENT_PRIORITY       4
+#define TEST_MONITOR_PRIORITY      3
+#define TEST_POLL_TICKS            (TX_TIMER_TICKS_PER_SECOND / 10)
+#define TEST_CONNECT_TIMEOUT_TICKS (60 * TX_TIMER_TICKS_PER_SECOND)
+#define TEST_TELEMETRY_INTERVAL    1
+
+typedef UINT (*CRYPTO_OPERATION)(UINT op,
+    VOID* handle,
+    struct NX_CRYPTO_METHOD_STRUCT* method,
+    UCHAR* key,
+    NX_CRYPTO_KEY_SIZE key_size_in_bits,
+    UCHAR* input,
+    ULONG input_length_in_byte,
+    UCHAR* iv_ptr,
+    UCHAR* output,
+    ULONG output_length_in_byte,
+    VOID* crypto_metadata,
+    ULONG crypto_metadata_size,
+    VOID* packet_ptr,
+    VOID (*nx_crypto_hw_process_callback)(VOID* packet_ptr, UINT status));
+
+typedef struct COUNTING_METHOD_STRUCT
+{
+    NX_CRYPTO_METHOD method;
+    CRYPTO_OPERATION operation;
+    ULONG calls;
+} COUNTING_METHOD;
+
+extern NX_CRYPTO_METHOD crypto_method_sha256;
+extern NX_CRYPTO_METHOD crypto_method_aes_cbc_128;
+#if (AZURE_IOT_TLS_PROFILE == AZURE_IOT_TLS_PROFILE_GCM)
+extern NX_CRYPTO_METHOD crypto_method_aes_128_gcm_16;
+#endif
+
+static COUNTING_METHOD counting_sha256;
+static COUNTING_METHOD counting_aes_cbc;
+#if (AZURE_IOT_TLS_PROFILE == AZURE_IOT_TLS_PROFILE_GCM)
+static COUNTING_METHOD counting_aes_gcm;
+#endif
+
+static AZURE_IOT_NX_CONTEXT nx_context;
+
+static TX_THREAD client_thread;
+static ULONG client_thread_stack[TEST_THREAD_STACK_SIZE / sizeof(ULONG)];
+
+static TX_THREAD monitor_thread;
+static ULONG monitor_thread_stack[TEST_THREAD_STACK_SIZE / sizeof(ULONG)];
+
+// The wrapper is first in COUNTING_METHOD, so the method a session hands back leads to its counter
+static UINT counting_operation(UINT op,
+    VOID* handle,
+    struct NX_CRYPTO_METHOD_STRUCT* method,
+    UCHAR* key,
+    NX_CRYPTO_KEY_SIZE key_size_in_bits,
+    UCHAR* input,
+    ULONG input_length_in_byte,
+    UCHAR* iv_ptr,
+    UCHAR* output,
+    ULONG output_length_in_byte,
+    VOID* crypto_metadata,
+    ULONG crypto_metadata_size,
+    VOID* packet_ptr,
+    VOID (*nx_crypto_hw_process_callback)(VOID* packet_ptr, UINT status))
+{
+    COUNTING_METHOD* counting = (COUNTING_METHOD*)method;
+
+    counting->calls++;
+
+    return counting->operation(op,
+        handle,
+        method,
+        key,
+        key_size_in_bits,
+        input,
+        input_length_in_byte,
+        iv_ptr,
+        output,
+        output_length_in_byte,
+        crypto_metadata,
+        crypto_metadata_size,
+        packet_ptr,
+        nx_crypto_hw_process_callback);
+}
+
+static UINT counting_register(COUNTING_METHOD* counting, const NX_CRYPTO_METHOD* method)
+{
+    counting->method                     = *method;
+    counting->operation                  = method->nx_crypto_operation;
+    counting->method.nx_crypto_operation = counting_operation;
+    counting->calls                      = 0;
+
+    return azure_iot_crypto_method_register(&counting->method);
+}
+
+static ULONG aes_calls()
+{
+#if (AZURE_IOT_TLS_PROFILE == AZURE_IOT_TLS_PROFILE_GCM)
+    return counting_aes_cbc.calls + counting_aes_gcm.calls;
+#else
+    return counting_aes_cbc.calls;
+#endif
+}
+
+static UINT register_methods()
+{
+    NX_CRYPTO_METHOD unknown = crypto_method_sha256;
+    UINT status;
+
+    unknown.nx_crypto_algorithm = 0xFFFFFFFF;
+
+    if (azure_iot_crypto_method_register(NX_NULL) != NX_PTR_ERROR)
+    {
+        printf("FAIL: a NULL method was accepted\r\n");
+        return NX_NOT_SUCCESSFUL;
+    }
+
+    if (azure_iot_crypto_method_register(&unknown) != NX_NOT_FOUND)
+    {
+        printf("FAIL: a method for an algorithm the profile does not use was accepted\r\n");
+        return NX_NOT_SUCCESSFUL;
+    }
+
+    if ((status = counting_register(&counting_sha256, &crypto_method_sha256)) ||
+        (status = counting_register(&counting_aes_cbc, &crypto_method_aes_cbc_128)))
+    {
+        printf("FAIL: counting method not registered (0x%08x)\r\n", status);
+        return status;
+    }
+
+#if (AZURE_IOT_TLS_PROFILE == AZURE_IOT_TLS_PROFILE_GCM)
+    if ((status = counting_register(&counting_aes_gcm, &crypto_method_aes_128_gcm_16)))
+    {
+        printf("FAIL: counting GCM method not registered (0x%08x)\r\n", status);
+        return status;
+    }
+#endif
+
+    return NX_SUCCESS;
+}
+
+static UINT append_telemetry(NX_AZURE_IOT_JSON_WRITER* json_writer)
+{
+    return nx_azure_iot_json_writer_append_property_with_int32_value(
+        json_writer, (UCHAR*)"ticks", sizeof("ticks") - 1, (int32_t)tx_time_get());
+}
+
+static VOID telemetry_cb(AZURE_IOT_NX_CONTEXT* nx_context)
+{
+    azure_iot_nx_client_publish_telemetry(nx_context, NX_NULL, append_telemetry);
+}
+
+static VOID client_thread_entry(ULONG parameter)
+{
+    azure_iot_nx_client_hub_run(&nx_context, TEST_HUB_HOSTNAME, TEST_HUB_DEVICE_ID, network_connect);
+}
+
+static VOID monitor_thread_entry(ULONG parameter)
+{
+    ULONG start;
+    ULONG handshake_aes_calls;
+    UINT status;
+
+    if ((status = network_init(nx_driver_linux_tap)) || (status = network_connect()))
+    {
+        printf("FAIL: network could not be brought up (0x%08x)\r\n", status);
+        exit(1);
+    }
+
+    // Before the context exists, its TLS session takes the methods when it is created
+    if ((status = register_methods()))
+    {
+        exit(1);
+    }
+
+    if ((status = azure_iot_nx_client_create(
+             &nx_context, &nx_ip, &nx_pool, &nx_dns_client, sntp_time, TEST_MODEL_ID, sizeof(TEST_MODEL_ID) - 1)) ||
+        (status = azure_iot_nx_client_sas_set(&nx_context, TEST_DEVICE_SAS_KEY)) ||
+        (status = azure_iot_nx_client_register_timer_callback(&nx_context, telemetry_cb, TEST_TELEMETRY_INTERVAL)))
+    {
+        printf("FAIL: client could not be created (0x%08x)\r\n", status);
+        exit(1);
+    }
+
+    tx_thread_create(&client_thread,
+        "Test client",
+        client_thread_entry,
+        0,
+        client_thread_stack,
+        TEST_THREAD_STACK_SIZE,
+        TEST_CLIENT_PRIORITY,
+        TEST_CLIENT_PRIORITY,
+        TX_NO_TIME_SLICE,
+        TX_AUTO_START);
+
+    start = tx_time_get();
+
+    while (nx_context.azure_iot_connection_status != NX_SUCCESS)
+    {
+        if (tx_time_get() - start > TEST_CONNECT_TIMEOUT_TICKS)
+        {
+            printf("FAIL: not connected to the loopback hub\r\n");
+            exit(1);
+        }
+
+        tx_thread_sleep(TEST_POLL_TICKS);
+    }
+
+    // The certificate check hashes with SHA-256 and the Finished messages are already encrypted
+    printf("Connected, %lu SHA-256 and %lu AES calls in the handshake\r\n", counting_sha256.calls, aes_calls());
+
+    if (counting_sha256.calls == 0 || aes_calls() == 0)
+    {
+        printf("FAIL: the TLS session did not use the registered methods\r\n");
+        exit(1);
+    }
+
+    handshake_aes_calls = aes_calls();
+    start               = tx_time_get();
+
+    // Telemetry goes out through the record layer of the same session
+    while (aes_calls() == handshake_aes_calls)
+    {
+        if (tx_time_get() - start > TEST_CONNECT_TIMEOUT_TICKS)
+        {
+            printf("FAIL: telemetry was not encrypted by the registered AES method\r\n");
+            exit(1);
+        }
+
+        tx_thread_sleep(TEST_POLL_TICKS);
+    }
+
+    printf("PASS: %lu AES calls after the handshake\r\n", aes_calls() - handshake_aes_calls);
+    exit(0);
+}
+
+void tx_application_define(void* first_unused_memory)
+{
+    tx_thread_create(&monitor_thread,
+        "Test monitor",
+        monitor_thread_entry,
+        0,
+        monitor_thread_stack,
+        TEST_THREAD_STACK_SIZE,
+        TEST_MONITOR_PRIORITY,
+        TEST_MONITOR_PRIORITY,
+        TX_NO_TIME_SLICE,
+        TX_AUTO_START);
+}
+
+int main(int argc, char** argv)
+{
+    // Line buffered, so loopback_run.py sees each line as it is printed
+    setvbuf(stdout, NULL, _IOLBF, 0);
+
+    if (argc > 1)
+    {
+        nx_driver_linux_tap_device_set(argv[1]);
+    }
+
+    tx_kernel_enter();
+
+    return 0;
+}
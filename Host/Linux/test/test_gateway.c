@@ -0,0 +1,279 @@
+/* Copyright (c) Microsoft Corporation.
+   Licensed under the MIT License. */
+
+// Gateway mode against the loopback hub. Leaves added from one reused buffer must keep their own ids, their
+// telemetry and reported properties go over the connection of the gateway, and the telemetry they publish
+// while the gateway is dropped is queued and delivered with its capture time once it reconnects.
+//
+//     test_gateway [tap device]
+//
+// Run through loopback_run.py, which has the hub kick host-device once every leaf has published.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "tx_api.h"
+
+#include "nx_driver_linux_tap.h"
+
+#include "azure_iot_nx_client.h"
+#include "networking.h"
+#include "sntp_client.h"
+
+#define TEST_LEAF_COUNT 3
+
+#define TEST_MODEL_ID "dtmi:azurertos:devkit:gsghostlinux;1"
+
+#define TEST_HUB_HOSTNAME "loopback-hub.local"
+#define TEST_DEVICE_ID    "host-device"
+
+// The loopback hub accepts any key
+#define TEST_DEVICE_SAS_KEY "bG9vcGJhY2staHViLWRldmljZS1rZXk="
+
+#define TEST_THREAD_STACK_SIZE     4096
+#define TEST_CONTEXT_PRIORITY      4
+#define TEST_MONITOR_PRIORITY      3
+#define TEST_POLL_TICKS            (TX_TIMER_TICKS_PER_SECOND / 10)
+#define TEST_CONNECT_TIMEOUT_TICKS (60 * TX_TIMER_TICKS_PER_SECOND)
+#define TEST_TELEMETRY_INTERVAL    2
+
+static AZURE_IOT_NX_CONTEXT nx_context;
+static UINT leaf_indexes[TEST_LEAF_COUNT];
+
+static TX_THREAD context_thread;
+static ULONG context_thread_stack[TEST_THREAD_STACK_SIZE / sizeof(ULONG)];
+
+static TX_THREAD monitor_thread;
+static ULONG monitor_thread_stack[TEST_THREAD_STACK_SIZE / sizeof(ULONG)];
+
+static UINT append_telemetry(NX_AZURE_IOT_JSON_WRITER* json_writer)
+{
+    return nx_azure_iot_json_writer_append_property_with_int32_value(
+        json_writer, (UCHAR*)"ticks", sizeof("ticks") - 1, (int32_t)tx_time_get());
+}
+
+static UINT append_properties(NX_AZURE_IOT_JSON_WRITER* json_writer)
+{
+    return nx_azure_iot_json_writer_append_property_with_int32_value(
+        json_writer, (UCHAR*)"interval", sizeof("interval") - 1, TEST_TELEMETRY_INTERVAL);
+}
+
+// Runs on the client thread, also while it waits to reconnect
+static VOID telemetry_cb(AZURE_IOT_NX_CONTEXT* context)
+{
+    UINT index;
+
+    for (index = 0; index < TEST_LEAF_COUNT; index++)
+    {
+        azure_iot_nx_client_gateway_publish_telemetry(context, leaf_indexes[index], append_telemetry);
+        azure_iot_nx_client_gateway_publish_properties(context, leaf_indexes[index], append_properties);
+    }
+}
+
+static VOID context_thread_entry(ULONG parameter)
+{
+    CHAR leaf_id[AZURE_IOT_DEVICE_ID_SIZE];
+    UINT status;
+    UINT index;
+
+    if ((status = azure_iot_nx_client_create(
+             &nx_context, &nx_ip, &nx_pool, &nx_dns_client, sntp_time, TEST_MODEL_ID, sizeof(TEST_MODEL_ID) - 1)) ||
+        (status = azure_iot_nx_client_sas_set(&nx_context, TEST_DEVICE_SAS_KEY)) ||
+        (status = azure_iot_nx_client_register_timer_callback(&nx_context, telemetry_cb, TEST_TELEMETRY_INTERVAL)))
+    {
+        printf("FAIL: gateway context could not be created (0x%08x)\r\n", status);
+        exit(1);
+    }
+
+    // The same buffer for every id, the context must keep a copy of each
+    for (index = 0; index < TEST_LEAF_COUNT; index++)
+    {
+        snprintf(leaf_id, sizeof(leaf_id), "leaf-%u", index + 1);
+
+        if ((status = azure_iot_nx_client_gateway_leaf_add(&nx_context, leaf_id, &leaf_indexes[index])))
+        {
+            printf("FAIL: %s could not be added (0x%08x)\r\n", leaf_id, status);
+            exit(1);
+        }
+    }
+
+    memset(leaf_id, 0, sizeof(leaf_id));
+
+    azure_iot_nx_client_hub_run(&nx_context, TEST_HUB_HOSTNAME, TEST_DEVICE_ID, network_connect);
+}
+
+static const AZURE_IOT_GATEWAY_LEAF* leaf_get(UINT index)
+{
+    return azure_iot_nx_client_gateway_leaf_get(&nx_context, leaf_indexes[index]);
+}
+
+static bool gateway_connected()
+{
+    return nx_context.azure_iot_connection_status == NX_SUCCESS;
+}
+
+static VOID wait_for(bool (*condition)(VOID), const CHAR* failure)
+{
+    ULONG start = tx_time_get();
+
+    while (!condition())
+    {
+        if (tx_time_get() - start > TEST_CONNECT_TIMEOUT_TICKS)
+        {
+            printf("FAIL: %s\r\n", failure);
+            exit(1);
+        }
+
+        tx_thread_sleep(TEST_POLL_TICKS);
+    }
+}
+
+static bool leaves_sent()
+{
+    UINT index;
+
+    for (index = 0; index < TEST_LEAF_COUNT; index++)
+    {
+        if (leaf_get(index) == NX_NULL || leaf_get(index)->sent == 0)
+        {
+            return false;
+        }
+    }
+
+    return gateway_connected();
+}
+
+static ULONG disconnect_ticks;
+
+static bool gateway_dropped()
+{
+    return nx_context.azure_iot_disconnect_ticks != disconnect_ticks;
+}
+
+static bool leaves_queued()
+{
+    UINT index;
+
+    for (index = 0; index < TEST_LEAF_COUNT; index++)
+    {
+        if (leaf_get(index)->queued == 0)
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+static ULONG sent_at_drop[TEST_LEAF_COUNT];
+
+// Leaf telemetry waits behind the queue, so once a leaf has sent as much as it queued all of it was delivered
+static bool leaves_delivered()
+{
+    UINT index;
+
+    for (index = 0; index < TEST_LEAF_COUNT; index++)
+    {
+        if (leaf_get(index)->sent - sent_at_drop[index] < leaf_get(index)->queued)
+        {
+            return false;
+        }
+    }
+
+    return gateway_connected();
+}
+
+static VOID monitor_thread_entry(ULONG parameter)
+{
+    CHAR leaf_id[AZURE_IOT_DEVICE_ID_SIZE];
+    UINT status;
+    UINT index;
+
+    if ((status = network_init(nx_driver_linux_tap)) || (status = network_connect()))
+    {
+        printf("FAIL: network could not be brought up (0x%08x)\r\n", status);
+        exit(1);
+    }
+
+    tx_thread_create(&context_thread,
+        "Test gateway",
+        context_thread_entry,
+        0,
+        context_thread_stack,
+        TEST_THREAD_STACK_SIZE,
+        TEST_CONTEXT_PRIORITY,
+        TEST_CONTEXT_PRIORITY,
+        TX_NO_TIME_SLICE,
+        TX_AUTO_START);
+
+    wait_for(leaves_sent, "the leaves did not publish over the gateway");
+
+    for (index = 0; index < TEST_LEAF_COUNT; index++)
+    {
+        snprintf(leaf_id, sizeof(leaf_id), "leaf-%u", index + 1);
+
+        if (strcmp(leaf_get(index)->id, leaf_id) != 0)
+        {
+            printf("FAIL: leaf %u has id %s, not %s\r\n", index, leaf_get(index)->id, leaf_id);
+            exit(1);
+        }
+    }
+
+    disconnect_ticks = nx_context.azure_iot_disconnect_ticks;
+
+    // loopback_run.py has the hub drop the gateway on this line
+    printf("All %u leaves published\r\n", TEST_LEAF_COUNT);
+
+    wait_for(gateway_dropped, "the gateway was not dropped");
+
+    for (index = 0; index < TEST_LEAF_COUNT; index++)
+    {
+        sent_at_drop[index] = leaf_get(index)->sent;
+    }
+
+    wait_for(leaves_queued, "no leaf telemetry was queued while disconnected");
+    wait_for(leaves_delivered, "queued leaf telemetry was not delivered after the reconnect");
+
+    for (index = 0; index < TEST_LEAF_COUNT; index++)
+    {
+        printf("%s: %lu sent, %lu queued, %lu failed\r\n",
+            leaf_get(index)->id,
+            leaf_get(index)->sent,
+            leaf_get(index)->queued,
+            leaf_get(index)->failed);
+    }
+
+    printf("PASS: queued leaf telemetry delivered after %lu ms offline\r\n",
+        nx_context.azure_iot_outage_ticks * 1000 / TX_TIMER_TICKS_PER_SECOND);
+    exit(0);
+}
+
+void tx_application_define(void* first_unused_memory)
+{
+    tx_thread_create(&monitor_thread,
+        "Test monitor",
+        monitor_thread_entry,
+        0,
+        monitor_thread_stack,
+        TEST_THREAD_STACK_SIZE,
+        TEST_MONITOR_PRIORITY,
+        TEST_MONITOR_PRIORITY,
+        TX_NO_TIME_SLICE,
+        TX_AUTO_START);
+}
+
+int main(int argc, char** argv)
+{
+    // Line buffered, so loopback_run.py sees each line as it is printed
+    setvbuf(stdout, NULL, _IOLBF, 0);
+
+    if (argc > 1)
+    {
+        nx_driver_linux_tap_device_set(argv[1]);
+    }
+
+    tx_kernel_enter();
+
+    return 0;
+}
@@ -0,0 +1,166 @@
+/* Copyright (c) Microsoft Corporation.
+   Licensed under the MIT License. */
+
+// Zero copy payloads of the legacy MQTT client, a payload chained across small packets must read the same as
+// one in a single packet through the segment iterator, azure_iot_mqtt_payload_copy and azure_iot_mqtt_twin_parse
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "tx_api.h"
+
+#include "nx_api.h"
+
+#include "azure_iot_mqtt.h"
+
+// Small enough that the MQTT header, topic and twin document below span several packets
+#define TEST_PACKET_PAYLOAD_SIZE 48
+#define TEST_PACKET_COUNT        16
+#define TEST_THREAD_STACK_SIZE   4096
+#define TEST_THREAD_PRIORITY     4
+
+// Stands in for the fixed header and topic the payload offset skips
+static const CHAR header[] = "0\x7f$iothub/twin/res/200/?$rid=1";
+
+static const CHAR twin[] = "{\"desired\":{\"telemetryInterval\":25,\"ledState\":true,\"$version\":4},"
+                           "\"reported\":{\"telemetryInterval\":10,\"ledState\":false}}";
+
+static NX_PACKET_POOL pool;
+static ULONG pool_memory[TEST_PACKET_COUNT * (sizeof(NX_PACKET) + TEST_PACKET_PAYLOAD_SIZE) / sizeof(ULONG)];
+
+static TX_THREAD test_thread;
+static ULONG test_thread_stack[TEST_THREAD_STACK_SIZE / sizeof(ULONG)];
+
+static int failures;
+
+static void check(const char* name, bool passed)
+{
+    printf("%s: %s\n", passed ? "PASS" : "FAIL", name);
+
+    if (!passed)
+    {
+        failures++;
+    }
+}
+
+static UINT message_create(AZURE_IOT_MQTT_MESSAGE* message)
+{
+    UINT status;
+
+    memset(message, 0, sizeof(*message));
+
+    if ((status = nx_packet_allocate(&pool, &message->packet, NX_RECEIVE_PACKET, NX_NO_WAIT)) ||
+        (status = nx_packet_data_append(message->packet, (VOID*)header, sizeof(header) - 1, &pool, NX_NO_WAIT)) ||
+        (status = nx_packet_data_append(message->packet, (VOID*)twin, sizeof(twin) - 1, &pool, NX_NO_WAIT)))
+    {
+        return status;
+    }
+
+    message->offset = sizeof(header) - 1;
+    message->length = sizeof(twin) - 1;
+
+    return NX_SUCCESS;
+}
+
+static void check_segments(AZURE_IOT_MQTT_MESSAGE* message)
+{
+    AZURE_IOT_MQTT_SEGMENT segment = {0};
+    CHAR joined[sizeof(twin)];
+    ULONG joined_length = 0;
+    UINT segments       = 0;
+    const CHAR* data;
+    ULONG length;
+
+    check("payload is chained", message->packet->nx_packet_next != NX_NULL);
+    check("chained payload has no single pointer", !azure_iot_mqtt_payload_get(message, &data, &length));
+
+    while (azure_iot_mqtt_payload_segment_next(message, &segment) && joined_length + segment.length < sizeof(joined))
+    {
+        memcpy(joined + joined_length, segment.data, segment.length);
+        joined_length += segment.length;
+        segments++;
+    }
+
+    joined[joined_length] = 0;
+
+    printf("%u segments\n", segments);
+    check("segments span several packets", segments > 1);
+    check("segments join to the payload", joined_length == message->length && strcmp(joined, twin) == 0);
+}
+
+static void check_copy(AZURE_IOT_MQTT_MESSAGE* message)
+{
+    CHAR buffer[sizeof(twin)];
+    CHAR small[8];
+
+    check("copy returns the payload length",
+        azure_iot_mqtt_payload_copy(message, buffer, sizeof(buffer)) == message->length);
+    check("copy holds the payload", strcmp(buffer, twin) == 0);
+    check("short copy is truncated and terminated",
+        azure_iot_mqtt_payload_copy(message, small, sizeof(small)) == message->length &&
+            strncmp(small, twin, sizeof(small) - 1) == 0 && small[sizeof(small) - 1] == 0);
+}
+
+static void check_twin_parse(AZURE_IOT_MQTT_MESSAGE* message)
+{
+    INT telemetry_interval = 0;
+    bool led_state         = false;
+    UINT found;
+    UINT changed;
+
+    const TWIN_PROPERTY properties[] = {
+        {"telemetryInterval", TWIN_PROPERTY_INT, &telemetry_interval, sizeof(telemetry_interval)},
+        {"ledState", TWIN_PROPERTY_BOOL, &led_state, sizeof(led_state)}};
+
+    check("chained twin parses", azure_iot_mqtt_twin_parse(message, "desired", properties, 2, &found, &changed));
+    check("desired values read across packets",
+        found == 0x3 && changed == 0x3 && telemetry_interval == 25 && led_state);
+}
+
+static VOID test_thread_entry(ULONG parameter)
+{
+    AZURE_IOT_MQTT_MESSAGE message;
+    UINT status;
+
+    nx_system_initialize();
+
+    if ((status = nx_packet_pool_create(
+             &pool, "Test pool", TEST_PACKET_PAYLOAD_SIZE, pool_memory, sizeof(pool_memory))) ||
+        (status = message_create(&message)))
+    {
+        printf("FAIL: chained payload not created (0x%08x)\n", status);
+        exit(1);
+    }
+
+    check_segments(&message);
+    check_copy(&message);
+    check_twin_parse(&message);
+
+    nx_packet_release(message.packet);
+
+    printf("%s: %d failures\n", failures ? "FAILED" : "PASSED", failures);
+
+    exit(failures ? 1 : 0);
+}
+
+void tx_application_define(void* first_unused_memory)
+{
+    tx_thread_create(&test_thread,
+        "Test",
+        test_thread_entry,
+        0,
+        test_thread_stack,
+        TEST_THREAD_STACK_SIZE,
+        TEST_THREAD_PRIORITY,
+        TEST_THREAD_PRIORITY,
+        TX_NO_TIME_SLICE,
+        TX_AUTO_START);
+}
+
+int main(void)
+{
+    tx_kernel_enter();
+
+    return 0;
+}
@@ -0,0 +1,155 @@
+/* Copyright (c) Microsoft Corporation.
+   Licensed under the MIT License. */
+
+// Reported property cache, how values the hub did not accept are kept and retried
+
+#include <stdio.h>
+#include <string.h>
+
+#include "azure_iot_property_cache.h"
+#include "nx_azure_iot.h"
+
+static int failures;
+
+static void check(const char* name, bool passed)
+{
+    printf("%s: %s\n", passed ? "PASS" : "FAIL", name);
+
+    if (!passed)
+    {
+        failures++;
+    }
+}
+
+static AZURE_IOT_PROPERTY_CACHE_ENTRY* cache_int(
+    AZURE_IOT_PROPERTY_CACHE* cache, CHAR* name, int32_t value, bool force)
+{
+    AZURE_IOT_PROPERTY property;
+
+    memset(&property, 0, sizeof(property));
+    property.name          = name;
+    property.type          = AZURE_IOT_PROPERTY_TYPE_INT32;
+    property.value.integer = value;
+
+    if (azure_iot_property_cache_update(
+            cache, &property, azure_iot_property_cache_hash(&property, NX_NULL, 0), force) != NX_SUCCESS)
+    {
+        return NX_NULL;
+    }
+
+    return &cache->entries[cache->count - 1];
+}
+
+// A PATCH the hub answers with an error leaves the value pending, due again once the backoff has passed
+static void check_failed_patch(void)
+{
+    static AZURE_IOT_PROPERTY_CACHE cache;
+    AZURE_IOT_PROPERTY_CACHE_ENTRY* entry;
+    ULONG now = 1000;
+
+    azure_iot_property_cache_init(&cache);
+    entry = cache_int(&cache, "telemetryInterval", 10, false);
+
+    check("new value is due", azure_iot_property_cache_due(entry, now));
+
+    azure_iot_property_cache_sent(&cache, entry, NX_NOT_SUCCESSFUL, 0, now);
+    check("failed value stays pending", entry->pending && !entry->acked);
+    check("failed value waits out the backoff",
+        !azure_iot_property_cache_due(entry, now + AZURE_IOT_PROPERTY_CACHE_RETRY_TICKS - 1));
+    check("failed value is due after the backoff",
+        azure_iot_property_cache_due(entry, now + AZURE_IOT_PROPERTY_CACHE_RETRY_TICKS));
+
+    now += AZURE_IOT_PROPERTY_CACHE_RETRY_TICKS;
+    azure_iot_property_cache_sent(&cache, entry, NX_NOT_SUCCESSFUL, 0, now);
+    check("second failure doubles the backoff",
+        !azure_iot_property_cache_due(entry, now + 2 * AZURE_IOT_PROPERTY_CACHE_RETRY_TICKS - 1) &&
+            azure_iot_property_cache_due(entry, now + 2 * AZURE_IOT_PROPERTY_CACHE_RETRY_TICKS));
+
+    // A newer value replaces the failed one, but the hub is given the same time to recover
+    entry = cache_int(&cache, "telemetryInterval", 20, false);
+    check("newer value keeps the backoff", !azure_iot_property_cache_due(entry, now + 1));
+
+    now += 2 * AZURE_IOT_PROPERTY_CACHE_RETRY_TICKS;
+    azure_iot_property_cache_sent(&cache, entry, NX_SUCCESS, 7, now);
+    check("accepted retry is acknowledged",
+        !entry->pending && entry->acked && entry->acked_version == 7 && entry->failures == 0);
+    check("retries counted", cache.retries == 2 && cache.sent == 1);
+
+    cache_int(&cache, "telemetryInterval", 20, false);
+    check("accepted value is suppressed", !entry->pending && cache.suppressed == 1);
+}
+
+static void check_backoff_limit(void)
+{
+    static AZURE_IOT_PROPERTY_CACHE cache;
+    AZURE_IOT_PROPERTY_CACHE_ENTRY* entry;
+    ULONG now = 0;
+    int attempt;
+
+    azure_iot_property_cache_init(&cache);
+    entry = cache_int(&cache, "ledState", 1, false);
+
+    for (attempt = 0; attempt < 40; attempt++)
+    {
+        azure_iot_property_cache_sent(&cache, entry, NX_NOT_SUCCESSFUL, 0, now);
+    }
+
+    check("backoff stops at the maximum",
+        !azure_iot_property_cache_due(entry, now + AZURE_IOT_PROPERTY_CACHE_RETRY_MAX_TICKS - 1) &&
+            azure_iot_property_cache_due(entry, now + AZURE_IOT_PROPERTY_CACHE_RETRY_MAX_TICKS));
+
+    // Close to the wrap of the tick counter
+    now = 0xFFFFFFFF - AZURE_IOT_PROPERTY_CACHE_RETRY_TICKS / 2;
+    entry->failures = 0;
+    azure_iot_property_cache_sent(&cache, entry, NX_NOT_SUCCESSFUL, 0, now);
+    check("backoff across the tick wrap",
+        !azure_iot_property_cache_due(entry, now + AZURE_IOT_PROPERTY_CACHE_RETRY_TICKS - 1) &&
+            azure_iot_property_cache_due(entry, now + AZURE_IOT_PROPERTY_CACHE_RETRY_TICKS));
+
+    azure_iot_property_cache_invalidate(&cache);
+    check("a new hub gets pending values at once", azure_iot_property_cache_due(entry, now));
+}
+
+// More than fits in a PATCH on its own can never be sent, so it is not retried
+static void check_oversized_value(void)
+{
+    static AZURE_IOT_PROPERTY_CACHE cache;
+    AZURE_IOT_PROPERTY_CACHE_ENTRY* entry;
+
+    azure_iot_property_cache_init(&cache);
+    entry = cache_int(&cache, "deviceInformation", 1, false);
+
+    azure_iot_property_cache_sent(&cache, entry, NX_AZURE_IOT_INSUFFICIENT_BUFFER_SPACE, 0, 0);
+    check("oversized value is dropped", !entry->pending && !entry->acked && cache.retries == 0);
+}
+
+// Members of a group hashed as they arrive from a chained packet match the members hashed at once
+static void check_group_hash(void)
+{
+    static const UCHAR members[] = "\"temperature\":21.5,\"humidity\":40";
+    AZURE_IOT_PROPERTY property;
+    ULONG hash;
+
+    memset(&property, 0, sizeof(property));
+    property.type = AZURE_IOT_PROPERTY_TYPE_GROUP;
+
+    hash = azure_iot_property_cache_hash(&property, members, 10);
+    hash = azure_iot_property_cache_hash_append(hash, members + 10, sizeof(members) - 11);
+
+    check("group hashed in pieces matches the whole",
+        hash == azure_iot_property_cache_hash(&property, members, sizeof(members) - 1));
+    check("changed member changes the group hash",
+        hash != azure_iot_property_cache_hash(&property, members, sizeof(members) - 2));
+}
+
+int main(void)
+{
+    check_failed_patch();
+    check_backoff_limit();
+    check_oversized_value();
+    check_group_hash();
+
+    printf("%s: %d failures\n", failures ? "FAILED" : "PASSED", failures);
+
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,267 @@
+/* Copyright (c) Microsoft Corporation.
+   Licensed under the MIT License. */
+
+// SHA-256 and HMAC-SHA256 of the SAS token code against the FIPS 180-2 and RFC 4231 vectors
+
+#include <stdio.h>
+#include <string.h>
+
+#include "hmac_sha256.h"
+#include "sas_token.h"
+#include "sha256.h"
+
+static int failures;
+
+static void hex_to_bytes(const char* hex, unsigned char* bytes)
+{
+    unsigned int value;
+
+    while (*hex && sscanf(hex, "%2x", &value) == 1)
+    {
+        *bytes++ = (unsigned char)value;
+        hex += 2;
+    }
+}
+
+static void check_digest(const char* name, const unsigned char* digest, const char* expected_hex)
+{
+    unsigned char expected[SHA256_DIGEST_SIZE];
+
+    hex_to_bytes(expected_hex, expected);
+
+    if (memcmp(digest, expected, SHA256_DIGEST_SIZE) != 0)
+    {
+        printf("FAIL: %s\n", name);
+        failures++;
+    }
+    else
+    {
+        printf("PASS: %s\n", name);
+    }
+}
+
+static void check_sha256(const char* name, const char* message, const char* expected_hex)
+{
+    sha256_t sha;
+    unsigned char digest[SHA256_DIGEST_SIZE];
+
+    sha256_init(&sha);
+    sha256_update(&sha, (const unsigned char*)message, strlen(message));
+    sha256_final(&sha, digest);
+
+    check_digest(name, digest, expected_hex);
+}
+
+// One million 'a' fed in uneven chunks, so both the buffered and the whole block paths are taken
+static void check_sha256_million(void)
+{
+    static const size_t chunks[] = {1, 63, 64, 65, 127, 200, 3};
+    unsigned char data[200];
+    unsigned char digest[SHA256_DIGEST_SIZE];
+    size_t remaining = 1000000;
+    size_t chunk;
+    size_t index = 0;
+    sha256_t sha;
+
+    memset(data, 'a', sizeof(data));
+    sha256_init(&sha);
+
+    while (remaining > 0)
+    {
+        chunk = chunks[index++ % (sizeof(chunks) / sizeof(chunks[0]))];
+        chunk = chunk < remaining ? chunk : remaining;
+
+        sha256_update(&sha, data, chunk);
+        remaining -= chunk;
+    }
+
+    sha256_final(&sha, digest);
+
+    check_digest("SHA-256 one million 'a'", digest, "cdc76e5c9914fb9281a1c7e284d73e67f1809a48a497200e046d39ccc7112cd0");
+}
+
+static void check_hmac(const char* name,
+    unsigned char key_byte,
+    size_t key_length,
+    const unsigned char* key,
+    const unsigned char* data,
+    size_t data_length,
+    const char* expected_hex)
+{
+    unsigned char key_buffer[131];
+    unsigned char digest[HMAC_SHA256_DIGEST_SIZE];
+    hmac_sha256_key_t hmac_key;
+    char cached_name[96];
+
+    if (key == NULL)
+    {
+        memset(key_buffer, key_byte, key_length);
+        key = key_buffer;
+    }
+
+    hmac_sha256(digest, data, data_length, key, key_length);
+    check_digest(name, digest, expected_hex);
+
+    // The same result from the precomputed key schedule, used twice
+    hmac_sha256_key_init(&hmac_key, key, key_length);
+    hmac_sha256_compute(&hmac_key, digest, data, data_length);
+    hmac_sha256_compute(&hmac_key, digest, data, data_length);
+
+    snprintf(cached_name, sizeof(cached_name), "%s (key schedule)", name);
+    check_digest(cached_name, digest, expected_hex);
+}
+
+static void check_rfc4231(void)
+{
+    static const unsigned char key_4[] = {0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08, 0x09, 0x0a, 0x0b, 0x0c,
+        0x0d, 0x0e, 0x0f, 0x10, 0x11, 0x12, 0x13, 0x14, 0x15, 0x16, 0x17, 0x18, 0x19};
+    static const char data_6[] = "Test Using Larger Than Block-Size Key - Hash Key First";
+    static const char data_7[] = "This is a test using a larger than block-size key and a larger than block-size data. "
+                                 "The key needs to be hashed before being used by the HMAC algorithm.";
+    unsigned char data[50];
+
+    check_hmac("RFC 4231 case 1",
+        0x0b,
+        20,
+        NULL,
+        (const unsigned char*)"Hi There",
+        8,
+        "b0344c61d8db38535ca8afceaf0bf12b881dc200c9833da726e9376c2e32cff7");
+
+    check_hmac("RFC 4231 case 2",
+        0,
+        4,
+        (const unsigned char*)"Jefe",
+        (const unsigned char*)"what do ya want for nothing?",
+        28,
+        "5bdcc146bf60754e6a042426089575c75a003f089d2739839dec58b964ec3843");
+
+    memset(data, 0xdd, sizeof(data));
+    check_hmac("RFC 4231 case 3",
+        0xaa,
+        20,
+        NULL,
+        data,
+        sizeof(data),
+        "773ea91e36800e46854db8ebd09181a72959098b3ef8c122d9635514ced565fe");
+
+    memset(data, 0xcd, sizeof(data));
+    check_hmac("RFC 4231 case 4",
+        0,
+        sizeof(key_4),
+        key_4,
+        data,
+        sizeof(data),
+        "82558a389a443c0ea4cc819899f2083a85f0faa3e578f8077a2e3ff46729665b");
+
+    check_hmac("RFC 4231 case 6",
+        0xaa,
+        131,
+        NULL,
+        (const unsigned char*)data_6,
+        strlen(data_6),
+        "60e431591ee0b67f0d8a26aacbf5b77f8e0bc6213728c5140546040f0ee37f54");
+
+    check_hmac("RFC 4231 case 7",
+        0xaa,
+        131,
+        NULL,
+        (const unsigned char*)data_7,
+        strlen(data_7),
+        "9b09ffa71b942fcb27635fbcd5b0e944bfdc63644f0713938a7f51535c3a35e2");
+}
+
+static void check_sas_token(const char* name,
+    sas_key_cache_t* key_cache,
+    char* key,
+    char* hostname,
+    char* device_id,
+    const char* expected)
+{
+    char token[256];
+
+    if (!create_sas_token(key_cache, key, strlen(key), hostname, device_id, 1700000000, token, sizeof(token)) ||
+        strcmp(token, expected) != 0)
+    {
+        printf("FAIL: %s\n", name);
+        failures++;
+    }
+    else
+    {
+        printf("PASS: %s\n", name);
+    }
+}
+
+// Two clients with their own key caches, interleaved so a shared cache would sign with the wrong key
+static void check_sas_key_caches(void)
+{
+    static sas_key_cache_t cache_a;
+    static sas_key_cache_t cache_b;
+    static char key_a[]  = "AAECAwQFBgcICQoLDA0ODxAREhMUFRYXGBkaGxwdHh8=";
+    static char key_b[]  = "ZGVmZ2hpamtsbW5vcHFyc3R1dnd4eXp7fH1+f4CBgoOEhYaHiImKi4yNjo+QkZKTlJWWl5iZmpucnZ6foKGiow==";
+    const char* token_a = "SharedAccessSignature sr=hub-a.azure-devices.net%2Fdevices%2Fdevice-a"
+                          "&sig=oYTsoNnnyk0ydDfJ%2fbVZPolNn09f7A3ayi09bsASvWY%3d&se=1731449600";
+    const char* token_b = "SharedAccessSignature sr=hub-b.azure-devices.net%2Fdevices%2Fdevice-b"
+                          "&sig=wJA3iPsIE3BEuN70EO281LkrZNJnOyAo%2fXBwnT6i2Ks%3d&se=1731449600";
+
+    check_sas_token("SAS token client A", &cache_a, key_a, "hub-a.azure-devices.net", "device-a", token_a);
+    check_sas_token("SAS token client B", &cache_b, key_b, "hub-b.azure-devices.net", "device-b", token_b);
+    check_sas_token("SAS token client A cached", &cache_a, key_a, "hub-a.azure-devices.net", "device-a", token_a);
+    check_sas_token("SAS token client B cached", &cache_b, key_b, "hub-b.azure-devices.net", "device-b", token_b);
+}
+
+static unsigned int transform_calls;
+
+static void counting_transform(uint32_t state[8], const unsigned char block[64])
+{
+    transform_calls++;
+}
+
+// A board hash engine sees every block, and NULL restores the software compression function
+static void check_transform_hook(void)
+{
+    unsigned char data[64 * 3] = {0};
+    unsigned char digest[SHA256_DIGEST_SIZE];
+    sha256_t sha;
+
+    sha256_set_transform(counting_transform);
+    sha256_init(&sha);
+    sha256_update(&sha, data, sizeof(data));
+    sha256_final(&sha, digest);
+    sha256_set_transform(NULL);
+
+    // Three data blocks and one padding block
+    if (transform_calls != 4)
+    {
+        printf("FAIL: transform hook called %u times\n", transform_calls);
+        failures++;
+    }
+    else
+    {
+        printf("PASS: transform hook\n");
+    }
+
+    check_sha256(
+        "SHA-256 \"abc\" after the hook", "abc", "ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad");
+}
+
+int main(void)
+{
+    check_sha256("SHA-256 empty", "", "e3b0c44298fc1c149afbf4c8996fb92427ae41e4649b934ca495991b7852b855");
+    check_sha256("SHA-256 \"abc\"", "abc", "ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad");
+    check_sha256("SHA-256 448 bits",
+        "abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq",
+        "248d6a61d20638b8e5c026930c3e6039a33ce45964ff2167f6ecedd419db06c1");
+    check_sha256("SHA-256 896 bits",
+        "abcdefghbcdefghicdefghijdefghijkefghijklfghijklmghijklmnhijklmnoijklmnopjklmnopqklmnopqrlmnopqrsmnopqrstnopqrstu",
+        "cf5b16a778af8380036ce59e7b0492370b249b11e8f07a51afac45037afee9d1");
+    check_sha256_million();
+
+    check_rfc4231();
+    check_sas_key_caches();
+    check_transform_hook();
+
+    printf("%s: %d failures\n", failures ? "FAILED" : "PASSED", failures);
+
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,178 @@
+/* Copyright (c) Microsoft Corporation.
+   Licensed under the MIT License. */
+
+// Twin parser, documents fed in pieces must give the same properties as the whole document
+
+#include <stdio.h>
+#include <string.h>
+
+#include "twin_parser.h"
+
+#define TEST_STRING_SIZE 8
+
+typedef struct TEST_VALUES_STRUCT
+{
+    int interval;
+    bool led;
+    double target;
+    char name[TEST_STRING_SIZE];
+} TEST_VALUES;
+
+static const char full_twin[] =
+    "{\"desired\":{\"telemetryInterval\":25,\"ledState\":true,"
+    "\"thermostat1\":{\"__t\":\"c\",\"targetTemperature\":21.5},"
+    "\"name\":\"a long device name\",\"list\":[{\"telemetryInterval\":1}],\"$version\":4},"
+    "\"reported\":{\"telemetryInterval\":10,\"ledState\":false}}";
+
+static int failures;
+
+static void check(const char* name, bool passed)
+{
+    printf("%s: %s\n", passed ? "PASS" : "FAIL", name);
+
+    if (!passed)
+    {
+        failures++;
+    }
+}
+
+static void properties_init(TWIN_PROPERTY* properties, TEST_VALUES* values)
+{
+    memset(values, 0, sizeof(*values));
+
+    properties[0] = (TWIN_PROPERTY){"telemetryInterval", TWIN_PROPERTY_INT, &values->interval, sizeof(int)};
+    properties[1] = (TWIN_PROPERTY){"ledState", TWIN_PROPERTY_BOOL, &values->led, sizeof(bool)};
+    properties[2] = (TWIN_PROPERTY){
+        "thermostat1.targetTemperature", TWIN_PROPERTY_DOUBLE, &values->target, sizeof(double)};
+    properties[3] = (TWIN_PROPERTY){"name", TWIN_PROPERTY_STRING, values->name, sizeof(values->name)};
+}
+
+// Parse the document in the pieces ending at each of splits, the last piece runs to the end
+static bool parse_split(const char* json,
+    const char* root,
+    const unsigned int* splits,
+    unsigned int split_count,
+    TEST_VALUES* values,
+    unsigned int* found,
+    unsigned int* changed)
+{
+    TWIN_PROPERTY properties[4];
+    TWIN_PARSER parser;
+    unsigned int start = 0;
+
+    properties_init(properties, values);
+    twin_parser_init(&parser, root, properties, 4);
+
+    for (unsigned int i = 0; i < split_count; i++)
+    {
+        twin_parser_feed(&parser, json + start, splits[i] - start);
+        start = splits[i];
+    }
+
+    twin_parser_feed(&parser, json + start, strlen(json) - start);
+
+    return twin_parser_finish(&parser, found, changed);
+}
+
+static void check_whole_document(void)
+{
+    TEST_VALUES values;
+    unsigned int found;
+    unsigned int changed;
+
+    check("full twin parses", parse_split(full_twin, "desired", NULL, 0, &values, &found, &changed));
+    check("desired values found", found == 0xF && changed == 0xF);
+    check("desired values stored",
+        values.interval == 25 && values.led && values.target == 21.5 && strcmp(values.name, "a long ") == 0);
+
+    // Without the root only top level keys match, none of them is a property
+    check("no root matches nothing",
+        parse_split(full_twin, NULL, NULL, 0, &values, &found, &changed) && found == 0 && changed == 0);
+}
+
+// Every single split point, and the document a byte at a time
+static void check_split_documents(void)
+{
+    const unsigned int length = strlen(full_twin);
+    unsigned int bytes[sizeof(full_twin)];
+    TEST_VALUES whole;
+    TEST_VALUES piece;
+    unsigned int whole_found;
+    unsigned int piece_found;
+    unsigned int mismatches = 0;
+
+    parse_split(full_twin, "desired", NULL, 0, &whole, &whole_found, NULL);
+
+    for (unsigned int split = 0; split <= length; split++)
+    {
+        if (!parse_split(full_twin, "desired", &split, 1, &piece, &piece_found, NULL) ||
+            piece_found != whole_found || memcmp(&piece, &whole, sizeof(whole)) != 0)
+        {
+            printf("split at %u differs\n", split);
+            mismatches++;
+        }
+    }
+
+    check("every split matches the whole document", mismatches == 0);
+
+    for (unsigned int i = 0; i < length; i++)
+    {
+        bytes[i] = i + 1;
+    }
+
+    check("byte at a time matches the whole document",
+        parse_split(full_twin, "desired", bytes, length - 1, &piece, &piece_found, NULL) &&
+            piece_found == whole_found && memcmp(&piece, &whole, sizeof(whole)) == 0);
+}
+
+// Patches are parsed with no root, the second of two identical patches changes nothing
+static void check_patch(void)
+{
+    static const char patch[] = "{\"telemetryInterval\": 5, \"thermostat1\": {\"targetTemperature\": -3e1}}";
+    TWIN_PROPERTY properties[4];
+    TEST_VALUES values;
+    unsigned int found;
+    unsigned int changed;
+
+    properties_init(properties, &values);
+
+    check("patch parses", twin_parse(patch, strlen(patch), NULL, properties, 4, &found, &changed));
+    check("patch values stored", found == 0x5 && changed == 0x5 && values.interval == 5 && values.target == -30);
+    check("repeated patch changes nothing",
+        twin_parse(patch, strlen(patch), NULL, properties, 4, &found, &changed) && found == 0x5 && changed == 0);
+}
+
+static void check_malformed(void)
+{
+    static const char* documents[] = {
+        "{\"telemetryInterval\":5",
+        "{\"telemetryInterval\" 5}",
+        "{\"telemetryInterval\":5}}",
+        "{\"a\":{\"b\":{\"c\":{\"d\":{\"e\":{\"f\":{\"g\":{\"h\":{}}}}}}}}}",
+        "{\"name\":\"unterminated}",
+    };
+    TWIN_PROPERTY properties[4];
+    TEST_VALUES values;
+    unsigned int rejected = 0;
+
+    properties_init(properties, &values);
+
+    for (unsigned int i = 0; i < sizeof(documents) / sizeof(documents[0]); i++)
+    {
+        rejected += !twin_parse(documents[i], strlen(documents[i]), NULL, properties, 4, NULL, NULL);
+    }
+
+    check("malformed and too deep documents rejected", rejected == sizeof(documents) / sizeof(documents[0]));
+}
+
+int main(void)
+{
+    check_whole_document();
+    check_split_documents();
+    check_patch();
+    check_malformed();
+
+    printf("%s: %d failures\n", failures ? "FAILED" : "PASSED", failures);
+
+    return failures ? 1 : 0;
+}
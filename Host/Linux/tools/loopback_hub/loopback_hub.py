@@ -0,0 +1,185 @@
+# Copyright (c) Microsoft Corporation.
+# Licensed under the MIT License.
+
+"""Minimal stand-in for the IoT Hub and DPS MQTT APIs.
+
+Runs next to a local mosquitto broker (see mosquitto.conf) and answers the requests the device
+client makes: DPS registration, twin GET and reported property PATCH. Telemetry is counted and
+logged. Direct methods and desired property updates can be sent from stdin, and reported property
+PATCHes answered with an error status to exercise the retries of the device:
+
+    method <name> <json payload>
+    desired <json patch>
+    fail-patch <count> [status]
+    kick <device id>
+
+Devices on a listener with a mount point, like hub-1.loopback-hub.local, each get a twin of their own,
+as IoT Hub keeps the twin and method topics of each connection apart. The console addresses the device
+without a mount point, kick drops any device from the broker.
+"""
+
+import argparse
+import json
+import sys
+import threading
+import time
+import urllib.parse
+
+import paho.mqtt.client as mqtt
+
+DPS_OPERATION_ID = "loopback-operation"
+
+
+class LoopbackHub:
+    def __init__(self, client, broker, hub_hostname, device_id, fail_patches=0, fail_status=500):
+        self.client = client
+        self.broker = broker
+        self.hub_hostname = hub_hostname
+        self.device_id = device_id
+        self.registration_id = device_id
+        self.twins = {}
+        self.desired = self.twin("")["desired"]
+        self.reported = self.twin("")["reported"]
+        self.telemetry_count = 0
+        self.telemetry_bytes = 0
+        self.start_time = time.time()
+        self.next_rid = 1
+        self.fail_patches = fail_patches
+        self.fail_status = fail_status
+
+    @staticmethod
+    def split_topic(topic):
+        # Topics of a mounted listener arrive behind its mount point, e.g. hub-1/$iothub/twin/GET/
+        mount = ""
+        if not topic.startswith(("$", "devices/")):
+            mount, _, topic = topic.partition("/")
+            mount += "/"
+        path, _, query = topic.partition("?")
+        return mount, path, dict(urllib.parse.parse_qsl(query))
+
+    def twin(self, mount):
+        return self.twins.setdefault(mount, {"desired": {"$version": 1}, "reported": {"$version": 1}})
+
+    def publish(self, topic, payload):
+        self.client.publish(topic, json.dumps(payload) if payload is not None else b"")
+
+    def on_connect(self, client, userdata, flags, rc):
+        for topic in ("$iothub/twin/#", "$iothub/methods/res/#", "$dps/registrations/#", "devices/+/messages/events/#"):
+            client.subscribe(topic)
+            client.subscribe("+/" + topic)
+        print("Loopback hub ready, hub hostname {}".format(self.hub_hostname))
+
+    def kick(self, device_id):
+        # The broker drops a client when another connects with its id, as IoT Hub does on a second connection.
+        # Without a network loop this client does not reconnect once the device takes its id back.
+        kicker = mqtt.Client(client_id=device_id)
+        kicker.connect(*self.broker)
+        kicker.loop(timeout=1)
+        kicker.disconnect()
+        print("kicked {}".format(device_id))
+
+    def on_message(self, client, userdata, message):
+        mount, path, query = self.split_topic(message.topic)
+        rid = query.get("$rid", "0")
+        twin = self.twin(mount)
+        label = "[{}] ".format(mount.rstrip("/")) if mount else ""
+
+        if path.startswith("devices/") and "/messages/events/" in path:
+            self.telemetry_count += 1
+            self.telemetry_bytes += len(message.payload)
+            elapsed = time.time() - self.start_time
+            # The property bag follows the events path, queued telemetry carries its capture time in $.ctime
+            # and telemetry a gateway sends for a downstream device the id of that device in leafId
+            properties = dict(urllib.parse.parse_qsl(path.partition("/messages/events/")[2]))
+            captured = " captured {}".format(properties["$.ctime"]) if "$.ctime" in properties else ""
+            leaf = " leaf {}".format(properties["leafId"]) if "leafId" in properties else ""
+            print("{}telemetry #{} ({} bytes, {:.2f} msg/s){}{}: {}".format(
+                label, self.telemetry_count, len(message.payload), self.telemetry_count / elapsed, captured, leaf,
+                message.payload.decode(errors="replace")))
+
+        elif path == "$iothub/twin/GET/":
+            self.publish(mount + "$iothub/twin/res/200/?$rid={}".format(rid),
+                         {"desired": twin["desired"], "reported": twin["reported"]})
+
+        elif path == "$iothub/twin/PATCH/properties/reported/" and self.fail_patches > 0:
+            self.fail_patches -= 1
+            print("{}reported rejected with {}: {}".format(
+                label, self.fail_status, message.payload.decode(errors="replace")))
+            self.publish(mount + "$iothub/twin/res/{}/?$rid={}".format(self.fail_status, rid), None)
+
+        elif path == "$iothub/twin/PATCH/properties/reported/":
+            twin["reported"].update(json.loads(message.payload or b"{}"))
+            twin["reported"]["$version"] += 1
+            print("{}reported: {}".format(label, message.payload.decode(errors="replace")))
+            self.publish(mount + "$iothub/twin/res/204/?$rid={}&$version={}".format(
+                rid, twin["reported"]["$version"]), None)
+
+        elif path.startswith("$iothub/methods/res/"):
+            print("{}method response {}: {}".format(label, path.split("/")[3], message.payload.decode(errors="replace")))
+
+        elif path == "$dps/registrations/PUT/iotdps-register/":
+            self.registration_id = json.loads(message.payload or b"{}").get("registrationId", self.device_id)
+            self.publish(mount + "$dps/registrations/res/202/?$rid={}&retry-after=1".format(rid),
+                         {"operationId": DPS_OPERATION_ID, "status": "assigning"})
+
+        elif path == "$dps/registrations/GET/iotdps-get-operationstatus/":
+            self.publish(mount + "$dps/registrations/res/200/?$rid={}".format(rid), {
+                "operationId": DPS_OPERATION_ID,
+                "status": "assigned",
+                "registrationState": {
+                    "registrationId": self.registration_id,
+                    "assignedHub": self.hub_hostname,
+                    "deviceId": self.registration_id,
+                    "status": "assigned",
+                    "substatus": "initialAssignment",
+                },
+            })
+
+    def console(self):
+        for line in sys.stdin:
+            verb, _, rest = line.strip().partition(" ")
+            if verb == "method":
+                name, _, payload = rest.partition(" ")
+                self.client.publish("$iothub/methods/POST/{}/?$rid={}".format(name, self.next_rid), payload or "{}")
+                self.next_rid += 1
+            elif verb == "desired":
+                patch = json.loads(rest)
+                self.desired["$version"] += 1
+                self.desired.update(patch)
+                patch["$version"] = self.desired["$version"]
+                self.publish("$iothub/twin/PATCH/properties/desired/?$version={}".format(patch["$version"]), patch)
+            elif verb == "kick":
+                self.kick(rest)
+            elif verb == "fail-patch":
+                count, _, status = rest.partition(" ")
+                self.fail_patches = int(count)
+                self.fail_status = int(status or self.fail_status)
+            elif verb:
+                print("unknown command, use: method <name> <payload> | desired <json> | "
+                      "fail-patch <count> [status] | kick <device id>")
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("--broker", default="127.0.0.1")
+    parser.add_argument("--port", type=int, default=1883)
+    parser.add_argument("--hub-hostname", default="loopback-hub.local")
+    parser.add_argument("--device-id", default="host-device")
+    parser.add_argument("--fail-patch", type=int, default=0, metavar="COUNT",
+                        help="answer the first COUNT reported property PATCHes with --fail-status")
+    parser.add_argument("--fail-status", type=int, default=500)
+    args = parser.parse_args()
+
+    client = mqtt.Client(client_id="loopback-hub")
+    hub = LoopbackHub(client, (args.broker, args.port), args.hub_hostname, args.device_id,
+                      args.fail_patch, args.fail_status)
+    client.on_connect = hub.on_connect
+    client.on_message = hub.on_message
+    client.connect(args.broker, args.port)
+
+    threading.Thread(target=hub.console, daemon=True).start()
+    client.loop_forever()
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,46 @@
+# Copyright (c) Microsoft Corporation.
+# Licensed under the MIT License.
+
+#!/bin/bash
+
+# Generate a throwaway CA and a server certificate for the loopback hub, and the C source
+# that lets the device trust the CA in place of the Azure root certificates.
+
+set -e
+
+SCRIPT=$(readlink -f "$0")
+SCRIPTDIR=$(dirname "$SCRIPT")
+CERTDIR="$SCRIPTDIR/certs"
+HOSTNAME=${1:-loopback-hub.local}
+# rsa or ec, an EC server key lets the GCM profile negotiate ECDHE-ECDSA instead of ECDHE-RSA
+SERVER_KEY=${2:-rsa}
+
+mkdir -p "$CERTDIR"
+cd "$CERTDIR"
+
+openssl req -x509 -newkey rsa:2048 -nodes -days 365 -subj "/CN=Loopback Hub CA" \
+    -keyout ca.key -out ca.pem
+if [ "$SERVER_KEY" = "ec" ]; then
+    openssl req -newkey ec -pkeyopt ec_paramgen_curve:prime256v1 -nodes -subj "/CN=$HOSTNAME" \
+        -keyout server.key -out server.csr
+else
+    openssl req -newkey rsa:2048 -nodes -subj "/CN=$HOSTNAME" \
+        -keyout server.key -out server.csr
+fi
+openssl x509 -req -in server.csr -CA ca.pem -CAkey ca.key -CAcreateserial -days 365 \
+    -extfile <(printf "subjectAltName=DNS:%s" "$HOSTNAME"; printf ",DNS:hub-%s.$HOSTNAME" 1 2 3 4) -out server.pem
+openssl x509 -in ca.pem -outform der -out ca.der
+
+# The client expects three root certificates, trust the loopback CA in every slot
+{
+    echo "/* Generated by make_certs.sh, do not edit. */"
+    for suffix in "" "_2" "_3"; do
+        echo
+        echo "const unsigned char azure_iot_root_cert${suffix}[] = {"
+        xxd -i < ca.der
+        echo "};"
+        echo "const unsigned int azure_iot_root_cert_size${suffix} = sizeof(azure_iot_root_cert${suffix});"
+    done
+} > loopback_cert.c
+
+echo "Certificates written to $CERTDIR, re-run cmake so the build picks up loopback_cert.c"
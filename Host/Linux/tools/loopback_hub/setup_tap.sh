@@ -0,0 +1,38 @@
+# Copyright (c) Microsoft Corporation.
+# Licensed under the MIT License.
+
+#!/bin/bash
+
+# Create the TAP device the host build attaches to, and serve DHCP and DNS on it. The loopback
+# hub hostname resolves to the host, everything else is forwarded so SNTP still works.
+# Run as root: sudo ./setup_tap.sh [tap device] [user]
+
+set -e
+
+TAP=${1:-tap0}
+OWNER=${2:-$SUDO_USER}
+HOST_IP=192.168.77.1
+HUB_HOSTNAME=loopback-hub.local
+
+# hub-1 to hub-4.loopback-hub.local, an address each for the mounted listeners of mosquitto.conf
+HUB_COUNT=4
+
+ip tuntap add dev "$TAP" mode tap user "$OWNER"
+ip addr add "$HOST_IP/24" dev "$TAP"
+HUB_ADDRESSES=()
+for n in $(seq 1 $HUB_COUNT); do
+    ip addr add "192.168.77.$((100 + n))/24" dev "$TAP"
+    HUB_ADDRESSES+=(--address=/hub-$n.$HUB_HOSTNAME/192.168.77.$((100 + n)))
+done
+ip link set "$TAP" up
+
+# Give the device a route to the internet for SNTP
+sysctl -q net.ipv4.ip_forward=1
+iptables -t nat -A POSTROUTING -s 192.168.77.0/24 ! -o "$TAP" -j MASQUERADE
+
+dnsmasq --interface="$TAP" --bind-interfaces \
+    --dhcp-range=192.168.77.10,192.168.77.50,12h \
+    --address=/$HUB_HOSTNAME/$HOST_IP "${HUB_ADDRESSES[@]}" \
+    --pid-file=/tmp/dnsmasq-$TAP.pid
+
+echo "$TAP is up at $HOST_IP, $HUB_HOSTNAME and hub-1 to hub-$HUB_COUNT.$HUB_HOSTNAME resolve to the host"
@@ -53,4 +53,11 @@ typedef enum
 // ----------------------------------------------------------------------------
 #define IOT_DEVICE_SAS_KEY ""
 
+// ----------------------------------------------------------------------------
+// Azure IoT telemetry encoding
+//    Define this to send telemetry as CBOR keyed by the DTDL model content
+//    index instead of JSON, the receiving service must decode application/cbor
+// ----------------------------------------------------------------------------
+//#define ENABLE_CBOR_TELEMETRY
+
 #endif // _AZURE_CONFIG_H
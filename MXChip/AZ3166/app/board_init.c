@@ -317,6 +317,8 @@ static void UART_Console_Init(void)
     {
         STM32_Error_Handler();
     }
+
+    console_init();
 }
 
 static int val;
@@ -365,6 +367,36 @@ void EXTI15_10_IRQHandler(void)
     HAL_GPIO_EXTI_IRQHandler(GPIO_PIN_10);
 }
 
+void DMA1_Stream0_IRQHandler(void)
+{
+    HAL_DMA_IRQHandler(I2cHandle.hdmarx);
+}
+
+void DMA1_Stream6_IRQHandler(void)
+{
+    HAL_DMA_IRQHandler(I2cHandle.hdmatx);
+}
+
+void I2C1_EV_IRQHandler(void)
+{
+    HAL_I2C_EV_IRQHandler(&I2cHandle);
+}
+
+void I2C1_ER_IRQHandler(void)
+{
+    HAL_I2C_ER_IRQHandler(&I2cHandle);
+}
+
+void DMA2_Stream6_IRQHandler(void)
+{
+    HAL_DMA_IRQHandler(UartHandle.hdmatx);
+}
+
+void USART6_IRQHandler(void)
+{
+    HAL_UART_IRQHandler(&UartHandle);
+}
+
 void HAL_GPIO_EXTI_Callback(uint16_t GPIO_Pin)
 {
     switch (GPIO_Pin)
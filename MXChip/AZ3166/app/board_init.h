@@ -30,4 +30,7 @@ extern UART_HandleTypeDef UartHandle;
 /* Define prototypes. */
 void board_init(void);
 
+// Route console output through the shared console buffer, see console.c
+void console_init(void);
+
 #endif // _BOARD_INIT_H
@@ -0,0 +1,301 @@
+/* Copyright (c) Microsoft Corporation.
+   Licensed under the MIT License. */
+
+#include "flash_store.h"
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "stm32f4xx_hal.h"
+
+#define FLASH_STORE_SECTOR FLASH_SECTOR_11
+#define FLASH_RECORD_MAGIC 0x3153564B // "KVS1"
+#define FLASH_ERASED_WORD  0xFFFFFFFF
+
+// A value follows its header, padded to whole words. A zero length record marks an erased key.
+typedef struct FLASH_RECORD_HEADER_STRUCT
+{
+    ULONG magic;
+    CHAR key[AZURE_IOT_STORE_KEY_SIZE];
+    ULONG length;
+} FLASH_RECORD_HEADER;
+
+// Live records of the other keys, held while the sector is recycled
+static UCHAR compact_buffer[FLASH_STORE_COMPACT_SIZE];
+
+static ULONG record_size(ULONG length)
+{
+    return sizeof(FLASH_RECORD_HEADER) + ((length + 3) & ~3);
+}
+
+// Latest record of key, and the offset where the next record goes
+static const FLASH_RECORD_HEADER* record_find(const CHAR* key, ULONG* free_offset)
+{
+    const FLASH_RECORD_HEADER* found = NX_NULL;
+    const FLASH_RECORD_HEADER* header;
+    ULONG offset = 0;
+
+    while (offset + sizeof(FLASH_RECORD_HEADER) <= FLASH_STORE_SIZE)
+    {
+        header = (const FLASH_RECORD_HEADER*)(FLASH_STORE_ADDRESS + offset);
+
+        // The magic is programmed last, so the scan stops at free space and at a write cut short by a reset
+        if (header->magic != FLASH_RECORD_MAGIC || header->length > FLASH_STORE_SIZE - offset - sizeof(*header))
+        {
+            break;
+        }
+
+        if (strncmp(header->key, key, AZURE_IOT_STORE_KEY_SIZE) == 0)
+        {
+            found = header;
+        }
+
+        offset += record_size(header->length);
+    }
+
+    *free_offset = offset;
+
+    return found;
+}
+
+static bool region_erased(ULONG offset, ULONG size)
+{
+    const ULONG* word = (const ULONG*)(FLASH_STORE_ADDRESS + offset);
+
+    for (; size > 0; size -= sizeof(ULONG))
+    {
+        if (*word++ != FLASH_ERASED_WORD)
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+static UINT sector_erase(VOID)
+{
+    FLASH_EraseInitTypeDef erase = {0};
+    uint32_t sector_error;
+
+    erase.TypeErase    = FLASH_TYPEERASE_SECTORS;
+    erase.Sector       = FLASH_STORE_SECTOR;
+    erase.NbSectors    = 1;
+    erase.VoltageRange = FLASH_VOLTAGE_RANGE_3;
+
+    // Stalls instruction fetch, and so every thread and interrupt, for up to a couple of seconds
+    if (HAL_FLASHEx_Erase(&erase, &sector_error) != HAL_OK)
+    {
+        printf("ERROR: flash store sector erase failed (0x%08x)\r\n", (UINT)HAL_FLASH_GetError());
+        return NX_NOT_SUCCESSFUL;
+    }
+
+    return NX_SUCCESS;
+}
+
+static UINT word_program(ULONG address, ULONG value)
+{
+    if (HAL_FLASH_Program(FLASH_TYPEPROGRAM_WORD, address, value) != HAL_OK)
+    {
+        printf("ERROR: flash store program failed (0x%08x)\r\n", (UINT)HAL_FLASH_GetError());
+        return NX_NOT_SUCCESSFUL;
+    }
+
+    return NX_SUCCESS;
+}
+
+static UINT record_program(ULONG offset, const CHAR* key, const UCHAR* data, ULONG length)
+{
+    ULONG address = FLASH_STORE_ADDRESS + offset;
+    FLASH_RECORD_HEADER header;
+    ULONG word;
+    ULONG index;
+    UINT status = NX_SUCCESS;
+
+    memset(&header, 0, sizeof(header));
+    header.magic = FLASH_RECORD_MAGIC;
+    strncpy(header.key, key, AZURE_IOT_STORE_KEY_SIZE - 1);
+    header.length = length;
+
+    // Everything but the magic first, the record only becomes visible once it is complete
+    for (index = sizeof(ULONG); index < sizeof(header) && status == NX_SUCCESS; index += sizeof(ULONG))
+    {
+        memcpy(&word, (UCHAR*)&header + index, sizeof(ULONG));
+        status = word_program(address + index, word);
+    }
+
+    for (index = 0; index < length && status == NX_SUCCESS; index += sizeof(ULONG))
+    {
+        word = FLASH_ERASED_WORD;
+        memcpy(&word, data + index, length - index < sizeof(ULONG) ? length - index : sizeof(ULONG));
+        status = word_program(address + sizeof(header) + index, word);
+    }
+
+    if (status == NX_SUCCESS)
+    {
+        status = word_program(address, header.magic);
+    }
+
+    // Drop stale erased lines the flash data cache may hold for the record
+    __HAL_FLASH_DATA_CACHE_DISABLE();
+    __HAL_FLASH_DATA_CACHE_RESET();
+    __HAL_FLASH_DATA_CACHE_ENABLE();
+
+    return status;
+}
+
+// Copy the latest record of every key other than skip_key that still holds a value into compact_buffer
+static UINT live_records_stage(const CHAR* skip_key, ULONG* staged)
+{
+    const FLASH_RECORD_HEADER* header;
+    ULONG offset = 0;
+    ULONG free_offset;
+    ULONG size;
+
+    *staged = 0;
+
+    while (offset + sizeof(FLASH_RECORD_HEADER) <= FLASH_STORE_SIZE)
+    {
+        header = (const FLASH_RECORD_HEADER*)(FLASH_STORE_ADDRESS + offset);
+
+        if (header->magic != FLASH_RECORD_MAGIC || header->length > FLASH_STORE_SIZE - offset - sizeof(*header))
+        {
+            break;
+        }
+
+        size = record_size(header->length);
+
+        if (header->length > 0 && strncmp(header->key, skip_key, AZURE_IOT_STORE_KEY_SIZE) != 0 &&
+            record_find(header->key, &free_offset) == header)
+        {
+            if (*staged + size > sizeof(compact_buffer))
+            {
+                printf("ERROR: flash store values do not fit the compaction buffer\r\n");
+                return NX_SIZE_ERROR;
+            }
+
+            memcpy(compact_buffer + *staged, header, size);
+            *staged += size;
+        }
+
+        offset += size;
+    }
+
+    return NX_SUCCESS;
+}
+
+// Program the staged records from the start of the erased sector
+static UINT live_records_restore(ULONG staged)
+{
+    const FLASH_RECORD_HEADER* header;
+    ULONG offset = 0;
+    UINT status  = NX_SUCCESS;
+
+    while (offset < staged && status == NX_SUCCESS)
+    {
+        header = (const FLASH_RECORD_HEADER*)(compact_buffer + offset);
+        status = record_program(offset, header->key, (const UCHAR*)(header + 1), header->length);
+        offset += record_size(header->length);
+    }
+
+    return status;
+}
+
+static UINT flash_store_read(const CHAR* key, UCHAR* data, UINT size, UINT* length)
+{
+    const FLASH_RECORD_HEADER* header;
+    ULONG free_offset;
+
+    header = record_find(key, &free_offset);
+
+    if (header == NX_NULL || header->length == 0)
+    {
+        return NX_NOT_FOUND;
+    }
+
+    if (header->length > size)
+    {
+        return NX_SIZE_ERROR;
+    }
+
+    memcpy(data, header + 1, header->length);
+    *length = header->length;
+
+    return NX_SUCCESS;
+}
+
+static UINT flash_store_write(const CHAR* key, const UCHAR* data, UINT length)
+{
+    ULONG size = record_size(length);
+    ULONG offset;
+    ULONG staged = 0;
+    bool recycle;
+    UINT status = NX_SUCCESS;
+
+    if (strlen(key) >= AZURE_IOT_STORE_KEY_SIZE || size > FLASH_STORE_SIZE)
+    {
+        return NX_SIZE_ERROR;
+    }
+
+    record_find(key, &offset);
+
+    // Recycle the sector when it is full, or when a write was cut short and left the free space dirty,
+    // carrying the values of the other keys over
+    recycle = offset + size > FLASH_STORE_SIZE || !region_erased(offset, size);
+
+    if (recycle)
+    {
+        if ((status = live_records_stage(key, &staged)))
+        {
+            return status;
+        }
+
+        if (staged + size > FLASH_STORE_SIZE)
+        {
+            return NX_SIZE_ERROR;
+        }
+    }
+
+    HAL_FLASH_Unlock();
+
+    if (recycle)
+    {
+        if ((status = sector_erase()) == NX_SUCCESS)
+        {
+            status = live_records_restore(staged);
+        }
+
+        offset = staged;
+    }
+
+    if (status == NX_SUCCESS)
+    {
+        status = record_program(offset, key, data, length);
+    }
+
+    HAL_FLASH_Lock();
+
+    return status;
+}
+
+static UINT flash_store_erase(const CHAR* key)
+{
+    const FLASH_RECORD_HEADER* header;
+    ULONG free_offset;
+
+    header = record_find(key, &free_offset);
+
+    if (header == NX_NULL || header->length == 0)
+    {
+        return NX_SUCCESS;
+    }
+
+    return flash_store_write(key, NX_NULL, 0);
+}
+
+const AZURE_IOT_STORE flash_store = {
+    .read  = flash_store_read,
+    .write = flash_store_write,
+    .erase = flash_store_erase,
+};
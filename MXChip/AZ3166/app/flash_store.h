@@ -0,0 +1,23 @@
+/* Copyright (c) Microsoft Corporation.
+   Licensed under the MIT License. */
+
+#ifndef _FLASH_STORE_H
+#define _FLASH_STORE_H
+
+#include "azure_iot_store.h"
+
+// The last 128K sector of the internal flash, kept out of the image by MXChip_AZ3166.ld
+#define FLASH_STORE_ADDRESS 0x080E0000
+#define FLASH_STORE_SIZE    (128 * 1024)
+
+// Bytes of live records, headers included, that are carried over when the sector is recycled
+#ifndef FLASH_STORE_COMPACT_SIZE
+#define FLASH_STORE_COMPACT_SIZE 1024
+#endif
+
+// Values are appended to the sector and it is only erased once full. The latest value of every other key is
+// copied to RAM first and written back after the erase, a reset during that window loses them. Sized for a few
+// small values that rarely change, such as the DPS assignment.
+extern const AZURE_IOT_STORE flash_store;
+
+#endif // _FLASH_STORE_H
@@ -0,0 +1,93 @@
+/* Copyright (c) Microsoft Corporation.
+   Licensed under the MIT License. */
+
+#include "i2c_transfer.h"
+
+extern I2C_HandleTypeDef I2cHandle;
+
+static TX_SEMAPHORE transfer_semaphore;
+static volatile HAL_StatusTypeDef transfer_status;
+
+VOID i2c_transfer_reset(VOID)
+{
+    // Stop the streams and reset the peripheral, so nothing of an abandoned transfer completes later
+    HAL_NVIC_DisableIRQ(I2C1_EV_IRQn);
+    HAL_NVIC_DisableIRQ(I2C1_ER_IRQn);
+
+    HAL_DMA_Abort(I2cHandle.hdmatx);
+    HAL_DMA_Abort(I2cHandle.hdmarx);
+
+    // Init runs HAL_I2C_MspInit again, which enables the interrupts
+    HAL_I2C_DeInit(&I2cHandle);
+    HAL_I2C_Init(&I2cHandle);
+
+    tx_semaphore_get(&transfer_semaphore, TX_NO_WAIT);
+}
+
+static HAL_StatusTypeDef transfer_wait(HAL_StatusTypeDef status, ULONG timeout_ticks)
+{
+    if (status != HAL_OK)
+    {
+        return status;
+    }
+
+    if (tx_semaphore_get(&transfer_semaphore, timeout_ticks) != TX_SUCCESS)
+    {
+        i2c_transfer_reset();
+        return HAL_TIMEOUT;
+    }
+
+    return transfer_status;
+}
+
+UINT i2c_transfer_init(VOID)
+{
+    return tx_semaphore_create(&transfer_semaphore, "I2C transfer", 0);
+}
+
+HAL_StatusTypeDef i2c_transfer_write(
+    uint16_t address, uint16_t reg, uint8_t* data, uint16_t length, ULONG timeout_ticks)
+{
+    return transfer_wait(
+        HAL_I2C_Mem_Write_DMA(&I2cHandle, address, reg, I2C_MEMADD_SIZE_8BIT, data, length), timeout_ticks);
+}
+
+HAL_StatusTypeDef i2c_transfer_read(uint16_t address, uint16_t reg, uint8_t* data, uint16_t length, ULONG timeout_ticks)
+{
+    return transfer_wait(
+        HAL_I2C_Mem_Read_DMA(&I2cHandle, address, reg, I2C_MEMADD_SIZE_8BIT, data, length), timeout_ticks);
+}
+
+// The HAL callbacks are shared by every I2C handle, only complete transfers of the sensor bus
+void HAL_I2C_MemTxCpltCallback(I2C_HandleTypeDef* hi2c)
+{
+    if (hi2c != &I2cHandle)
+    {
+        return;
+    }
+
+    transfer_status = HAL_OK;
+    tx_semaphore_put(&transfer_semaphore);
+}
+
+void HAL_I2C_MemRxCpltCallback(I2C_HandleTypeDef* hi2c)
+{
+    if (hi2c != &I2cHandle)
+    {
+        return;
+    }
+
+    transfer_status = HAL_OK;
+    tx_semaphore_put(&transfer_semaphore);
+}
+
+void HAL_I2C_ErrorCallback(I2C_HandleTypeDef* hi2c)
+{
+    if (hi2c != &I2cHandle)
+    {
+        return;
+    }
+
+    transfer_status = HAL_ERROR;
+    tx_semaphore_put(&transfer_semaphore);
+}
@@ -0,0 +1,24 @@
+/* Copyright (c) Microsoft Corporation.
+   Licensed under the MIT License. */
+
+#ifndef _I2C_TRANSFER_H
+#define _I2C_TRANSFER_H
+
+#include "tx_api.h"
+
+#include "stm32f4xx_hal.h"
+
+// Create the completion semaphore, before the first transfer
+UINT i2c_transfer_init(VOID);
+
+// Register writes and reads by DMA on the bus shared by the sensors and the display, the calling thread sleeps
+// until the transfer completes. Callers hold the sensor bus lock, one transfer is in flight at a time. A transfer
+// that does not complete within timeout_ticks is aborted and the peripheral reset before HAL_TIMEOUT is returned.
+HAL_StatusTypeDef i2c_transfer_write(
+    uint16_t address, uint16_t reg, uint8_t* data, uint16_t length, ULONG timeout_ticks);
+HAL_StatusTypeDef i2c_transfer_read(uint16_t address, uint16_t reg, uint8_t* data, uint16_t length, ULONG timeout_ticks);
+
+// Abort whatever the bus is doing and reset the peripheral, e.g. after a blocking transfer timed out
+VOID i2c_transfer_reset(VOID);
+
+#endif // _I2C_TRANSFER_H
@@ -8,6 +8,7 @@
 #include "board_init.h"
 #include "cmsis_utils.h"
 #include "screen.h"
+#include "sensor_sampler.h"
 #include "sntp_client.h"
 #include "wwd_networking.h"
 
@@ -64,6 +65,13 @@ void tx_application_define(void* first_unused_memory)
     {
         printf("ERROR: Azure IoT thread creation failed\r\n");
     }
+
+#ifndef ENABLE_LEGACY_MQTT
+    // Sample the sensors and drive the display off the network thread, the legacy client still
+    // reads the sensors and updates the display directly
+    sensor_sampler_start();
+    screen_start();
+#endif
 }
 
 int main(void)
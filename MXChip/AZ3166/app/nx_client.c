@@ -5,8 +5,9 @@
 
 #include <stdio.h>
 
+#include "flash_store.h"
 #include "screen.h"
-#include "sensor.h"
+#include "sensor_sampler.h"
 #include "stm32f4xx_hal.h"
 
 #include "nx_api.h"
@@ -19,32 +20,16 @@
 #include "azure_config.h"
 #include "azure_device_x509_cert_config.h"
 #include "azure_pnp_info.h"
+#include "gsgmxchip_dispatch.h"
 #include "wwd_networking.h"
 
-#define IOT_MODEL_ID "dtmi:azurertos:devkit:gsgmxchip;2"
-
-// Device telemetry names
-#define TELEMETRY_HUMIDITY          "humidity"
-#define TELEMETRY_TEMPERATURE       "temperature"
-#define TELEMETRY_PRESSURE          "pressure"
-#define TELEMETRY_MAGNETOMETERX     "magnetometerX"
-#define TELEMETRY_MAGNETOMETERY     "magnetometerY"
-#define TELEMETRY_MAGNETOMETERZ     "magnetometerZ"
-#define TELEMETRY_ACCELEROMETERX    "accelerometerX"
-#define TELEMETRY_ACCELEROMETERY    "accelerometerY"
-#define TELEMETRY_ACCELEROMETERZ    "accelerometerZ"
-#define TELEMETRY_GYROSCOPEX        "gyroscopeX"
-#define TELEMETRY_GYROSCOPEY        "gyroscopeY"
-#define TELEMETRY_GYROSCOPEZ        "gyroscopeZ"
+#define IOT_MODEL_ID "dtmi:azurertos:devkit:gsgmxchip;3"
+
 #define TELEMETRY_INTERVAL_PROPERTY "telemetryInterval"
 
 // Properties
 #define LED_STATE_PROPERTY          "ledState"
 
-// Commands
-#define SET_LED_STATE_COMMAND       "setLedState"
-#define SET_DISPLAY_TEXT_COMMAND    "setDisplayText"
-
 typedef enum TELEMETRY_STATE_ENUM
 {
     TELEMETRY_STATE_DEFAULT,
@@ -57,6 +42,7 @@ typedef enum TELEMETRY_STATE_ENUM
 static AZURE_IOT_NX_CONTEXT azure_iot_nx_client;
 
 static int32_t telemetry_interval = 10;
+static bool telemetry_interval_desired;
 
 static UINT append_device_info_properties(NX_AZURE_IOT_JSON_WRITER* json_writer)
 {
@@ -109,110 +95,46 @@ static UINT append_device_info_properties(NX_AZURE_IOT_JSON_WRITER* json_writer)
 
 static UINT append_device_telemetry(NX_AZURE_IOT_JSON_WRITER* json_writer)
 {
-    lps22hb_t lps22hb_data    = lps22hb_data_read();
-    hts221_data_t hts221_data = hts221_data_read();
-
-    if (nx_azure_iot_json_writer_append_property_with_double_value(
-            json_writer, (UCHAR*)TELEMETRY_HUMIDITY, sizeof(TELEMETRY_HUMIDITY) - 1, hts221_data.humidity_perc, 2) ||
-
-        nx_azure_iot_json_writer_append_property_with_double_value(json_writer,
-            (UCHAR*)TELEMETRY_TEMPERATURE,
-            sizeof(TELEMETRY_TEMPERATURE) - 1,
-            lps22hb_data.temperature_degC,
-            2) ||
-
-        nx_azure_iot_json_writer_append_property_with_double_value(
-            json_writer, (UCHAR*)TELEMETRY_PRESSURE, sizeof(TELEMETRY_PRESSURE) - 1, lps22hb_data.pressure_hPa, 2))
-    {
-        return NX_NOT_SUCCESSFUL;
-    }
-
-    return NX_AZURE_IOT_SUCCESS;
+    return sensor_registry_append_json(&sensor_registry, json_writer, SENSOR_CHANNEL_TEMPERATURE, 3);
 }
 
 static UINT append_device_telemetry_magnetometer(NX_AZURE_IOT_JSON_WRITER* json_writer)
 {
-    lis2mdl_data_t lis2mdl_data = lis2mdl_data_read();
-
-    if (nx_azure_iot_json_writer_append_property_with_double_value(json_writer,
-            (UCHAR*)TELEMETRY_MAGNETOMETERX,
-            sizeof(TELEMETRY_MAGNETOMETERX) - 1,
-            lis2mdl_data.magnetic_mG[0],
-            2) ||
-
-        nx_azure_iot_json_writer_append_property_with_double_value(json_writer,
-            (UCHAR*)TELEMETRY_MAGNETOMETERY,
-            sizeof(TELEMETRY_MAGNETOMETERY) - 1,
-            lis2mdl_data.magnetic_mG[1],
-            2) ||
-
-        nx_azure_iot_json_writer_append_property_with_double_value(json_writer,
-            (UCHAR*)TELEMETRY_MAGNETOMETERZ,
-            sizeof(TELEMETRY_MAGNETOMETERZ) - 1,
-            lis2mdl_data.magnetic_mG[2],
-            2))
-    {
-        return NX_NOT_SUCCESSFUL;
-    }
-
-    return NX_AZURE_IOT_SUCCESS;
+    return sensor_registry_append_json(&sensor_registry, json_writer, SENSOR_CHANNEL_MAGNETOMETER_X, 3);
 }
 
 static UINT append_device_telemetry_accelerometer(NX_AZURE_IOT_JSON_WRITER* json_writer)
 {
-    lsm6dsl_data_t lsm6dsl_data = lsm6dsl_data_read();
-
-    if (nx_azure_iot_json_writer_append_property_with_double_value(json_writer,
-            (UCHAR*)TELEMETRY_ACCELEROMETERX,
-            sizeof(TELEMETRY_ACCELEROMETERX) - 1,
-            lsm6dsl_data.acceleration_mg[0],
-            2) ||
-
-        nx_azure_iot_json_writer_append_property_with_double_value(json_writer,
-            (UCHAR*)TELEMETRY_ACCELEROMETERY,
-            sizeof(TELEMETRY_ACCELEROMETERY) - 1,
-            lsm6dsl_data.acceleration_mg[1],
-            2) ||
-
-        nx_azure_iot_json_writer_append_property_with_double_value(json_writer,
-            (UCHAR*)TELEMETRY_ACCELEROMETERZ,
-            sizeof(TELEMETRY_ACCELEROMETERZ) - 1,
-            lsm6dsl_data.acceleration_mg[2],
-            2))
-    {
-        return NX_NOT_SUCCESSFUL;
-    }
-
-    return NX_AZURE_IOT_SUCCESS;
+    // The RMS over the interval carries the vibration that a single sample would miss
+    return sensor_registry_append_json(&sensor_registry, json_writer, SENSOR_CHANNEL_ACCELEROMETER_X, 3);
 }
 
 static UINT append_device_telemetry_gyroscope(NX_AZURE_IOT_JSON_WRITER* json_writer)
 {
-    lsm6dsl_data_t lsm6dsl_data = lsm6dsl_data_read();
+    return sensor_registry_append_json(&sensor_registry, json_writer, SENSOR_CHANNEL_GYROSCOPE_X, 3);
+}
 
-    if (nx_azure_iot_json_writer_append_property_with_double_value(json_writer,
-            (UCHAR*)TELEMETRY_GYROSCOPEX,
-            sizeof(TELEMETRY_GYROSCOPEX) - 1,
-            lsm6dsl_data.angular_rate_mdps[0],
-            2) ||
+#ifdef ENABLE_CBOR_TELEMETRY
+static UINT append_device_telemetry_cbor(AZURE_IOT_CBOR_WRITER* cbor_writer)
+{
+    return sensor_registry_append_cbor(&sensor_registry, cbor_writer, SENSOR_CHANNEL_TEMPERATURE, 3);
+}
 
-        nx_azure_iot_json_writer_append_property_with_double_value(json_writer,
-            (UCHAR*)TELEMETRY_GYROSCOPEY,
-            sizeof(TELEMETRY_GYROSCOPEY) - 1,
-            lsm6dsl_data.angular_rate_mdps[1],
-            2) ||
+static UINT append_device_telemetry_magnetometer_cbor(AZURE_IOT_CBOR_WRITER* cbor_writer)
+{
+    return sensor_registry_append_cbor(&sensor_registry, cbor_writer, SENSOR_CHANNEL_MAGNETOMETER_X, 3);
+}
 
-        nx_azure_iot_json_writer_append_property_with_double_value(json_writer,
-            (UCHAR*)TELEMETRY_GYROSCOPEZ,
-            sizeof(TELEMETRY_GYROSCOPEZ) - 1,
-            lsm6dsl_data.angular_rate_mdps[2],
-            2))
-    {
-        return NX_NOT_SUCCESSFUL;
-    }
+static UINT append_device_telemetry_accelerometer_cbor(AZURE_IOT_CBOR_WRITER* cbor_writer)
+{
+    return sensor_registry_append_cbor(&sensor_registry, cbor_writer, SENSOR_CHANNEL_ACCELEROMETER_X, 3);
+}
 
-    return NX_AZURE_IOT_SUCCESS;
+static UINT append_device_telemetry_gyroscope_cbor(AZURE_IOT_CBOR_WRITER* cbor_writer)
+{
+    return sensor_registry_append_cbor(&sensor_registry, cbor_writer, SENSOR_CHANNEL_GYROSCOPE_X, 3);
 }
+#endif
 
 static void set_led_state(bool level)
 {
@@ -228,101 +150,37 @@ static void set_led_state(bool level)
     }
 }
 
-static void command_received_cb(AZURE_IOT_NX_CONTEXT* nx_context_ptr,
-    const UCHAR* component,
-    USHORT component_length,
-    const UCHAR* method,
-    USHORT method_length,
-    UCHAR* payload,
-    USHORT payload_length,
-    VOID* context_ptr,
-    USHORT context_length)
+UINT gsgmxchip_set_led_state_command(AZURE_IOT_NX_CONTEXT* nx_context, bool value)
 {
-    UINT status;
+    set_led_state(value);
+    azure_iot_nx_client_publish_bool_property(nx_context, NULL, LED_STATE_PROPERTY, value);
 
-    if (strncmp((CHAR*)method, SET_LED_STATE_COMMAND, method_length) == 0)
-    {
-        bool arg = (strncmp((CHAR*)payload, "true", payload_length) == 0);
-        set_led_state(arg);
-
-        if ((status = nx_azure_iot_hub_client_command_message_response(
-                 &nx_context_ptr->iothub_client, 200, context_ptr, context_length, NULL, 0, NX_WAIT_FOREVER)))
-        {
-            printf("Direct method response failed! (0x%08x)\r\n", status);
-            return;
-        }
-
-        azure_iot_nx_client_publish_bool_property(&azure_iot_nx_client, NULL, LED_STATE_PROPERTY, arg);
-    }
-    else if (strncmp((CHAR*)method, SET_DISPLAY_TEXT_COMMAND, method_length) == 0)
-    {
-        // drop the first and last character to remove the quotes
-        screen_printn((CHAR*)payload + 1, payload_length - 2, L0);
-        if ((status = nx_azure_iot_hub_client_command_message_response(
-                 &nx_context_ptr->iothub_client, 200, context_ptr, context_length, NULL, 0, NX_WAIT_FOREVER)))
-        {
-            printf("Direct method response failed! (0x%08x)\r\n", status);
-            return;
-        }
-    }
-    else
-    {
-        printf("Direct method is not for this device\r\n");
-
-        if ((status = nx_azure_iot_hub_client_command_message_response(
-                 &nx_context_ptr->iothub_client, 501, context_ptr, context_length, NULL, 0, NX_WAIT_FOREVER)))
-        {
-            printf("Direct method response failed! (0x%08x)\r\n", status);
-            return;
-        }
-    }
+    return 200;
 }
 
-static void writable_property_received_cb(AZURE_IOT_NX_CONTEXT* nx_context,
-    const UCHAR* component_name,
-    UINT component_name_len,
-    UCHAR* property_name,
-    UINT property_name_len,
-    NX_AZURE_IOT_JSON_READER* json_reader_ptr,
-    UINT version)
+UINT gsgmxchip_set_display_text_command(AZURE_IOT_NX_CONTEXT* nx_context, const UCHAR* value, UINT value_length)
 {
-    UINT status;
-
-    if (strncmp((CHAR*)property_name, TELEMETRY_INTERVAL_PROPERTY, property_name_len) == 0)
-    {
-        status = nx_azure_iot_json_reader_token_int32_get(json_reader_ptr, &telemetry_interval);
-        if (status == NX_AZURE_IOT_SUCCESS)
-        {
-            printf("Updating %s to %ld\r\n", TELEMETRY_INTERVAL_PROPERTY, telemetry_interval);
+    screen_printn((CHAR*)value, value_length, L0);
 
-            // Confirm reception back to hub
-            azure_nx_client_respond_int_writable_property(
-                nx_context, NULL, TELEMETRY_INTERVAL_PROPERTY, telemetry_interval, 200, version);
-
-            azure_nx_client_periodic_interval_set(nx_context, telemetry_interval);
-        }
-    }
+    return 200;
 }
 
-static void property_received_cb(AZURE_IOT_NX_CONTEXT* nx_context,
-    const UCHAR* component_name,
-    UINT component_name_len,
-    UCHAR* property_name,
-    UINT property_name_len,
-    NX_AZURE_IOT_JSON_READER* json_reader_ptr,
-    UINT version)
+UINT gsgmxchip_telemetry_interval_set(AZURE_IOT_NX_CONTEXT* nx_context, int32_t value)
 {
-    UINT status;
+    // Answered here with the twin version, properties_complete_cb only reports the default when there was none
+    telemetry_interval_desired = true;
 
-    if (strncmp((CHAR*)property_name, TELEMETRY_INTERVAL_PROPERTY, property_name_len) == 0)
+    if (value < 1)
     {
-        status = nx_azure_iot_json_reader_token_int32_get(json_reader_ptr, &telemetry_interval);
-        if (status == NX_AZURE_IOT_SUCCESS)
-        {
-            printf("Updating %s to %ld\r\n", TELEMETRY_INTERVAL_PROPERTY, telemetry_interval);
-            azure_nx_client_periodic_interval_set(nx_context, telemetry_interval);
-        }
+        printf("Rejecting %s of %ld\r\n", TELEMETRY_INTERVAL_PROPERTY, value);
+        return 400;
     }
+
+    printf("Updating %s to %ld\r\n", TELEMETRY_INTERVAL_PROPERTY, value);
+    telemetry_interval = value;
+    azure_nx_client_periodic_interval_set(nx_context, telemetry_interval);
+
+    return 200;
 }
 
 static void properties_complete_cb(AZURE_IOT_NX_CONTEXT* nx_context)
@@ -330,8 +188,12 @@ static void properties_complete_cb(AZURE_IOT_NX_CONTEXT* nx_context)
     // Device twin processing is done, send out property updates
     azure_iot_nx_client_publish_properties(nx_context, DEVICE_INFO_COMPONENT_NAME, append_device_info_properties);
     azure_iot_nx_client_publish_bool_property(nx_context, NULL, LED_STATE_PROPERTY, false);
-    azure_iot_nx_client_publish_int_writable_property(
-        nx_context, NULL, TELEMETRY_INTERVAL_PROPERTY, telemetry_interval);
+
+    if (!telemetry_interval_desired)
+    {
+        azure_iot_nx_client_publish_int_writable_property(
+            nx_context, NULL, TELEMETRY_INTERVAL_PROPERTY, telemetry_interval);
+    }
 
     printf("\r\nStarting Main loop\r\n");
     screen_print("Azure IoT", L0);
@@ -341,6 +203,39 @@ static void telemetry_cb(AZURE_IOT_NX_CONTEXT* nx_context)
 {
     static TELEMETRY_STATE telemetry_state = TELEMETRY_STATE_DEFAULT;
 
+    // First channel of the three published in each state
+    static const SENSOR_CHANNEL telemetry_state_channels[TELEMETRY_STATE_END] = {
+        SENSOR_CHANNEL_TEMPERATURE, SENSOR_CHANNEL_MAGNETOMETER_X, SENSOR_CHANNEL_ACCELEROMETER_X, SENSOR_CHANNEL_GYROSCOPE_X};
+
+    // Pick up the windows aggregated by the sampler, no bus access on this thread
+    sensor_registry_collect(&sensor_registry);
+
+#ifdef ENABLE_CBOR_TELEMETRY
+    switch (telemetry_state)
+    {
+        case TELEMETRY_STATE_DEFAULT:
+            azure_iot_nx_client_publish_telemetry_cbor(&azure_iot_nx_client, NULL, append_device_telemetry_cbor);
+            break;
+
+        case TELEMETRY_STATE_MAGNETOMETER:
+            azure_iot_nx_client_publish_telemetry_cbor(
+                &azure_iot_nx_client, NULL, append_device_telemetry_magnetometer_cbor);
+            break;
+
+        case TELEMETRY_STATE_ACCELEROMETER:
+            azure_iot_nx_client_publish_telemetry_cbor(
+                &azure_iot_nx_client, NULL, append_device_telemetry_accelerometer_cbor);
+            break;
+
+        case TELEMETRY_STATE_GYROSCOPE:
+            azure_iot_nx_client_publish_telemetry_cbor(
+                &azure_iot_nx_client, NULL, append_device_telemetry_gyroscope_cbor);
+            break;
+
+        default:
+            break;
+    }
+#else
     switch (telemetry_state)
     {
         case TELEMETRY_STATE_DEFAULT:
@@ -363,6 +258,10 @@ static void telemetry_cb(AZURE_IOT_NX_CONTEXT* nx_context)
             break;
     }
 
+#endif
+
+    sensor_registry_reset(&sensor_registry, telemetry_state_channels[telemetry_state], 3);
+
     telemetry_state = (telemetry_state + 1) % TELEMETRY_STATE_END;
 }
 
@@ -383,10 +282,8 @@ UINT azure_iot_nx_client_entry(
         return status;
     }
 
-    // Register the callbacks
-    azure_iot_nx_client_register_command_callback(&azure_iot_nx_client, command_received_cb);
-    azure_iot_nx_client_register_writable_property_callback(&azure_iot_nx_client, writable_property_received_cb);
-    azure_iot_nx_client_register_property_callback(&azure_iot_nx_client, property_received_cb);
+    // Register the callbacks, commands and writable properties are dispatched by the table generated from the model
+    azure_iot_nx_client_register_dispatch_table(&azure_iot_nx_client, &gsgmxchip_dispatch_table);
     azure_iot_nx_client_register_properties_complete_callback(&azure_iot_nx_client, properties_complete_cb);
     azure_iot_nx_client_register_timer_callback(&azure_iot_nx_client, telemetry_cb, telemetry_interval);
 
@@ -411,6 +308,7 @@ UINT azure_iot_nx_client_entry(
 
     // Enter the main loop
 #ifdef ENABLE_DPS
+    azure_iot_nx_client_store_set(&azure_iot_nx_client, &flash_store);
     azure_iot_nx_client_dps_run(&azure_iot_nx_client, IOT_DPS_ID_SCOPE, IOT_DPS_REGISTRATION_ID, wwd_network_connect);
 #else
     azure_iot_nx_client_hub_run(&azure_iot_nx_client, IOT_HUB_HOSTNAME, IOT_HUB_DEVICE_ID, wwd_network_connect);
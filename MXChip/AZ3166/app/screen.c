@@ -3,28 +3,243 @@
 
 #include "screen.h"
 
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "i2c_transfer.h"
+#include "sensor_sampler.h"
 #include "ssd1306.h"
 
-void screen_print(char* str, LINE_NUM line)
+#define SCREEN_THREAD_STACK_SIZE 1024
+#define SCREEN_THREAD_PRIORITY   12
+
+#define SCREEN_LINE_COUNT  4
+#define SCREEN_LINE_LENGTH (SSD1306_WIDTH / 11)
+#define SCREEN_PAGE_COUNT  (SSD1306_HEIGHT / 8)
+
+#define SCREEN_EVENT_UPDATE 1
+
+// A full page takes about 3 ms at 400 kHz
+#define SCREEN_COMMAND_TIMEOUT_MS     10
+#define SCREEN_TRANSFER_TIMEOUT_TICKS (TX_TIMER_TICKS_PER_SECOND / 10)
+
+typedef struct SCREEN_LINE_STRUCT
+{
+    CHAR text[SCREEN_LINE_LENGTH + 1];
+    bool pending;
+} SCREEN_LINE;
+
+static TX_THREAD screen_thread;
+static ULONG screen_thread_stack[SCREEN_THREAD_STACK_SIZE / sizeof(ULONG)];
+
+static TX_MUTEX screen_mutex;
+static TX_EVENT_FLAGS_GROUP screen_events;
+static bool screen_started;
+
+// Text waiting to be drawn by the display thread, guarded by screen_mutex
+static SCREEN_LINE screen_lines[SCREEN_LINE_COUNT];
+
+// What the display shows, the DMA source. ssd1306_Init leaves the display cleared.
+static uint8_t sent_frame[SSD1306_BUFFER_SIZE];
+static bool resync;
+
+static VOID draw_line(const CHAR* text, UINT line)
 {
-    ssd1306_Fill(Black);
-    ssd1306_SetCursor(2, line);
-    ssd1306_WriteString(str, Font_11x18, White);
-    ssd1306_UpdateScreen();
+    uint8_t top = line * L1;
+
+    for (uint8_t y = top; y < top + L1 && y < SSD1306_HEIGHT; y++)
+    {
+        for (uint8_t x = 0; x < SSD1306_WIDTH; x++)
+        {
+            ssd1306_DrawPixel(x, y, Black);
+        }
+    }
+
+    ssd1306_SetCursor(2, top);
+
+    for (; *text; text++)
+    {
+        if (ssd1306_WriteChar(*text, Font_11x18, White) != *text)
+        {
+            break;
+        }
+    }
 }
 
-void screen_printn(const char* str, unsigned int str_length, LINE_NUM line)
+static VOID draw_pending_lines(VOID)
 {
-    ssd1306_Fill(Black);
-    ssd1306_SetCursor(2, line);
+    SCREEN_LINE lines[SCREEN_LINE_COUNT];
+
+    // Draw from a copy, so printing never waits for the framebuffer
+    tx_mutex_get(&screen_mutex, TX_WAIT_FOREVER);
+    memcpy(lines, screen_lines, sizeof(lines));
+    for (UINT line = 0; line < SCREEN_LINE_COUNT; line++)
+    {
+        screen_lines[line].pending = false;
+    }
+    tx_mutex_put(&screen_mutex);
 
-    for (unsigned int i = 0; i < str_length; ++i)
+    for (UINT line = 0; line < SCREEN_LINE_COUNT; line++)
     {
-        if (ssd1306_WriteChar(str[i], Font_11x18, White) != str[i])
+        if (lines[line].pending)
         {
+            draw_line(lines[line].text, line);
+        }
+    }
+}
+
+static HAL_StatusTypeDef send_region(UINT page, UINT first, UINT last)
+{
+    // Column and page window of the horizontal addressing mode set up by ssd1306_Init
+    uint8_t window[] = {0x21, first, last - 1, 0x22, page, page};
+    HAL_StatusTypeDef status;
+
+    sensor_sampler_bus_lock();
+
+    if ((status = HAL_I2C_Mem_Write(&SSD1306_I2C_PORT,
+             SSD1306_I2C_ADDR,
+             0x00,
+             1,
+             window,
+             sizeof(window),
+             SCREEN_COMMAND_TIMEOUT_MS)) == HAL_OK)
+    {
+        status = i2c_transfer_write(SSD1306_I2C_ADDR,
+            0x40,
+            &sent_frame[page * SSD1306_WIDTH + first],
+            last - first,
+            SCREEN_TRANSFER_TIMEOUT_TICKS);
+    }
+    else
+    {
+        // A failed blocking command can leave the bus mid transfer, reset it before the sensors get it back.
+        // A DMA write that timed out has been reset by i2c_transfer_write already.
+        i2c_transfer_reset();
+    }
+
+    sensor_sampler_bus_unlock();
+
+    return status;
+}
+
+static VOID flush_changes(VOID)
+{
+    const uint8_t* frame = ssd1306_GetBuffer();
+    HAL_StatusTypeDef status;
+
+    for (UINT page = 0; page < SCREEN_PAGE_COUNT; page++)
+    {
+        const uint8_t* drawn = &frame[page * SSD1306_WIDTH];
+        uint8_t* sent        = &sent_frame[page * SSD1306_WIDTH];
+        UINT first           = 0;
+        UINT last            = SSD1306_WIDTH;
+
+        if (!resync)
+        {
+            while (first < SSD1306_WIDTH && drawn[first] == sent[first])
+            {
+                first++;
+            }
+
+            if (first == SSD1306_WIDTH)
+            {
+                continue;
+            }
+
+            while (drawn[last - 1] == sent[last - 1])
+            {
+                last--;
+            }
+        }
+
+        memcpy(&sent[first], &drawn[first], last - first);
+
+        if ((status = send_region(page, first, last)) != HAL_OK)
+        {
+            // The display is in an unknown state, send all of it next time
+            printf("ERROR: Display update failed (0x%02x)\r\n", status);
+            resync = true;
             return;
         }
     }
 
-    ssd1306_UpdateScreen();
-}
\ No newline at end of file
+    resync = false;
+}
+
+static VOID screen_thread_entry(ULONG parameter)
+{
+    ULONG events;
+
+    while (true)
+    {
+        draw_pending_lines();
+        flush_changes();
+
+        tx_event_flags_get(&screen_events, SCREEN_EVENT_UPDATE, TX_OR_CLEAR, &events, TX_WAIT_FOREVER);
+    }
+}
+
+UINT screen_start(VOID)
+{
+    UINT status;
+
+    if ((status = tx_mutex_create(&screen_mutex, "Screen", TX_NO_INHERIT)) ||
+        (status = tx_event_flags_create(&screen_events, "Screen")))
+    {
+        printf("ERROR: Screen sync objects create failed (0x%08x)\r\n", status);
+        return status;
+    }
+
+    screen_started = true;
+
+    if ((status = tx_thread_create(&screen_thread,
+             "Screen",
+             screen_thread_entry,
+             0,
+             screen_thread_stack,
+             SCREEN_THREAD_STACK_SIZE,
+             SCREEN_THREAD_PRIORITY,
+             SCREEN_THREAD_PRIORITY,
+             TX_NO_TIME_SLICE,
+             TX_AUTO_START)))
+    {
+        printf("ERROR: Screen thread create failed (0x%08x)\r\n", status);
+    }
+
+    return status;
+}
+
+void screen_print(char* str, LINE_NUM line)
+{
+    screen_printn(str, strlen(str), line);
+}
+
+void screen_printn(const char* str, unsigned int str_length, LINE_NUM line)
+{
+    SCREEN_LINE* screen_line = &screen_lines[line / L1];
+
+    if (str_length > SCREEN_LINE_LENGTH)
+    {
+        str_length = SCREEN_LINE_LENGTH;
+    }
+
+    if (!screen_started)
+    {
+        // Without the display thread, e.g. with the legacy client, draw and send it all right away
+        memcpy(screen_line->text, str, str_length);
+        screen_line->text[str_length] = 0;
+
+        draw_line(screen_line->text, line / L1);
+        ssd1306_UpdateScreen();
+        return;
+    }
+
+    tx_mutex_get(&screen_mutex, TX_WAIT_FOREVER);
+    memcpy(screen_line->text, str, str_length);
+    screen_line->text[str_length] = 0;
+    screen_line->pending          = true;
+    tx_mutex_put(&screen_mutex);
+
+    tx_event_flags_set(&screen_events, SCREEN_EVENT_UPDATE, TX_OR);
+}
@@ -4,6 +4,8 @@
 #ifndef _SCREEN_H
 #define _SCREEN_H
 
+#include "tx_api.h"
+
 /* Enumration for line on the screen */
 typedef enum
 {
@@ -13,7 +15,14 @@ typedef enum
     L3 = 54
 } LINE_NUM;
 
+// Start the display thread, the sensor sampler must be running as the display shares its bus
+UINT screen_start(VOID);
+
+// Replace the text of a line. Once the display thread runs this does not block on the display, the
+// latest text of each line is drawn by the thread and only the changed part of the screen is sent.
+// Printing no longer clears the screen, the other lines keep their text until they are printed
+// again, an empty string blanks a line.
 void screen_print(char* str, LINE_NUM line);
 void screen_printn(const char* str, unsigned int str_length, LINE_NUM line);
 
-#endif // _SCREEN_H
\ No newline at end of file
+#endif // _SCREEN_H
@@ -0,0 +1,155 @@
+/* Copyright (c) Microsoft Corporation.
+   Licensed under the MIT License. */
+
+#include "sensor_sampler.h"
+
+#include <stdio.h>
+
+#include "gsgmxchip_dispatch.h"
+#include "i2c_transfer.h"
+#include "sensor.h"
+
+#define SENSOR_SAMPLER_PRIORITY 8
+
+// Enough for a poll period at the highest ODR, the rest stays in the FIFO until the next poll
+#define IMU_SAMPLES_PER_READ 96
+
+// A FIFO burst of 252 bytes takes about 6 ms at 400 kHz
+#define IMU_BURST_TIMEOUT_TICKS (TX_TIMER_TICKS_PER_SECOND / 20)
+
+SENSOR_REGISTRY sensor_registry;
+
+static lsm6dsl_fifo_sample_t imu_samples[IMU_SAMPLES_PER_READ];
+
+// CBOR keys are generated from gsgmxchip-3.json with the dispatch table, readings are converted to its units
+static const SENSOR_CHANNEL_DESCRIPTOR lps22hb_channels[] = {
+    {"temperature", "degreeCelsius", "degreeCelsius", GSGMXCHIP_TEMPERATURE_CBOR_KEY},
+    {"pressure", "kilopascal", "millibar", GSGMXCHIP_PRESSURE_CBOR_KEY},
+};
+
+static const SENSOR_CHANNEL_DESCRIPTOR hts221_channels[] = {
+    {"humidity", "percent", "percent", GSGMXCHIP_HUMIDITY_CBOR_KEY},
+};
+
+static const SENSOR_CHANNEL_DESCRIPTOR lis2mdl_channels[] = {
+    {"magnetometerX", NULL, "milligauss", GSGMXCHIP_MAGNETOMETER_X_CBOR_KEY},
+    {"magnetometerY", NULL, "milligauss", GSGMXCHIP_MAGNETOMETER_Y_CBOR_KEY},
+    {"magnetometerZ", NULL, "milligauss", GSGMXCHIP_MAGNETOMETER_Z_CBOR_KEY},
+};
+
+static const SENSOR_CHANNEL_DESCRIPTOR lsm6dsl_channels[] = {
+    {"accelerometerX",
+        "gForce",
+        "milligForce",
+        GSGMXCHIP_ACCELEROMETER_X_CBOR_KEY,
+        "accelerometerXRms",
+        GSGMXCHIP_ACCELEROMETER_X_RMS_CBOR_KEY},
+    {"accelerometerY",
+        "gForce",
+        "milligForce",
+        GSGMXCHIP_ACCELEROMETER_Y_CBOR_KEY,
+        "accelerometerYRms",
+        GSGMXCHIP_ACCELEROMETER_Y_RMS_CBOR_KEY},
+    {"accelerometerZ",
+        "gForce",
+        "milligForce",
+        GSGMXCHIP_ACCELEROMETER_Z_CBOR_KEY,
+        "accelerometerZRms",
+        GSGMXCHIP_ACCELEROMETER_Z_RMS_CBOR_KEY},
+    {"gyroscopeX", "degreePerSecond", "millidegreePerSecond", GSGMXCHIP_GYROSCOPE_X_CBOR_KEY},
+    {"gyroscopeY", "degreePerSecond", "millidegreePerSecond", GSGMXCHIP_GYROSCOPE_Y_CBOR_KEY},
+    {"gyroscopeZ", "degreePerSecond", "millidegreePerSecond", GSGMXCHIP_GYROSCOPE_Z_CBOR_KEY},
+};
+
+static UINT lps22hb_read(float* values, UINT max_samples)
+{
+    lps22hb_t data = lps22hb_data_read();
+
+    values[0] = data.temperature_degC;
+    values[1] = data.pressure_hPa;
+
+    return 1;
+}
+
+static UINT hts221_read(float* values, UINT max_samples)
+{
+    values[0] = hts221_data_read().humidity_perc;
+
+    return 1;
+}
+
+static UINT lis2mdl_read(float* values, UINT max_samples)
+{
+    lis2mdl_data_t data = lis2mdl_data_read();
+
+    for (UINT axis = 0; axis < 3; axis++)
+    {
+        values[axis] = data.magnetic_mG[axis];
+    }
+
+    return 1;
+}
+
+// FIFO bursts by DMA, the sampler thread sleeps while the bus moves the data
+static int32_t lsm6dsl_burst_read(uint16_t address, uint8_t reg, uint8_t* data, uint16_t len)
+{
+    return i2c_transfer_read(address, reg, data, len, IMU_BURST_TIMEOUT_TICKS) == HAL_OK ? 0 : -1;
+}
+
+static UINT lsm6dsl_read(float* values, UINT max_samples)
+{
+    UINT count = lsm6dsl_fifo_read(imu_samples, max_samples < IMU_SAMPLES_PER_READ ? max_samples : IMU_SAMPLES_PER_READ);
+
+    for (UINT i = 0; i < count; i++)
+    {
+        for (UINT axis = 0; axis < 3; axis++)
+        {
+            values[axis]     = imu_samples[i].acceleration_mg[axis];
+            values[axis + 3] = imu_samples[i].angular_rate_mdps[axis];
+        }
+
+        values += 6;
+    }
+
+    return count;
+}
+
+// Registration order fixes the SENSOR_CHANNEL numbering
+static const SENSOR_DESCRIPTOR sensors[] = {
+    {"lps22hb", lps22hb_channels, 2, SENSOR_SAMPLER_POLL_TICKS, lps22hb_read},
+    {"hts221", hts221_channels, 1, SENSOR_SAMPLER_HUMIDITY_TICKS, hts221_read},
+    {"lis2mdl", lis2mdl_channels, 3, SENSOR_SAMPLER_POLL_TICKS, lis2mdl_read},
+    {"lsm6dsl", lsm6dsl_channels, 6, SENSOR_SAMPLER_POLL_TICKS, lsm6dsl_read},
+};
+
+UINT sensor_sampler_start(VOID)
+{
+    UINT status;
+
+    if ((status = i2c_transfer_init()) ||
+        (status = sensor_registry_init(
+             &sensor_registry, sensors, sizeof(sensors) / sizeof(sensors[0]), SENSOR_SAMPLER_WINDOW_TICKS)))
+    {
+        printf("ERROR: Sensor registry init failed (0x%08x)\r\n", status);
+        return status;
+    }
+
+    if (lsm6dsl_fifo_config(SENSOR_SAMPLER_IMU_ODR_HZ) != SENSOR_OK)
+    {
+        printf("ERROR: Accelerometer FIFO config failed\r\n");
+    }
+
+    lsm6dsl_fifo_burst_read_set(lsm6dsl_burst_read);
+
+    return sensor_registry_start(&sensor_registry, SENSOR_SAMPLER_PRIORITY);
+}
+
+VOID sensor_sampler_bus_lock(VOID)
+{
+    sensor_registry_bus_lock(&sensor_registry);
+}
+
+VOID sensor_sampler_bus_unlock(VOID)
+{
+    sensor_registry_bus_unlock(&sensor_registry);
+}
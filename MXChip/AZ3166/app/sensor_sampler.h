@@ -0,0 +1,48 @@
+/* Copyright (c) Microsoft Corporation.
+   Licensed under the MIT License. */
+
+#ifndef _SENSOR_SAMPLER_H
+#define _SENSOR_SAMPLER_H
+
+#include "tx_api.h"
+
+#include "sensor_registry.h"
+
+// Accelerometer and gyroscope rate, batched by the LSM6DSL FIFO between polls
+#define SENSOR_SAMPLER_IMU_ODR_HZ 104
+
+// The bus is polled at 10 Hz, the rate of the magnetometer and barometer. Humidity updates at 1 Hz.
+#define SENSOR_SAMPLER_POLL_TICKS     (TX_TIMER_TICKS_PER_SECOND / 10)
+#define SENSOR_SAMPLER_HUMIDITY_TICKS TX_TIMER_TICKS_PER_SECOND
+
+// Statistics are handed over to the publisher in windows of this length
+#define SENSOR_SAMPLER_WINDOW_TICKS TX_TIMER_TICKS_PER_SECOND
+
+// Registry channels, in the order the sensors are registered
+typedef enum SENSOR_CHANNEL_ENUM
+{
+    SENSOR_CHANNEL_TEMPERATURE,
+    SENSOR_CHANNEL_PRESSURE,
+    SENSOR_CHANNEL_HUMIDITY,
+    SENSOR_CHANNEL_MAGNETOMETER_X,
+    SENSOR_CHANNEL_MAGNETOMETER_Y,
+    SENSOR_CHANNEL_MAGNETOMETER_Z,
+    SENSOR_CHANNEL_ACCELEROMETER_X,
+    SENSOR_CHANNEL_ACCELEROMETER_Y,
+    SENSOR_CHANNEL_ACCELEROMETER_Z,
+    SENSOR_CHANNEL_GYROSCOPE_X,
+    SENSOR_CHANNEL_GYROSCOPE_Y,
+    SENSOR_CHANNEL_GYROSCOPE_Z,
+    SENSOR_CHANNEL_COUNT
+} SENSOR_CHANNEL;
+
+extern SENSOR_REGISTRY sensor_registry;
+
+// Start the sampling thread, the sensors must have been configured by board_init
+UINT sensor_sampler_start(VOID);
+
+// The OLED shares the I2C bus with the sensors, no-ops until the sampler is started
+VOID sensor_sampler_bus_lock(VOID);
+VOID sensor_sampler_bus_unlock(VOID);
+
+#endif // _SENSOR_SAMPLER_H
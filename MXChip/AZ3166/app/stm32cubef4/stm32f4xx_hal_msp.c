@@ -88,6 +88,25 @@ void HAL_MspInit(void)
 #define I2Cx_SDA_GPIO_PORT              GPIOB
 #define I2Cx_SCL_SDA_AF                 GPIO_AF4_I2C1
 
+/* Definition for I2Cx DMA, TX for the display updates and RX for the accelerometer FIFO bursts */
+#define I2Cx_DMA_CLK_ENABLE()           __HAL_RCC_DMA1_CLK_ENABLE()
+#define I2Cx_TX_DMA_STREAM              DMA1_Stream6
+#define I2Cx_TX_DMA_CHANNEL             DMA_CHANNEL_1
+#define I2Cx_TX_DMA_IRQn                DMA1_Stream6_IRQn
+#define I2Cx_RX_DMA_STREAM              DMA1_Stream0
+#define I2Cx_RX_DMA_CHANNEL             DMA_CHANNEL_1
+#define I2Cx_RX_DMA_IRQn                DMA1_Stream0_IRQn
+
+static DMA_HandleTypeDef hdma_tx;
+static DMA_HandleTypeDef hdma_rx;
+
+/* Definition for the console UART TX DMA, DMA2 stream 3 belongs to the WiFi SDIO */
+#define UART_TX_DMA_STREAM              DMA2_Stream6
+#define UART_TX_DMA_CHANNEL             DMA_CHANNEL_5
+#define UART_TX_DMA_IRQn                DMA2_Stream6_IRQn
+
+static DMA_HandleTypeDef hdma_uart_tx;
+
 /**
  * @brief I2C MSP Initialization
  * @param hi2c: I2C handle pointer
@@ -116,6 +135,48 @@ void HAL_I2C_MspInit(I2C_HandleTypeDef *hi2c)
   GPIO_InitStruct.Pin       = I2Cx_SDA_PIN;
   GPIO_InitStruct.Alternate = I2Cx_SCL_SDA_AF;
   HAL_GPIO_Init(I2Cx_SDA_GPIO_PORT, &GPIO_InitStruct);
+
+  /*##-3- Configure the DMA ##################################################*/
+  I2Cx_DMA_CLK_ENABLE();
+
+  hdma_tx.Instance                 = I2Cx_TX_DMA_STREAM;
+  hdma_tx.Init.Channel             = I2Cx_TX_DMA_CHANNEL;
+  hdma_tx.Init.Direction           = DMA_MEMORY_TO_PERIPH;
+  hdma_tx.Init.PeriphInc           = DMA_PINC_DISABLE;
+  hdma_tx.Init.MemInc              = DMA_MINC_ENABLE;
+  hdma_tx.Init.PeriphDataAlignment = DMA_PDATAALIGN_BYTE;
+  hdma_tx.Init.MemDataAlignment    = DMA_MDATAALIGN_BYTE;
+  hdma_tx.Init.Mode                = DMA_NORMAL;
+  hdma_tx.Init.Priority            = DMA_PRIORITY_LOW;
+  hdma_tx.Init.FIFOMode            = DMA_FIFOMODE_DISABLE;
+  HAL_DMA_Init(&hdma_tx);
+
+  __HAL_LINKDMA(hi2c, hdmatx, hdma_tx);
+
+  hdma_rx.Instance                 = I2Cx_RX_DMA_STREAM;
+  hdma_rx.Init.Channel             = I2Cx_RX_DMA_CHANNEL;
+  hdma_rx.Init.Direction           = DMA_PERIPH_TO_MEMORY;
+  hdma_rx.Init.PeriphInc           = DMA_PINC_DISABLE;
+  hdma_rx.Init.MemInc              = DMA_MINC_ENABLE;
+  hdma_rx.Init.PeriphDataAlignment = DMA_PDATAALIGN_BYTE;
+  hdma_rx.Init.MemDataAlignment    = DMA_MDATAALIGN_BYTE;
+  hdma_rx.Init.Mode                = DMA_NORMAL;
+  hdma_rx.Init.Priority            = DMA_PRIORITY_LOW;
+  hdma_rx.Init.FIFOMode            = DMA_FIFOMODE_DISABLE;
+  HAL_DMA_Init(&hdma_rx);
+
+  __HAL_LINKDMA(hi2c, hdmarx, hdma_rx);
+
+  /*##-4- Configure the NVIC #################################################*/
+  /* The blocking sensor transfers leave the I2C interrupts disabled in the peripheral */
+  HAL_NVIC_SetPriority(I2Cx_TX_DMA_IRQn, 0xE, 0);
+  HAL_NVIC_EnableIRQ(I2Cx_TX_DMA_IRQn);
+  HAL_NVIC_SetPriority(I2Cx_RX_DMA_IRQn, 0xE, 0);
+  HAL_NVIC_EnableIRQ(I2Cx_RX_DMA_IRQn);
+  HAL_NVIC_SetPriority(I2C1_EV_IRQn, 0xE, 0);
+  HAL_NVIC_EnableIRQ(I2C1_EV_IRQn);
+  HAL_NVIC_SetPriority(I2C1_ER_IRQn, 0xE, 0);
+  HAL_NVIC_EnableIRQ(I2C1_ER_IRQn);
 }
 
 /**
@@ -145,6 +206,29 @@ void HAL_UART_MspInit(UART_HandleTypeDef* huart)
     GPIO_InitStruct.Speed = GPIO_SPEED_FREQ_LOW;
     GPIO_InitStruct.Alternate = GPIO_AF8_USART6;
     HAL_GPIO_Init(GPIOA, &GPIO_InitStruct);
+
+    /* TX DMA, drains the console buffer */
+    __HAL_RCC_DMA2_CLK_ENABLE();
+
+    hdma_uart_tx.Instance                 = UART_TX_DMA_STREAM;
+    hdma_uart_tx.Init.Channel             = UART_TX_DMA_CHANNEL;
+    hdma_uart_tx.Init.Direction           = DMA_MEMORY_TO_PERIPH;
+    hdma_uart_tx.Init.PeriphInc           = DMA_PINC_DISABLE;
+    hdma_uart_tx.Init.MemInc              = DMA_MINC_ENABLE;
+    hdma_uart_tx.Init.PeriphDataAlignment = DMA_PDATAALIGN_BYTE;
+    hdma_uart_tx.Init.MemDataAlignment    = DMA_MDATAALIGN_BYTE;
+    hdma_uart_tx.Init.Mode                = DMA_NORMAL;
+    hdma_uart_tx.Init.Priority            = DMA_PRIORITY_LOW;
+    hdma_uart_tx.Init.FIFOMode            = DMA_FIFOMODE_DISABLE;
+    HAL_DMA_Init(&hdma_uart_tx);
+
+    __HAL_LINKDMA(huart, hdmatx, hdma_uart_tx);
+
+    /* The transfer completes on the UART transmission complete interrupt */
+    HAL_NVIC_SetPriority(UART_TX_DMA_IRQn, 0xF, 0);
+    HAL_NVIC_EnableIRQ(UART_TX_DMA_IRQn);
+    HAL_NVIC_SetPriority(USART6_IRQn, 0xF, 0);
+    HAL_NVIC_EnableIRQ(USART6_IRQn);
   }
 }
 
@@ -69,6 +69,11 @@ SSD1306_Error_t ssd1306_FillBuffer(uint8_t* buf, uint32_t len) {
     return ret;
 }
 
+/* Gives access to the Screenbuffer, e.g. to send changed regions only */
+uint8_t* ssd1306_GetBuffer(void) {
+    return SSD1306_Buffer;
+}
+
 // Initialize the oled screen
 void ssd1306_Init(void) {
     // Reset OLED
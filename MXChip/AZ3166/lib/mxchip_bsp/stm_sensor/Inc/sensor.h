@@ -1,6 +1,8 @@
 #ifndef SENSOR_H
 #define SENSOR_H
 
+#include <stdint.h>
+
 typedef enum 
 {
   SENSOR_OK = 0,
@@ -35,6 +37,21 @@ typedef struct {
 Sensor_StatusTypeDef lsm6dsl_config(void);
 lsm6dsl_data_t lsm6dsl_data_read(void);
 
+typedef struct {
+  float acceleration_mg[3];
+  float angular_rate_mdps[3];
+} lsm6dsl_fifo_sample_t;
+
+/* Batch accelerometer and gyroscope into the FIFO at the ODR closest to odr_hz (12 to 833 Hz) */
+Sensor_StatusTypeDef lsm6dsl_fifo_config(uint16_t odr_hz);
+/* Drain up to max_samples samples from the FIFO with burst reads, returns the number read */
+uint16_t lsm6dsl_fifo_read(lsm6dsl_fifo_sample_t* samples, uint16_t max_samples);
+
+/* Reads len bytes from register reg of the device at the 8 bit I2C address, 0 on success */
+typedef int32_t (*sensor_burst_read_t)(uint16_t address, uint8_t reg, uint8_t* data, uint16_t len);
+/* Route the FIFO bursts through read, e.g. a DMA transfer, NULL goes back to blocking reads */
+void lsm6dsl_fifo_burst_read_set(sensor_burst_read_t read);
+
 typedef struct {
   float magnetic_mG[3];
   float temperature_degC;
@@ -192,3 +192,111 @@ lsm6dsl_data_t reading= {0};
 
 }
 
+
+/* FIFO ------------------------------------------------------------------------*/
+
+/* Each FIFO pattern is one gyroscope then one accelerometer sample of three 16 bit words */
+#define FIFO_PATTERN_WORDS   6
+#define FIFO_PATTERN_BYTES   (FIFO_PATTERN_WORDS * sizeof(int16_t))
+/* fifo_raw_data_get reads at most 255 bytes at a time */
+#define FIFO_BURST_PATTERNS  (255 / FIFO_PATTERN_BYTES)
+
+static uint8_t fifo_burst[FIFO_BURST_PATTERNS * FIFO_PATTERN_BYTES];
+static sensor_burst_read_t fifo_burst_read;
+
+void lsm6dsl_fifo_burst_read_set(sensor_burst_read_t read)
+{
+  fifo_burst_read = read;
+}
+
+/* The data registers roll back to FIFO_DATA_OUT_L, so a burst of any length is one register read */
+static int32_t fifo_burst_get(uint16_t len)
+{
+  if (fifo_burst_read != NULL)
+  {
+    return fifo_burst_read(LSM6DSL_I2C_ADD_L, LSM6DSL_FIFO_DATA_OUT_L, fifo_burst, len);
+  }
+
+  return lsm6dsl_fifo_raw_data_get(&dev_ctx, fifo_burst, len);
+}
+
+Sensor_StatusTypeDef lsm6dsl_fifo_config(uint16_t odr_hz)
+{
+  static const uint16_t odr_table[] = {12, 26, 52, 104, 208, 416, 833};
+  uint8_t odr = 0;
+
+  while (odr < sizeof(odr_table) / sizeof(odr_table[0]) - 1 && odr_table[odr] < odr_hz)
+  {
+    odr++;
+  }
+
+  /* The sensor, FIFO and ODR enums share their encoding from 12.5 Hz up */
+  lsm6dsl_fifo_mode_set(&dev_ctx, LSM6DSL_BYPASS_MODE);
+  lsm6dsl_xl_data_rate_set(&dev_ctx, (lsm6dsl_odr_xl_t)(LSM6DSL_XL_ODR_12Hz5 + odr));
+  lsm6dsl_gy_data_rate_set(&dev_ctx, (lsm6dsl_odr_g_t)(LSM6DSL_GY_ODR_12Hz5 + odr));
+  lsm6dsl_fifo_gy_batch_set(&dev_ctx, LSM6DSL_FIFO_GY_NO_DEC);
+  lsm6dsl_fifo_xl_batch_set(&dev_ctx, LSM6DSL_FIFO_XL_NO_DEC);
+  lsm6dsl_fifo_data_rate_set(&dev_ctx, (lsm6dsl_odr_fifo_t)(LSM6DSL_FIFO_12Hz5 + odr));
+
+  if (lsm6dsl_fifo_mode_set(&dev_ctx, LSM6DSL_STREAM_MODE) != 0)
+  {
+    return SENSOR_ERROR;
+  }
+
+  return SENSOR_OK;
+}
+
+uint16_t lsm6dsl_fifo_read(lsm6dsl_fifo_sample_t* samples, uint16_t max_samples)
+{
+  uint16_t words = 0;
+  uint16_t pattern = 0;
+  uint16_t count = 0;
+
+  lsm6dsl_fifo_data_level_get(&dev_ctx, &words);
+  lsm6dsl_fifo_pattern_get(&dev_ctx, &pattern);
+
+  /* Skip to the start of the next pattern so the axes stay aligned */
+  while (pattern != 0 && words > 0)
+  {
+    lsm6dsl_fifo_raw_data_get(&dev_ctx, fifo_burst, sizeof(int16_t));
+    pattern = (pattern + 1) % FIFO_PATTERN_WORDS;
+    words--;
+  }
+
+  while (words >= FIFO_PATTERN_WORDS && count < max_samples)
+  {
+    uint16_t patterns = words / FIFO_PATTERN_WORDS;
+
+    if (patterns > FIFO_BURST_PATTERNS)
+    {
+      patterns = FIFO_BURST_PATTERNS;
+    }
+    if (patterns > max_samples - count)
+    {
+      patterns = max_samples - count;
+    }
+
+    /* Whatever the failed burst took out of the FIFO is lost, the next poll realigns on the pattern */
+    if (fifo_burst_get(patterns * FIFO_PATTERN_BYTES) != 0)
+    {
+      break;
+    }
+
+    for (uint16_t i = 0; i < patterns; i++)
+    {
+      int16_t raw[FIFO_PATTERN_WORDS];
+      lsm6dsl_fifo_sample_t* sample = &samples[count++];
+
+      memcpy(raw, &fifo_burst[i * FIFO_PATTERN_BYTES], FIFO_PATTERN_BYTES);
+      for (uint8_t axis = 0; axis < 3; axis++)
+      {
+        sample->angular_rate_mdps[axis] = lsm6dsl_from_fs2000dps_to_mdps(raw[axis]);
+        sample->acceleration_mg[axis] = lsm6dsl_from_fs2g_to_mg(raw[3 + axis]);
+      }
+    }
+
+    words -= patterns * FIFO_PATTERN_WORDS;
+  }
+
+  return count;
+}
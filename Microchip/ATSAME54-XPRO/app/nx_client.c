@@ -15,10 +15,12 @@
 
 #include "azure_iot_nx_client.h"
 #include "networking.h"
+#include "sensor_registry.h"
 
 #include "azure_config.h"
 #include "azure_device_x509_cert_config.h"
 #include "azure_pnp_info.h"
+#include "gsg_dispatch.h"
 
 #define IOT_MODEL_ID "dtmi:azurertos:devkit:gsgmicrochipsame54;1"
 
@@ -27,11 +29,14 @@
 #define TELEMETRY_HUMIDITY          "humidity"
 #define TELEMETRY_INTERVAL_PROPERTY "telemetryInterval"
 #define LED_STATE_PROPERTY          "ledState"
-#define SET_LED_STATE_COMMAND       "setLedState"
 
 static AZURE_IOT_NX_CONTEXT azure_iot_nx_client;
 
 static int32_t telemetry_interval = 10;
+static bool telemetry_interval_desired;
+
+// Sampled on the telemetry timer, a window covers one reading
+static SENSOR_REGISTRY sensor_registry;
 
 static UINT append_device_info_properties(NX_AZURE_IOT_JSON_WRITER* json_writer)
 {
@@ -82,7 +87,7 @@ static UINT append_device_info_properties(NX_AZURE_IOT_JSON_WRITER* json_writer)
     return NX_AZURE_IOT_SUCCESS;
 }
 
-static UINT append_device_telemetry(NX_AZURE_IOT_JSON_WRITER* json_writer)
+static UINT bme280_read(float* values, UINT max_samples)
 {
     struct bme280_data data;
 
@@ -90,6 +95,7 @@ static UINT append_device_telemetry(NX_AZURE_IOT_JSON_WRITER* json_writer)
     if (read_bme280(&data) != BME280_OK)
     {
         printf("FAILED to read weather click sensor\r\n");
+        return 0;
     }
 #else
     printf("Generating fake sensor data\r\n");
@@ -98,19 +104,26 @@ static UINT append_device_telemetry(NX_AZURE_IOT_JSON_WRITER* json_writer)
     data.humidity    = 78.2;
 #endif
 
-    if (nx_azure_iot_json_writer_append_property_with_double_value(
-            json_writer, (UCHAR*)TELEMETRY_HUMIDITY, sizeof(TELEMETRY_HUMIDITY) - 1, data.humidity, 2) ||
+    values[0] = data.humidity;
+    values[1] = data.temperature;
+    values[2] = data.pressure;
 
-        nx_azure_iot_json_writer_append_property_with_double_value(
-            json_writer, (UCHAR*)TELEMETRY_TEMPERATURE, sizeof(TELEMETRY_TEMPERATURE) - 1, data.temperature, 2) ||
+    return 1;
+}
 
-        nx_azure_iot_json_writer_append_property_with_double_value(
-            json_writer, (UCHAR*)TELEMETRY_PRESSURE, sizeof(TELEMETRY_PRESSURE) - 1, data.pressure, 2))
-    {
-        return NX_NOT_SUCCESSFUL;
-    }
+static const SENSOR_CHANNEL_DESCRIPTOR bme280_channels[] = {
+    {TELEMETRY_HUMIDITY, "percent", "percent", 0},
+    {TELEMETRY_TEMPERATURE, "degreeCelsius", "degreeCelsius", 1},
+    {TELEMETRY_PRESSURE, "pascal", "pascal", 2},
+};
 
-    return NX_AZURE_IOT_SUCCESS;
+static const SENSOR_DESCRIPTOR sensors[] = {
+    {"bme280", bme280_channels, 3, 0, bme280_read},
+};
+
+static UINT append_device_telemetry(NX_AZURE_IOT_JSON_WRITER* json_writer)
+{
+    return sensor_registry_append_json(&sensor_registry, json_writer, 0, sensor_registry.channel_count);
 }
 
 static void set_led_state(bool level)
@@ -129,90 +142,30 @@ static void set_led_state(bool level)
     gpio_set_pin_level(PC18, !level);
 }
 
-static void command_received_cb(AZURE_IOT_NX_CONTEXT* nx_context_ptr,
-    const UCHAR* component,
-    USHORT component_length,
-    const UCHAR* method,
-    USHORT method_length,
-    UCHAR* payload,
-    USHORT payload_length,
-    VOID* context_ptr,
-    USHORT context_length)
+UINT gsg_set_led_state_command(AZURE_IOT_NX_CONTEXT* nx_context, bool value)
 {
-    UINT status;
-
-    if (strncmp((CHAR*)method, SET_LED_STATE_COMMAND, method_length) == 0)
-    {
-        bool arg = (strncmp((CHAR*)payload, "true", payload_length) == 0);
-        set_led_state(arg);
-
-        if ((status = nx_azure_iot_hub_client_command_message_response(
-                 &nx_context_ptr->iothub_client, 200, context_ptr, context_length, NULL, 0, NX_WAIT_FOREVER)))
-        {
-            printf("Direct method response failed! (0x%08x)\r\n", status);
-            return;
-        }
+    set_led_state(value);
+    azure_iot_nx_client_publish_bool_property(nx_context, NULL, LED_STATE_PROPERTY, value);
 
-        azure_iot_nx_client_publish_bool_property(&azure_iot_nx_client, NULL, LED_STATE_PROPERTY, arg);
-    }
-    else
-    {
-        printf("Direct method is not for this device\r\n");
-
-        if ((status = nx_azure_iot_hub_client_command_message_response(
-                 &nx_context_ptr->iothub_client, 501, context_ptr, context_length, NULL, 0, NX_WAIT_FOREVER)))
-        {
-            printf("Direct method response failed! (0x%08x)\r\n", status);
-            return;
-        }
-    }
+    return 200;
 }
 
-static void writable_property_received_cb(AZURE_IOT_NX_CONTEXT* nx_context,
-    const UCHAR* component_name,
-    UINT component_name_len,
-    UCHAR* property_name,
-    UINT property_name_len,
-    NX_AZURE_IOT_JSON_READER* json_reader_ptr,
-    UINT version)
+UINT gsg_telemetry_interval_set(AZURE_IOT_NX_CONTEXT* nx_context, int32_t value)
 {
-    UINT status;
+    // Answered here with the twin version, properties_complete_cb only reports the default when there was none
+    telemetry_interval_desired = true;
 
-    if (strncmp((CHAR*)property_name, TELEMETRY_INTERVAL_PROPERTY, property_name_len) == 0)
+    if (value < 1)
     {
-        status = nx_azure_iot_json_reader_token_int32_get(json_reader_ptr, &telemetry_interval);
-        if (status == NX_AZURE_IOT_SUCCESS)
-        {
-            printf("Updating %s to %ld\r\n", TELEMETRY_INTERVAL_PROPERTY, telemetry_interval);
-
-            // Confirm reception back to hub
-            azure_nx_client_respond_int_writable_property(
-                nx_context, NULL, TELEMETRY_INTERVAL_PROPERTY, telemetry_interval, 200, version);
-
-            azure_nx_client_periodic_interval_set(nx_context, telemetry_interval);
-        }
+        printf("Rejecting %s of %ld\r\n", TELEMETRY_INTERVAL_PROPERTY, value);
+        return 400;
     }
-}
 
-static void property_received_cb(AZURE_IOT_NX_CONTEXT* nx_context,
-    const UCHAR* component_name,
-    UINT component_name_len,
-    UCHAR* property_name,
-    UINT property_name_len,
-    NX_AZURE_IOT_JSON_READER* json_reader_ptr,
-    UINT version)
-{
-    UINT status;
+    printf("Updating %s to %ld\r\n", TELEMETRY_INTERVAL_PROPERTY, value);
+    telemetry_interval = value;
+    azure_nx_client_periodic_interval_set(nx_context, telemetry_interval);
 
-    if (strncmp((CHAR*)property_name, TELEMETRY_INTERVAL_PROPERTY, property_name_len) == 0)
-    {
-        status = nx_azure_iot_json_reader_token_int32_get(json_reader_ptr, &telemetry_interval);
-        if (status == NX_AZURE_IOT_SUCCESS)
-        {
-            printf("Updating %s to %ld\r\n", TELEMETRY_INTERVAL_PROPERTY, telemetry_interval);
-            azure_nx_client_periodic_interval_set(nx_context, telemetry_interval);
-        }
-    }
+    return 200;
 }
 
 static void properties_complete_cb(AZURE_IOT_NX_CONTEXT* nx_context)
@@ -220,16 +173,25 @@ static void properties_complete_cb(AZURE_IOT_NX_CONTEXT* nx_context)
     // Device twin processing is done, send out property updates
     azure_iot_nx_client_publish_properties(nx_context, DEVICE_INFO_COMPONENT_NAME, append_device_info_properties);
     azure_iot_nx_client_publish_bool_property(nx_context, NULL, LED_STATE_PROPERTY, false);
-    azure_iot_nx_client_publish_int_writable_property(
-        nx_context, NULL, TELEMETRY_INTERVAL_PROPERTY, telemetry_interval);
+
+    if (!telemetry_interval_desired)
+    {
+        azure_iot_nx_client_publish_int_writable_property(
+            nx_context, NULL, TELEMETRY_INTERVAL_PROPERTY, telemetry_interval);
+    }
 
     printf("\r\nStarting Main loop\r\n");
 }
 
 static void telemetry_cb(AZURE_IOT_NX_CONTEXT* nx_context)
 {
+    sensor_registry_sample(&sensor_registry);
+    sensor_registry_collect(&sensor_registry);
+
     // Send out telemetry
     azure_iot_nx_client_publish_telemetry(nx_context, NULL, append_device_telemetry);
+
+    sensor_registry_reset(&sensor_registry, 0, sensor_registry.channel_count);
 }
 
 UINT azure_iot_nx_client_entry(
@@ -237,6 +199,12 @@ UINT azure_iot_nx_client_entry(
 {
     UINT status;
 
+    if ((status = sensor_registry_init(&sensor_registry, sensors, sizeof(sensors) / sizeof(sensors[0]), 0)))
+    {
+        printf("ERROR: sensor_registry_init failed (0x%08x)\r\n", status);
+        return status;
+    }
+
     if ((status = azure_iot_nx_client_create(&azure_iot_nx_client,
              ip_ptr,
              pool_ptr,
@@ -249,10 +217,8 @@ UINT azure_iot_nx_client_entry(
         return status;
     }
 
-    // Register the callbacks
-    azure_iot_nx_client_register_command_callback(&azure_iot_nx_client, command_received_cb);
-    azure_iot_nx_client_register_writable_property_callback(&azure_iot_nx_client, writable_property_received_cb);
-    azure_iot_nx_client_register_property_callback(&azure_iot_nx_client, property_received_cb);
+    // Register the callbacks, commands and writable properties are dispatched by the table generated from the model
+    azure_iot_nx_client_register_dispatch_table(&azure_iot_nx_client, &gsg_dispatch_table);
     azure_iot_nx_client_register_properties_complete_callback(&azure_iot_nx_client, properties_complete_cb);
     azure_iot_nx_client_register_timer_callback(&azure_iot_nx_client, telemetry_cb, telemetry_interval);
 
@@ -6,8 +6,8 @@
 #include <stdio.h>
 
 #include "azure_iot_mqtt.h"
-#include "json_utils.h"
 #include "sntp_client.h"
+#include "twin_parser.h"
 
 #include "azure_config.h"
 
@@ -32,6 +32,13 @@ static TX_EVENT_FLAGS_GROUP azure_iot_flags;
 
 static INT telemetry_interval = 10;
 
+// Writeable properties picked out of twin documents, bit n of the parser masks is entry n
+#define TWIN_PROPERTY_TELEMETRY_INTERVAL (1 << 0)
+#define TWIN_PROPERTY_COUNT              1
+
+static const TWIN_PROPERTY twin_properties[TWIN_PROPERTY_COUNT] = {
+    {TELEMETRY_INTERVAL_PROPERTY, TWIN_PROPERTY_INT, &telemetry_interval, sizeof(telemetry_interval)}};
+
 static void set_led_state(bool level)
 {
     if (level)
@@ -52,15 +59,18 @@ static void set_led_state(bool level)
     }
 }
 
-static void mqtt_direct_method(AZURE_IOT_MQTT* iot_mqtt, CHAR* direct_method_name, CHAR* message)
+static void mqtt_direct_method(AZURE_IOT_MQTT* iot_mqtt, CHAR* direct_method_name, AZURE_IOT_MQTT_PAYLOAD message)
 {
+    CHAR arg_buffer[sizeof("true")];
+
     if (strcmp(direct_method_name, "setLedState") == 0)
     {
         printf("Direct method=%s invoked\r\n", direct_method_name);
 
         // 'false' - turn LED off
         // 'true'  - turn LED on
-        bool arg = (strcmp(message, "true") == 0);
+        bool arg = azure_iot_mqtt_payload_copy(message, arg_buffer, sizeof(arg_buffer)) == 4 &&
+                   strcmp(arg_buffer, "true") == 0;
 
         set_led_state(arg);
 
@@ -77,21 +87,27 @@ static void mqtt_direct_method(AZURE_IOT_MQTT* iot_mqtt, CHAR* direct_method_nam
     }
 }
 
-static void mqtt_c2d_message(AZURE_IOT_MQTT* iot_mqtt, CHAR* properties, CHAR* message)
+static void mqtt_c2d_message(AZURE_IOT_MQTT* iot_mqtt, CHAR* properties, AZURE_IOT_MQTT_PAYLOAD message)
 {
-    printf("Received C2D message, properties='%s', message='%s'\r\n", properties, message);
+    AZURE_IOT_MQTT_SEGMENT segment = {0};
+
+    printf("Received C2D message, properties='%s', message='", properties);
+
+    // A message chained across packets is printed a packet at a time
+    while (azure_iot_mqtt_payload_segment_next(message, &segment))
+    {
+        printf("%.*s", (int)segment.length, segment.data);
+    }
+
+    printf("'\r\n");
 }
 
-static void mqtt_device_twin_desired_prop(AZURE_IOT_MQTT* iot_mqtt, CHAR* message)
+static void mqtt_device_twin_desired_prop(AZURE_IOT_MQTT* iot_mqtt, AZURE_IOT_MQTT_PAYLOAD message)
 {
-    jsmn_parser parser;
-    jsmntok_t tokens[64];
-    INT token_count;
+    UINT found;
 
-    jsmn_init(&parser);
-    token_count = jsmn_parse(&parser, message, strlen(message), tokens, 64);
-
-    if (findJsonInt(message, tokens, token_count, TELEMETRY_INTERVAL_PROPERTY, &telemetry_interval))
+    if (azure_iot_mqtt_twin_parse(message, NULL, twin_properties, TWIN_PROPERTY_COUNT, &found, NULL) &&
+        (found & TWIN_PROPERTY_TELEMETRY_INTERVAL))
     {
         // Set a telemetry event so we pick up the change immediately
         tx_event_flags_set(&azure_iot_flags, TELEMETRY_INTERVAL_EVENT, TX_OR);
@@ -101,16 +117,13 @@ static void mqtt_device_twin_desired_prop(AZURE_IOT_MQTT* iot_mqtt, CHAR* messag
     }
 }
 
-static void mqtt_device_twin_prop(AZURE_IOT_MQTT* iot_mqtt, CHAR* message)
+static void mqtt_device_twin_prop(AZURE_IOT_MQTT* iot_mqtt, AZURE_IOT_MQTT_PAYLOAD message)
 {
-    jsmn_parser parser;
-    jsmntok_t tokens[64];
-    INT token_count;
-
-    jsmn_init(&parser);
-    token_count = jsmn_parse(&parser, message, strlen(message), tokens, 64);
+    UINT changed;
 
-    if (findJsonInt(message, tokens, token_count, TELEMETRY_INTERVAL_PROPERTY, &telemetry_interval))
+    // Only desired values apply, the reported section echoes what the device sent last time
+    if (azure_iot_mqtt_twin_parse(message, "desired", twin_properties, TWIN_PROPERTY_COUNT, NULL, &changed) &&
+        (changed & TWIN_PROPERTY_TELEMETRY_INTERVAL))
     {
         // Set a telemetry event so we pick up the change immediately
         tx_event_flags_set(&azure_iot_flags, TELEMETRY_INTERVAL_EVENT, TX_OR);
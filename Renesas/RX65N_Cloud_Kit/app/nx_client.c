@@ -14,10 +14,12 @@
 #include "nx_azure_iot_provisioning_client.h"
 
 #include "azure_iot_nx_client.h"
+#include "sensor_registry.h"
 
 #include "azure_config.h"
 #include "azure_device_x509_cert_config.h"
 #include "azure_pnp_info.h"
+#include "gsgrx65ncloud_dispatch.h"
 #include "rx_networking.h"
 
 #define IOT_MODEL_ID "dtmi:azurertos:devkit:gsgrx65ncloud;1"
@@ -36,7 +38,10 @@
 #define TELEMETRY_LIGHT             "illuminance"
 #define TELEMETRY_INTERVAL_PROPERTY "telemetryInterval"
 #define LED_STATE_PROPERTY          "ledState"
-#define SET_LED_STATE_COMMAND       "setLedState"
+
+// Scale of the raw BMI160 readings at the ranges set by init_bmi160, 4 g and 2000 dps
+#define BMI160_ACCEL_LSB_PER_G  8192.0f
+#define BMI160_GYRO_LSB_PER_DPS 16.4f
 
 typedef enum TELEMETRY_STATE_ENUM
 {
@@ -47,6 +52,37 @@ typedef enum TELEMETRY_STATE_ENUM
     TELEMETRY_STATE_END
 } TELEMETRY_STATE;
 
+// Registry channels, in the order the sensors are registered
+typedef enum SENSOR_CHANNEL_ENUM
+{
+    SENSOR_CHANNEL_TEMPERATURE,
+    SENSOR_CHANNEL_HUMIDITY,
+    SENSOR_CHANNEL_PRESSURE,
+    SENSOR_CHANNEL_GAS_RESISTANCE,
+    SENSOR_CHANNEL_ACCELEROMETER_X,
+    SENSOR_CHANNEL_ACCELEROMETER_Y,
+    SENSOR_CHANNEL_ACCELEROMETER_Z,
+    SENSOR_CHANNEL_GYROSCOPE_X,
+    SENSOR_CHANNEL_GYROSCOPE_Y,
+    SENSOR_CHANNEL_GYROSCOPE_Z,
+    SENSOR_CHANNEL_ILLUMINANCE,
+    SENSOR_CHANNEL_COUNT
+} SENSOR_CHANNEL;
+
+// Channels published in each state
+typedef struct TELEMETRY_GROUP_STRUCT
+{
+    SENSOR_CHANNEL first;
+    UINT count;
+} TELEMETRY_GROUP;
+
+static const TELEMETRY_GROUP telemetry_groups[TELEMETRY_STATE_END] = {
+    {SENSOR_CHANNEL_TEMPERATURE, 4},
+    {SENSOR_CHANNEL_ACCELEROMETER_X, 3},
+    {SENSOR_CHANNEL_GYROSCOPE_X, 3},
+    {SENSOR_CHANNEL_ILLUMINANCE, 1},
+};
+
 #define LED_ON  0
 #define LED_OFF 1
 #define LED0    PORTB.PODR.BIT.B0
@@ -55,6 +91,13 @@ typedef enum TELEMETRY_STATE_ENUM
 static AZURE_IOT_NX_CONTEXT azure_iot_nx_client;
 
 static int32_t telemetry_interval = 10;
+static bool telemetry_interval_desired;
+
+// Sampled on every telemetry timer, each group is sent as the mean since it was last sent
+static SENSOR_REGISTRY sensor_registry;
+
+// Group of the current telemetry state, for append_device_telemetry
+static const TELEMETRY_GROUP* telemetry_group = &telemetry_groups[TELEMETRY_STATE_DEFAULT];
 
 static UINT append_device_info_properties(NX_AZURE_IOT_JSON_WRITER* json_writer)
 {
@@ -105,85 +148,91 @@ static UINT append_device_info_properties(NX_AZURE_IOT_JSON_WRITER* json_writer)
     return NX_AZURE_IOT_SUCCESS;
 }
 
-static UINT append_device_telemetry(NX_AZURE_IOT_JSON_WRITER* json_writer)
+static UINT bme680_read(float* values, UINT max_samples)
 {
     struct bme68x_data data;
-    read_bme680(&data);
 
-    if (nx_azure_iot_json_writer_append_property_with_double_value(
-            json_writer, (UCHAR*)TELEMETRY_HUMIDITY, sizeof(TELEMETRY_HUMIDITY) - 1, data.humidity, 2) ||
-
-        nx_azure_iot_json_writer_append_property_with_double_value(
-            json_writer, (UCHAR*)TELEMETRY_TEMPERATURE, sizeof(TELEMETRY_TEMPERATURE) - 1, data.temperature, 2) ||
-
-        nx_azure_iot_json_writer_append_property_with_double_value(
-            json_writer, (UCHAR*)TELEMETRY_PRESSURE, sizeof(TELEMETRY_PRESSURE) - 1, data.pressure, 2) ||
-
-        nx_azure_iot_json_writer_append_property_with_double_value(json_writer,
-            (UCHAR*)TELEMETRY_GAS_RESISTANCE,
-            sizeof(TELEMETRY_GAS_RESISTANCE) - 1,
-            data.gas_resistance,
-            2))
+    if (read_bme680(&data) != BME68X_OK)
     {
-        return NX_NOT_SUCCESSFUL;
+        printf("ERROR: read_bme680\r\n");
+        return 0;
     }
 
-    return NX_AZURE_IOT_SUCCESS;
+    values[0] = data.temperature;
+    values[1] = data.humidity;
+    values[2] = data.pressure;
+    values[3] = data.gas_resistance;
+
+    return 1;
 }
 
-static UINT append_device_accelerometer(NX_AZURE_IOT_JSON_WRITER* json_writer)
+static UINT bmi160_read(float* values, UINT max_samples)
 {
-    struct bmi160_sensor_data data;
-    read_bmi160_accel(&data);
+    struct bmi160_sensor_data acceleration;
+    struct bmi160_sensor_data angular_rate;
 
-    if (nx_azure_iot_json_writer_append_property_with_int32_value(
-            json_writer, (UCHAR*)TELEMETRY_ACCELEROMETERX, sizeof(TELEMETRY_ACCELEROMETERX) - 1, data.x) ||
-
-        nx_azure_iot_json_writer_append_property_with_int32_value(
-            json_writer, (UCHAR*)TELEMETRY_ACCELEROMETERY, sizeof(TELEMETRY_ACCELEROMETERY) - 1, data.y) ||
-
-        nx_azure_iot_json_writer_append_property_with_int32_value(
-            json_writer, (UCHAR*)TELEMETRY_ACCELEROMETERZ, sizeof(TELEMETRY_ACCELEROMETERZ) - 1, data.z))
+    if (read_bmi160_accel(&acceleration) != BMI160_OK || read_bmi160_gyro(&angular_rate) != BMI160_OK)
     {
-        return NX_NOT_SUCCESSFUL;
+        printf("ERROR: read_bmi160\r\n");
+        return 0;
     }
 
-    return NX_AZURE_IOT_SUCCESS;
+    values[0] = acceleration.x / BMI160_ACCEL_LSB_PER_G;
+    values[1] = acceleration.y / BMI160_ACCEL_LSB_PER_G;
+    values[2] = acceleration.z / BMI160_ACCEL_LSB_PER_G;
+    values[3] = angular_rate.x / BMI160_GYRO_LSB_PER_DPS;
+    values[4] = angular_rate.y / BMI160_GYRO_LSB_PER_DPS;
+    values[5] = angular_rate.z / BMI160_GYRO_LSB_PER_DPS;
+
+    return 1;
 }
 
-static UINT append_device_gyroscope(NX_AZURE_IOT_JSON_WRITER* json_writer)
+static UINT isl29035_read(float* values, UINT max_samples)
 {
-    struct bmi160_sensor_data data;
-    read_bmi160_gyro(&data);
-
-    if (nx_azure_iot_json_writer_append_property_with_int32_value(
-            json_writer, (UCHAR*)TELEMETRY_GYROSCOPEX, sizeof(TELEMETRY_GYROSCOPEX) - 1, data.x) ||
-
-        nx_azure_iot_json_writer_append_property_with_int32_value(
-            json_writer, (UCHAR*)TELEMETRY_GYROSCOPEY, sizeof(TELEMETRY_GYROSCOPEY) - 1, data.y) ||
+    double als;
 
-        nx_azure_iot_json_writer_append_property_with_int32_value(
-            json_writer, (UCHAR*)TELEMETRY_GYROSCOPEZ, sizeof(TELEMETRY_GYROSCOPEZ) - 1, data.z))
+    if (read_isl29035(&als) != ISL29035_OK)
     {
-        return NX_NOT_SUCCESSFUL;
+        printf("ERROR: read_isl29035\r\n");
+        return 0;
     }
 
-    return NX_AZURE_IOT_SUCCESS;
-}
-
-static UINT append_device_light(NX_AZURE_IOT_JSON_WRITER* json_writer)
-{
-    double als;
+    values[0] = als;
 
-    read_isl29035(&als);
+    return 1;
+}
 
-    if (nx_azure_iot_json_writer_append_property_with_double_value(
-            json_writer, (UCHAR*)TELEMETRY_LIGHT, sizeof(TELEMETRY_LIGHT) - 1, als, 2))
-    {
-        return NX_NOT_SUCCESSFUL;
-    }
+// CBOR keys follow the telemetry order of gsgrx65ncloud-1.json, the readings are converted to its units
+static const SENSOR_CHANNEL_DESCRIPTOR bme680_channels[] = {
+    {TELEMETRY_TEMPERATURE, "degreeCelsius", "degreeCelsius", 0},
+    {TELEMETRY_HUMIDITY, "percent", "percent", 1},
+    {TELEMETRY_PRESSURE, "kilopascal", "pascal", 2},
+    // Not in the model, sent in the ohm of the driver with the next free key
+    {TELEMETRY_GAS_RESISTANCE, NULL, NULL, 10},
+};
+
+static const SENSOR_CHANNEL_DESCRIPTOR bmi160_channels[] = {
+    {TELEMETRY_ACCELEROMETERX, "gForce", "gForce", 4},
+    {TELEMETRY_ACCELEROMETERY, "gForce", "gForce", 5},
+    {TELEMETRY_ACCELEROMETERZ, "gForce", "gForce", 6},
+    {TELEMETRY_GYROSCOPEX, "degreePerSecond", "degreePerSecond", 7},
+    {TELEMETRY_GYROSCOPEY, "degreePerSecond", "degreePerSecond", 8},
+    {TELEMETRY_GYROSCOPEZ, "degreePerSecond", "degreePerSecond", 9},
+};
+
+static const SENSOR_CHANNEL_DESCRIPTOR isl29035_channels[] = {
+    {TELEMETRY_LIGHT, "lux", "lux", 3},
+};
+
+static const SENSOR_DESCRIPTOR sensors[] = {
+    {"bme680", bme680_channels, 4, 0, bme680_read},
+    {"bmi160", bmi160_channels, 6, 0, bmi160_read},
+    {"isl29035", isl29035_channels, 1, 0, isl29035_read},
+};
 
-    return NX_AZURE_IOT_SUCCESS;
+static UINT append_device_telemetry(NX_AZURE_IOT_JSON_WRITER* json_writer)
+{
+    return sensor_registry_append_json(&sensor_registry, json_writer, telemetry_group->first, telemetry_group->count);
 }
 
 static void set_led_state(bool level)
@@ -202,90 +251,30 @@ static void set_led_state(bool level)
     }
 }
 
-static void command_received_cb(AZURE_IOT_NX_CONTEXT* nx_context_ptr,
-    const UCHAR* component,
-    USHORT component_length,
-    const UCHAR* method,
-    USHORT method_length,
-    UCHAR* payload,
-    USHORT payload_length,
-    VOID* context_ptr,
-    USHORT context_length)
+UINT gsgrx65ncloud_set_led_state_command(AZURE_IOT_NX_CONTEXT* nx_context, bool value)
 {
-    UINT status;
-
-    if (strncmp((CHAR*)method, SET_LED_STATE_COMMAND, method_length) == 0)
-    {
-        bool arg = (strncmp((CHAR*)payload, "true", payload_length) == 0);
-        set_led_state(arg);
+    set_led_state(value);
+    azure_iot_nx_client_publish_bool_property(nx_context, NULL, LED_STATE_PROPERTY, value);
 
-        if ((status = nx_azure_iot_hub_client_command_message_response(
-                 &nx_context_ptr->iothub_client, 200, context_ptr, context_length, NULL, 0, NX_WAIT_FOREVER)))
-        {
-            printf("Direct method response failed! (0x%08x)\r\n", status);
-            return;
-        }
-
-        azure_iot_nx_client_publish_bool_property(&azure_iot_nx_client, NULL, LED_STATE_PROPERTY, arg);
-    }
-    else
-    {
-        printf("Direct method is not for this device\r\n");
-
-        if ((status = nx_azure_iot_hub_client_command_message_response(
-                 &nx_context_ptr->iothub_client, 501, context_ptr, context_length, NULL, 0, NX_WAIT_FOREVER)))
-        {
-            printf("Direct method response failed! (0x%08x)\r\n", status);
-            return;
-        }
-    }
+    return 200;
 }
 
-static void writable_property_received_cb(AZURE_IOT_NX_CONTEXT* nx_context,
-    const UCHAR* component_name,
-    UINT component_name_len,
-    UCHAR* property_name,
-    UINT property_name_len,
-    NX_AZURE_IOT_JSON_READER* json_reader_ptr,
-    UINT version)
+UINT gsgrx65ncloud_telemetry_interval_set(AZURE_IOT_NX_CONTEXT* nx_context, int32_t value)
 {
-    UINT status;
+    // Answered here with the twin version, properties_complete_cb only reports the default when there was none
+    telemetry_interval_desired = true;
 
-    if (strncmp((CHAR*)property_name, TELEMETRY_INTERVAL_PROPERTY, property_name_len) == 0)
+    if (value < 1)
     {
-        status = nx_azure_iot_json_reader_token_int32_get(json_reader_ptr, &telemetry_interval);
-        if (status == NX_AZURE_IOT_SUCCESS)
-        {
-            printf("Updating %s to %ld\r\n", TELEMETRY_INTERVAL_PROPERTY, telemetry_interval);
-
-            // Confirm reception back to hub
-            azure_nx_client_respond_int_writable_property(
-                nx_context, NULL, TELEMETRY_INTERVAL_PROPERTY, telemetry_interval, 200, version);
-
-            azure_nx_client_periodic_interval_set(nx_context, telemetry_interval);
-        }
+        printf("Rejecting %s of %ld\r\n", TELEMETRY_INTERVAL_PROPERTY, value);
+        return 400;
     }
-}
 
-static void property_received_cb(AZURE_IOT_NX_CONTEXT* nx_context,
-    const UCHAR* component_name,
-    UINT component_name_len,
-    UCHAR* property_name,
-    UINT property_name_len,
-    NX_AZURE_IOT_JSON_READER* json_reader_ptr,
-    UINT version)
-{
-    UINT status;
+    printf("Updating %s to %ld\r\n", TELEMETRY_INTERVAL_PROPERTY, value);
+    telemetry_interval = value;
+    azure_nx_client_periodic_interval_set(nx_context, telemetry_interval);
 
-    if (strncmp((CHAR*)property_name, TELEMETRY_INTERVAL_PROPERTY, property_name_len) == 0)
-    {
-        status = nx_azure_iot_json_reader_token_int32_get(json_reader_ptr, &telemetry_interval);
-        if (status == NX_AZURE_IOT_SUCCESS)
-        {
-            printf("Updating %s to %ld\r\n", TELEMETRY_INTERVAL_PROPERTY, telemetry_interval);
-            azure_nx_client_periodic_interval_set(nx_context, telemetry_interval);
-        }
-    }
+    return 200;
 }
 
 static void properties_complete_cb(AZURE_IOT_NX_CONTEXT* nx_context)
@@ -293,8 +282,12 @@ static void properties_complete_cb(AZURE_IOT_NX_CONTEXT* nx_context)
     // Device twin processing is done, send out property updates
     azure_iot_nx_client_publish_properties(nx_context, DEVICE_INFO_COMPONENT_NAME, append_device_info_properties);
     azure_iot_nx_client_publish_bool_property(nx_context, NULL, LED_STATE_PROPERTY, false);
-    azure_iot_nx_client_publish_int_writable_property(
-        nx_context, NULL, TELEMETRY_INTERVAL_PROPERTY, telemetry_interval);
+
+    if (!telemetry_interval_desired)
+    {
+        azure_iot_nx_client_publish_int_writable_property(
+            nx_context, NULL, TELEMETRY_INTERVAL_PROPERTY, telemetry_interval);
+    }
 
     printf("\r\nStarting Main loop\r\n");
 }
@@ -303,27 +296,13 @@ static void telemetry_cb(AZURE_IOT_NX_CONTEXT* nx_context)
 {
     static TELEMETRY_STATE telemetry_state = TELEMETRY_STATE_DEFAULT;
 
-    switch (telemetry_state)
-    {
-        case TELEMETRY_STATE_DEFAULT:
-            azure_iot_nx_client_publish_telemetry(&azure_iot_nx_client, NULL, append_device_telemetry);
-            break;
-
-        case TELEMETRY_STATE_ACCELEROMETER:
-            azure_iot_nx_client_publish_telemetry(&azure_iot_nx_client, NULL, append_device_accelerometer);
-            break;
+    sensor_registry_sample(&sensor_registry);
+    sensor_registry_collect(&sensor_registry);
 
-        case TELEMETRY_STATE_GYROSCOPE:
-            azure_iot_nx_client_publish_telemetry(&azure_iot_nx_client, NULL, append_device_gyroscope);
-            break;
+    telemetry_group = &telemetry_groups[telemetry_state];
+    azure_iot_nx_client_publish_telemetry(&azure_iot_nx_client, NULL, append_device_telemetry);
 
-        case TELEMETRY_STATE_LIGHT:
-            azure_iot_nx_client_publish_telemetry(&azure_iot_nx_client, NULL, append_device_light);
-            break;
-
-        default:
-            break;
-    }
+    sensor_registry_reset(&sensor_registry, telemetry_group->first, telemetry_group->count);
 
     telemetry_state = (telemetry_state + 1) % TELEMETRY_STATE_END;
 }
@@ -333,6 +312,12 @@ UINT azure_iot_nx_client_entry(
 {
     UINT status;
 
+    if ((status = sensor_registry_init(&sensor_registry, sensors, sizeof(sensors) / sizeof(sensors[0]), 0)))
+    {
+        printf("ERROR: sensor_registry_init failed (0x%08x)\r\n", status);
+        return status;
+    }
+
     if ((status = azure_iot_nx_client_create(&azure_iot_nx_client,
              ip_ptr,
              pool_ptr,
@@ -345,10 +330,8 @@ UINT azure_iot_nx_client_entry(
         return status;
     }
 
-    // Register the callbacks
-    azure_iot_nx_client_register_command_callback(&azure_iot_nx_client, command_received_cb);
-    azure_iot_nx_client_register_writable_property_callback(&azure_iot_nx_client, writable_property_received_cb);
-    azure_iot_nx_client_register_property_callback(&azure_iot_nx_client, property_received_cb);
+    // Register the callbacks, commands and writable properties are dispatched by the table generated from the model
+    azure_iot_nx_client_register_dispatch_table(&azure_iot_nx_client, &gsgrx65ncloud_dispatch_table);
     azure_iot_nx_client_register_properties_complete_callback(&azure_iot_nx_client, properties_complete_cb);
     azure_iot_nx_client_register_timer_callback(&azure_iot_nx_client, telemetry_cb, telemetry_interval);
 
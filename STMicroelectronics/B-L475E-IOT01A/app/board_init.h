@@ -11,4 +11,7 @@ extern UART_HandleTypeDef UartHandle;
 void board_init(void);
 int hardware_rand(void);
 
+// Route console output through the shared console buffer, see console.c
+void console_init(void);
+
 #endif // _BOARD_INIT_H
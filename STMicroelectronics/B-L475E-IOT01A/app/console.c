@@ -4,10 +4,47 @@
 #include "stm32l4xx_hal.h"
 
 #include "board_init.h"
+#include "console_buffer.h"
+
+static VOID console_transmit(const UCHAR* data, UINT length)
+{
+	if (HAL_UART_Transmit_DMA(&UartHandle, (uint8_t *)data, length) != HAL_OK)
+	{
+		// Skip what could not be sent rather than stall the console
+		console_buffer_transmit_complete();
+	}
+}
+
+void HAL_UART_TxCpltCallback(UART_HandleTypeDef *huart)
+{
+	if (huart == &UartHandle)
+	{
+		console_buffer_transmit_complete();
+	}
+}
+
+void HAL_UART_ErrorCallback(UART_HandleTypeDef *huart)
+{
+	// Errors are also reported for reception, only give up on a transmission that is under way,
+	// stopping its DMA before the ring can reuse the bytes
+	if (huart != &UartHandle || console_buffer_in_flight() == 0)
+	{
+		return;
+	}
+
+	HAL_UART_AbortTransmit(huart);
+	console_buffer_transmit_complete();
+}
+
+void console_init(void)
+{
+	console_buffer_init(console_transmit);
+}
 
 int __io_putchar(int ch)
 {
-	HAL_UART_Transmit(&UartHandle, (uint8_t *)&ch, 1, HAL_MAX_DELAY);
+	char c = ch;
+	console_buffer_write(&c, 1);
 	return ch;
 }
 
@@ -17,12 +54,11 @@ int __io_getchar(void)
 	HAL_UART_Receive(&UartHandle, &ch, 1, HAL_MAX_DELAY);
 
 	/* Echo character back to console */
-	HAL_UART_Transmit(&UartHandle, &ch, 1, HAL_MAX_DELAY);
+	console_buffer_write((char *)&ch, 1);
 
 	/* And cope with Windows */
 	if (ch == '\r') {
-		uint8_t ret = '\n';
-		HAL_UART_Transmit(&UartHandle, &ret, 1, HAL_MAX_DELAY);
+		console_buffer_write("\n", 1);
 	}
 
 	return ch;
@@ -54,11 +90,7 @@ int _write(int file, char *ptr, int len)
 #error unknown compiler
 #endif
 {
-	int DataIdx;
-
-	for (DataIdx = 0; DataIdx < len; DataIdx++)
-	{
-		__io_putchar(*ptr++);
-	}
+	// Queue and return, output that does not fit is counted by console_buffer_dropped_bytes
+	console_buffer_write((const CHAR *)ptr, len);
 	return len;
 }
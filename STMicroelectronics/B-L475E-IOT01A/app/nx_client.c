@@ -19,10 +19,12 @@
 #include "nx_azure_iot_provisioning_client.h"
 
 #include "azure_iot_nx_client.h"
+#include "sensor_registry.h"
 
 #include "azure_config.h"
 #include "azure_device_x509_cert_config.h"
 #include "azure_pnp_info.h"
+#include "gsgstml4s5_dispatch.h"
 #include "stm_networking.h"
 
 #define IOT_MODEL_ID "dtmi:azurertos:devkit:gsgstml4s5;2"
@@ -41,7 +43,6 @@
 #define TELEMETRY_GYROSCOPEZ        "gyroscopeZ"
 #define TELEMETRY_INTERVAL_PROPERTY "telemetryInterval"
 #define LED_STATE_PROPERTY          "ledState"
-#define SET_LED_STATE_COMMAND       "setLedState"
 
 typedef enum TELEMETRY_STATE_ENUM
 {
@@ -52,9 +53,31 @@ typedef enum TELEMETRY_STATE_ENUM
     TELEMETRY_STATE_END
 } TELEMETRY_STATE;
 
+// Registry channels, in the order the sensors are registered
+typedef enum SENSOR_CHANNEL_ENUM
+{
+    SENSOR_CHANNEL_TEMPERATURE,
+    SENSOR_CHANNEL_HUMIDITY,
+    SENSOR_CHANNEL_PRESSURE,
+    SENSOR_CHANNEL_MAGNETOMETER_X,
+    SENSOR_CHANNEL_MAGNETOMETER_Y,
+    SENSOR_CHANNEL_MAGNETOMETER_Z,
+    SENSOR_CHANNEL_ACCELEROMETER_X,
+    SENSOR_CHANNEL_ACCELEROMETER_Y,
+    SENSOR_CHANNEL_ACCELEROMETER_Z,
+    SENSOR_CHANNEL_GYROSCOPE_X,
+    SENSOR_CHANNEL_GYROSCOPE_Y,
+    SENSOR_CHANNEL_GYROSCOPE_Z,
+    SENSOR_CHANNEL_COUNT
+} SENSOR_CHANNEL;
+
 static AZURE_IOT_NX_CONTEXT azure_iot_nx_client;
 
 static int32_t telemetry_interval = 10;
+static bool telemetry_interval_desired;
+
+// Sampled on every telemetry timer, each group is sent as the mean since it was last sent
+static SENSOR_REGISTRY sensor_registry;
 
 static UINT append_device_info_properties(NX_AZURE_IOT_JSON_WRITER* json_writer)
 {
@@ -105,81 +128,101 @@ static UINT append_device_info_properties(NX_AZURE_IOT_JSON_WRITER* json_writer)
     return NX_AZURE_IOT_SUCCESS;
 }
 
-static UINT append_device_telemetry(NX_AZURE_IOT_JSON_WRITER* json_writer)
+static UINT hts221_read(float* values, UINT max_samples)
 {
-    if (nx_azure_iot_json_writer_append_property_with_double_value(
-            json_writer, (UCHAR*)TELEMETRY_HUMIDITY, sizeof(TELEMETRY_HUMIDITY) - 1, BSP_HSENSOR_ReadHumidity(), 2) ||
+    values[0] = BSP_TSENSOR_ReadTemp();
+    values[1] = BSP_HSENSOR_ReadHumidity();
 
-        nx_azure_iot_json_writer_append_property_with_double_value(
-            json_writer, (UCHAR*)TELEMETRY_TEMPERATURE, sizeof(TELEMETRY_TEMPERATURE) - 1, BSP_TSENSOR_ReadTemp(), 2) ||
+    return 1;
+}
 
-        nx_azure_iot_json_writer_append_property_with_double_value(
-            json_writer, (UCHAR*)TELEMETRY_PRESSURE, sizeof(TELEMETRY_PRESSURE) - 1, BSP_PSENSOR_ReadPressure(), 2))
-    {
-        return NX_NOT_SUCCESSFUL;
-    }
+static UINT lps22hb_read(float* values, UINT max_samples)
+{
+    values[0] = BSP_PSENSOR_ReadPressure();
 
-    return NX_AZURE_IOT_SUCCESS;
+    return 1;
 }
 
-static UINT append_device_telemetry_magnetometer(NX_AZURE_IOT_JSON_WRITER* json_writer)
+static UINT lis3mdl_read(float* values, UINT max_samples)
 {
     int16_t data[3];
     BSP_MAGNETO_GetXYZ(data);
 
-    if (nx_azure_iot_json_writer_append_property_with_double_value(
-            json_writer, (UCHAR*)TELEMETRY_MAGNETOMETERX, sizeof(TELEMETRY_MAGNETOMETERX) - 1, data[0], 2) ||
-
-        nx_azure_iot_json_writer_append_property_with_double_value(
-            json_writer, (UCHAR*)TELEMETRY_MAGNETOMETERY, sizeof(TELEMETRY_MAGNETOMETERY) - 1, data[1], 2) ||
-
-        nx_azure_iot_json_writer_append_property_with_double_value(
-            json_writer, (UCHAR*)TELEMETRY_MAGNETOMETERZ, sizeof(TELEMETRY_MAGNETOMETERZ) - 1, data[2], 2))
+    for (UINT axis = 0; axis < 3; axis++)
     {
-        return NX_NOT_SUCCESSFUL;
+        values[axis] = data[axis];
     }
 
-    return NX_AZURE_IOT_SUCCESS;
+    return 1;
 }
 
-static UINT append_device_telemetry_accelerometer(NX_AZURE_IOT_JSON_WRITER* json_writer)
+static UINT lsm6dsl_read(float* values, UINT max_samples)
 {
-    int16_t data[3];
-    BSP_ACCELERO_AccGetXYZ(data);
-
-    if (nx_azure_iot_json_writer_append_property_with_double_value(
-            json_writer, (UCHAR*)TELEMETRY_ACCELEROMETERX, sizeof(TELEMETRY_ACCELEROMETERX) - 1, data[0], 2) ||
+    int16_t acceleration[3];
+    float angular_rate[3];
+    BSP_ACCELERO_AccGetXYZ(acceleration);
+    BSP_GYRO_GetXYZ(angular_rate);
 
-        nx_azure_iot_json_writer_append_property_with_double_value(
-            json_writer, (UCHAR*)TELEMETRY_ACCELEROMETERY, sizeof(TELEMETRY_ACCELEROMETERY) - 1, data[1], 2) ||
-
-        nx_azure_iot_json_writer_append_property_with_double_value(
-            json_writer, (UCHAR*)TELEMETRY_ACCELEROMETERZ, sizeof(TELEMETRY_ACCELEROMETERZ) - 1, data[2], 2))
+    for (UINT axis = 0; axis < 3; axis++)
     {
-        return NX_NOT_SUCCESSFUL;
+        values[axis]     = acceleration[axis];
+        values[axis + 3] = angular_rate[axis];
     }
 
-    return NX_AZURE_IOT_SUCCESS;
+    return 1;
 }
 
-static UINT append_device_telemetry_gyroscope(NX_AZURE_IOT_JSON_WRITER* json_writer)
-{
-    float data[3];
-    BSP_GYRO_GetXYZ(data);
+// CBOR keys follow the telemetry order of gsgstml4s5-2.json, the readings are converted to its units
+static const SENSOR_CHANNEL_DESCRIPTOR hts221_channels[] = {
+    {TELEMETRY_TEMPERATURE, "degreeCelsius", "degreeCelsius", 0},
+    {TELEMETRY_HUMIDITY, "percent", "percent", 1},
+};
+
+static const SENSOR_CHANNEL_DESCRIPTOR lps22hb_channels[] = {
+    {TELEMETRY_PRESSURE, "kilopascal", "hectopascal", 2},
+};
+
+// The model gives the magnetometer no unit, it is sent in the milligauss of the driver
+static const SENSOR_CHANNEL_DESCRIPTOR lis3mdl_channels[] = {
+    {TELEMETRY_MAGNETOMETERX, NULL, "milligauss", 3},
+    {TELEMETRY_MAGNETOMETERY, NULL, "milligauss", 4},
+    {TELEMETRY_MAGNETOMETERZ, NULL, "milligauss", 5},
+};
+
+static const SENSOR_CHANNEL_DESCRIPTOR lsm6dsl_channels[] = {
+    {TELEMETRY_ACCELEROMETERX, "gForce", "milligForce", 6},
+    {TELEMETRY_ACCELEROMETERY, "gForce", "milligForce", 7},
+    {TELEMETRY_ACCELEROMETERZ, "gForce", "milligForce", 8},
+    {TELEMETRY_GYROSCOPEX, "degreePerSecond", "millidegreePerSecond", 9},
+    {TELEMETRY_GYROSCOPEY, "degreePerSecond", "millidegreePerSecond", 10},
+    {TELEMETRY_GYROSCOPEZ, "degreePerSecond", "millidegreePerSecond", 11},
+};
+
+static const SENSOR_DESCRIPTOR sensors[] = {
+    {"hts221", hts221_channels, 2, 0, hts221_read},
+    {"lps22hb", lps22hb_channels, 1, 0, lps22hb_read},
+    {"lis3mdl", lis3mdl_channels, 3, 0, lis3mdl_read},
+    {"lsm6dsl", lsm6dsl_channels, 6, 0, lsm6dsl_read},
+};
 
-    if (nx_azure_iot_json_writer_append_property_with_double_value(
-            json_writer, (UCHAR*)TELEMETRY_GYROSCOPEX, sizeof(TELEMETRY_GYROSCOPEX) - 1, data[0], 2) ||
+static UINT append_device_telemetry(NX_AZURE_IOT_JSON_WRITER* json_writer)
+{
+    return sensor_registry_append_json(&sensor_registry, json_writer, SENSOR_CHANNEL_TEMPERATURE, 3);
+}
 
-        nx_azure_iot_json_writer_append_property_with_double_value(
-            json_writer, (UCHAR*)TELEMETRY_GYROSCOPEY, sizeof(TELEMETRY_GYROSCOPEY) - 1, data[1], 2) ||
+static UINT append_device_telemetry_magnetometer(NX_AZURE_IOT_JSON_WRITER* json_writer)
+{
+    return sensor_registry_append_json(&sensor_registry, json_writer, SENSOR_CHANNEL_MAGNETOMETER_X, 3);
+}
 
-        nx_azure_iot_json_writer_append_property_with_double_value(
-            json_writer, (UCHAR*)TELEMETRY_GYROSCOPEZ, sizeof(TELEMETRY_GYROSCOPEZ) - 1, data[2], 2))
-    {
-        return NX_NOT_SUCCESSFUL;
-    }
+static UINT append_device_telemetry_accelerometer(NX_AZURE_IOT_JSON_WRITER* json_writer)
+{
+    return sensor_registry_append_json(&sensor_registry, json_writer, SENSOR_CHANNEL_ACCELEROMETER_X, 3);
+}
 
-    return NX_AZURE_IOT_SUCCESS;
+static UINT append_device_telemetry_gyroscope(NX_AZURE_IOT_JSON_WRITER* json_writer)
+{
+    return sensor_registry_append_json(&sensor_registry, json_writer, SENSOR_CHANNEL_GYROSCOPE_X, 3);
 }
 
 static void set_led_state(bool level)
@@ -196,90 +239,30 @@ static void set_led_state(bool level)
     }
 }
 
-static void command_received_cb(AZURE_IOT_NX_CONTEXT* nx_context_ptr,
-    const UCHAR* component,
-    USHORT component_length,
-    const UCHAR* method,
-    USHORT method_length,
-    UCHAR* payload,
-    USHORT payload_length,
-    VOID* context_ptr,
-    USHORT context_length)
+UINT gsgstml4s5_set_led_state_command(AZURE_IOT_NX_CONTEXT* nx_context, bool value)
 {
-    UINT status;
-
-    if (strncmp((CHAR*)method, SET_LED_STATE_COMMAND, method_length) == 0)
-    {
-        bool arg = (strncmp((CHAR*)payload, "true", payload_length) == 0);
-        set_led_state(arg);
-
-        if ((status = nx_azure_iot_hub_client_command_message_response(
-                 &nx_context_ptr->iothub_client, 200, context_ptr, context_length, NULL, 0, NX_WAIT_FOREVER)))
-        {
-            printf("Direct method response failed! (0x%08x)\r\n", status);
-            return;
-        }
+    set_led_state(value);
+    azure_iot_nx_client_publish_bool_property(nx_context, NULL, LED_STATE_PROPERTY, value);
 
-        azure_iot_nx_client_publish_bool_property(&azure_iot_nx_client, NULL, LED_STATE_PROPERTY, arg);
-    }
-    else
-    {
-        printf("Direct method is not for this device\r\n");
-
-        if ((status = nx_azure_iot_hub_client_command_message_response(
-                 &nx_context_ptr->iothub_client, 501, context_ptr, context_length, NULL, 0, NX_WAIT_FOREVER)))
-        {
-            printf("Direct method response failed! (0x%08x)\r\n", status);
-            return;
-        }
-    }
+    return 200;
 }
 
-static void writable_property_received_cb(AZURE_IOT_NX_CONTEXT* nx_context,
-    const UCHAR* component_name,
-    UINT component_name_len,
-    UCHAR* property_name,
-    UINT property_name_len,
-    NX_AZURE_IOT_JSON_READER* json_reader_ptr,
-    UINT version)
+UINT gsgstml4s5_telemetry_interval_set(AZURE_IOT_NX_CONTEXT* nx_context, int32_t value)
 {
-    UINT status;
+    // Answered here with the twin version, properties_complete_cb only reports the default when there was none
+    telemetry_interval_desired = true;
 
-    if (strncmp((CHAR*)property_name, TELEMETRY_INTERVAL_PROPERTY, property_name_len) == 0)
+    if (value < 1)
     {
-        status = nx_azure_iot_json_reader_token_int32_get(json_reader_ptr, &telemetry_interval);
-        if (status == NX_AZURE_IOT_SUCCESS)
-        {
-            printf("Updating %s to %ld\r\n", TELEMETRY_INTERVAL_PROPERTY, telemetry_interval);
-
-            // Confirm reception back to hub
-            azure_nx_client_respond_int_writable_property(
-                nx_context, NULL, TELEMETRY_INTERVAL_PROPERTY, telemetry_interval, 200, version);
-
-            azure_nx_client_periodic_interval_set(nx_context, telemetry_interval);
-        }
+        printf("Rejecting %s of %ld\r\n", TELEMETRY_INTERVAL_PROPERTY, value);
+        return 400;
     }
-}
 
-static void property_received_cb(AZURE_IOT_NX_CONTEXT* nx_context,
-    const UCHAR* component_name,
-    UINT component_name_len,
-    UCHAR* property_name,
-    UINT property_name_len,
-    NX_AZURE_IOT_JSON_READER* json_reader_ptr,
-    UINT version)
-{
-    UINT status;
+    printf("Updating %s to %ld\r\n", TELEMETRY_INTERVAL_PROPERTY, value);
+    telemetry_interval = value;
+    azure_nx_client_periodic_interval_set(nx_context, telemetry_interval);
 
-    if (strncmp((CHAR*)property_name, TELEMETRY_INTERVAL_PROPERTY, property_name_len) == 0)
-    {
-        status = nx_azure_iot_json_reader_token_int32_get(json_reader_ptr, &telemetry_interval);
-        if (status == NX_AZURE_IOT_SUCCESS)
-        {
-            printf("Updating %s to %ld\r\n", TELEMETRY_INTERVAL_PROPERTY, telemetry_interval);
-            azure_nx_client_periodic_interval_set(nx_context, telemetry_interval);
-        }
-    }
+    return 200;
 }
 
 static void properties_complete_cb(AZURE_IOT_NX_CONTEXT* nx_context)
@@ -287,8 +270,12 @@ static void properties_complete_cb(AZURE_IOT_NX_CONTEXT* nx_context)
     // Device twin processing is done, send out property updates
     azure_iot_nx_client_publish_properties(nx_context, DEVICE_INFO_COMPONENT_NAME, append_device_info_properties);
     azure_iot_nx_client_publish_bool_property(nx_context, NULL, LED_STATE_PROPERTY, false);
-    azure_iot_nx_client_publish_int_writable_property(
-        nx_context, NULL, TELEMETRY_INTERVAL_PROPERTY, telemetry_interval);
+
+    if (!telemetry_interval_desired)
+    {
+        azure_iot_nx_client_publish_int_writable_property(
+            nx_context, NULL, TELEMETRY_INTERVAL_PROPERTY, telemetry_interval);
+    }
 
     printf("\r\nStarting Main loop\r\n");
 }
@@ -297,6 +284,13 @@ static void telemetry_cb(AZURE_IOT_NX_CONTEXT* nx_context)
 {
     static TELEMETRY_STATE telemetry_state = TELEMETRY_STATE_DEFAULT;
 
+    // First channel of the three published in each state
+    static const SENSOR_CHANNEL telemetry_state_channels[TELEMETRY_STATE_END] = {
+        SENSOR_CHANNEL_TEMPERATURE, SENSOR_CHANNEL_MAGNETOMETER_X, SENSOR_CHANNEL_ACCELEROMETER_X, SENSOR_CHANNEL_GYROSCOPE_X};
+
+    sensor_registry_sample(&sensor_registry);
+    sensor_registry_collect(&sensor_registry);
+
     switch (telemetry_state)
     {
         case TELEMETRY_STATE_DEFAULT:
@@ -319,7 +313,9 @@ static void telemetry_cb(AZURE_IOT_NX_CONTEXT* nx_context)
             break;
     }
 
-    telemetry_state = (telemetry_state + 1) % TELEMETRY_STATE_END;    
+    sensor_registry_reset(&sensor_registry, telemetry_state_channels[telemetry_state], 3);
+
+    telemetry_state = (telemetry_state + 1) % TELEMETRY_STATE_END;
 }
 
 UINT azure_iot_nx_client_entry(
@@ -327,6 +323,12 @@ UINT azure_iot_nx_client_entry(
 {
     UINT status;
 
+    if ((status = sensor_registry_init(&sensor_registry, sensors, sizeof(sensors) / sizeof(sensors[0]), 0)))
+    {
+        printf("ERROR: sensor_registry_init failed (0x%08x)\r\n", status);
+        return status;
+    }
+
     if ((status = azure_iot_nx_client_create(&azure_iot_nx_client,
              ip_ptr,
              pool_ptr,
@@ -339,10 +341,8 @@ UINT azure_iot_nx_client_entry(
         return status;
     }
 
-    // Register the callbacks
-    azure_iot_nx_client_register_command_callback(&azure_iot_nx_client, command_received_cb);
-    azure_iot_nx_client_register_writable_property_callback(&azure_iot_nx_client, writable_property_received_cb);
-    azure_iot_nx_client_register_property_callback(&azure_iot_nx_client, property_received_cb);
+    // Register the callbacks, commands and writable properties are dispatched by the table generated from the model
+    azure_iot_nx_client_register_dispatch_table(&azure_iot_nx_client, &gsgstml4s5_dispatch_table);
     azure_iot_nx_client_register_properties_complete_callback(&azure_iot_nx_client, properties_complete_cb);
     azure_iot_nx_client_register_timer_callback(&azure_iot_nx_client, telemetry_cb, telemetry_interval);
 
@@ -59,6 +59,10 @@
 
 /* Exported Constants --------------------------------------------------------*/
 #define ES_WIFI_PAYLOAD_SIZE     1200
+/* Bytes of AT framing around the payload of an in-place receive ("\r\n", "\r\nOK\r\n> " and padding). */
+#define ES_WIFI_RECEIVE_OVERHEAD 32
+/* Value of ES_WIFIObject_t.ActiveSocket when the socket selected by P0 is not known. */
+#define ES_WIFI_SOCKET_UNKNOWN   0xFF
 /* Exported macro-------------------------------------------------------------*/
 #define MIN(a, b)  ((a) < (b) ? (a) : (b))
 
@@ -272,6 +276,11 @@ typedef struct {
   uint8_t            CmdData[ES_WIFI_DATA_SIZE];
   uint32_t           Timeout;
   uint32_t           BufferSize;  
+  /* Transport settings last written to the module, so unchanged ones are not resent. */
+  uint8_t            ActiveSocket;
+  uint16_t           ActiveReadLen;
+  uint32_t           ActiveReadTimeout;
+  uint32_t           ActiveWriteTimeout;
 } ES_WIFIObject_t;
 
 
@@ -319,6 +328,7 @@ ES_WIFI_Status_t  ES_WIFI_StopServerMultiConn(ES_WIFIObject_t *Obj,ES_WIFI_Conn_
 ES_WIFI_Status_t  ES_WIFI_SendData(ES_WIFIObject_t *Obj, uint8_t Socket, uint8_t *pdata, uint16_t Reqlen , uint16_t *SentLen, uint32_t Timeout);
 ES_WIFI_Status_t  ES_WIFI_SendDataTo(ES_WIFIObject_t *Obj, uint8_t Socket, uint8_t *pdata, uint16_t Reqlen , uint16_t *SentLen, uint32_t Timeout, uint8_t *IPaddr, uint16_t Port);
 ES_WIFI_Status_t  ES_WIFI_ReceiveData(ES_WIFIObject_t *Obj, uint8_t Socket, uint8_t *pdata, uint16_t Reqlen, uint16_t *Receivedlen, uint32_t Timeout);
+ES_WIFI_Status_t  ES_WIFI_ReceiveDataInPlace(ES_WIFIObject_t *Obj, uint8_t Socket, uint8_t *pbuf, uint16_t bufsize, uint16_t *Offset, uint16_t *Receivedlen, uint32_t Timeout);
 ES_WIFI_Status_t  ES_WIFI_ReceiveDataFrom(ES_WIFIObject_t *Obj, uint8_t Socket, uint8_t *pdata, uint16_t Reqlen, uint16_t *Receivedlen, uint32_t Timeout, uint8_t *IPaddr, uint16_t *pPort);
 ES_WIFI_Status_t  ES_WIFI_ActivateAP(ES_WIFIObject_t *Obj, ES_WIFI_APConfig_t *ApConfig);
 ES_WIFI_APState_t ES_WIFI_WaitAPStateChange(ES_WIFIObject_t *Obj);
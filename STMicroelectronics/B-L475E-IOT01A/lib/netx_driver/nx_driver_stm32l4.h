@@ -41,10 +41,27 @@ extern   "C" {
 
 #define NX_DRIVER_ERROR                         90
     
+/* Define receive statistics of a driver socket. Latencies are in ticks, measured from
+   a send or connect to the first data received after it.  */
+
+typedef struct NX_DRIVER_SOCKET_STATISTICS_STRUCT
+{
+    ULONG               receive_packets;
+    ULONG               receive_bytes;
+    ULONG               receive_polls;
+    ULONG               receive_empty_polls;
+    ULONG               receive_latency_last;
+    ULONG               receive_latency_max;
+} NX_DRIVER_SOCKET_STATISTICS;
+
 /* Define global driver entry function. */
 
 VOID  nx_driver_stm32l4(NX_IP_DRIVER *driver_req_ptr);
 
+/* Define function to retrieve receive statistics of a driver socket. */
+
+UINT  nx_driver_stm32l4_socket_statistics_get(UINT socket_index, NX_DRIVER_SOCKET_STATISTICS *statistics_ptr);
+
 #ifdef   __cplusplus
 /* Yes, C++ compiler is present.  Use standard C.  */
     }
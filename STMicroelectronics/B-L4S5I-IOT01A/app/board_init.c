@@ -21,6 +21,9 @@
 
 UART_HandleTypeDef UartHandle;
 
+// Drains the console buffer
+static DMA_HandleTypeDef hdma_uart_tx;
+
 // Expose functions from STMCubeMX generation
 extern SPI_HandleTypeDef hspi;
 extern RNG_HandleTypeDef hrng;
@@ -38,6 +41,31 @@ static void UART_Console_Init(void)
     UartHandle.Init.HwFlowCtl              = UART_HWCONTROL_NONE;
     UartHandle.AdvancedInit.AdvFeatureInit = UART_ADVFEATURE_NO_INIT;
     BSP_COM_Init(COM1, &UartHandle);
+
+    // USART1 TX reaches DMA1 channel 4 through the DMAMUX
+    __HAL_RCC_DMAMUX1_CLK_ENABLE();
+    __HAL_RCC_DMA1_CLK_ENABLE();
+
+    hdma_uart_tx.Instance                 = DMA1_Channel4;
+    hdma_uart_tx.Init.Request             = DMA_REQUEST_USART1_TX;
+    hdma_uart_tx.Init.Direction           = DMA_MEMORY_TO_PERIPH;
+    hdma_uart_tx.Init.PeriphInc           = DMA_PINC_DISABLE;
+    hdma_uart_tx.Init.MemInc              = DMA_MINC_ENABLE;
+    hdma_uart_tx.Init.PeriphDataAlignment = DMA_PDATAALIGN_BYTE;
+    hdma_uart_tx.Init.MemDataAlignment    = DMA_MDATAALIGN_BYTE;
+    hdma_uart_tx.Init.Mode                = DMA_NORMAL;
+    hdma_uart_tx.Init.Priority            = DMA_PRIORITY_LOW;
+    HAL_DMA_Init(&hdma_uart_tx);
+
+    __HAL_LINKDMA(&UartHandle, hdmatx, hdma_uart_tx);
+
+    // The transfer completes on the UART transmission complete interrupt
+    HAL_NVIC_SetPriority(DMA1_Channel4_IRQn, 0xF, 0);
+    HAL_NVIC_EnableIRQ(DMA1_Channel4_IRQn);
+    HAL_NVIC_SetPriority(USART1_IRQn, 0xF, 0);
+    HAL_NVIC_EnableIRQ(USART1_IRQn);
+
+    console_init();
 }
 
 static void Init_MEM1_Sensors(void)
@@ -121,3 +149,14 @@ void SPI3_IRQHandler(void)
 {
     HAL_SPI_IRQHandler(&hspi);
 }
+
+// Console interrupt handles
+void DMA1_Channel4_IRQHandler(void)
+{
+    HAL_DMA_IRQHandler(UartHandle.hdmatx);
+}
+
+void USART1_IRQHandler(void)
+{
+    HAL_UART_IRQHandler(&UartHandle);
+}
@@ -93,6 +93,10 @@ static void AT_ParseConnSettings(char *pdata, ES_WIFI_Network_t *NetSettings);
 static void AT_ParseTransportSettings(char *pdata, ES_WIFI_Transport_t *TransportSettings);
 static void AT_ParseIsConnected(char *pdata, uint8_t *isConnected);
 static ES_WIFI_Status_t AT_ExecuteCommand(ES_WIFIObject_t *Obj, uint8_t* cmd, uint8_t *pdata);
+static void AT_InvalidateSocketCache(ES_WIFIObject_t *Obj);
+static ES_WIFI_Status_t AT_SelectSocket(ES_WIFIObject_t *Obj, uint8_t Socket);
+static ES_WIFI_Status_t AT_SetReadConfig(ES_WIFIObject_t *Obj, uint16_t Reqlen, uint32_t Timeout);
+static ES_WIFI_Status_t AT_SetWriteTimeout(ES_WIFIObject_t *Obj, uint32_t Timeout);
 
 uint32_t HAL_GetTick(void);
 /* Private functions ---------------------------------------------------------*/
@@ -822,27 +826,134 @@ static ES_WIFI_Status_t AT_RequestSendData(ES_WIFIObject_t *Obj, uint8_t* cmd, u
 }
 
 
+/**
+  * @brief  Invalidate the cached transport settings.
+  * @param  Obj: pointer to module handle
+  * @retval None.
+  */
+static void AT_InvalidateSocketCache(ES_WIFIObject_t *Obj)
+{
+  Obj->ActiveSocket = ES_WIFI_SOCKET_UNKNOWN;
+  Obj->ActiveReadLen = 0;
+  Obj->ActiveReadTimeout = 0;
+  Obj->ActiveWriteTimeout = 0;
+}
+
+/**
+  * @brief  Select the socket used by the following commands (P0), unless already selected.
+  * @param  Obj: pointer to module handle
+  * @param  Socket: number of the socket
+  * @retval Operation Status.
+  */
+static ES_WIFI_Status_t AT_SelectSocket(ES_WIFIObject_t *Obj, uint8_t Socket)
+{
+  ES_WIFI_Status_t ret;
+
+  if (Obj->ActiveSocket == Socket)
+  {
+    return ES_WIFI_STATUS_OK;
+  }
+
+  /* Read and write settings are not known to survive a socket change.  */
+  AT_InvalidateSocketCache(Obj);
+  sprintf((char*)Obj->CmdData,"P0=%d\r", Socket);
+  ret = AT_ExecuteCommand(Obj, Obj->CmdData, Obj->CmdData);
+  if (ret == ES_WIFI_STATUS_OK)
+  {
+    Obj->ActiveSocket = Socket;
+  }
+  return ret;
+}
+
+/**
+  * @brief  Set read length (R1) and read timeout (R2) of the selected socket, unless unchanged.
+  * @param  Obj: pointer to module handle
+  * @param  Reqlen: requested data length
+  * @param  Timeout: read timeout in mS
+  * @retval Operation Status.
+  */
+static ES_WIFI_Status_t AT_SetReadConfig(ES_WIFIObject_t *Obj, uint16_t Reqlen, uint32_t Timeout)
+{
+  ES_WIFI_Status_t ret = ES_WIFI_STATUS_OK;
+
+  if (Obj->ActiveReadLen != Reqlen)
+  {
+    sprintf((char*)Obj->CmdData,"R1=%d\r", Reqlen);
+    ret = AT_ExecuteCommand(Obj, Obj->CmdData, Obj->CmdData);
+    if (ret != ES_WIFI_STATUS_OK)
+    {
+      DEBUG("setting requested len failed\r\n");
+      AT_InvalidateSocketCache(Obj);
+      return ret;
+    }
+    Obj->ActiveReadLen = Reqlen;
+  }
+
+  if (Obj->ActiveReadTimeout != Timeout)
+  {
+    sprintf((char*)Obj->CmdData,"R2=%lu\r", Timeout);
+    ret = AT_ExecuteCommand(Obj, Obj->CmdData, Obj->CmdData);
+    if (ret != ES_WIFI_STATUS_OK)
+    {
+      DEBUG("setting timeout failed\r\n");
+      AT_InvalidateSocketCache(Obj);
+      return ret;
+    }
+    Obj->ActiveReadTimeout = Timeout;
+  }
+
+  return ret;
+}
+
+/**
+  * @brief  Set write timeout (S2) of the selected socket, unless unchanged.
+  * @param  Obj: pointer to module handle
+  * @param  Timeout: write timeout in mS
+  * @retval Operation Status.
+  */
+static ES_WIFI_Status_t AT_SetWriteTimeout(ES_WIFIObject_t *Obj, uint32_t Timeout)
+{
+  ES_WIFI_Status_t ret = ES_WIFI_STATUS_OK;
+
+  if (Obj->ActiveWriteTimeout != Timeout)
+  {
+    sprintf((char*)Obj->CmdData,"S2=%lu\r", Timeout);
+    ret = AT_ExecuteCommand(Obj, Obj->CmdData, Obj->CmdData);
+    if (ret != ES_WIFI_STATUS_OK)
+    {
+      AT_InvalidateSocketCache(Obj);
+      return ret;
+    }
+    Obj->ActiveWriteTimeout = Timeout;
+  }
+
+  return ret;
+}
+
 /**
   * @brief  Parses Received data.
   * @param  Obj: pointer to module handle
   * @param  cmd:command formatted string
-  * @param  pdata: payload
-  * @param  Reqlen : requested Data length.
+  * @param  pbuf: buffer receiving the response
+  * @param  bufsize: size of pbuf, 0 for ES_WIFI_DATA_SIZE
+  * @param  pdata : (OUT) pointer to the payload inside pbuf
   * @param  ReadData : pointer to received data length.
   * @retval Operation Status.
   */
-static ES_WIFI_Status_t AT_RequestReceiveData(ES_WIFIObject_t *Obj, uint8_t* cmd, char *pdata, uint16_t Reqlen, uint16_t *ReadData)
+static ES_WIFI_Status_t AT_RequestReceiveData(ES_WIFIObject_t *Obj, uint8_t* cmd, uint8_t *pbuf, uint16_t bufsize, uint8_t **pdata, uint16_t *ReadData)
 {
   int len;
   int i = 0;
-  uint8_t *p=Obj->CmdData;
+  uint8_t *p=pbuf;
 
   LOCK_WIFI();
   if(Obj->fops.IO_Send(cmd, strlen((char*)cmd), Obj->Timeout) > 0)
   {
-    len = Obj->fops.IO_Receive(p, 0 , Obj->Timeout);
+    /* Leave room for the odd byte of the last SPI word and the terminator.  */
+    len = Obj->fops.IO_Receive(p, (bufsize > 2) ? (bufsize - 2) : 0, Obj->Timeout);
     if (len == ES_WIFI_ERROR_STUFFING_FOREVER )
     {
+      AT_InvalidateSocketCache(Obj);
       UNLOCK_WIFI();
       return ES_WIFI_STATUS_MODULE_CRASH;
     }    
@@ -877,11 +988,7 @@ static ES_WIFI_Status_t AT_RequestReceiveData(ES_WIFIObject_t *Obj, uint8_t* cmd
      if(strstr( (char*) p + len - AT_OK_STRING_LEN, AT_OK_STRING))
      {
        *ReadData = len - AT_OK_STRING_LEN;
-	   if (*ReadData > Reqlen)
-       {
-         *ReadData = Reqlen;
-       }
-       memcpy(pdata, p, *ReadData);
+       *pdata = p;
        UNLOCK_WIFI();
        return ES_WIFI_STATUS_OK;
      }
@@ -902,6 +1009,32 @@ static ES_WIFI_Status_t AT_RequestReceiveData(ES_WIFIObject_t *Obj, uint8_t* cmd
   return ES_WIFI_STATUS_IO_ERROR;
 }
 
+/**
+  * @brief  Receive data into the command buffer and copy it out.
+  * @param  Obj: pointer to module handle
+  * @param  cmd:command formatted string
+  * @param  pdata: payload
+  * @param  Reqlen : requested Data length.
+  * @param  ReadData : pointer to received data length.
+  * @retval Operation Status.
+  */
+static ES_WIFI_Status_t AT_RequestReceiveDataCopy(ES_WIFIObject_t *Obj, uint8_t* cmd, char *pdata, uint16_t Reqlen, uint16_t *ReadData)
+{
+  ES_WIFI_Status_t ret;
+  uint8_t *p;
+
+  ret = AT_RequestReceiveData(Obj, cmd, Obj->CmdData, 0, &p, ReadData);
+  if (ret == ES_WIFI_STATUS_OK)
+  {
+    if (*ReadData > Reqlen)
+    {
+      *ReadData = Reqlen;
+    }
+    memcpy(pdata, p, *ReadData);
+  }
+  return ret;
+}
+
 
 /**
   * @brief  Initialize WIFI module.
@@ -915,6 +1048,7 @@ ES_WIFI_Status_t  ES_WIFI_Init(ES_WIFIObject_t *Obj)
   LOCK_WIFI();
 
   Obj->Timeout = ES_WIFI_TIMEOUT;
+  AT_InvalidateSocketCache(Obj);
 
   if (Obj->fops.IO_Init(ES_WIFI_INIT) == 0)
   {
@@ -1407,6 +1541,7 @@ ES_WIFI_Status_t ES_WIFI_ResetToFactoryDefault(ES_WIFIObject_t *Obj)
 {
   ES_WIFI_Status_t ret ;
   LOCK_WIFI();
+  AT_InvalidateSocketCache(Obj);
   sprintf((char*)Obj->CmdData,"Z0\r");
   ret = AT_ExecuteCommand(Obj, Obj->CmdData, Obj->CmdData);
   UNLOCK_WIFI();
@@ -1422,6 +1557,7 @@ ES_WIFI_Status_t ES_WIFI_ResetModule(ES_WIFIObject_t *Obj)
 {
   int ret;
   LOCK_WIFI();
+  AT_InvalidateSocketCache(Obj);
 
   sprintf((char*)Obj->CmdData,"ZR\r");
   ret = Obj->fops.IO_Send(Obj->CmdData, strlen((char*)Obj->CmdData), Obj->Timeout);
@@ -1446,6 +1582,7 @@ ES_WIFI_Status_t ES_WIFI_HardResetModule(ES_WIFIObject_t *Obj)
 {
   int ret;
   LOCK_WIFI();
+  AT_InvalidateSocketCache(Obj);
   ret = Obj->fops.IO_Init(ES_WIFI_RESET);
   UNLOCK_WIFI();
   return (ret > 0) ? ES_WIFI_STATUS_OK : ES_WIFI_STATUS_ERROR;
@@ -1640,6 +1777,7 @@ ES_WIFI_Status_t ES_WIFI_StartClientConnection(ES_WIFIObject_t *Obj, ES_WIFI_Con
 
   LOCK_WIFI();
 
+  AT_InvalidateSocketCache(Obj);
   sprintf((char*)Obj->CmdData,"P0=%d\r", conn->Number);
   ret = AT_ExecuteCommand(Obj, Obj->CmdData, Obj->CmdData);
 
@@ -1703,6 +1841,7 @@ ES_WIFI_Status_t ES_WIFI_StopClientConnection(ES_WIFIObject_t *Obj, ES_WIFI_Conn
   ES_WIFI_Status_t ret;
   LOCK_WIFI();
 
+  AT_InvalidateSocketCache(Obj);
   sprintf((char*)Obj->CmdData,"P0=%d\r", conn->Number);
   ret = AT_ExecuteCommand(Obj, Obj->CmdData, Obj->CmdData);
 
@@ -1728,6 +1867,7 @@ ES_WIFI_Status_t ES_WIFI_StartAWSClientConnection(ES_WIFIObject_t *Obj, ES_WIFI_
   ES_WIFI_Status_t ret;
   LOCK_WIFI();
 
+  AT_InvalidateSocketCache(Obj);
   sprintf((char*)Obj->CmdData,"P0=%d\r", conn->Number);
   ret = AT_ExecuteCommand(Obj, Obj->CmdData, Obj->CmdData);
 
@@ -1791,6 +1931,7 @@ ES_WIFI_Status_t ES_WIFI_StartServerSingleConn(ES_WIFIObject_t *Obj, ES_WIFI_Con
   ES_WIFI_Status_t ret = ES_WIFI_STATUS_OK;
   LOCK_WIFI();
 
+  AT_InvalidateSocketCache(Obj);
   sprintf((char*)Obj->CmdData,"P0=%d\r", conn->Number);
   ret = AT_ExecuteCommand(Obj, Obj->CmdData, Obj->CmdData);
   if(ret != ES_WIFI_STATUS_OK)
@@ -1944,6 +2085,7 @@ ES_WIFI_Status_t ES_WIFI_CloseServerConnection(ES_WIFIObject_t *Obj, int socket)
 {
   ES_WIFI_Status_t ret;
   LOCK_WIFI();
+  AT_InvalidateSocketCache(Obj);
   sprintf((char*)Obj->CmdData,"P0=%d\r", socket);
   ret = AT_ExecuteCommand(Obj, Obj->CmdData, Obj->CmdData);
   if(ret != ES_WIFI_STATUS_OK)
@@ -1975,6 +2117,7 @@ ES_WIFI_Status_t ES_WIFI_StopServerSingleConn(ES_WIFIObject_t *Obj, int socket)
 {
   ES_WIFI_Status_t ret;
   LOCK_WIFI();
+  AT_InvalidateSocketCache(Obj);
   sprintf((char*)Obj->CmdData,"P0=%d\r", socket);
   ret = AT_ExecuteCommand(Obj, Obj->CmdData, Obj->CmdData);
   if(ret != ES_WIFI_STATUS_OK)
@@ -2013,6 +2156,7 @@ ES_WIFI_Status_t ES_WIFI_StartServerMultiConn(ES_WIFIObject_t *Obj, ES_WIFI_Conn
   ret = AT_ExecuteCommand(Obj, Obj->CmdData, Obj->CmdData);
   if(ret == ES_WIFI_STATUS_OK)
   {
+    AT_InvalidateSocketCache(Obj);
     sprintf((char*)Obj->CmdData,"P0=%d\r", conn->Number);
     ret = AT_ExecuteCommand(Obj, Obj->CmdData, Obj->CmdData);
     if(ret == ES_WIFI_STATUS_OK)
@@ -2070,6 +2214,7 @@ ES_WIFI_Status_t ES_WIFI_StopServerMultiConn(ES_WIFIObject_t *Obj, ES_WIFI_Conn_
   ES_WIFI_Status_t ret = ES_WIFI_STATUS_OK;
   LOCK_WIFI();
 
+  AT_InvalidateSocketCache(Obj);
   sprintf((char*)Obj->CmdData,"P0=%d\r", conn->Number);
   ret = AT_ExecuteCommand(Obj, Obj->CmdData, Obj->CmdData);
   if(ret != ES_WIFI_STATUS_OK)
@@ -2152,12 +2297,10 @@ ES_WIFI_Status_t ES_WIFI_SendData(ES_WIFIObject_t *Obj, uint8_t Socket, uint8_t
   if(Reqlen >= ES_WIFI_PAYLOAD_SIZE ) Reqlen= ES_WIFI_PAYLOAD_SIZE;
 
   *SentLen = Reqlen;
-  sprintf((char*)Obj->CmdData,"P0=%d\r", Socket);
-  ret = AT_ExecuteCommand(Obj, Obj->CmdData, Obj->CmdData);
+  ret = AT_SelectSocket(Obj, Socket);
   if(ret == ES_WIFI_STATUS_OK)
   {
-    sprintf((char*)Obj->CmdData,"S2=%lu\r",wkgTimeOut);
-    ret = AT_ExecuteCommand(Obj, Obj->CmdData, Obj->CmdData);
+    ret = AT_SetWriteTimeout(Obj, wkgTimeOut);
 
     if(ret == ES_WIFI_STATUS_OK)
     {
@@ -2212,8 +2355,7 @@ ES_WIFI_Status_t  ES_WIFI_SendDataTo(ES_WIFIObject_t *Obj, uint8_t Socket, uint8
 
   LOCK_WIFI();
 
-  sprintf((char*)Obj->CmdData,"P0=%d\r", Socket);
-  ret = AT_ExecuteCommand(Obj, Obj->CmdData, Obj->CmdData);
+  ret = AT_SelectSocket(Obj, Socket);
 
   if (ret == ES_WIFI_STATUS_OK)
   {
@@ -2244,8 +2386,7 @@ ES_WIFI_Status_t  ES_WIFI_SendDataTo(ES_WIFIObject_t *Obj, uint8_t Socket, uint8
 
   if(ret == ES_WIFI_STATUS_OK)
   {
-    sprintf((char*)Obj->CmdData, "S2=%lu\r", wkgTimeOut);
-    ret = AT_ExecuteCommand(Obj, Obj->CmdData, Obj->CmdData);
+    ret = AT_SetWriteTimeout(Obj, wkgTimeOut);
   }
 
   if(ret == ES_WIFI_STATUS_OK)
@@ -2312,34 +2453,23 @@ ES_WIFI_Status_t ES_WIFI_ReceiveData(ES_WIFIObject_t *Obj, uint8_t Socket, uint8
 
   if(Reqlen <= ES_WIFI_PAYLOAD_SIZE )
   {
-    sprintf((char*)Obj->CmdData,"P0=%d\r", Socket);
-    ret = AT_ExecuteCommand(Obj, Obj->CmdData, Obj->CmdData);
+    /* Socket, length and timeout are only sent when they change.  */
+    ret = AT_SelectSocket(Obj, Socket);
 
     if(ret == ES_WIFI_STATUS_OK)
     {
-      sprintf((char*)Obj->CmdData,"R1=%d\r", Reqlen);
-      ret = AT_ExecuteCommand(Obj, Obj->CmdData, Obj->CmdData);
+      ret = AT_SetReadConfig(Obj, Reqlen, wkgTimeOut);
       if(ret == ES_WIFI_STATUS_OK)
       {
-        sprintf((char*)Obj->CmdData,"R2=%lu\r", wkgTimeOut);
-        ret = AT_ExecuteCommand(Obj, Obj->CmdData, Obj->CmdData);
-        if(ret == ES_WIFI_STATUS_OK)
-        {
-          sprintf((char*)Obj->CmdData,"R0\r");
-          ret = AT_RequestReceiveData(Obj, Obj->CmdData, (char *)pdata, Reqlen, Receivedlen);
-          if (ret != ES_WIFI_STATUS_OK)
-          {
-            DEBUG("AT_RequestReceiveData  failed\r\n");
-          }
-        }
-        else
+        sprintf((char*)Obj->CmdData,"R0\r");
+        ret = AT_RequestReceiveDataCopy(Obj, Obj->CmdData, (char *)pdata, Reqlen, Receivedlen);
+        if (ret != ES_WIFI_STATUS_OK)
         {
-         DEBUG("setting timeout failed\r\n");
+          DEBUG("AT_RequestReceiveData  failed\r\n");
         }
       }
       else
       {
-        DEBUG("setting requested len failed\r\n");
         *Receivedlen = 0;
       }
     }
@@ -2353,14 +2483,34 @@ ES_WIFI_Status_t ES_WIFI_ReceiveData(ES_WIFIObject_t *Obj, uint8_t Socket, uint8
   return ret;
 }
 
-
-ES_WIFI_Status_t  ES_WIFI_ReceiveDataFrom(ES_WIFIObject_t *Obj, uint8_t Socket, uint8_t *pdata, uint16_t Reqlen, uint16_t *Receivedlen, uint32_t Timeout, uint8_t *IPaddr, uint16_t *pPort)
+/**
+  * @brief  Receive data over WIFI directly into the caller's buffer.
+  * @param  Obj: pointer to module handle
+  * @param  Socket: number of the socket
+  * @param  pbuf: buffer receiving the AT response, payload included
+  * @param  bufsize: size of pbuf, ES_WIFI_RECEIVE_OVERHEAD more than the data requested
+  * @param  Offset: (OUT) offset of the payload in pbuf
+  * @param  Receivedlen: (OUT) length of the payload
+  * @param  Timeout: read timeout in mS
+  * @retval Operation Status.
+  */
+ES_WIFI_Status_t ES_WIFI_ReceiveDataInPlace(ES_WIFIObject_t *Obj, uint8_t Socket, uint8_t *pbuf, uint16_t bufsize, uint16_t *Offset, uint16_t *Receivedlen, uint32_t Timeout)
 {
   uint32_t wkgTimeOut;
+  uint16_t Reqlen;
+  uint8_t *p;
 
   ES_WIFI_Status_t ret = ES_WIFI_STATUS_ERROR;
+
+  *Offset = 0;
   *Receivedlen = 0;
 
+  if (bufsize <= ES_WIFI_RECEIVE_OVERHEAD)
+  {
+    return ES_WIFI_STATUS_ERROR;
+  }
+
+  Reqlen = MIN(bufsize - ES_WIFI_RECEIVE_OVERHEAD, ES_WIFI_PAYLOAD_SIZE);
 
   if (Timeout == 0)
   {
@@ -2373,40 +2523,73 @@ ES_WIFI_Status_t  ES_WIFI_ReceiveDataFrom(ES_WIFIObject_t *Obj, uint8_t Socket,
 
   LOCK_WIFI();
 
-  if (Reqlen <= ES_WIFI_PAYLOAD_SIZE )
+  /* Socket, length and timeout are only sent when they change.  */
+  ret = AT_SelectSocket(Obj, Socket);
+  if(ret == ES_WIFI_STATUS_OK)
   {
-    sprintf((char*)Obj->CmdData, "P0=%d\r", Socket);
-    ret = AT_ExecuteCommand(Obj, Obj->CmdData, Obj->CmdData);
+    ret = AT_SetReadConfig(Obj, Reqlen, wkgTimeOut);
   }
 
   if(ret == ES_WIFI_STATUS_OK)
   {
-    sprintf((char*)Obj->CmdData,"R1=%d\r", Reqlen);
-    ret = AT_ExecuteCommand(Obj, Obj->CmdData, Obj->CmdData);
+    ret = AT_RequestReceiveData(Obj, (uint8_t*)"R0\r", pbuf, bufsize, &p, Receivedlen);
+    if (ret == ES_WIFI_STATUS_OK)
+    {
+      if (*Receivedlen > Reqlen)
+      {
+        DEBUG("AT_RequestReceiveData overflow\r\n.");
+        *Receivedlen = 0;
+        ret = ES_WIFI_STATUS_ERROR;
+      }
+      else
+      {
+        *Offset = (uint16_t)(p - pbuf);
+      }
+    }
+  }
+
+  UNLOCK_WIFI();
+  return ret;
+}
+
+
+ES_WIFI_Status_t  ES_WIFI_ReceiveDataFrom(ES_WIFIObject_t *Obj, uint8_t Socket, uint8_t *pdata, uint16_t Reqlen, uint16_t *Receivedlen, uint32_t Timeout, uint8_t *IPaddr, uint16_t *pPort)
+{
+  uint32_t wkgTimeOut;
+
+  ES_WIFI_Status_t ret = ES_WIFI_STATUS_ERROR;
+  *Receivedlen = 0;
+
+
+  if (Timeout == 0)
+  {
+    wkgTimeOut = NET_DEFAULT_NOBLOCKING_READ_TIMEOUT;
   }
   else
   {
-    DEBUG("P0 failed.\r\n");
+    wkgTimeOut = Timeout;
+  }
+
+  LOCK_WIFI();
+
+  if (Reqlen <= ES_WIFI_PAYLOAD_SIZE )
+  {
+    ret = AT_SelectSocket(Obj, Socket);
   }
 
   if(ret == ES_WIFI_STATUS_OK)
   {
-    sprintf((char*)Obj->CmdData,"R2=%lu\r", wkgTimeOut);
-    ret = AT_ExecuteCommand(Obj, Obj->CmdData, Obj->CmdData);
+    ret = AT_SetReadConfig(Obj, Reqlen, wkgTimeOut);
   }
   else
   {
-    DEBUG("R1 failed.\r\n");
+    DEBUG("P0 failed.\r\n");
   }
 
   if(ret == ES_WIFI_STATUS_OK)
   {
     sprintf((char*)Obj->CmdData,"R0\r");
-    ret = AT_RequestReceiveData(Obj, Obj->CmdData, (char *)pdata, Reqlen, Receivedlen);
-  }
-  else
-  {
-    DEBUG("R2 failed.\r\n");
+    ret = AT_RequestReceiveDataCopy(Obj, Obj->CmdData, (char *)pdata, Reqlen, Receivedlen);
   }
 
   if (ret == ES_WIFI_STATUS_OK)
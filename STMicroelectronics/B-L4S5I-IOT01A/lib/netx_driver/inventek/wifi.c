@@ -507,6 +507,26 @@ WIFI_Status_t WIFI_ReceiveData(uint8_t socket, uint8_t *pdata, uint16_t Reqlen,
   return ret;
 }
 
+/**
+  * @brief  Receive Data from a socket without copying it out of the Rx buffer
+  * @param  pbuf : pointer to Rx buffer, which also receives the AT framing
+  * @param  bufsize : size of the Rx buffer, ES_WIFI_RECEIVE_OVERHEAD more than the data requested
+  * @param  Offset : (OUT) offset of the received data in the Rx buffer
+  * @param  RcvDatalen : (OUT) length of the data actually received
+  * @param  Timeout : Socket read timeout (ms)
+  * @retval Operation status
+  */
+WIFI_Status_t WIFI_ReceiveDataInPlace(uint8_t socket, uint8_t *pbuf, uint16_t bufsize, uint16_t *Offset, uint16_t *RcvDatalen, uint32_t Timeout)
+{
+  WIFI_Status_t ret = WIFI_STATUS_ERROR;
+
+  if(ES_WIFI_ReceiveDataInPlace(&EsWifiObj, socket, pbuf, bufsize, Offset, RcvDatalen, Timeout) == ES_WIFI_STATUS_OK)
+  {
+    ret = WIFI_STATUS_OK;
+  }
+  return ret;
+}
+
 /**
   * @brief  Receive Data from a socket
   * @param  pdata : pointer to Rx buffer
@@ -45,6 +45,12 @@
 #define NX_DRIVER_THREAD_INTERVAL               NX_IP_PERIODIC_RATE
 #endif /* NX_DRIVER_THREAD_INTERVAL */
 
+/* Interval to receive packets while data is flowing. The poll interval doubles from this value
+   up to NX_DRIVER_THREAD_INTERVAL each time a poll finds no data.  */
+#ifndef NX_DRIVER_THREAD_INTERVAL_MINIMUM
+#define NX_DRIVER_THREAD_INTERVAL_MINIMUM       1
+#endif /* NX_DRIVER_THREAD_INTERVAL_MINIMUM */
+
 /* Define the maximum sockets at the same time. This is limited by hardware TCP/IP on STM32L4.  */
 #define NX_DRIVER_SOCKETS_MAXIMUM               4
 
@@ -90,14 +96,28 @@ typedef struct NX_DRIVER_SOCKET_STRUCT
     USHORT               remote_port;
     UCHAR                tcp_connected;
     UCHAR                is_client;
-    USHORT               reseverd;
+    UCHAR                response_pending;
+    UCHAR                reseverd;
+    ULONG                request_time;
+    NX_DRIVER_SOCKET_STATISTICS statistics;
 } NX_DRIVER_SOCKET;
 
+/* Define the event flag of each socket that wakes up the driver thread.  */
+#define NX_DRIVER_SOCKET_EVENT(i)               ((ULONG)1 << (i))
+#define NX_DRIVER_SOCKET_EVENT_ALL              (NX_DRIVER_SOCKET_EVENT(NX_DRIVER_SOCKETS_MAXIMUM) - 1)
+
 static NX_DRIVER_INFORMATION nx_driver_information;
 static NX_DRIVER_SOCKET nx_driver_sockets[NX_DRIVER_SOCKETS_MAXIMUM];
+static const NX_DRIVER_SOCKET_STATISTICS nx_driver_statistics_empty;
 static TX_THREAD nx_driver_thread;
 static UCHAR nx_driver_thread_stack[NX_DRIVER_STACK_SIZE];
 
+/* Mutex to serialize access to the WiFi module, so receive polling does not need the IP mutex.  */
+static TX_MUTEX nx_driver_wifi_mutex;
+
+/* Event flags to wake up the driver thread when a socket expects incoming data.  */
+static TX_EVENT_FLAGS_GROUP nx_driver_events;
+
 /* Define the routines for processing each driver entry request.  The contents of these routines will change with
    each driver. However, the main driver entry function will not change, except for the entry function name.  */
    
@@ -119,6 +139,10 @@ static UINT         _nx_driver_tcpip_handler(struct NX_IP_STRUCT *ip_ptr,
                                              VOID *socket_ptr, UINT operation, NX_PACKET *packet_ptr,
                                              NXD_ADDRESS *local_ip, NXD_ADDRESS *remote_ip,
                                              UINT local_port, UINT *remote_port, UINT wait_option);
+static UINT         _nx_driver_tcpip_request(VOID *socket_ptr, UINT operation, NX_PACKET *packet_ptr,
+                                             NXD_ADDRESS *local_ip, NXD_ADDRESS *remote_ip,
+                                             UINT local_port, UINT *remote_port, UINT wait_option);
+static VOID         _nx_driver_socket_response_expect(UINT socket_index);
 
 /* Define the prototypes for the hardware implementation of this driver. The contents of these routines are
    driver-specific.  */
@@ -967,7 +991,10 @@ static VOID  _nx_driver_deferred_processing(NX_IP_DRIVER *driver_req_ptr)
 /*                                                                        */ 
 /*    This function is the driver thread entry. In this thread, it        */ 
 /*    performs checking for incoming TCP and UDP packets. On new packet,  */ 
-/*    it will be passed to NetX.                                          */
+/*    it will be passed to NetX. The thread wakes up when a socket        */
+/*    expects a response, and otherwise polls at an interval that backs   */
+/*    off while sockets are idle. The WiFi module is accessed outside of  */
+/*    the IP mutex.                                                       */
 /*                                                                        */ 
 /*  INPUT                                                                 */ 
 /*                                                                        */ 
@@ -979,9 +1006,11 @@ static VOID  _nx_driver_deferred_processing(NX_IP_DRIVER *driver_req_ptr)
 /*                                                                        */ 
 /*  CALLS                                                                 */ 
 /*                                                                        */ 
+/*    tx_event_flags_get                    Wait for socket events        */
 /*    tx_mutex_get                          Obtain protection mutex       */
 /*    tx_mutex_put                          Release protection mutex      */
-/*    tx_thread_sleep                       Sleep driver thread           */
+/*    tx_time_get                           Get system time               */
+/*    WIFI_ReceiveDataInPlace               Receive data from WiFi module */
 /*    nx_packet_allocate                    Allocate a packet for incoming*/
 /*                                            TCP and UDP data            */
 /*    _nx_tcp_socket_driver_packet_receive  Receive TCP packet            */
@@ -1008,6 +1037,13 @@ UINT status;
 NXD_ADDRESS local_ip;
 NXD_ADDRESS remote_ip;
 uint16_t data_length;
+uint16_t data_offset;
+VOID *socket_ptr;
+ULONG events;
+ULONG poll_mask;
+ULONG active_mask = 0;
+ULONG interval = NX_DRIVER_THREAD_INTERVAL;
+ULONG current_time;
 NX_IP *ip_ptr = nx_driver_information.nx_driver_information_ip_ptr;
 NX_INTERFACE *interface_ptr = nx_driver_information.nx_driver_information_interface;
 NX_PACKET_POOL *pool_ptr = nx_driver_information.nx_driver_information_packet_pool_ptr;
@@ -1016,17 +1052,42 @@ NX_PACKET_POOL *pool_ptr = nx_driver_information.nx_driver_information_packet_po
 
     for (;;)
     {
-        
-        /* Obtain the IP internal mutex before processing the IP event.  */
-        tx_mutex_get(&(ip_ptr -> nx_ip_protection), TX_WAIT_FOREVER);
 
-        /* Loop through TCP socket.  */
+        /* Wait for a socket to expect data, or for the poll interval to expire.  */
+        if (tx_event_flags_get(&nx_driver_events, NX_DRIVER_SOCKET_EVENT_ALL, TX_OR_CLEAR,
+                               &events, interval) == TX_SUCCESS)
+        {
+
+            /* Poll the signaled sockets and the sockets that had data in the last pass.  */
+            poll_mask = events | active_mask;
+        }
+        else
+        {
+
+            /* Poll interval expired. Poll all sockets.  */
+            poll_mask = NX_DRIVER_SOCKET_EVENT_ALL;
+        }
+        active_mask = 0;
+
+        /* Loop through sockets.  */
         for (i = 0; i < NX_DRIVER_SOCKETS_MAXIMUM; i++)
         {
-            if (nx_driver_sockets[i].socket_ptr == NX_NULL)
+            if ((poll_mask & NX_DRIVER_SOCKET_EVENT(i)) == 0)
+            {
+
+                /* Skip sockets not scheduled in this pass.  */
+                continue;
+            }
+
+            /* Obtain the IP internal mutex to inspect the socket.  */
+            tx_mutex_get(&(ip_ptr -> nx_ip_protection), TX_WAIT_FOREVER);
+
+            socket_ptr = nx_driver_sockets[i].socket_ptr;
+            if (socket_ptr == NX_NULL)
             {
 
                 /* Skip sockets not used.  */
+                tx_mutex_put(&(ip_ptr -> nx_ip_protection));
                 continue;
             }
 
@@ -1035,6 +1096,7 @@ NX_PACKET_POOL *pool_ptr = nx_driver_information.nx_driver_information_packet_po
             {
 
                 /* Skip sockets not listening.  */
+                tx_mutex_put(&(ip_ptr -> nx_ip_protection));
                 continue;
             }
 
@@ -1047,11 +1109,11 @@ NX_PACKET_POOL *pool_ptr = nx_driver_information.nx_driver_information_packet_po
                 {
 
                     /* TCP server. Try accept. */
-                    if (_nx_tcp_socket_driver_establish(nx_driver_sockets[i].socket_ptr, interface_ptr, 0))
+                    if (_nx_tcp_socket_driver_establish(socket_ptr, interface_ptr, 0))
                     {
 
-                        /* NetX TCP socket is not ready to accept. Just sleep to avoid starving.  */
-                        tx_thread_sleep(NX_DRIVER_THREAD_INTERVAL);
+                        /* NetX TCP socket is not ready to accept. Try again in the next pass.  */
+                        tx_mutex_put(&(ip_ptr -> nx_ip_protection));
                         continue;
                     }
                 }
@@ -1061,6 +1123,9 @@ NX_PACKET_POOL *pool_ptr = nx_driver_information.nx_driver_information_packet_po
                 packet_type = NX_UDP_PACKET;
             } 
 
+            /* Release the IP internal mutex while talking to the WiFi module.  */
+            tx_mutex_put(&(ip_ptr -> nx_ip_protection));
+
             /* Loop to receive all data on current socket.  */
             for (;;)
             {
@@ -1074,15 +1139,32 @@ NX_PACKET_POOL *pool_ptr = nx_driver_information.nx_driver_information_packet_po
                 /* Get available size of packet.  */
                 data_length = (uint16_t)(packet_ptr -> nx_packet_data_end - packet_ptr -> nx_packet_prepend_ptr);
 
-                /* Limit the data length to ES_WIFI_PAYLOAD_SIZE due to underlayer limitation.  */
-                if (data_length > ES_WIFI_PAYLOAD_SIZE)
+                /* Limit the data length to ES_WIFI_PAYLOAD_SIZE due to underlayer limitation.
+                   The AT framing around the data is received into the packet as well.  */
+                if (data_length > (ES_WIFI_PAYLOAD_SIZE + ES_WIFI_RECEIVE_OVERHEAD))
                 {
-                    data_length = ES_WIFI_PAYLOAD_SIZE;
+                    data_length = ES_WIFI_PAYLOAD_SIZE + ES_WIFI_RECEIVE_OVERHEAD;
                 }
 
-                /* Receive data without suspending.  */
-                status = WIFI_ReceiveData(i, (uint8_t*)(packet_ptr -> nx_packet_prepend_ptr),
-                                          data_length, &data_length, NX_NO_WAIT);
+                /* Receive data into the packet without suspending.  */
+                tx_mutex_get(&nx_driver_wifi_mutex, TX_WAIT_FOREVER);
+                status = WIFI_ReceiveDataInPlace(i, (uint8_t*)(packet_ptr -> nx_packet_prepend_ptr),
+                                                 data_length, &data_offset, &data_length, NX_NO_WAIT);
+                tx_mutex_put(&nx_driver_wifi_mutex);
+
+                /* Obtain the IP internal mutex to pass the result to NetX.  */
+                tx_mutex_get(&(ip_ptr -> nx_ip_protection), TX_WAIT_FOREVER);
+
+                if (nx_driver_sockets[i].socket_ptr != socket_ptr)
+                {
+
+                    /* Socket was closed while receiving.  */
+                    tx_mutex_put(&(ip_ptr -> nx_ip_protection));
+                    nx_packet_release(packet_ptr);
+                    break;
+                }
+
+                nx_driver_sockets[i].statistics.receive_polls++;
 
                 if (status != WIFI_STATUS_OK)
                 {
@@ -1090,14 +1172,15 @@ NX_PACKET_POOL *pool_ptr = nx_driver_information.nx_driver_information_packet_po
                     /* Connection error. Notify upper layer with Null packet.  */
                     if (nx_driver_sockets[i].protocol == NX_PROTOCOL_TCP)
                     {
-                        _nx_tcp_socket_driver_packet_receive(nx_driver_sockets[i].socket_ptr, NX_NULL);
+                        _nx_tcp_socket_driver_packet_receive(socket_ptr, NX_NULL);
                         nx_driver_sockets[i].tcp_connected = NX_FALSE;
                     }
                     else
                     {
-                        _nx_udp_socket_driver_packet_receive(nx_driver_sockets[i].socket_ptr, NX_NULL,
+                        _nx_udp_socket_driver_packet_receive(socket_ptr, NX_NULL,
                                                              NX_NULL, NX_NULL, 0);
                     }
+                    tx_mutex_put(&(ip_ptr -> nx_ip_protection));
                     nx_packet_release(packet_ptr);
                     break;
                 }
@@ -1106,11 +1189,33 @@ NX_PACKET_POOL *pool_ptr = nx_driver_information.nx_driver_information_packet_po
                 {
 
                     /* No incoming data.  */
+                    nx_driver_sockets[i].statistics.receive_empty_polls++;
+                    tx_mutex_put(&(ip_ptr -> nx_ip_protection));
                     nx_packet_release(packet_ptr);
                     break;
                 }
 
-                /* Set packet length.  */
+                /* Update statistics.  */
+                nx_driver_sockets[i].statistics.receive_packets++;
+                nx_driver_sockets[i].statistics.receive_bytes += data_length;
+                if (nx_driver_sockets[i].response_pending)
+                {
+
+                    /* First data after a request. Record the response latency.  */
+                    current_time = tx_time_get();
+                    nx_driver_sockets[i].statistics.receive_latency_last =
+                        current_time - nx_driver_sockets[i].request_time;
+                    if (nx_driver_sockets[i].statistics.receive_latency_last >
+                        nx_driver_sockets[i].statistics.receive_latency_max)
+                    {
+                        nx_driver_sockets[i].statistics.receive_latency_max =
+                            nx_driver_sockets[i].statistics.receive_latency_last;
+                    }
+                    nx_driver_sockets[i].response_pending = NX_FALSE;
+                }
+
+                /* Skip the AT framing and set packet length.  */
+                packet_ptr -> nx_packet_prepend_ptr += data_offset;
                 packet_ptr -> nx_packet_length = (ULONG)data_length;
                 packet_ptr -> nx_packet_append_ptr = packet_ptr -> nx_packet_prepend_ptr + data_length;
                 packet_ptr -> nx_packet_ip_interface = interface_ptr;
@@ -1118,7 +1223,7 @@ NX_PACKET_POOL *pool_ptr = nx_driver_information.nx_driver_information_packet_po
                 /* Pass it to NetXDuo.  */
                 if (nx_driver_sockets[i].protocol == NX_PROTOCOL_TCP)
                 {
-                    _nx_tcp_socket_driver_packet_receive(nx_driver_sockets[i].socket_ptr, packet_ptr);
+                    _nx_tcp_socket_driver_packet_receive(socket_ptr, packet_ptr);
                 }
                 else
                 {
@@ -1129,18 +1234,32 @@ NX_PACKET_POOL *pool_ptr = nx_driver_information.nx_driver_information_packet_po
                     local_ip.nxd_ip_version = NX_IP_VERSION_V4;
                     local_ip.nxd_ip_address.v4 = nx_driver_sockets[i].local_ip;
 
-                    _nx_udp_socket_driver_packet_receive(nx_driver_sockets[i].socket_ptr,
+                    _nx_udp_socket_driver_packet_receive(socket_ptr,
                                                          packet_ptr, &local_ip, &remote_ip,
                                                          nx_driver_sockets[i].remote_port);
                 }
+
+                /* Release the IP internal mutex.  */
+                tx_mutex_put(&(ip_ptr -> nx_ip_protection));
+
+                /* Keep polling this socket while data is flowing.  */
+                active_mask |= NX_DRIVER_SOCKET_EVENT(i);
+            }
+        }
+
+        /* Poll quickly while data is flowing, otherwise back off to the idle interval.  */
+        if (active_mask)
+        {
+            interval = NX_DRIVER_THREAD_INTERVAL_MINIMUM;
+        }
+        else if (interval < NX_DRIVER_THREAD_INTERVAL)
+        {
+            interval <<= 1;
+            if (interval > NX_DRIVER_THREAD_INTERVAL)
+            {
+                interval = NX_DRIVER_THREAD_INTERVAL;
             }
         }
-        
-        /* Release the IP internal mutex before processing the IP event.  */
-        tx_mutex_put(&(ip_ptr -> nx_ip_protection));
-        
-        /* Sleep some ticks to next loop.  */
-        tx_thread_sleep(NX_DRIVER_THREAD_INTERVAL);
     }
 }
 
@@ -1157,7 +1276,8 @@ NX_PACKET_POOL *pool_ptr = nx_driver_information.nx_driver_information_packet_po
 /*                                                                        */
 /*  DESCRIPTION                                                           */ 
 /*                                                                        */ 
-/*    This function processing the TCP/IP request.                        */
+/*    This function processing the TCP/IP request. Access to the WiFi     */
+/*    module is serialized with the driver thread by the WiFi mutex.      */
 /*                                                                        */ 
 /*  INPUT                                                                 */ 
 /*                                                                        */ 
@@ -1178,7 +1298,9 @@ NX_PACKET_POOL *pool_ptr = nx_driver_information.nx_driver_information_packet_po
 /*                                                                        */ 
 /*  CALLS                                                                 */ 
 /*                                                                        */ 
-/*    nx_packet_transmit_release            Release transmittion packet   */
+/*    tx_mutex_get                          Obtain WiFi mutex             */
+/*    tx_mutex_put                          Release WiFi mutex            */
+/*    _nx_driver_tcpip_request              Perform TCP/IP request        */
 /*                                                                        */
 /*  CALLED BY                                                             */ 
 /*                                                                        */ 
@@ -1197,6 +1319,30 @@ static UINT _nx_driver_tcpip_handler(struct NX_IP_STRUCT *ip_ptr,
                                      NXD_ADDRESS *local_ip, NXD_ADDRESS *remote_ip,
                                      UINT local_port, UINT *remote_port, UINT wait_option)
 {
+UINT status;
+
+    NX_PARAMETER_NOT_USED(ip_ptr);
+    NX_PARAMETER_NOT_USED(interface_ptr);
+
+    /* Obtain exclusive access to the WiFi module.  */
+    tx_mutex_get(&nx_driver_wifi_mutex, TX_WAIT_FOREVER);
+
+    status = _nx_driver_tcpip_request(socket_ptr, operation, packet_ptr,
+                                      local_ip, remote_ip, local_port, remote_port, wait_option);
+
+    /* Release the WiFi module.  */
+    tx_mutex_put(&nx_driver_wifi_mutex);
+
+    return(status);
+}
+
+
+/* Perform a TCP/IP request on the WiFi module. The caller must hold the
+   WiFi mutex.  */
+static UINT _nx_driver_tcpip_request(VOID *socket_ptr, UINT operation, NX_PACKET *packet_ptr,
+                                     NXD_ADDRESS *local_ip, NXD_ADDRESS *remote_ip,
+                                     UINT local_port, UINT *remote_port, UINT wait_option)
+{
 UINT status = NX_NOT_SUCCESSFUL;
 UCHAR remote_ip_bytes[4];
 NX_PACKET *current_packet;
@@ -1243,6 +1389,8 @@ UINT i;
 
                 /* Find an empty entry.  */
                 nx_driver_sockets[i].socket_ptr = socket_ptr;
+                nx_driver_sockets[i].response_pending = NX_FALSE;
+                nx_driver_sockets[i].statistics = nx_driver_statistics_empty;
                 break;
             }
         }
@@ -1289,6 +1437,9 @@ UINT i;
         nx_driver_sockets[i].remote_port = *remote_port;
         nx_driver_sockets[i].protocol = NX_PROTOCOL_TCP;
         nx_driver_sockets[i].is_client = NX_TRUE;
+
+        /* Start polling the new connection.  */
+        _nx_driver_socket_response_expect(i);
         break;
 
     case NX_TCPIP_OFFLOAD_TCP_SERVER_SOCKET_LISTEN:
@@ -1341,6 +1492,9 @@ UINT i;
         nx_driver_sockets[i].remote_ip = remote_ip -> nxd_ip_address.v4;
         *remote_port = (UINT)nx_driver_sockets[i].remote_port;
         nx_driver_sockets[i].tcp_connected = NX_TRUE;
+
+        /* Start polling the new connection.  */
+        _nx_driver_socket_response_expect(i);
         break;
 
     case NX_TCPIP_OFFLOAD_TCP_SERVER_SOCKET_UNLISTEN:
@@ -1498,6 +1652,9 @@ UINT i;
 
         /* Release the packet.  */
         nx_packet_transmit_release(packet_ptr);
+
+        /* Poll for the response.  */
+        _nx_driver_socket_response_expect(i);
         break;
 
     case NX_TCPIP_OFFLOAD_TCP_SOCKET_SEND:
@@ -1570,6 +1727,9 @@ UINT i;
 
         /* Release the packet.  */
         nx_packet_transmit_release(packet_ptr);
+
+        /* Poll for the response.  */
+        _nx_driver_socket_response_expect(i);
         break;
 
     default:
@@ -1580,6 +1740,41 @@ UINT i;
 }
 
 
+/* Record that a socket expects incoming data and wake up the driver
+   thread to poll it.  */
+static VOID _nx_driver_socket_response_expect(UINT socket_index)
+{
+    if (nx_driver_sockets[socket_index].response_pending == NX_FALSE)
+    {
+
+        /* Measure latency from the first unanswered request.  */
+        nx_driver_sockets[socket_index].request_time = tx_time_get();
+        nx_driver_sockets[socket_index].response_pending = NX_TRUE;
+    }
+
+    tx_event_flags_set(&nx_driver_events, NX_DRIVER_SOCKET_EVENT(socket_index), TX_OR);
+}
+
+
+/* Retrieve the receive statistics of a driver socket.  */
+UINT  nx_driver_stm32l4_socket_statistics_get(UINT socket_index, NX_DRIVER_SOCKET_STATISTICS *statistics_ptr)
+{
+TX_INTERRUPT_SAVE_AREA
+
+    if ((socket_index >= NX_DRIVER_SOCKETS_MAXIMUM) || (statistics_ptr == NX_NULL))
+    {
+        return(NX_PTR_ERROR);
+    }
+
+    /* Copy the counters without being interrupted by the driver thread.  */
+    TX_DISABLE
+    *statistics_ptr = nx_driver_sockets[socket_index].statistics;
+    TX_RESTORE
+
+    return(NX_SUCCESS);
+}
+
+
 /****** DRIVER SPECIFIC ****** Start of part/vendor specific internal driver functions.  */
 
 
@@ -1608,6 +1803,8 @@ UINT i;
 /*  CALLS                                                                 */ 
 /*                                                                        */ 
 /*    tx_thread_info_get                    Get thread information        */ 
+/*    tx_mutex_create                       Create WiFi mutex             */
+/*    tx_event_flags_create                 Create driver events          */
 /*    tx_thread_create                      Create driver thread          */ 
 /*                                                                        */
 /*  CALLED BY                                                             */ 
@@ -1630,6 +1827,21 @@ UINT priority = 0;
     tx_thread_info_get(tx_thread_identify(), NX_NULL, NX_NULL, NX_NULL, &priority,
                        NX_NULL, NX_NULL, NX_NULL, NX_NULL);
 
+    /* Create the mutex protecting the WiFi module.  */
+    status = tx_mutex_create(&nx_driver_wifi_mutex, "Driver WiFi Mutex", TX_INHERIT);
+    if (status)
+    {
+        return(status);
+    }
+
+    /* Create the event flags to wake up the driver thread.  */
+    status = tx_event_flags_create(&nx_driver_events, "Driver Events");
+    if (status)
+    {
+        tx_mutex_delete(&nx_driver_wifi_mutex);
+        return(status);
+    }
+
     /* Create the driver thread.  */
     /* The priority of network thread is lower than IP thread.  */
     status = tx_thread_create(&nx_driver_thread, "Driver Thread", _nx_driver_thread_entry, 0,  
@@ -1739,7 +1951,9 @@ UINT i;
         {
 
             /* Disconnect.  */
+            tx_mutex_get(&nx_driver_wifi_mutex, TX_WAIT_FOREVER);
             WIFI_CloseClientConnection(i);
+            tx_mutex_put(&nx_driver_wifi_mutex);
             nx_driver_sockets[i].socket_ptr = NX_NULL;
         }
     }
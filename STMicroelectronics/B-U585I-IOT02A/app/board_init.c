@@ -27,6 +27,7 @@ RNG_HandleTypeDef hrng;
 SPI_HandleTypeDef hspi2;
 
 UART_HandleTypeDef huart1;
+DMA_HandleTypeDef handle_GPDMA1_Channel1;
 
 /* USER CODE BEGIN PV */
 
@@ -364,7 +365,7 @@ static void MX_USART1_UART_Init(void)
         Error_Handler();
     }
     /* USER CODE BEGIN USART1_Init 2 */
-
+    console_init();
     /* USER CODE END USART1_Init 2 */
 }
 
@@ -10,4 +10,7 @@ extern UART_HandleTypeDef huart1;
 
 void board_init(void);
 
+// Route console output through the shared console buffer, see console.c
+void console_init(void);
+
 #endif // _BOARD_INIT_H
@@ -55,6 +55,7 @@ void DebugMon_Handler(void);
 void EXTI14_IRQHandler(void);
 void EXTI15_IRQHandler(void);
 void TIM6_IRQHandler(void);
+void GPDMA1_Channel1_IRQHandler(void);
 void USART1_IRQHandler(void);
 /* USER CODE BEGIN EFP */
 
@@ -38,6 +38,15 @@ static sl_wfx_context_t       nx_sl_wfx_context;
 static NX_PACKET_POOL        *nx_sl_pool_ptr = NULL;
 static NX_IP                 *nx_sl_ip_ptr   = NULL;
 
+#if NX_SL_WFX_RX_PACKET_COUNT > 0
+static NX_PACKET_POOL         nx_sl_rx_pool;
+static ULONG                  nx_sl_rx_pool_area[((NX_SL_WFX_RX_PACKET_SIZE + sizeof(NX_PACKET))
+                                                  * NX_SL_WFX_RX_PACKET_COUNT) / sizeof(ULONG)];
+#endif
+static nx_sl_wfx_rx_statistics_t   nx_sl_rx_statistics;
+static nx_sl_wfx_rx_low_water_cb_t nx_sl_rx_low_water_cb = NULL;
+static UINT                        nx_sl_rx_low_water    = NX_FALSE;
+
 /* Define the routines for processing each driver entry request */
 static UINT nx_sl_driver_initialize(NX_IP_DRIVER *driver_req_ptr);
 static UINT nx_sl_driver_uninitialize(NX_IP_DRIVER *driver_req_ptr);
@@ -140,8 +149,8 @@ void nx_sl_wfx_driver_entry(NX_IP_DRIVER *driver_req_ptr)
       break;
 
     case NX_LINK_GET_RX_COUNT:
-      /* Return the link's line speed in the supplied return pointer. Unsupported feature */
-      *(driver_req_ptr->nx_ip_driver_return_ptr) = 0;
+      /* Return the number of frames passed to the IP stack */
+      *(driver_req_ptr->nx_ip_driver_return_ptr) = nx_sl_rx_statistics.frames;
       break;
 
     case NX_LINK_GET_TX_COUNT:
@@ -150,8 +159,9 @@ void nx_sl_wfx_driver_entry(NX_IP_DRIVER *driver_req_ptr)
       break;
 
     case NX_LINK_GET_ALLOC_ERRORS:
-      /* Return the link's line speed in the supplied return pointer. Unsupported feature */
-      *(driver_req_ptr->nx_ip_driver_return_ptr) = 0;
+      /* Return the number of frames dropped for lack of receive packets */
+      *(driver_req_ptr->nx_ip_driver_return_ptr) = nx_sl_rx_statistics.dropped_no_packet
+                                                   + nx_sl_rx_statistics.dropped_append;
       break;
 
     case NX_LINK_DEFERRED_PROCESSING:
@@ -173,8 +183,56 @@ void nx_sl_wfx_driver_entry(NX_IP_DRIVER *driver_req_ptr)
   }
 }
 
+/**************************************************************************//**
+ * Set the callback invoked when receive packets run low
+ *****************************************************************************/
+void nx_sl_driver_rx_low_water_callback_set(nx_sl_wfx_rx_low_water_cb_t callback)
+{
+  nx_sl_rx_low_water_cb = callback;
+}
+
+/**************************************************************************//**
+ * Get the receive statistics
+ *****************************************************************************/
+void nx_sl_driver_rx_statistics_get(nx_sl_wfx_rx_statistics_t *statistics_ptr)
+{
+  TX_INTERRUPT_SAVE_AREA
+
+  TX_DISABLE
+  *statistics_ptr = nx_sl_rx_statistics;
+  TX_RESTORE
+}
+
+/**************************************************************************//**
+ * Track free receive packets and signal the low-water mark
+ *****************************************************************************/
+static void nx_sl_driver_rx_pool_check(void)
+{
+  ULONG available = nx_sl_pool_ptr->nx_packet_pool_available;
+
+  if (available < nx_sl_rx_statistics.min_available) {
+    nx_sl_rx_statistics.min_available = available;
+  }
+
+  if (available < NX_SL_WFX_RX_LOW_WATER) {
+    /* Signal once per crossing */
+    if (nx_sl_rx_low_water == NX_FALSE) {
+      nx_sl_rx_low_water = NX_TRUE;
+      nx_sl_rx_statistics.low_water_events++;
+      if (nx_sl_rx_low_water_cb != NULL) {
+        nx_sl_rx_low_water_cb(available);
+      }
+    }
+  } else {
+    nx_sl_rx_low_water = NX_FALSE;
+  }
+}
+
 /**************************************************************************//**
  * Receive incoming packet from WF200
+ *
+ * Runs on the WFX bus thread, so it must never block: frames are dropped
+ * and counted when no packet is available.
  *****************************************************************************/
 void nx_sl_driver_receive_callback(sl_wfx_received_ind_t *rx_buffer)
 {
@@ -182,10 +240,15 @@ void nx_sl_driver_receive_callback(sl_wfx_received_ind_t *rx_buffer)
   UCHAR     *packet_buffer;
   UINT      status;
 
+  if (nx_sl_pool_ptr == NULL) {
+    return;
+  }
+
   /* Allocate a NX_PACKET to be passed to the IP stack */
-  status = nx_packet_allocate(nx_sl_pool_ptr, &packet_ptr, NX_IP_PACKET, TX_WAIT_FOREVER);
+  status = nx_packet_allocate(nx_sl_pool_ptr, &packet_ptr, NX_IP_PACKET, NX_NO_WAIT);
+  nx_sl_driver_rx_pool_check();
   if (status != NX_SUCCESS) {
-    printf("nx_sl_driver_receive_callback: unable to allocate memory for receive packet\n");
+    nx_sl_rx_statistics.dropped_no_packet++;
     return;
   }
 
@@ -197,9 +260,10 @@ void nx_sl_driver_receive_callback(sl_wfx_received_ind_t *rx_buffer)
                                  packet_buffer,
                                  rx_buffer->body.frame_length + 2,
                                  nx_sl_pool_ptr,
-                                 TX_WAIT_FOREVER);
+                                 NX_NO_WAIT);
   if (status != NX_SUCCESS) {
-    printf("nx_sl_driver_receive_callback: packet append error\n");
+    nx_sl_rx_statistics.dropped_append++;
+    nx_packet_release(packet_ptr);
     return;
   }
   /* Clean off the offset */
@@ -208,6 +272,9 @@ void nx_sl_driver_receive_callback(sl_wfx_received_ind_t *rx_buffer)
   /* Adjust the packet length */
   packet_ptr->nx_packet_length = packet_ptr->nx_packet_length - 2;
 
+  nx_sl_rx_statistics.frames++;
+  nx_sl_rx_statistics.bytes += packet_ptr->nx_packet_length;
+
   nx_sl_driver_transfer_to_netx(nx_sl_ip_ptr, packet_ptr);
 }
 
@@ -226,8 +293,22 @@ static UINT nx_sl_driver_initialize(NX_IP_DRIVER *driver_req_ptr)
   /* Obtain the index number of the network interface */
   interface_index = driver_req_ptr->nx_ip_driver_interface->nx_interface_index;
 
-  /* Setup the default packet pool for the driver's received packets */
+  /* Setup the packet pool for the driver's received packets */
+#if NX_SL_WFX_RX_PACKET_COUNT > 0
+  error_code = nx_packet_pool_create(&nx_sl_rx_pool, "WFX RX Packet Pool",
+                                     NX_SL_WFX_RX_PACKET_SIZE,
+                                     nx_sl_rx_pool_area, sizeof(nx_sl_rx_pool_area));
+  if (error_code != NX_SUCCESS) {
+    return error_code;
+  }
+  nx_sl_pool_ptr = &nx_sl_rx_pool;
+#else
   nx_sl_pool_ptr = nx_sl_ip_ptr->nx_ip_default_packet_pool;
+#endif
+
+  memset(&nx_sl_rx_statistics, 0, sizeof(nx_sl_rx_statistics));
+  nx_sl_rx_statistics.min_available = nx_sl_pool_ptr->nx_packet_pool_available;
+  nx_sl_rx_low_water = NX_FALSE;
 
   /* Initialize the Ethernet controller */
   error_code = nx_sl_driver_hardware_initialize();
@@ -450,6 +531,12 @@ static UINT nx_sl_driver_uninitialize(NX_IP_DRIVER *driver_req_ptr)
 {
   (void)driver_req_ptr;
 
+  /* Stop handing received frames to the IP stack */
+  nx_sl_pool_ptr = NULL;
+#if NX_SL_WFX_RX_PACKET_COUNT > 0
+  nx_packet_pool_delete(&nx_sl_rx_pool);
+#endif
+
   /* Zero out the driver instance */
   memset(&nx_sl_wfx_context, 0, sizeof(sl_wfx_context_t));
   return NX_SUCCESS;
@@ -27,14 +27,43 @@
 #define NX_SL_WFX_MAX_SSID_LENGTH        32
 #define NX_SL_WFX_MAX_PASSWORD_LENGTH    63
 
+/* Receive packets are taken from a pool owned by the driver, so a busy IP stack
+   cannot starve the WFX bus. The pool is static RAM of
+   (NX_SL_WFX_RX_PACKET_SIZE + sizeof(NX_PACKET)) * NX_SL_WFX_RX_PACKET_COUNT,
+   about 12.8 KB with the defaults. Set the count to 0 to use the IP default
+   pool and save it. */
+#ifndef NX_SL_WFX_RX_PACKET_COUNT
+#define NX_SL_WFX_RX_PACKET_COUNT        8
+#endif
+#define NX_SL_WFX_RX_PACKET_SIZE         1536
+
+/* Number of free receive packets below which the low-water callback fires */
+#ifndef NX_SL_WFX_RX_LOW_WATER
+#define NX_SL_WFX_RX_LOW_WATER           2
+#endif
+
 typedef struct nx_sl_wfx_wifi_info_s {
   CHAR ssid[NX_SL_WFX_MAX_SSID_LENGTH + 1];
   CHAR password[NX_SL_WFX_MAX_PASSWORD_LENGTH + 1];
   sl_wfx_security_mode_t mode;
 } nx_sl_wfx_wifi_info_t;
 
+typedef struct nx_sl_wfx_rx_statistics_s {
+  ULONG frames;               /* Frames passed to the IP stack */
+  ULONG bytes;                /* Bytes passed to the IP stack */
+  ULONG dropped_no_packet;    /* Frames dropped because the pool was empty */
+  ULONG dropped_append;       /* Frames dropped because they did not fit the packet */
+  ULONG low_water_events;     /* Times the free packet count fell below the low-water mark */
+  ULONG min_available;        /* Lowest free packet count seen */
+} nx_sl_wfx_rx_statistics_t;
+
+/* Called from the WFX bus thread when free receive packets drop below the low-water mark */
+typedef void (*nx_sl_wfx_rx_low_water_cb_t)(ULONG available);
+
 void nx_sl_wifi_info_set(nx_sl_wfx_wifi_info_t *wifi_info_ptr);
 void nx_sl_wfx_driver_entry(NX_IP_DRIVER *driver_req_ptr);
 void nx_sl_driver_receive_callback(sl_wfx_received_ind_t *rx_buffer);
+void nx_sl_driver_rx_low_water_callback_set(nx_sl_wfx_rx_low_water_cb_t callback);
+void nx_sl_driver_rx_statistics_get(nx_sl_wfx_rx_statistics_t *statistics_ptr);
 
 #endif /* NX_SL_WFX_DRIVER_H */
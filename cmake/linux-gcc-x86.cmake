@@ -0,0 +1,32 @@
+# Copyright (c) Microsoft Corporation.
+# Licensed under the MIT License.
+
+# Define the CPU architecture for Threadx, the Linux port runs each ThreadX thread on a pthread
+set(THREADX_ARCH "linux")
+set(THREADX_TOOLCHAIN "gnu")
+
+# default to Debug build
+if(NOT CMAKE_BUILD_TYPE)
+    set(CMAKE_BUILD_TYPE "Debug" CACHE STRING "Choose the type of build, options are: Debug Release." FORCE)
+endif()
+
+set(CMAKE_C_COMPILER    gcc)
+set(CMAKE_CXX_COMPILER  g++)
+set(CMAKE_ASM_COMPILER  gcc)
+
+# The ThreadX and NetX Duo Linux ports store pointers in ULONG, so build 32-bit (needs gcc-multilib)
+set(CMAKE_COMMON_FLAGS "-m32 -g3 -fno-strict-aliasing -Wall -Wno-unused-parameter -D_GNU_SOURCE")
+set(CMAKE_C_FLAGS 	"${CMAKE_COMMON_FLAGS}")
+set(CMAKE_CXX_FLAGS "${CMAKE_COMMON_FLAGS}")
+set(CMAKE_ASM_FLAGS "${CMAKE_COMMON_FLAGS}")
+set(CMAKE_EXE_LINKER_FLAGS "-m32 -pthread")
+
+set(CMAKE_C_FLAGS_DEBUG "-O0")
+set(CMAKE_CXX_FLAGS_DEBUG "-O0")
+set(CMAKE_ASM_FLAGS_DEBUG "")
+set(CMAKE_EXE_LINKER_FLAGS_DEBUG "")
+
+set(CMAKE_C_FLAGS_RELEASE "-O2")
+set(CMAKE_CXX_FLAGS_RELEASE "-O2")
+set(CMAKE_ASM_FLAGS_RELEASE "")
+set(CMAKE_EXE_LINKER_FLAGS_RELEASE "")
@@ -38,3 +38,21 @@ macro(print_all_variables)
     endforeach()
     message(STATUS "print_all_variables------------------------------------------}")
 endmacro()
+
+# Generate <PREFIX>_dispatch.c/.h from a DTDL model in shared/model and build them into TARGET
+function(dtdl_dispatch TARGET MODEL PREFIX)
+    find_package(Python3 REQUIRED COMPONENTS Interpreter)
+
+    set(MODEL_DIR ${GSG_BASE_DIR}/shared/model)
+    set(OUTPUT_DIR ${CMAKE_CURRENT_BINARY_DIR}/dispatch)
+    file(GLOB MODEL_FILES ${MODEL_DIR}/*.json)
+
+    add_custom_command(
+        OUTPUT ${OUTPUT_DIR}/${PREFIX}_dispatch.c ${OUTPUT_DIR}/${PREFIX}_dispatch.h
+        COMMAND ${Python3_EXECUTABLE} ${MODEL_DIR}/dtdl_dispatch.py ${MODEL_DIR}/${MODEL} --prefix ${PREFIX} --output ${OUTPUT_DIR}
+        DEPENDS ${MODEL_DIR}/dtdl_dispatch.py ${MODEL_FILES}
+        COMMENT "Generating ${PREFIX} dispatch table from ${MODEL}")
+
+    target_sources(${TARGET} PRIVATE ${OUTPUT_DIR}/${PREFIX}_dispatch.c)
+    target_include_directories(${TARGET} PRIVATE ${OUTPUT_DIR})
+endfunction()
@@ -0,0 +1,190 @@
+# Copyright (c) Microsoft Corporation.
+# Licensed under the MIT License.
+
+"""Generate the property and command dispatch table of a device model.
+
+Reads a DTDL v2 interface and the interfaces of its components, looked up by @id in the same
+directory, and writes <prefix>_dispatch.h and <prefix>_dispatch.c. The header declares one typed
+handler per writable property and command which the application implements, the source holds a
+constant perfect hash table of them for azure_iot_nx_client_register_dispatch_table. The header
+also defines the CBOR key of each telemetry of the model, its index in the contents.
+
+    python dtdl_dispatch.py gsgmxchip-2.json --prefix gsgmxchip --output <dir>
+"""
+
+import argparse
+import glob
+import json
+import os
+import re
+import sys
+
+FNV_PRIME = 16777619
+MASK32 = 0xFFFFFFFF
+
+SCHEMAS = {
+    None: ("AZURE_IOT_DISPATCH_SCHEMA_NONE", "none", ""),
+    "integer": ("AZURE_IOT_DISPATCH_SCHEMA_INTEGER", "integer", ", int32_t value"),
+    "long": ("AZURE_IOT_DISPATCH_SCHEMA_INTEGER", "integer", ", int32_t value"),
+    "boolean": ("AZURE_IOT_DISPATCH_SCHEMA_BOOLEAN", "boolean", ", bool value"),
+    "double": ("AZURE_IOT_DISPATCH_SCHEMA_DOUBLE", "number", ", double value"),
+    "float": ("AZURE_IOT_DISPATCH_SCHEMA_DOUBLE", "number", ", double value"),
+    "string": ("AZURE_IOT_DISPATCH_SCHEMA_STRING", "string", ", const UCHAR* value, UINT value_length"),
+}
+
+
+def fnv_hash(seed, component, name):
+    h = seed
+    for b in component.encode():
+        h = ((h ^ b) * FNV_PRIME) & MASK32
+    h = (h * FNV_PRIME) & MASK32
+    for b in name.encode():
+        h = ((h ^ b) * FNV_PRIME) & MASK32
+    return h ^ (h >> 16)
+
+
+def snake_case(name):
+    return re.sub(r"(?<=[a-z0-9])([A-Z])|(?<=[A-Z])([A-Z])(?=[a-z])", r"_\1\2", name).lower()
+
+
+def has_type(content, dtdl_type):
+    types = content["@type"]
+    return dtdl_type == types or (isinstance(types, list) and dtdl_type in types)
+
+
+def load_interfaces(model_dir):
+    interfaces = {}
+    for path in glob.glob(os.path.join(model_dir, "*.json")):
+        with open(path) as f:
+            model = json.load(f)
+        interfaces[model["@id"]] = model
+    return interfaces
+
+
+def collect_entries(interface, component, interfaces, prefix):
+    entries = []
+    for content in interface["contents"]:
+        if has_type(content, "Component"):
+            if component is not None:
+                sys.exit("error: nested component {}".format(content["name"]))
+            schema = interfaces.get(content["schema"])
+            if schema is None:
+                sys.exit("error: no model for component schema {}".format(content["schema"]))
+            entries += collect_entries(schema, content["name"], interfaces, prefix)
+            continue
+
+        if has_type(content, "Property") and content.get("writable", False):
+            kind, schema, suffix = "AZURE_IOT_DISPATCH_PROPERTY", content["schema"], "set"
+        elif has_type(content, "Command"):
+            kind, schema, suffix = "AZURE_IOT_DISPATCH_COMMAND", content.get("request", {}).get("schema"), "command"
+        else:
+            continue
+
+        if schema not in SCHEMAS:
+            sys.exit("error: unsupported schema {} of {}".format(schema, content["name"]))
+
+        parts = [prefix] + ([snake_case(component)] if component else []) + [snake_case(content["name"]), suffix]
+        entries.append({
+            "component": component,
+            "name": content["name"],
+            "kind": kind,
+            "schema": schema,
+            "handler": "_".join(parts),
+        })
+    return entries
+
+
+def collect_telemetry(interface):
+    # Keys index the contents of the device interface itself, telemetry of components has none
+    return [(content["name"], index) for index, content in enumerate(interface["contents"])
+            if has_type(content, "Telemetry")]
+
+
+def perfect_hash(entries):
+    slot_count = 1
+    while slot_count < len(entries):
+        slot_count *= 2
+
+    # Widen the table when no seed separates the names, a sparse table costs a few empty slots of flash
+    while True:
+        for seed in range(0x811C9DC5, 0x811C9DC5 + 100000):
+            slots = {}
+            for entry in entries:
+                slot = fnv_hash(seed, entry["component"] or "", entry["name"]) & (slot_count - 1)
+                if slot in slots:
+                    break
+                slots[slot] = entry
+            else:
+                return seed, slot_count, slots
+        slot_count *= 2
+
+
+def c_string(value):
+    return "NULL, 0" if value is None else '"{}", {}'.format(value, len(value))
+
+
+def write_header(path, prefix, model_id, entries, telemetry):
+    guard = "_{}_DISPATCH_H".format(prefix.upper())
+    with open(path, "w") as f:
+        f.write("/* Generated from {} by shared/model/dtdl_dispatch.py, do not edit. */\n\n".format(model_id))
+        f.write("#ifndef {0}\n#define {0}\n\n".format(guard))
+        f.write('#include "azure_iot_nx_client.h"\n\n')
+        keys = ["{}_{}_CBOR_KEY".format(prefix.upper(), snake_case(name).upper()) for name, _ in telemetry]
+        width = max([len(key) for key in keys] + [0])
+        for key, (_, index) in zip(keys, telemetry):
+            f.write("#define {} {}\n".format(key.ljust(width), index))
+        if telemetry:
+            f.write("\n")
+        for entry in entries:
+            f.write("UINT {}(AZURE_IOT_NX_CONTEXT* nx_context{});\n".format(
+                entry["handler"], SCHEMAS[entry["schema"]][2]))
+        if entries:
+            f.write("\n")
+        f.write("extern const AZURE_IOT_DISPATCH_TABLE {}_dispatch_table;\n\n".format(prefix))
+        f.write("#endif\n")
+
+
+def write_source(path, prefix, model_id, seed, slot_count, slots):
+    with open(path, "w") as f:
+        f.write("/* Generated from {} by shared/model/dtdl_dispatch.py, do not edit. */\n\n".format(model_id))
+        f.write('#include "{}_dispatch.h"\n\n'.format(prefix))
+        f.write("static const AZURE_IOT_DISPATCH_ENTRY slots[{}] = {{\n".format(slot_count))
+        for slot in range(slot_count):
+            entry = slots.get(slot)
+            if entry is None:
+                f.write("    {0},\n")
+                continue
+            schema, member, _ = SCHEMAS[entry["schema"]]
+            f.write("    {{{}, {}, {}, {}, .handler.{} = {}}},\n".format(
+                c_string(entry["component"]), c_string(entry["name"]), entry["kind"], schema, member,
+                entry["handler"]))
+        f.write("};\n\n")
+        f.write("const AZURE_IOT_DISPATCH_TABLE {}_dispatch_table = {{slots, {}, 0x{:08x}}};\n".format(
+            prefix, slot_count, seed))
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("model")
+    parser.add_argument("--prefix", required=True)
+    parser.add_argument("--output", default=".")
+    args = parser.parse_args()
+
+    with open(args.model) as f:
+        model = json.load(f)
+
+    interfaces = load_interfaces(os.path.dirname(os.path.abspath(args.model)))
+    # A model with no writable properties or commands gets a single empty slot, every lookup misses
+    entries = collect_entries(model, None, interfaces, args.prefix)
+    seed, slot_count, slots = perfect_hash(entries)
+    telemetry = collect_telemetry(model)
+
+    os.makedirs(args.output, exist_ok=True)
+    write_header(os.path.join(args.output, args.prefix + "_dispatch.h"), args.prefix, model["@id"], entries,
+                 telemetry)
+    write_source(os.path.join(args.output, args.prefix + "_dispatch.c"), args.prefix, model["@id"], seed,
+                 slot_count, slots)
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,172 @@
+/* Copyright (c) Microsoft Corporation.
+   Licensed under the MIT License. */
+
+#include "azure_iot_cbor.h"
+
+#include <string.h>
+
+#include "nx_azure_iot.h"
+
+// Major types, pre-shifted into the top three bits of the initial byte
+#define CBOR_UNSIGNED_INT 0x00
+#define CBOR_NEGATIVE_INT 0x20
+#define CBOR_TEXT_STRING  0x60
+#define CBOR_MAP          0xA0
+
+#define CBOR_INDEFINITE_LENGTH 0x1F
+#define CBOR_FALSE             0xF4
+#define CBOR_TRUE              0xF5
+#define CBOR_FLOAT32           0xFA
+#define CBOR_BREAK             0xFF
+
+static UINT cbor_write(AZURE_IOT_CBOR_WRITER* writer, const UCHAR* data, UINT length)
+{
+    if (writer->length + length > writer->buffer_size)
+    {
+        return NX_AZURE_IOT_INSUFFICIENT_BUFFER_SPACE;
+    }
+
+    memcpy(&writer->buffer[writer->length], data, length);
+    writer->length += length;
+
+    return NX_AZURE_IOT_SUCCESS;
+}
+
+// Initial byte plus the shortest big-endian argument that holds the value
+static UINT cbor_write_head(AZURE_IOT_CBOR_WRITER* writer, UCHAR major_type, ULONG value)
+{
+    UCHAR head[5];
+    UINT length;
+
+    if (value < 24)
+    {
+        head[0] = major_type | (UCHAR)value;
+        length  = 1;
+    }
+    else if (value <= 0xFF)
+    {
+        head[0] = major_type | 24;
+        head[1] = (UCHAR)value;
+        length  = 2;
+    }
+    else if (value <= 0xFFFF)
+    {
+        head[0] = major_type | 25;
+        head[1] = (UCHAR)(value >> 8);
+        head[2] = (UCHAR)value;
+        length  = 3;
+    }
+    else
+    {
+        head[0] = major_type | 26;
+        head[1] = (UCHAR)(value >> 24);
+        head[2] = (UCHAR)(value >> 16);
+        head[3] = (UCHAR)(value >> 8);
+        head[4] = (UCHAR)value;
+        length  = 5;
+    }
+
+    return cbor_write(writer, head, length);
+}
+
+UINT azure_iot_cbor_writer_init(AZURE_IOT_CBOR_WRITER* writer, UCHAR* buffer, UINT buffer_size)
+{
+    if (writer == NX_NULL || buffer == NX_NULL)
+    {
+        return NX_AZURE_IOT_INVALID_PARAMETER;
+    }
+
+    writer->buffer      = buffer;
+    writer->buffer_size = buffer_size;
+    writer->length      = 0;
+
+    return NX_AZURE_IOT_SUCCESS;
+}
+
+UINT azure_iot_cbor_writer_append_begin_map(AZURE_IOT_CBOR_WRITER* writer)
+{
+    // Indefinite length so callers don't need to count their properties up front
+    const UCHAR head = CBOR_MAP | CBOR_INDEFINITE_LENGTH;
+
+    return cbor_write(writer, &head, 1);
+}
+
+UINT azure_iot_cbor_writer_append_end_map(AZURE_IOT_CBOR_WRITER* writer)
+{
+    const UCHAR head = CBOR_BREAK;
+
+    return cbor_write(writer, &head, 1);
+}
+
+UINT azure_iot_cbor_writer_append_property_with_double_value(AZURE_IOT_CBOR_WRITER* writer, UINT key, double value)
+{
+    UINT status;
+    UCHAR item[5];
+    float single = (float)value;
+    uint32_t bits;
+
+    memcpy(&bits, &single, sizeof(bits));
+
+    item[0] = CBOR_FLOAT32;
+    item[1] = (UCHAR)(bits >> 24);
+    item[2] = (UCHAR)(bits >> 16);
+    item[3] = (UCHAR)(bits >> 8);
+    item[4] = (UCHAR)bits;
+
+    if ((status = cbor_write_head(writer, CBOR_UNSIGNED_INT, key)))
+    {
+        return status;
+    }
+
+    return cbor_write(writer, item, sizeof(item));
+}
+
+UINT azure_iot_cbor_writer_append_property_with_int32_value(AZURE_IOT_CBOR_WRITER* writer, UINT key, int32_t value)
+{
+    UINT status;
+
+    if ((status = cbor_write_head(writer, CBOR_UNSIGNED_INT, key)))
+    {
+        return status;
+    }
+
+    // Negative integers are encoded as -1 - n
+    if (value < 0)
+    {
+        return cbor_write_head(writer, CBOR_NEGATIVE_INT, (ULONG)(-1 - value));
+    }
+
+    return cbor_write_head(writer, CBOR_UNSIGNED_INT, (ULONG)value);
+}
+
+UINT azure_iot_cbor_writer_append_property_with_bool_value(AZURE_IOT_CBOR_WRITER* writer, UINT key, bool value)
+{
+    UINT status;
+    const UCHAR item = value ? CBOR_TRUE : CBOR_FALSE;
+
+    if ((status = cbor_write_head(writer, CBOR_UNSIGNED_INT, key)))
+    {
+        return status;
+    }
+
+    return cbor_write(writer, &item, 1);
+}
+
+UINT azure_iot_cbor_writer_append_property_with_string_value(
+    AZURE_IOT_CBOR_WRITER* writer, UINT key, const UCHAR* value, UINT value_len)
+{
+    UINT status;
+
+    if ((status = cbor_write_head(writer, CBOR_UNSIGNED_INT, key)) ||
+        (status = cbor_write_head(writer, CBOR_TEXT_STRING, value_len)))
+    {
+        return status;
+    }
+
+    return cbor_write(writer, value, value_len);
+}
+
+UINT azure_iot_cbor_writer_get_bytes_used(AZURE_IOT_CBOR_WRITER* writer)
+{
+    return writer->length;
+}
@@ -0,0 +1,35 @@
+/* Copyright (c) Microsoft Corporation.
+   Licensed under the MIT License. */
+
+#ifndef _AZURE_IOT_CBOR_H
+#define _AZURE_IOT_CBOR_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "nx_api.h"
+
+// Minimal CBOR (RFC 8949) writer for telemetry. Messages are a single map keyed by small
+// integers, by convention the index of the telemetry in the contents of the device DTDL model.
+typedef struct AZURE_IOT_CBOR_WRITER_STRUCT
+{
+    UCHAR* buffer;
+    UINT buffer_size;
+    UINT length;
+} AZURE_IOT_CBOR_WRITER;
+
+UINT azure_iot_cbor_writer_init(AZURE_IOT_CBOR_WRITER* writer, UCHAR* buffer, UINT buffer_size);
+
+UINT azure_iot_cbor_writer_append_begin_map(AZURE_IOT_CBOR_WRITER* writer);
+UINT azure_iot_cbor_writer_append_end_map(AZURE_IOT_CBOR_WRITER* writer);
+
+// Doubles are written as single precision floats, which covers the resolution of the on-board sensors
+UINT azure_iot_cbor_writer_append_property_with_double_value(AZURE_IOT_CBOR_WRITER* writer, UINT key, double value);
+UINT azure_iot_cbor_writer_append_property_with_int32_value(AZURE_IOT_CBOR_WRITER* writer, UINT key, int32_t value);
+UINT azure_iot_cbor_writer_append_property_with_bool_value(AZURE_IOT_CBOR_WRITER* writer, UINT key, bool value);
+UINT azure_iot_cbor_writer_append_property_with_string_value(
+    AZURE_IOT_CBOR_WRITER* writer, UINT key, const UCHAR* value, UINT value_len);
+
+UINT azure_iot_cbor_writer_get_bytes_used(AZURE_IOT_CBOR_WRITER* writer);
+
+#endif
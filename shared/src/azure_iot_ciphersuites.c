@@ -11,6 +11,12 @@
 #error "X509 must be enabled."
 #endif /* NX_SECURE_DISABLE_X509 */
 
+#if (AZURE_IOT_TLS_PROFILE == AZURE_IOT_TLS_PROFILE_GCM)
+#if !defined(NX_SECURE_ENABLE_ECC_CIPHERSUITE) || !defined(NX_SECURE_ENABLE_AEAD_CIPHER)
+#error "The GCM profile needs NX_SECURE_ENABLE_ECC_CIPHERSUITE and NX_SECURE_ENABLE_AEAD_CIPHER."
+#endif
+#endif
+
 /* Define supported crypto method. */
 extern NX_CRYPTO_METHOD crypto_method_hmac;
 extern NX_CRYPTO_METHOD crypto_method_hmac_sha256;
@@ -18,7 +24,14 @@ extern NX_CRYPTO_METHOD crypto_method_tls_prf_sha256;
 extern NX_CRYPTO_METHOD crypto_method_sha256;
 extern NX_CRYPTO_METHOD crypto_method_aes_cbc_128;
 extern NX_CRYPTO_METHOD crypto_method_rsa;
+#if (AZURE_IOT_TLS_PROFILE == AZURE_IOT_TLS_PROFILE_GCM)
+extern NX_CRYPTO_METHOD crypto_method_sha384;
+extern NX_CRYPTO_METHOD crypto_method_aes_128_gcm_16;
+extern NX_CRYPTO_METHOD crypto_method_ecdhe;
+extern NX_CRYPTO_METHOD crypto_method_ecdsa;
+#endif
 
+// The array itself is writable, azure_iot_crypto_method_register swaps entries for hardware methods
 const NX_CRYPTO_METHOD* _nx_azure_iot_tls_supported_crypto[] = {
     &crypto_method_hmac,
     &crypto_method_hmac_sha256,
@@ -26,6 +39,12 @@ const NX_CRYPTO_METHOD* _nx_azure_iot_tls_supported_crypto[] = {
     &crypto_method_sha256,
     &crypto_method_aes_cbc_128,
     &crypto_method_rsa,
+#if (AZURE_IOT_TLS_PROFILE == AZURE_IOT_TLS_PROFILE_GCM)
+    &crypto_method_sha384,
+    &crypto_method_aes_128_gcm_16,
+    &crypto_method_ecdhe,
+    &crypto_method_ecdsa,
+#endif
 };
 
 const UINT _nx_azure_iot_tls_supported_crypto_size =
@@ -34,14 +53,57 @@ const UINT _nx_azure_iot_tls_supported_crypto_size =
 // Define supported TLS ciphersuites.
 extern const NX_CRYPTO_CIPHERSUITE nx_crypto_tls_rsa_with_aes_128_cbc_sha256;
 extern const NX_CRYPTO_CIPHERSUITE nx_crypto_x509_rsa_sha_256;
+#if (AZURE_IOT_TLS_PROFILE == AZURE_IOT_TLS_PROFILE_GCM)
+extern const NX_CRYPTO_CIPHERSUITE nx_crypto_tls_ecdhe_ecdsa_with_aes_128_gcm_sha256;
+extern const NX_CRYPTO_CIPHERSUITE nx_crypto_tls_ecdhe_rsa_with_aes_128_gcm_sha256;
+extern const NX_CRYPTO_CIPHERSUITE nx_crypto_tls_ecdhe_ecdsa_with_aes_128_cbc_sha256;
+extern const NX_CRYPTO_CIPHERSUITE nx_crypto_tls_ecdhe_rsa_with_aes_128_cbc_sha256;
+extern const NX_CRYPTO_CIPHERSUITE nx_crypto_tls_rsa_with_aes_128_gcm_sha256;
+extern const NX_CRYPTO_CIPHERSUITE nx_crypto_x509_rsa_sha_384;
+extern const NX_CRYPTO_CIPHERSUITE nx_crypto_x509_ecdsa_sha_256;
+extern const NX_CRYPTO_CIPHERSUITE nx_crypto_x509_ecdsa_sha_384;
+#endif
 
+// In order of preference, the server picks the first one it supports
 const NX_CRYPTO_CIPHERSUITE* _nx_azure_iot_tls_ciphersuite_map[] = {
     // TLS ciphersuites.
+#if (AZURE_IOT_TLS_PROFILE == AZURE_IOT_TLS_PROFILE_GCM)
+    &nx_crypto_tls_ecdhe_ecdsa_with_aes_128_gcm_sha256,
+    &nx_crypto_tls_ecdhe_rsa_with_aes_128_gcm_sha256,
+    &nx_crypto_tls_ecdhe_ecdsa_with_aes_128_cbc_sha256,
+    &nx_crypto_tls_ecdhe_rsa_with_aes_128_cbc_sha256,
+    &nx_crypto_tls_rsa_with_aes_128_gcm_sha256,
+#endif
     &nx_crypto_tls_rsa_with_aes_128_cbc_sha256,
 
     // X.509 ciphersuites.
+#if (AZURE_IOT_TLS_PROFILE == AZURE_IOT_TLS_PROFILE_GCM)
+    &nx_crypto_x509_ecdsa_sha_256,
+    &nx_crypto_x509_ecdsa_sha_384,
+    &nx_crypto_x509_rsa_sha_384,
+#endif
     &nx_crypto_x509_rsa_sha_256,
 };
 
 const UINT _nx_azure_iot_tls_ciphersuite_map_size =
     sizeof(_nx_azure_iot_tls_ciphersuite_map) / sizeof(NX_CRYPTO_CIPHERSUITE*);
+
+UINT azure_iot_crypto_method_register(const NX_CRYPTO_METHOD* crypto_method)
+{
+    if (crypto_method == NX_NULL)
+    {
+        return NX_PTR_ERROR;
+    }
+
+    // Sessions resolve the ciphersuite roles by algorithm id, so swapping the entry is enough
+    for (UINT i = 0; i < _nx_azure_iot_tls_supported_crypto_size; i++)
+    {
+        if (_nx_azure_iot_tls_supported_crypto[i]->nx_crypto_algorithm == crypto_method->nx_crypto_algorithm)
+        {
+            _nx_azure_iot_tls_supported_crypto[i] = crypto_method;
+            return NX_SUCCESS;
+        }
+    }
+
+    return NX_NOT_FOUND;
+}
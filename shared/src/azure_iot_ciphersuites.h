@@ -6,6 +6,18 @@
 
 #include "nx_secure_tls_api.h"
 
+// TLS cipher suite profiles, select one by defining AZURE_IOT_TLS_PROFILE
+//    AZURE_IOT_TLS_PROFILE_CBC: RSA key transport with AES-128-CBC and HMAC-SHA256, smallest code size
+//    AZURE_IOT_TLS_PROFILE_GCM: ECDHE-ECDSA and ECDHE-RSA with AES-128-GCM, falling back to the CBC suites.
+//                               Needs NX_SECURE_ENABLE_ECC_CIPHERSUITE and NX_SECURE_ENABLE_AEAD_CIPHER in nx_user.h,
+//                               so far only the host build enables them, the boards all use the CBC profile
+#define AZURE_IOT_TLS_PROFILE_CBC 0
+#define AZURE_IOT_TLS_PROFILE_GCM 1
+
+#ifndef AZURE_IOT_TLS_PROFILE
+#define AZURE_IOT_TLS_PROFILE AZURE_IOT_TLS_PROFILE_CBC
+#endif
+
 // Users can use these ciphersuites as sample, and also can build their own ciphersuite
 // referring to nx_secure/nx_crypto_generic_ciphersuites.c.
 extern const NX_CRYPTO_METHOD* _nx_azure_iot_tls_supported_crypto[];
@@ -13,7 +25,24 @@ extern const UINT _nx_azure_iot_tls_supported_crypto_size;
 extern const NX_CRYPTO_CIPHERSUITE* _nx_azure_iot_tls_ciphersuite_map[];
 extern const UINT _nx_azure_iot_tls_ciphersuite_map_size;
 
+#if (AZURE_IOT_TLS_PROFILE == AZURE_IOT_TLS_PROFILE_GCM)
+// ECC curves from nx_secure/nx_crypto_generic_ciphersuites.c, offered by nx_secure_tls_ecc_initialize
+extern const USHORT nx_crypto_ecc_supported_groups[];
+extern const NX_CRYPTO_METHOD* nx_crypto_ecc_curves[];
+extern const UINT nx_crypto_ecc_supported_groups_size;
+#endif
+
 // Define the metadata size for _nx_azure_iot_tls_ciphers.
+#if (AZURE_IOT_TLS_PROFILE == AZURE_IOT_TLS_PROFILE_GCM)
+#define NX_AZURE_IOT_TLS_METADATA_BUFFER_SIZE (12 * 1024)
+#define AZURE_IOT_TLS_PROFILE_NAME            "ECDHE AES-128-GCM"
+#else
 #define NX_AZURE_IOT_TLS_METADATA_BUFFER_SIZE (9 * 1024)
+#define AZURE_IOT_TLS_PROFILE_NAME            "RSA AES-128-CBC"
+#endif
+
+// Replace the software crypto method implementing the same algorithm, e.g. with a hardware AES, SHA or
+// PKA engine. Call before the first connect, TLS sessions pick up the methods when they are created.
+UINT azure_iot_crypto_method_register(const NX_CRYPTO_METHOD* crypto_method);
 
 #endif /* NX_AZURE_IOT_CIPHERSUITES_H */
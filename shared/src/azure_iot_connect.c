@@ -2,38 +2,83 @@
    Licensed under the MIT License. */
 
 #include <stdio.h>
+#include <stdlib.h>
 
 #include "nx_azure_iot_hub_client.h"
 
+#include "azure_iot_connect.h"
 #include "azure_iot_nx_client.h"
+#include "azure_iot_dps_cache.h"
+#include "azure_iot_log.h"
 
 #define INITIAL_EXPONENTIAL_BACKOFF_IN_SEC     (3)
 #define MAX_EXPONENTIAL_BACKOFF_IN_SEC         (10 * 60)
 #define MAX_EXPONENTIAL_BACKOFF_JITTER_PERCENT (60)
 
-static UINT exponential_retry_count;
+#ifndef NX_AZURE_IOT_HUB_CLIENT_TOKEN_EXPIRY
+#define NX_AZURE_IOT_HUB_CLIENT_TOKEN_EXPIRY (3600)
+#endif
 
-static VOID exponential_backoff_reset()
+static bool jitter_seeded = false;
+
+// Jitter that differs across a fleet. Boards without a hardware NX_RAND fall back to rand(), which every device
+// would otherwise start from the same seed, so seed it from the wall clock and the device identity.
+static UINT jitter_rand(AZURE_IOT_NX_CONTEXT* nx_context)
+{
+    ULONG seed      = tx_time_get();
+    ULONG unix_time = 0;
+    CHAR* id        = nx_context->azure_iot_dps_registration_id;
+    UINT id_len     = nx_context->azure_iot_dps_registration_id_len;
+
+    if (!jitter_seeded)
+    {
+        if (id == NX_NULL)
+        {
+            id     = nx_context->azure_iot_hub_device_id;
+            id_len = nx_context->azure_iot_hub_device_id_len;
+        }
+
+        for (UINT i = 0; i < id_len; i++)
+        {
+            seed = (seed * 31) + (UCHAR)id[i];
+        }
+
+        // Reseed once SNTP has the time, until then the tick count and identity have to do
+        if (nx_context->unix_time_get != NX_NULL && nx_context->unix_time_get(&unix_time) == NX_SUCCESS)
+        {
+            seed ^= unix_time;
+            jitter_seeded = true;
+        }
+
+        srand((unsigned int)seed);
+    }
+
+    return (UINT)NX_RAND();
+}
+
+static VOID exponential_backoff_reset(AZURE_IOT_NX_CONTEXT* nx_context)
 {
-    exponential_retry_count = 0;
+    nx_context->azure_iot_retry_count = 0;
 }
 
-static VOID exponential_backoff_with_jitter()
+static VOID exponential_backoff_with_jitter(
+    AZURE_IOT_NX_CONTEXT* nx_context, VOID (*wait)(AZURE_IOT_NX_CONTEXT* nx_context, ULONG ticks))
 {
-    double jitter_percent = (MAX_EXPONENTIAL_BACKOFF_JITTER_PERCENT / 100.0) * (rand() / ((double)RAND_MAX));
+    double jitter_percent =
+        (MAX_EXPONENTIAL_BACKOFF_JITTER_PERCENT / 100.0) * ((jitter_rand(nx_context) % 1001) / 1000.0);
     UINT base_delay       = MAX_EXPONENTIAL_BACKOFF_IN_SEC;
     uint64_t delay;
     UINT backoff_seconds;
 
     // If the retry is 0, then we don't need to delay the first time
-    if (exponential_retry_count++ == 0)
+    if (nx_context->azure_iot_retry_count++ == 0)
     {
         return;
     }
 
-    if (exponential_retry_count < (sizeof(UINT) * 8))
+    if (nx_context->azure_iot_retry_count < (sizeof(UINT) * 8))
     {
-        delay = (uint64_t)((1 << exponential_retry_count) * INITIAL_EXPONENTIAL_BACKOFF_IN_SEC);
+        delay = (uint64_t)((1 << nx_context->azure_iot_retry_count) * INITIAL_EXPONENTIAL_BACKOFF_IN_SEC);
         if (delay <= (UINT)(-1))
         {
             base_delay = (UINT)delay;
@@ -46,28 +91,85 @@ static VOID exponential_backoff_with_jitter()
     }
     else
     {
-        exponential_retry_count++;
+        nx_context->azure_iot_retry_count++;
     }
 
     backoff_seconds = (UINT)(base_delay * (1 + jitter_percent));
 
-    printf("\r\nIoT connection backoff for %d seconds\r\n", backoff_seconds);
-    tx_thread_sleep(backoff_seconds * NX_IP_PERIODIC_RATE);
+    AZURE_IOT_LOG_INFO("\r\nIoT connection backoff for %d seconds\r\n", backoff_seconds);
+    wait(nx_context, backoff_seconds * NX_IP_PERIODIC_RATE);
+}
+
+static VOID sas_token_renew_schedule(AZURE_IOT_NX_CONTEXT* nx_context)
+{
+    UINT renew_seconds = 0;
+    UINT jitter_seconds = jitter_rand(nx_context) % (AZURE_IOT_SAS_TOKEN_RENEW_JITTER_SEC + 1);
+
+    if (NX_AZURE_IOT_HUB_CLIENT_TOKEN_EXPIRY > AZURE_IOT_SAS_TOKEN_RENEW_MARGIN_SEC + jitter_seconds)
+    {
+        renew_seconds = NX_AZURE_IOT_HUB_CLIENT_TOKEN_EXPIRY - AZURE_IOT_SAS_TOKEN_RENEW_MARGIN_SEC - jitter_seconds;
+    }
+
+    // A renewal time of zero disables the planned reconnect, the token lifetime is too short for it
+    nx_context->sas_token_connect_ticks = tx_time_get();
+    nx_context->sas_token_renew_ticks   = renew_seconds * TX_TIMER_TICKS_PER_SECOND;
+}
+
+static bool sas_token_renew_due(AZURE_IOT_NX_CONTEXT* nx_context)
+{
+    if (nx_context->azure_iot_auth_mode != AZURE_IOT_AUTH_MODE_SAS || nx_context->sas_token_renew_ticks == 0)
+    {
+        return false;
+    }
+
+    return (tx_time_get() - nx_context->sas_token_connect_ticks) >= nx_context->sas_token_renew_ticks;
+}
+
+// Forget the hub DPS assigned, the next initialize provisions again
+static VOID dps_assignment_drop(AZURE_IOT_NX_CONTEXT* nx_context)
+{
+    nx_context->azure_iot_dps_assigned         = false;
+    nx_context->azure_iot_dps_connect_failures = 0;
+    azure_iot_dps_cache_clear(nx_context);
 }
 
 static void iothub_connect(AZURE_IOT_NX_CONTEXT* nx_context)
 {
     UINT status;
+    ULONG connect_start;
 
     // Connect to IoT hub
-    printf("\r\nInitializing Azure IoT Hub client\r\n");
-    printf("\tHub hostname: %.*s\r\n", nx_context->azure_iot_hub_hostname_len, nx_context->azure_iot_hub_hostname);
-    printf("\tDevice id: %.*s\r\n", nx_context->azure_iot_hub_device_id_len, nx_context->azure_iot_hub_device_id);
-    printf("\tModel id: %.*s\r\n", nx_context->azure_iot_model_id_len, nx_context->azure_iot_model_id);
+    AZURE_IOT_LOG_INFO("\r\nInitializing Azure IoT Hub client\r\n");
+    AZURE_IOT_LOG_INFO(
+        "\tHub hostname: %.*s\r\n", nx_context->azure_iot_hub_hostname_len, nx_context->azure_iot_hub_hostname);
+    AZURE_IOT_LOG_INFO(
+        "\tDevice id: %.*s\r\n", nx_context->azure_iot_hub_device_id_len, nx_context->azure_iot_hub_device_id);
+    AZURE_IOT_LOG_INFO("\tModel id: %.*s\r\n", nx_context->azure_iot_model_id_len, nx_context->azure_iot_model_id);
 
+    connect_start = tx_time_get();
     if ((status = nx_azure_iot_hub_client_connect(&nx_context->iothub_client, NX_FALSE, NX_WAIT_FOREVER)))
     {
-        printf("ERROR: nx_azure_iot_hub_client_connect (0x%08x)\r\n", status);
+        AZURE_IOT_LOG_ERROR("ERROR: nx_azure_iot_hub_client_connect (0x%08x)\r\n", status);
+
+        // Rejected identities are handled by the monitor, count the hubs that could not be reached
+        if (nx_context->azure_iot_dps_assigned && status != NXD_MQTT_ERROR_BAD_USERNAME_PASSWORD &&
+            status != NXD_MQTT_ERROR_NOT_AUTHORIZED)
+        {
+            nx_context->azure_iot_dps_connect_failures++;
+        }
+    }
+    else
+    {
+        nx_context->azure_iot_dps_connect_failures = 0;
+        sas_token_renew_schedule(nx_context);
+
+        // DNS, TCP, TLS handshake and MQTT CONNECT
+        nx_context->azure_iot_connect_ticks = tx_time_get() - connect_start;
+        nx_context->azure_iot_outage_ticks  = tx_time_get() - nx_context->azure_iot_disconnect_ticks;
+
+        AZURE_IOT_LOG_INFO("\tConnect took %lu ms, %lu ms since disconnect\r\n",
+            nx_context->azure_iot_connect_ticks * 1000 / TX_TIMER_TICKS_PER_SECOND,
+            nx_context->azure_iot_outage_ticks * 1000 / TX_TIMER_TICKS_PER_SECOND);
     }
 
     // stash the connection status to be used by the monitor loop
@@ -80,7 +182,9 @@ VOID connection_status_set(AZURE_IOT_NX_CONTEXT* nx_context, UINT connection_sta
 
     if (nx_context->azure_iot_connection_status == NX_SUCCESS)
     {
-        printf("SUCCESS: Connected to IoT Hub\r\n\r\n");
+        sas_token_renew_schedule(nx_context);
+
+        AZURE_IOT_LOG_INFO("SUCCESS: Connected to IoT Hub\r\n\r\n");
     }
 }
 
@@ -96,11 +200,13 @@ VOID connection_status_set(AZURE_IOT_NX_CONTEXT* nx_context, UINT connection_sta
 //          +-------------------------+     +-------------------------+
 //
 //---------------------------------------------------------------------------------
-VOID connection_monitor(
-    AZURE_IOT_NX_CONTEXT* nx_context, UINT (*iot_initialize)(AZURE_IOT_NX_CONTEXT* nx_context), UINT (*network_connect)())
+VOID connection_monitor(AZURE_IOT_NX_CONTEXT* nx_context,
+    UINT (*iot_initialize)(AZURE_IOT_NX_CONTEXT* nx_context),
+    UINT (*network_connect)(),
+    VOID (*wait)(AZURE_IOT_NX_CONTEXT* nx_context, ULONG ticks))
 {
     // Check parameters
-    if ((nx_context == NX_NULL) || (iot_initialize == NX_NULL))
+    if ((nx_context == NX_NULL) || (iot_initialize == NX_NULL) || (wait == NX_NULL))
     {
         return;
     }
@@ -109,10 +215,20 @@ VOID connection_monitor(
     if (nx_context->azure_iot_connection_status == NX_SUCCESS)
     {
         // Reset the exponential
-        exponential_backoff_reset();
-        return;
+        exponential_backoff_reset(nx_context);
+
+        if (!sas_token_renew_due(nx_context))
+        {
+            return;
+        }
+
+        // Roll the connection before the token expires, the first reconnect attempt goes out without backoff
+        AZURE_IOT_LOG_INFO("SAS token due for renewal, reconnecting\r\n");
+        nx_context->azure_iot_connection_status = NX_AZURE_IOT_SAS_TOKEN_EXPIRED;
     }
 
+    nx_context->azure_iot_disconnect_ticks = tx_time_get();
+
     // Disconnect
     if (nx_context->azure_iot_connection_status != NX_AZURE_IOT_NOT_INITIALIZED)
     {
@@ -122,13 +238,38 @@ VOID connection_monitor(
     // Recover
     while (true)
     {
+        // A stored assignment whose hub keeps failing DNS or the connect may be stale, provision again
+        if (nx_context->azure_iot_dps_assigned &&
+            nx_context->azure_iot_dps_connect_failures >= AZURE_IOT_DPS_MAX_CONNECT_FAILURES)
+        {
+            AZURE_IOT_LOG_INFO("IoT Hub unreachable %u times in a row, provisioning again\r\n",
+                nx_context->azure_iot_dps_connect_failures);
+            dps_assignment_drop(nx_context);
+
+            if (nx_context->azure_iot_connection_status != NX_AZURE_IOT_NOT_INITIALIZED)
+            {
+                nx_azure_iot_hub_client_deinitialize(&nx_context->iothub_client);
+                nx_context->azure_iot_connection_status = NX_AZURE_IOT_NOT_INITIALIZED;
+            }
+        }
+
         switch (nx_context->azure_iot_connection_status)
         {
+            // The hub refused the identity, a DPS assignment may be stale so provision again
+            case NXD_MQTT_ERROR_BAD_USERNAME_PASSWORD:
+            case NXD_MQTT_ERROR_NOT_AUTHORIZED:
+            {
+                if (nx_context->azure_iot_dps_assigned)
+                {
+                    AZURE_IOT_LOG_INFO("IoT Hub rejected the DPS assignment, provisioning again\r\n");
+                    dps_assignment_drop(nx_context);
+                }
+            }
+
+            // Fallthrough
             // Something bad has happened with client state, we need to re-initialize it
             case NX_DNS_QUERY_FAILED:
             case NXD_MQTT_COMMUNICATION_FAILURE:
-            case NXD_MQTT_ERROR_BAD_USERNAME_PASSWORD:
-            case NXD_MQTT_ERROR_NOT_AUTHORIZED:
             {
                 // Deinitialize iot hub client
                 nx_azure_iot_hub_client_deinitialize(&nx_context->iothub_client);
@@ -144,12 +285,12 @@ VOID connection_monitor(
                 if (network_connect() != NX_SUCCESS)
                 {
                     // Failed, sleep and break out to try again next time
-                    tx_thread_sleep(5 * TX_TIMER_TICKS_PER_SECOND);
+                    wait(nx_context, 5 * TX_TIMER_TICKS_PER_SECOND);
                     break;
                 }
 
                 // Initialize IoT Hub
-                exponential_backoff_with_jitter();
+                exponential_backoff_with_jitter(nx_context, wait);
                 if (iot_initialize(nx_context) == NX_SUCCESS)
                 {
                     // Connect IoT Hub
@@ -160,14 +301,14 @@ VOID connection_monitor(
 
             case NX_AZURE_IOT_SAS_TOKEN_EXPIRED:
             {
-                printf("SAS token has expired\r\n");
+                AZURE_IOT_LOG_INFO("SAS token has expired\r\n");
             }
 
             // Fallthrough
             default:
             {
                 // Connect IoT Hub
-                exponential_backoff_with_jitter();
+                exponential_backoff_with_jitter(nx_context, wait);
                 iothub_connect(nx_context);
             }
             break;
@@ -10,7 +10,11 @@
 
 VOID connection_status_set(AZURE_IOT_NX_CONTEXT* nx_context, UINT connection_status);
 
-VOID connection_monitor(
-    AZURE_IOT_NX_CONTEXT* nx_context, UINT (*iothub_init)(AZURE_IOT_NX_CONTEXT* nx_context), UINT (*network_connect)());
+// Reconnect until the hub is connected. wait sleeps between attempts, the client passes one that keeps running
+// the periodic timer so telemetry is queued through the outage.
+VOID connection_monitor(AZURE_IOT_NX_CONTEXT* nx_context,
+    UINT (*iothub_init)(AZURE_IOT_NX_CONTEXT* nx_context),
+    UINT (*network_connect)(),
+    VOID (*wait)(AZURE_IOT_NX_CONTEXT* nx_context, ULONG ticks));
 
 #endif
\ No newline at end of file
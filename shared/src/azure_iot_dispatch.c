@@ -0,0 +1,64 @@
+/* Copyright (c) Microsoft Corporation.
+   Licensed under the MIT License. */
+
+#include "azure_iot_dispatch.h"
+
+#include <string.h>
+
+#define FNV_PRIME 16777619UL
+
+ULONG azure_iot_dispatch_hash(
+    ULONG seed, const UCHAR* component, UINT component_length, const UCHAR* name, UINT name_length)
+{
+    // Keep to 32 bits so the result matches the generator on hosts where ULONG is wider
+    uint32_t hash = (uint32_t)seed;
+    UINT i;
+
+    for (i = 0; i < component_length; i++)
+    {
+        hash = (hash ^ component[i]) * FNV_PRIME;
+    }
+
+    hash *= FNV_PRIME;
+
+    for (i = 0; i < name_length; i++)
+    {
+        hash = (hash ^ name[i]) * FNV_PRIME;
+    }
+
+    // The low bits of FNV only depend on the low bits of the input, fold the high half in before masking
+    return hash ^ (hash >> 16);
+}
+
+const AZURE_IOT_DISPATCH_ENTRY* azure_iot_dispatch_lookup(const AZURE_IOT_DISPATCH_TABLE* table,
+    UINT kind,
+    const UCHAR* component,
+    UINT component_length,
+    const UCHAR* name,
+    UINT name_length)
+{
+    const AZURE_IOT_DISPATCH_ENTRY* entry;
+
+    if (table == NX_NULL || name == NX_NULL)
+    {
+        return NX_NULL;
+    }
+
+    if (component == NX_NULL)
+    {
+        component_length = 0;
+    }
+
+    entry = &table->slots[azure_iot_dispatch_hash(table->seed, component, component_length, name, name_length) &
+                          (table->slot_count - 1)];
+
+    // The hash only separates known names, so confirm the slot really holds this one
+    if (entry->name == NX_NULL || entry->kind != kind || entry->name_length != name_length ||
+        entry->component_length != component_length || memcmp(entry->name, name, name_length) != 0 ||
+        (component_length > 0 && memcmp(entry->component, component, component_length) != 0))
+    {
+        return NX_NULL;
+    }
+
+    return entry;
+}
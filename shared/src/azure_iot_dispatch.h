@@ -0,0 +1,72 @@
+/* Copyright (c) Microsoft Corporation.
+   Licensed under the MIT License. */
+
+#ifndef _AZURE_IOT_DISPATCH_H
+#define _AZURE_IOT_DISPATCH_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "nx_api.h"
+
+struct AZURE_IOT_NX_CONTEXT_STRUCT;
+
+#define AZURE_IOT_DISPATCH_PROPERTY 0
+#define AZURE_IOT_DISPATCH_COMMAND  1
+
+// DTDL schema of a writable property or command request
+#define AZURE_IOT_DISPATCH_SCHEMA_NONE    0
+#define AZURE_IOT_DISPATCH_SCHEMA_INTEGER 1
+#define AZURE_IOT_DISPATCH_SCHEMA_BOOLEAN 2
+#define AZURE_IOT_DISPATCH_SCHEMA_DOUBLE  3
+#define AZURE_IOT_DISPATCH_SCHEMA_STRING  4
+
+// Typed handlers return the status code sent back to the hub, 200 to accept
+typedef UINT (*func_ptr_dispatch_none)(struct AZURE_IOT_NX_CONTEXT_STRUCT*);
+typedef UINT (*func_ptr_dispatch_integer)(struct AZURE_IOT_NX_CONTEXT_STRUCT*, int32_t);
+typedef UINT (*func_ptr_dispatch_boolean)(struct AZURE_IOT_NX_CONTEXT_STRUCT*, bool);
+typedef UINT (*func_ptr_dispatch_double)(struct AZURE_IOT_NX_CONTEXT_STRUCT*, double);
+typedef UINT (*func_ptr_dispatch_string)(struct AZURE_IOT_NX_CONTEXT_STRUCT*, const UCHAR*, UINT);
+
+// A writable property or command of the device model. Entries are generated from the DTDL by
+// shared/model/dtdl_dispatch.py, the root interface has a NULL component.
+typedef struct AZURE_IOT_DISPATCH_ENTRY_STRUCT
+{
+    CHAR* component;
+    UCHAR component_length;
+    CHAR* name;
+    UCHAR name_length;
+    UCHAR kind;
+    UCHAR schema;
+
+    union {
+        func_ptr_dispatch_none none;
+        func_ptr_dispatch_integer integer;
+        func_ptr_dispatch_boolean boolean;
+        func_ptr_dispatch_double number;
+        func_ptr_dispatch_string string;
+    } handler;
+} AZURE_IOT_DISPATCH_ENTRY;
+
+// Perfect hash table, the seed was chosen at generation time so that every entry lands in its own
+// slot. slot_count is a power of two and empty slots have a NULL name.
+typedef struct AZURE_IOT_DISPATCH_TABLE_STRUCT
+{
+    const AZURE_IOT_DISPATCH_ENTRY* slots;
+    UINT slot_count;
+    ULONG seed;
+} AZURE_IOT_DISPATCH_TABLE;
+
+// FNV-1a over the component, a zero byte and the name, starting from seed, with the high half folded in
+ULONG azure_iot_dispatch_hash(
+    ULONG seed, const UCHAR* component, UINT component_length, const UCHAR* name, UINT name_length);
+
+// Returns the entry of the given kind or NULL when the model has no such property or command
+const AZURE_IOT_DISPATCH_ENTRY* azure_iot_dispatch_lookup(const AZURE_IOT_DISPATCH_TABLE* table,
+    UINT kind,
+    const UCHAR* component,
+    UINT component_length,
+    const UCHAR* name,
+    UINT name_length);
+
+#endif
@@ -0,0 +1,139 @@
+/* Copyright (c) Microsoft Corporation.
+   Licensed under the MIT License. */
+
+#include "azure_iot_dps_cache.h"
+
+#include <stddef.h>
+#include <string.h>
+
+#include "azure_iot_log.h"
+
+#define DPS_CACHE_KEY   "dps"
+#define DPS_CACHE_MAGIC 0x31535044 // "DPS1"
+
+#define FNV_OFFSET_BASIS 2166136261u
+#define FNV_PRIME        16777619u
+
+typedef struct DPS_CACHE_RECORD_STRUCT
+{
+    ULONG magic;
+
+    // Hash of the id scope and registration id the assignment belongs to
+    ULONG identity;
+
+    UINT hostname_len;
+    UINT device_id_len;
+    CHAR hostname[AZURE_IOT_HOST_NAME_SIZE];
+    CHAR device_id[AZURE_IOT_DEVICE_ID_SIZE];
+
+    ULONG checksum;
+} DPS_CACHE_RECORD;
+
+static ULONG fnv1a(ULONG hash, const VOID* data, UINT length)
+{
+    const UCHAR* bytes = data;
+
+    while (length--)
+    {
+        hash = (hash ^ *bytes++) * FNV_PRIME;
+    }
+
+    return hash;
+}
+
+static ULONG identity_hash(AZURE_IOT_NX_CONTEXT* nx_context)
+{
+    ULONG hash = FNV_OFFSET_BASIS;
+
+    // Include the lengths so the boundary between the two strings counts
+    hash = fnv1a(hash, &nx_context->azure_iot_dps_id_scope_len, sizeof(UINT));
+    hash = fnv1a(hash, nx_context->azure_iot_dps_id_scope, nx_context->azure_iot_dps_id_scope_len);
+    hash = fnv1a(hash, &nx_context->azure_iot_dps_registration_id_len, sizeof(UINT));
+    hash = fnv1a(hash, nx_context->azure_iot_dps_registration_id, nx_context->azure_iot_dps_registration_id_len);
+
+    return hash;
+}
+
+static ULONG record_checksum(DPS_CACHE_RECORD* record)
+{
+    return fnv1a(FNV_OFFSET_BASIS, record, offsetof(DPS_CACHE_RECORD, checksum));
+}
+
+UINT azure_iot_dps_cache_load(AZURE_IOT_NX_CONTEXT* nx_context)
+{
+    DPS_CACHE_RECORD record;
+    UINT length = 0;
+    UINT status;
+
+    if (nx_context->azure_iot_store == NX_NULL)
+    {
+        return NX_NOT_FOUND;
+    }
+
+    if ((status = nx_context->azure_iot_store->read(DPS_CACHE_KEY, (UCHAR*)&record, sizeof(record), &length)))
+    {
+        return status == NX_NOT_FOUND ? NX_NOT_FOUND : NX_NOT_SUCCESSFUL;
+    }
+
+    // Torn writes, records of other firmware versions and assignments for other credentials are all misses
+    if (length != sizeof(record) || record.magic != DPS_CACHE_MAGIC || record.checksum != record_checksum(&record) ||
+        record.identity != identity_hash(nx_context) || record.hostname_len == 0 ||
+        record.hostname_len > AZURE_IOT_HOST_NAME_SIZE || record.device_id_len == 0 ||
+        record.device_id_len > AZURE_IOT_DEVICE_ID_SIZE)
+    {
+        return NX_NOT_FOUND;
+    }
+
+    memcpy(nx_context->azure_iot_hub_hostname, record.hostname, record.hostname_len);
+    memcpy(nx_context->azure_iot_hub_device_id, record.device_id, record.device_id_len);
+    nx_context->azure_iot_hub_hostname_len  = record.hostname_len;
+    nx_context->azure_iot_hub_device_id_len = record.device_id_len;
+
+    return NX_SUCCESS;
+}
+
+UINT azure_iot_dps_cache_save(AZURE_IOT_NX_CONTEXT* nx_context)
+{
+    DPS_CACHE_RECORD record;
+    UINT status;
+
+    if (nx_context->azure_iot_store == NX_NULL)
+    {
+        return NX_SUCCESS;
+    }
+
+    // Clear the padding so the checksum only depends on the fields
+    memset(&record, 0, sizeof(record));
+
+    record.magic         = DPS_CACHE_MAGIC;
+    record.identity      = identity_hash(nx_context);
+    record.hostname_len  = nx_context->azure_iot_hub_hostname_len;
+    record.device_id_len = nx_context->azure_iot_hub_device_id_len;
+    memcpy(record.hostname, nx_context->azure_iot_hub_hostname, record.hostname_len);
+    memcpy(record.device_id, nx_context->azure_iot_hub_device_id, record.device_id_len);
+    record.checksum = record_checksum(&record);
+
+    if ((status = nx_context->azure_iot_store->write(DPS_CACHE_KEY, (UCHAR*)&record, sizeof(record))))
+    {
+        AZURE_IOT_LOG_ERROR("ERROR: failed to store the DPS assignment (0x%08x)\r\n", status);
+    }
+
+    return status;
+}
+
+UINT azure_iot_dps_cache_clear(AZURE_IOT_NX_CONTEXT* nx_context)
+{
+    UINT status;
+
+    if (nx_context->azure_iot_store == NX_NULL)
+    {
+        return NX_SUCCESS;
+    }
+
+    if ((status = nx_context->azure_iot_store->erase(DPS_CACHE_KEY)))
+    {
+        AZURE_IOT_LOG_ERROR("ERROR: failed to erase the DPS assignment (0x%08x)\r\n", status);
+    }
+
+    return status;
+}
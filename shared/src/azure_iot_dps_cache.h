@@ -0,0 +1,20 @@
+/* Copyright (c) Microsoft Corporation.
+   Licensed under the MIT License. */
+
+#ifndef _AZURE_IOT_DPS_CACHE_H
+#define _AZURE_IOT_DPS_CACHE_H
+
+#include "azure_iot_nx_client.h"
+
+// The hub hostname and device id DPS assigned, kept in the store of the context so a reboot can connect
+// straight to the hub. Entries are tied to the DPS id scope and registration id they were assigned for.
+
+// Fill the hub config of the context, returns NX_NOT_FOUND if nothing usable is stored
+UINT azure_iot_dps_cache_load(AZURE_IOT_NX_CONTEXT* nx_context);
+
+// Store the hub config of the context
+UINT azure_iot_dps_cache_save(AZURE_IOT_NX_CONTEXT* nx_context);
+
+UINT azure_iot_dps_cache_clear(AZURE_IOT_NX_CONTEXT* nx_context);
+
+#endif
@@ -0,0 +1,41 @@
+/* Copyright (c) Microsoft Corporation.
+   Licensed under the MIT License. */
+
+#ifndef _AZURE_IOT_LOG_H
+#define _AZURE_IOT_LOG_H
+
+#include <stdio.h>
+
+#define AZURE_IOT_LOG_LEVEL_NONE  0
+#define AZURE_IOT_LOG_LEVEL_ERROR 1
+#define AZURE_IOT_LOG_LEVEL_INFO  2
+#define AZURE_IOT_LOG_LEVEL_DEBUG 3
+
+// Messages above this level are compiled out, set with -DAZURE_IOT_LOG_LEVEL=<NONE|ERROR|INFO|DEBUG> in CMake.
+// DEBUG adds the full telemetry and property payloads.
+#ifndef AZURE_IOT_LOG_LEVEL
+#define AZURE_IOT_LOG_LEVEL AZURE_IOT_LOG_LEVEL_INFO
+#endif
+
+// Still type checks the arguments and counts them as used, the optimizer drops the call
+#define AZURE_IOT_LOG_NOTHING(...) ((void)(0 && printf(__VA_ARGS__)))
+
+#if AZURE_IOT_LOG_LEVEL >= AZURE_IOT_LOG_LEVEL_ERROR
+#define AZURE_IOT_LOG_ERROR(...) printf(__VA_ARGS__)
+#else
+#define AZURE_IOT_LOG_ERROR(...) AZURE_IOT_LOG_NOTHING(__VA_ARGS__)
+#endif
+
+#if AZURE_IOT_LOG_LEVEL >= AZURE_IOT_LOG_LEVEL_INFO
+#define AZURE_IOT_LOG_INFO(...) printf(__VA_ARGS__)
+#else
+#define AZURE_IOT_LOG_INFO(...) AZURE_IOT_LOG_NOTHING(__VA_ARGS__)
+#endif
+
+#if AZURE_IOT_LOG_LEVEL >= AZURE_IOT_LOG_LEVEL_DEBUG
+#define AZURE_IOT_LOG_DEBUG(...) printf(__VA_ARGS__)
+#else
+#define AZURE_IOT_LOG_DEBUG(...) AZURE_IOT_LOG_NOTHING(__VA_ARGS__)
+#endif
+
+#endif
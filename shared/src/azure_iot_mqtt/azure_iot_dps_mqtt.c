@@ -7,6 +7,7 @@
 
 #include "azure_iot_cert.h"
 #include "azure_iot_dps_mqtt.h"
+#include "azure_iot_log.h"
 
 #include "azure_iot_mqtt/sas_token.h"
 
@@ -26,9 +27,38 @@
 
 #define EVENT_FLAGS_SUCCESS 1
 
-extern CHAR* azure_iot_x509_hostname;
+#define DPS_RETRY_AFTER "retry-after="
 
-static VOID process_retry(AZURE_IOT_MQTT* azure_iot_mqtt, CHAR* topic, CHAR* message)
+// Decimal value at the start of a topic field, the topic is not null terminated
+static INT topic_int_parse(const CHAR* field, const CHAR* topic_end)
+{
+    INT value = -1;
+
+    while (field < topic_end && *field >= '0' && *field <= '9')
+    {
+        value = (value < 0 ? 0 : value * 10) + (*field++ - '0');
+    }
+
+    return value;
+}
+
+static INT topic_retry_after(const CHAR* topic, UINT topic_length)
+{
+    const CHAR* topic_end = topic + topic_length;
+
+    for (const CHAR* find = topic; find + sizeof(DPS_RETRY_AFTER) - 1 <= topic_end; ++find)
+    {
+        if (strncmp(find, DPS_RETRY_AFTER, sizeof(DPS_RETRY_AFTER) - 1) == 0)
+        {
+            return topic_int_parse(find + sizeof(DPS_RETRY_AFTER) - 1, topic_end);
+        }
+    }
+
+    return -1;
+}
+
+static VOID process_retry(
+    AZURE_IOT_MQTT* azure_iot_mqtt, const CHAR* topic, UINT topic_length, const CHAR* message, UINT message_length)
 {
     UINT status;
 
@@ -39,32 +69,26 @@ static VOID process_retry(AZURE_IOT_MQTT* azure_iot_mqtt, CHAR* topic, CHAR* mes
     INT retry_interval;
     CHAR mqtt_publish_topic[256];
 
-    CHAR* find = strstr(topic, "retry-after=");
-    if (find == 0)
+    // extract retry interval
+    retry_interval = topic_retry_after(topic, topic_length);
+    if (retry_interval < 0)
     {
-        printf("Error: Unknown retry-after\r\n");
+        AZURE_IOT_LOG_ERROR("Error: Unknown retry-after\r\n");
         return;
     }
 
-    // extract retry interval
-    retry_interval = atoi(find + 12);
-
     jsmn_init(&parser);
 
-    token_count = jsmn_parse(&parser,
-        azure_iot_mqtt->mqtt_receive_message_buffer,
-        strlen(azure_iot_mqtt->mqtt_receive_message_buffer),
-        tokens,
-        12);
+    token_count = jsmn_parse(&parser, message, message_length, tokens, 12);
 
     strncpy(mqtt_publish_topic, DPS_STATUS_TOPIC, sizeof(mqtt_publish_topic));
-    if (!findJsonString(azure_iot_mqtt->mqtt_receive_message_buffer,
+    if (!findJsonString(message,
             tokens,
             token_count,
             "operationId",
             mqtt_publish_topic + sizeof(DPS_STATUS_TOPIC) - 1))
     {
-        printf("ERROR: Failed to parse DPS operationId\r\n");
+        AZURE_IOT_LOG_ERROR("ERROR: Failed to parse DPS operationId\r\n");
     }
 
     tx_thread_sleep(retry_interval * TX_TIMER_TICKS_PER_SECOND);
@@ -72,11 +96,11 @@ static VOID process_retry(AZURE_IOT_MQTT* azure_iot_mqtt, CHAR* topic, CHAR* mes
     status = mqtt_publish(azure_iot_mqtt, mqtt_publish_topic, "{}");
     if (status != NX_SUCCESS)
     {
-        printf("ERROR: Failed to poll for DPS status (0x%04x)\r\n", status);
+        AZURE_IOT_LOG_ERROR("ERROR: Failed to poll for DPS status (0x%04x)\r\n", status);
     }
 }
 
-static VOID process_success(AZURE_IOT_MQTT* azure_iot_mqtt, CHAR* topic, CHAR* message)
+static VOID process_success(AZURE_IOT_MQTT* azure_iot_mqtt, const CHAR* message, UINT message_length)
 {
     jsmn_parser parser;
     jsmntok_t tokens[64];
@@ -84,31 +108,121 @@ static VOID process_success(AZURE_IOT_MQTT* azure_iot_mqtt, CHAR* topic, CHAR* m
 
     jsmn_init(&parser);
 
-    token_count = jsmn_parse(&parser,
-        azure_iot_mqtt->mqtt_receive_message_buffer,
-        strlen(azure_iot_mqtt->mqtt_receive_message_buffer),
-        tokens,
-        64);
+    token_count = jsmn_parse(&parser, message, message_length, tokens, 64);
 
-    if (!findJsonString(azure_iot_mqtt->mqtt_receive_message_buffer,
+    if (!findJsonString(message,
             tokens,
             token_count,
             "assignedHub",
             azure_iot_mqtt->mqtt_hub_hostname))
     {
-        printf("ERROR: DPS failed to parse hub hostname\r\n");
+        AZURE_IOT_LOG_ERROR("ERROR: DPS failed to parse hub hostname\r\n");
     }
 
-    if (!findJsonString(azure_iot_mqtt->mqtt_receive_message_buffer,
+    if (!findJsonString(message,
             tokens,
             token_count,
             "deviceId",
             azure_iot_mqtt->mqtt_device_id))
     {
-        printf("ERROR: DPS failed to parse device id\r\n");
+        AZURE_IOT_LOG_ERROR("ERROR: DPS failed to parse device id\r\n");
+    }
+}
+
+// Topic and message are lengths into a buffer or a received packet, neither is null terminated
+static VOID dps_response_process(
+    AZURE_IOT_MQTT* azure_iot_mqtt, const CHAR* topic, UINT topic_length, const CHAR* message, UINT message_length)
+{
+    if (topic_length < sizeof(DPS_REGISTER_BASE) || strncmp(topic, DPS_REGISTER_BASE, sizeof(DPS_REGISTER_BASE) - 1))
+    {
+        AZURE_IOT_LOG_ERROR("ERROR: Unknown incoming DPS topic %.*s\r\n", (int)topic_length, topic);
+        return;
+    }
+
+    // Parse the response status
+    INT msg_status = topic_int_parse(topic + sizeof(DPS_REGISTER_BASE), topic + topic_length);
+
+    switch (msg_status)
+    {
+        case 202:
+            process_retry(azure_iot_mqtt, topic, topic_length, message, message_length);
+            break;
+
+        case 200:
+            process_success(azure_iot_mqtt, message, message_length);
+            tx_event_flags_set(&azure_iot_mqtt->mqtt_event_flags, EVENT_FLAGS_SUCCESS, TX_OR);
+            break;
+
+        default:
+            AZURE_IOT_LOG_ERROR("ERROR: Unknown incoming DPS topic status %d\r\n", msg_status);
+            break;
     }
 }
 
+#ifdef ENABLE_MQTT_ZERO_COPY
+// A response chained across packets is copied out, the buffer is only on the stack for the call
+static VOID dps_response_process_chained(AZURE_IOT_MQTT* azure_iot_mqtt,
+    NX_PACKET* packet_ptr,
+    ULONG topic_offset,
+    USHORT topic_length,
+    ULONG message_offset,
+    ULONG message_length)
+{
+    CHAR topic[AZURE_IOT_MQTT_TOPIC_NAME_LENGTH];
+    CHAR message[AZURE_IOT_MQTT_MESSAGE_LENGTH];
+    ULONG topic_copied;
+    ULONG message_copied;
+
+    if (topic_length > sizeof(topic) || message_length > sizeof(message) ||
+        nx_packet_data_extract_offset(packet_ptr, topic_offset, topic, topic_length, &topic_copied) ||
+        nx_packet_data_extract_offset(packet_ptr, message_offset, message, message_length, &message_copied) ||
+        topic_copied != topic_length || message_copied != message_length)
+    {
+        AZURE_IOT_LOG_ERROR("ERROR: DPS response too large (%lu bytes)\r\n", message_length);
+        return;
+    }
+
+    dps_response_process(azure_iot_mqtt, topic, topic_length, message, message_length);
+}
+
+// Provisioning responses are parsed where they sit in the received packet, so their size is bounded by the
+// packet pool rather than by buffers on the MQTT thread stack
+static UINT mqtt_packet_receive_cb(NXD_MQTT_CLIENT* client_ptr, NX_PACKET* packet_ptr, VOID* context)
+{
+    AZURE_IOT_MQTT* azure_iot_mqtt = (AZURE_IOT_MQTT*)context;
+    ULONG topic_offset;
+    USHORT topic_length;
+    ULONG message_offset;
+    ULONG message_length;
+
+    if ((*packet_ptr->nx_packet_prepend_ptr >> 4) != MQTT_CONTROL_PACKET_TYPE_PUBLISH)
+    {
+        return NX_FALSE;
+    }
+
+    if (_nxd_mqtt_process_publish_packet(packet_ptr, &topic_offset, &topic_length, &message_offset, &message_length))
+    {
+        AZURE_IOT_LOG_ERROR("ERROR: malformed MQTT publish packet\r\n");
+    }
+    else if (packet_ptr->nx_packet_next != NX_NULL)
+    {
+        dps_response_process_chained(
+            azure_iot_mqtt, packet_ptr, topic_offset, topic_length, message_offset, message_length);
+    }
+    else
+    {
+        dps_response_process(azure_iot_mqtt,
+            (CHAR*)packet_ptr->nx_packet_prepend_ptr + topic_offset,
+            topic_length,
+            (CHAR*)packet_ptr->nx_packet_prepend_ptr + message_offset,
+            message_length);
+    }
+
+    nx_packet_release(packet_ptr);
+
+    return NX_TRUE;
+}
+#else
 static VOID mqtt_notify_cb(NXD_MQTT_CLIENT* client_ptr, UINT number_of_messages)
 {
     UINT actual_topic_length;
@@ -122,54 +236,27 @@ static VOID mqtt_notify_cb(NXD_MQTT_CLIENT* client_ptr, UINT number_of_messages)
         // Get the mqtt client message
         status = nxd_mqtt_client_message_get(client_ptr,
             (UCHAR*)azure_iot_mqtt->mqtt_receive_topic_buffer,
-            AZURE_IOT_MQTT_TOPIC_NAME_LENGTH,
+            AZURE_IOT_MQTT_TOPIC_NAME_LENGTH - 1,
             &actual_topic_length,
             (UCHAR*)azure_iot_mqtt->mqtt_receive_message_buffer,
-            AZURE_IOT_MQTT_MESSAGE_LENGTH,
+            AZURE_IOT_MQTT_MESSAGE_LENGTH - 1,
             &actual_message_length);
         if (status != NXD_MQTT_SUCCESS)
         {
-            printf("ERROR: nxd_mqtt_client_message_get failed (0x%02x)\r\n", status);
-            continue;
-        }
-
-        // Append null string terminators
-        azure_iot_mqtt->mqtt_receive_topic_buffer[actual_topic_length]     = 0;
-        azure_iot_mqtt->mqtt_receive_message_buffer[actual_message_length] = 0;
-
-        if (strstr((CHAR*)azure_iot_mqtt->mqtt_receive_topic_buffer, DPS_REGISTER_BASE) == 0)
-        {
-            printf("ERROR: Unknown incoming DPS topic %s\r\n", (CHAR*)azure_iot_mqtt->mqtt_receive_topic_buffer);
+            AZURE_IOT_LOG_ERROR("ERROR: nxd_mqtt_client_message_get failed (0x%02x)\r\n", status);
             continue;
         }
 
-        // Parse the response status
-        CHAR* location = azure_iot_mqtt->mqtt_receive_topic_buffer + sizeof(DPS_REGISTER_BASE);
-        INT msg_status = atoi(location);
-
-        switch (msg_status)
-        {
-            case 202:
-                process_retry(azure_iot_mqtt,
-                    azure_iot_mqtt->mqtt_receive_topic_buffer,
-                    azure_iot_mqtt->mqtt_receive_message_buffer);
-                break;
-
-            case 200:
-                process_success(azure_iot_mqtt,
-                    azure_iot_mqtt->mqtt_receive_topic_buffer,
-                    azure_iot_mqtt->mqtt_receive_message_buffer);
-                tx_event_flags_set(&azure_iot_mqtt->mqtt_event_flags, EVENT_FLAGS_SUCCESS, TX_OR);
-                break;
-
-            default:
-                printf("ERROR: Unknown incoming DPS topic status %d\r\n", msg_status);
-                break;
-        }
+        dps_response_process(azure_iot_mqtt,
+            azure_iot_mqtt->mqtt_receive_topic_buffer,
+            actual_topic_length,
+            azure_iot_mqtt->mqtt_receive_message_buffer,
+            actual_message_length);
     }
 
     return;
 }
+#endif
 
 UINT azure_iot_dps_create(AZURE_IOT_MQTT* azure_iot_mqtt, NX_IP* nx_ip, NX_PACKET_POOL* nx_pool)
 {
@@ -178,7 +265,7 @@ UINT azure_iot_dps_create(AZURE_IOT_MQTT* azure_iot_mqtt, NX_IP* nx_ip, NX_PACKE
     status = tx_event_flags_create(&azure_iot_mqtt->mqtt_event_flags, "DPS event flags");
     if (status != TX_SUCCESS)
     {
-        printf("FAIL: Unable to create DPS event flags (0x%02x)\r\n", status);
+        AZURE_IOT_LOG_ERROR("FAIL: Unable to create DPS event flags (0x%02x)\r\n", status);
         return false;
     }
 
@@ -195,19 +282,24 @@ UINT azure_iot_dps_create(AZURE_IOT_MQTT* azure_iot_mqtt, NX_IP* nx_ip, NX_PACKE
         0);
     if (status)
     {
-        printf("Failed to create MQTT Client (0x%02x)\r\n", status);
+        AZURE_IOT_LOG_ERROR("Failed to create MQTT Client (0x%02x)\r\n", status);
         tx_event_flags_delete(&azure_iot_mqtt->mqtt_event_flags);
         return status;
     }
 
+#ifdef ENABLE_MQTT_ZERO_COPY
+    // Take PUBLISH packets before the MQTT client copies them into its receive queue
+    azure_iot_mqtt->nxd_mqtt_client.nxd_mqtt_packet_receive_notify = mqtt_packet_receive_cb;
+#else
     status = nxd_mqtt_client_receive_notify_set(&azure_iot_mqtt->nxd_mqtt_client, mqtt_notify_cb);
     if (status)
     {
-        printf("Error in setting receive notify (0x%02x)\r\n", status);
+        AZURE_IOT_LOG_ERROR("Error in setting receive notify (0x%02x)\r\n", status);
         tx_event_flags_delete(&azure_iot_mqtt->mqtt_event_flags);
         nxd_mqtt_client_delete(&azure_iot_mqtt->nxd_mqtt_client);
         return status;
     }
+#endif
 
     // Set the receive context (highjacking the packet_receive_context) for callbacks
     azure_iot_mqtt->nxd_mqtt_client.nxd_mqtt_packet_receive_context = azure_iot_mqtt;
@@ -219,7 +311,7 @@ UINT azure_iot_dps_delete(AZURE_IOT_MQTT* azure_iot_mqtt)
 {
     if (azure_iot_mqtt == NX_NULL)
     {
-        printf("Fail to delete DPS, null pointer\r\n");
+        AZURE_IOT_LOG_ERROR("Fail to delete DPS, null pointer\r\n");
         return NX_PTR_ERROR;
     }
 
@@ -236,9 +328,9 @@ UINT azure_iot_dps_register(AZURE_IOT_MQTT* azure_iot_mqtt, UINT wait)
     NXD_ADDRESS server_ip;
     CHAR mqtt_publish_payload[100];
 
-    printf("\tEndpoint: %s\r\n", AZURE_IOT_DPS_ENDPOINT);
-    printf("\tId scope: %s\r\n", azure_iot_mqtt->mqtt_dps_id_scope);
-    printf("\tRegistration id: %s\r\n", azure_iot_mqtt->mqtt_dps_registration_id);
+    AZURE_IOT_LOG_INFO("\tEndpoint: %s\r\n", AZURE_IOT_DPS_ENDPOINT);
+    AZURE_IOT_LOG_INFO("\tId scope: %s\r\n", azure_iot_mqtt->mqtt_dps_id_scope);
+    AZURE_IOT_LOG_INFO("\tRegistration id: %s\r\n", azure_iot_mqtt->mqtt_dps_registration_id);
 
     // Create the nxd_mqtt_client_secure_connect & password
     snprintf(azure_iot_mqtt->mqtt_username,
@@ -247,7 +339,8 @@ UINT azure_iot_dps_register(AZURE_IOT_MQTT* azure_iot_mqtt, UINT wait)
         azure_iot_mqtt->mqtt_dps_id_scope,
         azure_iot_mqtt->mqtt_dps_registration_id);
 
-    if (!create_dps_sas_token(azure_iot_mqtt->mqtt_sas_key,
+    if (!create_dps_sas_token(&azure_iot_mqtt->mqtt_sas_key_cache,
+            azure_iot_mqtt->mqtt_sas_key,
             strlen(azure_iot_mqtt->mqtt_sas_key),
             azure_iot_mqtt->mqtt_dps_id_scope,
             azure_iot_mqtt->mqtt_dps_registration_id,
@@ -255,7 +348,7 @@ UINT azure_iot_dps_register(AZURE_IOT_MQTT* azure_iot_mqtt, UINT wait)
             azure_iot_mqtt->mqtt_password,
             AZURE_IOT_MQTT_PASSWORD_SIZE))
     {
-        printf("ERROR: Unable to generate DPS SAS token\r\n");
+        AZURE_IOT_LOG_ERROR("ERROR: Unable to generate DPS SAS token\r\n");
         return NX_PTR_ERROR;
     }
 
@@ -266,7 +359,7 @@ UINT azure_iot_dps_register(AZURE_IOT_MQTT* azure_iot_mqtt, UINT wait)
         strlen(azure_iot_mqtt->mqtt_password));
     if (status != NXD_MQTT_SUCCESS)
     {
-        printf("Could not set client login (0x%04x)\r\n", status);
+        AZURE_IOT_LOG_ERROR("Could not set client login (0x%04x)\r\n", status);
         nx_secure_tls_session_delete(&azure_iot_mqtt->nxd_mqtt_client.nxd_mqtt_tls_session);
         return status;
     }
@@ -279,7 +372,7 @@ UINT azure_iot_dps_register(AZURE_IOT_MQTT* azure_iot_mqtt, UINT wait)
         NX_IP_VERSION_V4);
     if (status != NX_SUCCESS)
     {
-        printf("Error: Unable to resolve DNS for DPS MQTT Server %s (0x%04x)\r\n",
+        AZURE_IOT_LOG_ERROR("Error: Unable to resolve DNS for DPS MQTT Server %s (0x%04x)\r\n",
             AZURE_IOT_DPS_ENDPOINT,
             status);
         nx_secure_tls_session_delete(&azure_iot_mqtt->nxd_mqtt_client.nxd_mqtt_tls_session);
@@ -287,7 +380,7 @@ UINT azure_iot_dps_register(AZURE_IOT_MQTT* azure_iot_mqtt, UINT wait)
     }
 
     // Stash the hostname so we can verify the cert at connect
-    azure_iot_x509_hostname = AZURE_IOT_DPS_ENDPOINT;
+    azure_iot_mqtt->mqtt_x509_hostname = AZURE_IOT_DPS_ENDPOINT;
 
     status = nxd_mqtt_client_secure_connect(&azure_iot_mqtt->nxd_mqtt_client,
         &server_ip,
@@ -298,7 +391,7 @@ UINT azure_iot_dps_register(AZURE_IOT_MQTT* azure_iot_mqtt, UINT wait)
         MQTT_TIMEOUT);
     if (status != NXD_MQTT_SUCCESS)
     {
-        printf("Error: Could not connect to DPS MQTT server (0x%04x)\r\n", status);
+        AZURE_IOT_LOG_ERROR("Error: Could not connect to DPS MQTT server (0x%04x)\r\n", status);
         nx_secure_tls_session_delete(&azure_iot_mqtt->nxd_mqtt_client.nxd_mqtt_tls_session);
         return status;
     }
@@ -308,7 +401,7 @@ UINT azure_iot_dps_register(AZURE_IOT_MQTT* azure_iot_mqtt, UINT wait)
         &azure_iot_mqtt->nxd_mqtt_client, DPS_REGISTER_SUBSCRIBE, strlen(DPS_REGISTER_SUBSCRIBE), MQTT_QOS_0);
     if (status != NXD_MQTT_SUCCESS)
     {
-        printf("Error: Error in DPS registration subscription (0x%04x)\r\n", status);
+        AZURE_IOT_LOG_ERROR("Error: Error in DPS registration subscription (0x%04x)\r\n", status);
         nx_secure_tls_session_delete(&azure_iot_mqtt->nxd_mqtt_client.nxd_mqtt_tls_session);
         return status;
     }
@@ -324,7 +417,7 @@ UINT azure_iot_dps_register(AZURE_IOT_MQTT* azure_iot_mqtt, UINT wait)
     status = mqtt_publish(azure_iot_mqtt, DPS_REGISTER_TOPIC, mqtt_publish_payload);
     if (status != NX_SUCCESS)
     {
-        printf("ERROR: Failed to publish DPS registration (0x%04x)\r\n", status);
+        AZURE_IOT_LOG_ERROR("ERROR: Failed to publish DPS registration (0x%04x)\r\n", status);
     }
 
     // Wait for an event
@@ -334,7 +427,7 @@ UINT azure_iot_dps_register(AZURE_IOT_MQTT* azure_iot_mqtt, UINT wait)
 
     if (events != EVENT_FLAGS_SUCCESS)
     {
-        printf("ERROR: Failed to resolve device from DPS\r\n");
+        AZURE_IOT_LOG_ERROR("ERROR: Failed to resolve device from DPS\r\n");
         return NX_NOT_SUCCESSFUL;
     }
 
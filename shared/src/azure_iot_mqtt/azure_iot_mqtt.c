@@ -4,6 +4,7 @@
 #include "azure_iot_mqtt.h"
 
 #include <ctype.h>
+#include <stddef.h>
 #include <string.h>
 
 #include "tx_api.h"
@@ -12,23 +13,21 @@
 #include "nxd_mqtt_client.h"
 
 #include "azure_iot_cert.h"
+#include "azure_iot_log.h"
 #include "azure_iot_mqtt/azure_iot_dps_mqtt.h"
+#include "azure_iot_mqtt/azure_iot_mqtt_topic.h"
 #include "azure_iot_mqtt/sas_token.h"
 
 #define USERNAME                "%s/%s/?api-version=2020-09-30&model-id=%s"
 #define PUBLISH_TELEMETRY_TOPIC "devices/%s/messages/events/"
 
-#define DEVICE_MESSAGE_BASE  "messages/devicebound/"
 #define DEVICE_MESSAGE_TOPIC "devices/%s/messages/devicebound/#"
 
 #define DEVICE_TWIN_PUBLISH_TOPIC          "$iothub/twin/PATCH/properties/reported/?$rid=%d"
 #define DEVICE_TWIN_REQUEST_TOPIC          "$iothub/twin/GET/?$rid=%d"
-#define DEVICE_TWIN_RES_BASE               "$iothub/twin/res/"
 #define DEVICE_TWIN_RES_TOPIC              "$iothub/twin/res/#"
-#define DEVICE_TWIN_DESIRED_PROP_RES_BASE  "$iothub/twin/PATCH/properties/desired/"
 #define DEVICE_TWIN_DESIRED_PROP_RES_TOPIC "$iothub/twin/PATCH/properties/desired/#"
 
-#define DIRECT_METHOD_RECEIVE  "$iothub/methods/POST/"
 #define DIRECT_METHOD_TOPIC    "$iothub/methods/POST/#"
 #define DIRECT_METHOD_RESPONSE "$iothub/methods/res/%d/?$rid=%s"
 
@@ -36,18 +35,21 @@
 #define MQTT_TIMEOUT         (10 * TX_TIMER_TICKS_PER_SECOND)
 #define MQTT_KEEP_ALIVE      240
 
-CHAR* azure_iot_x509_hostname;
-
 static ULONG azure_iot_certificate_verify(NX_SECURE_TLS_SESSION* session, NX_SECURE_X509_CERT* certificate)
 {
     UINT status;
 
+    // The session is the one embedded in the MQTT client of this connection
+    NXD_MQTT_CLIENT* client = (NXD_MQTT_CLIENT*)((UCHAR*)session - offsetof(NXD_MQTT_CLIENT, nxd_mqtt_tls_session));
+    AZURE_IOT_MQTT* azure_iot_mqtt = (AZURE_IOT_MQTT*)client->nxd_mqtt_packet_receive_context;
+
     // Check certicate matches the correct address
-    status = nx_secure_x509_common_name_dns_check(
-        certificate, (UCHAR*)azure_iot_x509_hostname, strlen(azure_iot_x509_hostname));
+    status = nx_secure_x509_common_name_dns_check(certificate,
+        (UCHAR*)azure_iot_mqtt->mqtt_x509_hostname,
+        strlen(azure_iot_mqtt->mqtt_x509_hostname));
     if (status)
     {
-        printf("Error in certificate verification: DNS name did not match CN\r\n");
+        AZURE_IOT_LOG_ERROR("Error in certificate verification: DNS name did not match CN\r\n");
     }
 
     return status;
@@ -77,6 +79,28 @@ UINT azure_iot_mqtt_register_c2d_message_callback(
     return NX_SUCCESS;
 }
 
+UINT azure_iot_mqtt_register_topic_callback(AZURE_IOT_MQTT* azure_iot_mqtt, CHAR* topic_prefix, func_ptr_topic callback)
+{
+    AZURE_IOT_MQTT_TOPIC_HANDLER* handler;
+
+    if (azure_iot_mqtt == NULL || topic_prefix == NULL || callback == NULL)
+    {
+        return NX_PTR_ERROR;
+    }
+
+    if (azure_iot_mqtt->topic_handler_count >= AZURE_IOT_MQTT_TOPIC_HANDLER_COUNT)
+    {
+        return NX_NO_MORE_ENTRIES;
+    }
+
+    handler                      = &azure_iot_mqtt->topic_handlers[azure_iot_mqtt->topic_handler_count++];
+    handler->topic_prefix        = topic_prefix;
+    handler->topic_prefix_length = strlen(topic_prefix);
+    handler->callback            = callback;
+
+    return NX_SUCCESS;
+}
+
 UINT azure_iot_mqtt_register_device_twin_desired_prop_callback(
     AZURE_IOT_MQTT* azure_iot_mqtt, func_ptr_device_twin_desired_prop mqtt_device_twin_desired_prop_callback)
 {
@@ -120,39 +144,55 @@ UINT tls_setup(NXD_MQTT_CLIENT* client,
         sizeof(azure_iot_mqtt->tls_metadata_buffer));
     if (status != NX_SUCCESS)
     {
-        printf("Failed to create TLS session status (0x%04x)\r\n", status);
+        AZURE_IOT_LOG_ERROR("Failed to create TLS session status (0x%04x)\r\n", status);
         return status;
     }
 
+#if (AZURE_IOT_TLS_PROFILE == AZURE_IOT_TLS_PROFILE_GCM)
+    // Offer the curves for ECDHE key exchange and ECDSA server certificates
+    status = nx_secure_tls_ecc_initialize(
+        tls_session, nx_crypto_ecc_supported_groups, nx_crypto_ecc_supported_groups_size, nx_crypto_ecc_curves);
+    if (status != NX_SUCCESS)
+    {
+        AZURE_IOT_LOG_ERROR("Failed to initialize TLS ECC curves (0x%04x)\r\n", status);
+        return status;
+    }
+#endif
+
     status = nx_secure_tls_remote_certificate_allocate(tls_session,
         &azure_iot_mqtt->mqtt_remote_certificate,
         azure_iot_mqtt->mqtt_remote_cert_buffer,
         sizeof(azure_iot_mqtt->mqtt_remote_cert_buffer));
     if (status != NX_SUCCESS)
     {
-        printf("Failed to create remote certificate buffer (0x%04x)\r\n", status);
+        AZURE_IOT_LOG_ERROR("Failed to create remote certificate buffer (0x%04x)\r\n", status);
         return status;
     }
 
-    // Add a CA Certificate to our trusted store for verifying incoming server certificates
-    status = nx_secure_x509_certificate_initialize(trusted_cert,
-        (UCHAR*)azure_iot_root_cert,
-        azure_iot_root_cert_size,
-        NX_NULL,
-        0,
-        NX_NULL,
-        0,
-        NX_SECURE_X509_KEY_TYPE_NONE);
-    if (status != NX_SUCCESS)
+    // Parse the CA certificate once, reconnects reuse it for verifying incoming server certificates
+    if (!azure_iot_mqtt->mqtt_trusted_certificate_initialized)
     {
-        printf("Unable to initialize CA certificate (0x%04x)\r\n", status);
-        return status;
+        status = nx_secure_x509_certificate_initialize(&azure_iot_mqtt->mqtt_trusted_certificate,
+            (UCHAR*)azure_iot_root_cert,
+            azure_iot_root_cert_size,
+            NX_NULL,
+            0,
+            NX_NULL,
+            0,
+            NX_SECURE_X509_KEY_TYPE_NONE);
+        if (status != NX_SUCCESS)
+        {
+            AZURE_IOT_LOG_ERROR("Unable to initialize CA certificate (0x%04x)\r\n", status);
+            return status;
+        }
+
+        azure_iot_mqtt->mqtt_trusted_certificate_initialized = true;
     }
 
-    status = nx_secure_tls_trusted_certificate_add(tls_session, trusted_cert);
+    status = nx_secure_tls_trusted_certificate_add(tls_session, &azure_iot_mqtt->mqtt_trusted_certificate);
     if (status != NX_SUCCESS)
     {
-        printf("Unable to add CA certificate to trusted store (0x%04x)\r\n", status);
+        AZURE_IOT_LOG_ERROR("Unable to add CA certificate to trusted store (0x%04x)\r\n", status);
         return status;
     }
 
@@ -160,7 +200,7 @@ UINT tls_setup(NXD_MQTT_CLIENT* client,
         tls_session, azure_iot_mqtt->tls_packet_buffer, sizeof(azure_iot_mqtt->tls_packet_buffer));
     if (status != NX_SUCCESS)
     {
-        printf("Could not set TLS session packet buffer (0x%02x)\r\n", status);
+        AZURE_IOT_LOG_ERROR("Could not set TLS session packet buffer (0x%02x)\r\n", status);
         return status;
     }
 
@@ -169,7 +209,7 @@ UINT tls_setup(NXD_MQTT_CLIENT* client,
     status = nx_secure_tls_session_certificate_callback_set(tls_session, azure_iot_certificate_verify);
     if (status)
     {
-        printf("Failed to set the session certificate callback: status: %d", status);
+        AZURE_IOT_LOG_ERROR("Failed to set the session certificate callback: status: %d", status);
         return status;
     }
 
@@ -191,7 +231,7 @@ UINT mqtt_publish(AZURE_IOT_MQTT* azure_iot_mqtt, CHAR* topic, CHAR* message)
         NX_WAIT_FOREVER);
     if (status != NX_SUCCESS)
     {
-        printf("Failed to publish %s (0x%02x)\r\n", message, status);
+        AZURE_IOT_LOG_ERROR("Failed to publish %s (0x%02x)\r\n", message, status);
     }
 
     return status;
@@ -205,7 +245,7 @@ static UINT mqtt_publish_float(AZURE_IOT_MQTT* azure_iot_mqtt, CHAR* topic, CHAR
     int fracvalue = abs(100 * (value - (long)value));
 
     snprintf(mqtt_message, sizeof(mqtt_message), "{\"%s\":%d.%02d}", label, decvalue, fracvalue);
-    printf("Sending message %s\r\n", mqtt_message);
+    AZURE_IOT_LOG_DEBUG("Sending message %s\r\n", mqtt_message);
 
     return mqtt_publish(azure_iot_mqtt, topic, mqtt_message);
 }
@@ -215,141 +255,355 @@ static UINT mqtt_publish_bool(AZURE_IOT_MQTT* azure_iot_mqtt, CHAR* topic, CHAR*
     CHAR mqtt_message[200];
 
     snprintf(mqtt_message, sizeof(mqtt_message), "{\"%s\":%s}", label, (value ? "true" : "false"));
-    printf("Sending message %s\r\n", mqtt_message);
+    AZURE_IOT_LOG_DEBUG("Sending message %s\r\n", mqtt_message);
 
     return mqtt_publish(azure_iot_mqtt, topic, mqtt_message);
 }
 
-static VOID process_direct_method(AZURE_IOT_MQTT* azure_iot_mqtt, CHAR* topic, CHAR* message)
+static VOID process_direct_method(
+    AZURE_IOT_MQTT* azure_iot_mqtt, AZURE_IOT_MQTT_TOPIC* topic, AZURE_IOT_MQTT_PAYLOAD message)
 {
-    INT direct_method_receive_size = sizeof(DIRECT_METHOD_RECEIVE) - 1;
-    CHAR direct_method_name[64]    = {0};
+    CHAR direct_method_name[64] = {0};
+    UINT request_id_length      = topic->request_id_length;
 
-    CHAR* location = topic + direct_method_receive_size;
-    CHAR* find;
-
-    find = strchr(location, '/');
-    if (find == 0)
+    if (topic->request_id == NX_NULL)
     {
+        AZURE_IOT_LOG_ERROR("Error: failed to parse direct method rid\r\n");
         return;
     }
 
-    strncpy(direct_method_name, location, find - location);
-
-    location = find;
-
-    find = strstr(location, "$rid=");
-    if (find == 0)
+    if (topic->name_length >= sizeof(direct_method_name))
     {
-        printf("Error: failed to parse direct method rid\r\n");
+        AZURE_IOT_LOG_ERROR("Error: direct method name too long\r\n");
         return;
     }
 
-    location = find + 5;
-    strncpy(azure_iot_mqtt->direct_command_request_id, location, AZURE_IOT_MQTT_DIRECT_COMMAND_RID_SIZE);
+    if (request_id_length >= AZURE_IOT_MQTT_DIRECT_COMMAND_RID_SIZE)
+    {
+        request_id_length = AZURE_IOT_MQTT_DIRECT_COMMAND_RID_SIZE - 1;
+    }
 
-    printf("Received direct method=%s, rid=%s, message=%s\r\n",
+    memcpy(direct_method_name, topic->name, topic->name_length);
+    memcpy(azure_iot_mqtt->direct_command_request_id, topic->request_id, request_id_length);
+    azure_iot_mqtt->direct_command_request_id[request_id_length] = 0;
+
+#ifdef ENABLE_MQTT_ZERO_COPY
+    AZURE_IOT_LOG_INFO("Received direct method=%s, rid=%s, message length=%lu\r\n",
+        direct_method_name,
+        azure_iot_mqtt->direct_command_request_id,
+        message->length);
+#else
+    AZURE_IOT_LOG_INFO("Received direct method=%s, rid=%s, message=%s\r\n",
         direct_method_name,
         azure_iot_mqtt->direct_command_request_id,
         message);
+#endif
 
     if (azure_iot_mqtt->cb_ptr_mqtt_invoke_direct_method == NULL)
     {
-        printf("No callback is registered for MQTT direct method invoke\r\n");
+        AZURE_IOT_LOG_INFO("No callback is registered for MQTT direct method invoke\r\n");
         return;
     }
 
     azure_iot_mqtt->cb_ptr_mqtt_invoke_direct_method(azure_iot_mqtt, direct_method_name, message);
 }
 
-static VOID process_c2d_message(AZURE_IOT_MQTT* azure_iot_mqtt, CHAR* topic, CHAR* message)
+static VOID process_c2d_message(
+    AZURE_IOT_MQTT* azure_iot_mqtt, AZURE_IOT_MQTT_TOPIC* topic, AZURE_IOT_MQTT_PAYLOAD message)
 {
-    CHAR* properties;
-
-    // Get to parameters list
-    if ((properties = strstr(topic, ".to")) == 0)
+    if (azure_iot_mqtt->cb_ptr_mqtt_c2d_message == NULL)
     {
-        printf("Received C2D message has no parameter list\r\n");
+        AZURE_IOT_LOG_INFO("No callback is registered for MQTT cloud to device message processing\r\n");
         return;
     }
 
-    // Find the properties
-    if ((properties = strstr(properties, "&")) == 0)
+    azure_iot_mqtt->cb_ptr_mqtt_c2d_message(azure_iot_mqtt, topic->properties, message);
+}
+
+static VOID process_device_twin_response(
+    AZURE_IOT_MQTT* azure_iot_mqtt, AZURE_IOT_MQTT_TOPIC* topic, AZURE_IOT_MQTT_PAYLOAD message)
+{
+    AZURE_IOT_LOG_INFO("Processed device twin update response with status=%d\r\n", topic->status);
+
+    if (topic->status == 200)
     {
-        // No properties, point at the null terminator
-        properties = topic + strlen(topic);
+        azure_iot_mqtt->cb_ptr_mqtt_device_twin_prop_callback(azure_iot_mqtt, message);
     }
-    else
+}
+
+static VOID process_device_twin_desired_prop_update(
+    AZURE_IOT_MQTT* azure_iot_mqtt, AZURE_IOT_MQTT_TOPIC* topic, AZURE_IOT_MQTT_PAYLOAD message)
+{
+    AZURE_IOT_LOG_INFO("Received device twin desired property\r\n");
+
+    if (topic->version < 0)
     {
-        // Skip over the '&'
-        properties++;
+        AZURE_IOT_LOG_ERROR("Error: Failed to parse version from desired property update\r\n");
+        return;
     }
 
-    if (azure_iot_mqtt->cb_ptr_mqtt_c2d_message == NULL)
+    azure_iot_mqtt->desired_property_version = topic->version;
+
+    azure_iot_mqtt->cb_ptr_mqtt_device_twin_desired_prop_callback(azure_iot_mqtt, message);
+}
+
+static VOID process_application_topic(AZURE_IOT_MQTT* azure_iot_mqtt, CHAR* topic, AZURE_IOT_MQTT_PAYLOAD message)
+{
+    for (UINT i = 0; i < azure_iot_mqtt->topic_handler_count; ++i)
     {
-        printf("No callback is registered for MQTT cloud to device message processing\r\n");
-        return;
+        AZURE_IOT_MQTT_TOPIC_HANDLER* handler = &azure_iot_mqtt->topic_handlers[i];
+
+        if (strncmp(topic, handler->topic_prefix, handler->topic_prefix_length) == 0)
+        {
+            handler->callback(azure_iot_mqtt, topic, message);
+            return;
+        }
     }
 
-    azure_iot_mqtt->cb_ptr_mqtt_c2d_message(azure_iot_mqtt, properties, message);
+    AZURE_IOT_LOG_INFO("Unknown topic received, no custom processing specified\r\n");
 }
 
-static VOID process_device_twin_response(AZURE_IOT_MQTT* azure_iot_mqtt, CHAR* topic, CHAR* message)
+static VOID mqtt_disconnect_cb(NXD_MQTT_CLIENT* client_ptr)
 {
-    INT response_status;
+    AZURE_IOT_LOG_ERROR("ERROR: MQTT disconnected, reconnecting...\r\n");
 
-    // Parse the device twin response status
-    CHAR* location = topic + sizeof(DEVICE_TWIN_RES_BASE) - 1;
-    CHAR* find;
+    AZURE_IOT_MQTT* azure_iot_mqtt = (AZURE_IOT_MQTT*)client_ptr;
 
-    find = strchr(location, '/');
-    if (find == 0)
+    // Try and reconnect forever
+    while (azure_iot_mqtt_connect(azure_iot_mqtt) != NX_SUCCESS)
     {
-        return;
+        tx_thread_sleep(10 * TX_TIMER_TICKS_PER_SECOND);
     }
+}
 
-    response_status = atoi(location);
+static VOID mqtt_message_dispatch(AZURE_IOT_MQTT* azure_iot_mqtt, CHAR* topic_buffer, AZURE_IOT_MQTT_PAYLOAD payload)
+{
+    AZURE_IOT_MQTT_TOPIC topic;
 
-    printf("Processed device twin update response with status=%d\r\n", response_status);
+    azure_iot_mqtt_topic_parse(
+        topic_buffer, azure_iot_mqtt->mqtt_device_id, strlen(azure_iot_mqtt->mqtt_device_id), &topic);
 
-    if (response_status == 200)
+    switch (topic.type)
     {
-        azure_iot_mqtt->cb_ptr_mqtt_device_twin_prop_callback(azure_iot_mqtt, message);
+        case AZURE_IOT_MQTT_TOPIC_DIRECT_METHOD:
+            process_direct_method(azure_iot_mqtt, &topic, payload);
+            break;
+
+        case AZURE_IOT_MQTT_TOPIC_C2D_MESSAGE:
+            process_c2d_message(azure_iot_mqtt, &topic, payload);
+            break;
+
+        case AZURE_IOT_MQTT_TOPIC_TWIN_RESPONSE:
+            process_device_twin_response(azure_iot_mqtt, &topic, payload);
+            break;
+
+        case AZURE_IOT_MQTT_TOPIC_TWIN_DESIRED_PROPERTIES:
+            process_device_twin_desired_prop_update(azure_iot_mqtt, &topic, payload);
+            break;
+
+        default:
+            process_application_topic(azure_iot_mqtt, topic_buffer, payload);
+            break;
     }
 }
 
-static VOID process_device_twin_desired_prop_update(AZURE_IOT_MQTT* azure_iot_mqtt, CHAR* topic, CHAR* message)
+bool azure_iot_mqtt_payload_get(AZURE_IOT_MQTT_PAYLOAD payload, const CHAR** data, ULONG* length)
 {
-    printf("Received device twin desired property\r\n");
+#ifdef ENABLE_MQTT_ZERO_COPY
+    NX_PACKET* packet = payload->packet;
 
-    // Parse the device twin version
-    CHAR* location = topic + sizeof(DEVICE_TWIN_DESIRED_PROP_RES_BASE) - 1;
+    if (packet == NX_NULL ||
+        packet->nx_packet_prepend_ptr + payload->offset + payload->length > packet->nx_packet_append_ptr)
+    {
+        return false;
+    }
+
+    *data   = (CHAR*)packet->nx_packet_prepend_ptr + payload->offset;
+    *length = payload->length;
+#else
+    *data   = payload;
+    *length = strlen(payload);
+#endif
+
+    return true;
+}
 
-    location = strstr(location, "$version=");
-    if (location == 0)
+bool azure_iot_mqtt_payload_segment_next(AZURE_IOT_MQTT_PAYLOAD payload, AZURE_IOT_MQTT_SEGMENT* segment)
+{
+#ifdef ENABLE_MQTT_ZERO_COPY
+    NX_PACKET* packet;
+    ULONG packet_length;
+
+    if (payload->packet == NX_NULL || segment->position >= payload->length)
     {
-        printf("Error: Failed to parse version from desired property update\r\n");
-        return;
+        return false;
+    }
+
+    if (segment->position == 0 && segment->packet == NX_NULL)
+    {
+        segment->packet        = payload->packet;
+        segment->packet_offset = payload->offset;
     }
 
-    azure_iot_mqtt->desired_property_version = atoi(location + 9);
+    // The payload offset counts from the start of the chain, skip the packets holding only the header and topic
+    for (packet = segment->packet; packet != NX_NULL; packet = packet->nx_packet_next)
+    {
+        packet_length = (ULONG)(packet->nx_packet_append_ptr - packet->nx_packet_prepend_ptr);
+        if (segment->packet_offset < packet_length)
+        {
+            break;
+        }
 
-    azure_iot_mqtt->cb_ptr_mqtt_device_twin_desired_prop_callback(azure_iot_mqtt, message);
+        segment->packet_offset -= packet_length;
+    }
+
+    if (packet == NX_NULL)
+    {
+        return false;
+    }
+
+    segment->data   = (CHAR*)packet->nx_packet_prepend_ptr + segment->packet_offset;
+    segment->length = packet_length - segment->packet_offset;
+
+    if (segment->length > payload->length - segment->position)
+    {
+        segment->length = payload->length - segment->position;
+    }
+
+    segment->position += segment->length;
+    segment->packet        = packet->nx_packet_next;
+    segment->packet_offset = 0;
+#else
+    if (segment->position > 0 || payload[0] == 0)
+    {
+        return false;
+    }
+
+    segment->data     = payload;
+    segment->length   = strlen(payload);
+    segment->position = segment->length;
+#endif
+
+    return true;
 }
 
-static VOID mqtt_disconnect_cb(NXD_MQTT_CLIENT* client_ptr)
+ULONG azure_iot_mqtt_payload_copy(AZURE_IOT_MQTT_PAYLOAD payload, CHAR* buffer, ULONG buffer_size)
 {
-    printf("ERROR: MQTT disconnected, reconnecting...\r\n");
+    AZURE_IOT_MQTT_SEGMENT segment = {0};
+    ULONG copied                   = 0;
 
-    AZURE_IOT_MQTT* azure_iot_mqtt = (AZURE_IOT_MQTT*)client_ptr;
+    while (azure_iot_mqtt_payload_segment_next(payload, &segment))
+    {
+        ULONG length = segment.length;
 
-    // Try and reconnect forever
-    while (azure_iot_mqtt_connect(azure_iot_mqtt) != NX_SUCCESS)
+        if (copied + length > buffer_size - 1)
+        {
+            length = copied < buffer_size - 1 ? buffer_size - 1 - copied : 0;
+        }
+
+        memcpy(buffer + copied, segment.data, length);
+        copied += length;
+    }
+
+    buffer[copied] = 0;
+
+    return segment.position;
+}
+
+bool azure_iot_mqtt_twin_parse(AZURE_IOT_MQTT_PAYLOAD payload,
+    const CHAR* root,
+    const TWIN_PROPERTY* properties,
+    UINT property_count,
+    UINT* found_mask,
+    UINT* changed_mask)
+{
+    AZURE_IOT_MQTT_SEGMENT segment = {0};
+    TWIN_PARSER parser;
+
+    twin_parser_init(&parser, root, properties, property_count);
+
+    while (azure_iot_mqtt_payload_segment_next(payload, &segment))
     {
-        tx_thread_sleep(10 * TX_TIMER_TICKS_PER_SECOND);
+        twin_parser_feed(&parser, segment.data, segment.length);
     }
+
+    return twin_parser_finish(&parser, found_mask, changed_mask);
+}
+
+#ifdef ENABLE_MQTT_ZERO_COPY
+UINT azure_iot_mqtt_message_extract(
+    AZURE_IOT_MQTT_MESSAGE* message, ULONG offset, VOID* buffer, ULONG buffer_length, ULONG* bytes_copied)
+{
+    if (message == NX_NULL || message->packet == NX_NULL || offset >= message->length)
+    {
+        *bytes_copied = 0;
+        return NX_PTR_ERROR;
+    }
+
+    if (buffer_length > message->length - offset)
+    {
+        buffer_length = message->length - offset;
+    }
+
+    return nx_packet_data_extract_offset(message->packet, message->offset + offset, buffer, buffer_length, bytes_copied);
+}
+
+NX_PACKET* azure_iot_mqtt_message_retain(AZURE_IOT_MQTT_MESSAGE* message)
+{
+    NX_PACKET* packet = message->packet;
+
+    // The client skips the release once the packet is taken
+    message->packet = NX_NULL;
+
+    return packet;
 }
 
+// Runs on the MQTT thread for every received packet, PUBLISH packets are consumed here and
+// handed to the callbacks in place, everything else goes back to the MQTT client
+static UINT mqtt_packet_receive_cb(NXD_MQTT_CLIENT* client_ptr, NX_PACKET* packet_ptr, VOID* context)
+{
+    AZURE_IOT_MQTT* azure_iot_mqtt = (AZURE_IOT_MQTT*)context;
+    CHAR topic_buffer[AZURE_IOT_MQTT_TOPIC_NAME_LENGTH];
+    AZURE_IOT_MQTT_MESSAGE message;
+    ULONG topic_offset;
+    USHORT topic_length;
+    ULONG bytes_copied;
+
+    if ((*packet_ptr->nx_packet_prepend_ptr >> 4) != MQTT_CONTROL_PACKET_TYPE_PUBLISH)
+    {
+        return NX_FALSE;
+    }
+
+    if (_nxd_mqtt_process_publish_packet(packet_ptr, &topic_offset, &topic_length, &message.offset, &message.length))
+    {
+        AZURE_IOT_LOG_ERROR("ERROR: malformed MQTT publish packet\r\n");
+        nx_packet_release(packet_ptr);
+        return NX_TRUE;
+    }
+
+    // The topic is short and parsed as a string, copy just that out of the packet
+    if (topic_length >= sizeof(topic_buffer) ||
+        nx_packet_data_extract_offset(packet_ptr, topic_offset, topic_buffer, topic_length, &bytes_copied) ||
+        bytes_copied != topic_length)
+    {
+        AZURE_IOT_LOG_ERROR("ERROR: MQTT topic too long (%d)\r\n", topic_length);
+        nx_packet_release(packet_ptr);
+        return NX_TRUE;
+    }
+
+    topic_buffer[topic_length] = 0;
+    message.packet             = packet_ptr;
+
+    mqtt_message_dispatch(azure_iot_mqtt, topic_buffer, &message);
+
+    if (message.packet != NX_NULL)
+    {
+        nx_packet_release(message.packet);
+    }
+
+    return NX_TRUE;
+}
+#else
 static VOID mqtt_notify_cb(NXD_MQTT_CLIENT* client_ptr, UINT number_of_messages)
 {
     UINT actual_topic_length;
@@ -363,14 +617,14 @@ static VOID mqtt_notify_cb(NXD_MQTT_CLIENT* client_ptr, UINT number_of_messages)
         // Get the mqtt client message
         status = nxd_mqtt_client_message_get(client_ptr,
             (UCHAR*)azure_iot_mqtt->mqtt_receive_topic_buffer,
-            AZURE_IOT_MQTT_TOPIC_NAME_LENGTH,
+            AZURE_IOT_MQTT_TOPIC_NAME_LENGTH - 1,
             &actual_topic_length,
             (UCHAR*)azure_iot_mqtt->mqtt_receive_message_buffer,
-            AZURE_IOT_MQTT_MESSAGE_LENGTH,
+            AZURE_IOT_MQTT_MESSAGE_LENGTH - 1,
             &actual_message_length);
         if (status != NXD_MQTT_SUCCESS)
         {
-            printf("ERROR: nxd_mqtt_client_message_get failed (0x%02x)\r\n", status);
+            AZURE_IOT_LOG_ERROR("ERROR: nxd_mqtt_client_message_get failed (0x%02x)\r\n", status);
             continue;
         }
 
@@ -378,38 +632,17 @@ static VOID mqtt_notify_cb(NXD_MQTT_CLIENT* client_ptr, UINT number_of_messages)
         azure_iot_mqtt->mqtt_receive_topic_buffer[actual_topic_length]     = 0;
         azure_iot_mqtt->mqtt_receive_message_buffer[actual_message_length] = 0;
 
-        if (strstr((CHAR*)azure_iot_mqtt->mqtt_receive_topic_buffer, DIRECT_METHOD_RECEIVE))
-        {
-            process_direct_method(
-                azure_iot_mqtt, azure_iot_mqtt->mqtt_receive_topic_buffer, azure_iot_mqtt->mqtt_receive_message_buffer);
-        }
-        else if (strstr((CHAR*)azure_iot_mqtt->mqtt_receive_topic_buffer, DEVICE_MESSAGE_BASE))
-        {
-            process_c2d_message(
-                azure_iot_mqtt, azure_iot_mqtt->mqtt_receive_topic_buffer, azure_iot_mqtt->mqtt_receive_message_buffer);
-        }
-        else if (strstr((CHAR*)azure_iot_mqtt->mqtt_receive_topic_buffer, DEVICE_TWIN_RES_BASE))
-        {
-            process_device_twin_response(
-                azure_iot_mqtt, azure_iot_mqtt->mqtt_receive_topic_buffer, azure_iot_mqtt->mqtt_receive_message_buffer);
-        }
-        else if (strstr((CHAR*)azure_iot_mqtt->mqtt_receive_topic_buffer, DEVICE_TWIN_DESIRED_PROP_RES_BASE))
-        {
-            process_device_twin_desired_prop_update(
-                azure_iot_mqtt, azure_iot_mqtt->mqtt_receive_topic_buffer, azure_iot_mqtt->mqtt_receive_message_buffer);
-        }
-        else
-        {
-            printf("Unknown topic received, no custom processing specified\r\n");
-        }
+        mqtt_message_dispatch(
+            azure_iot_mqtt, azure_iot_mqtt->mqtt_receive_topic_buffer, azure_iot_mqtt->mqtt_receive_message_buffer);
     }
 }
+#endif
 
 static UINT azure_iot_mqtt_create_common(AZURE_IOT_MQTT* azure_iot_mqtt, NX_IP* nx_ip, NX_PACKET_POOL* nx_pool)
 {
     UINT status;
 
-    printf("\r\nInitializing MQTT Hub client\r\n");
+    AZURE_IOT_LOG_INFO("\r\nInitializing MQTT Hub client\r\n");
 
     status = nxd_mqtt_client_create(&azure_iot_mqtt->nxd_mqtt_client,
         "MQTT client",
@@ -424,22 +657,27 @@ static UINT azure_iot_mqtt_create_common(AZURE_IOT_MQTT* azure_iot_mqtt, NX_IP*
         0);
     if (status != NXD_MQTT_SUCCESS)
     {
-        printf("Failed to create MQTT Client (0x%02x)\r\n", status);
+        AZURE_IOT_LOG_ERROR("Failed to create MQTT Client (0x%02x)\r\n", status);
         return status;
     }
 
+#ifdef ENABLE_MQTT_ZERO_COPY
+    // Take PUBLISH packets before the MQTT client copies them into its receive queue
+    azure_iot_mqtt->nxd_mqtt_client.nxd_mqtt_packet_receive_notify = mqtt_packet_receive_cb;
+#else
     status = nxd_mqtt_client_receive_notify_set(&azure_iot_mqtt->nxd_mqtt_client, mqtt_notify_cb);
     if (status != NXD_MQTT_SUCCESS)
     {
-        printf("Error in setting receive notify (0x%02x)\r\n", status);
+        AZURE_IOT_LOG_ERROR("Error in setting receive notify (0x%02x)\r\n", status);
         nxd_mqtt_client_delete(&azure_iot_mqtt->nxd_mqtt_client);
         return status;
     }
+#endif
 
     status = nxd_mqtt_client_disconnect_notify_set(&azure_iot_mqtt->nxd_mqtt_client, mqtt_disconnect_cb);
     if (status != NXD_MQTT_SUCCESS)
     {
-        printf("Error in seting disconnect notification (0x%02x)\r\n", status);
+        AZURE_IOT_LOG_ERROR("Error in seting disconnect notification (0x%02x)\r\n", status);
         nxd_mqtt_client_delete(&azure_iot_mqtt->nxd_mqtt_client);
         return status;
     }
@@ -456,7 +694,7 @@ UINT azure_iot_mqtt_publish_float_property(AZURE_IOT_MQTT* azure_iot_mqtt, CHAR*
     CHAR mqtt_publish_topic[100];
     UINT status;
 
-    printf("Sending device twin update with float value\r\n");
+    AZURE_IOT_LOG_INFO("Sending device twin update with float value\r\n");
 
     snprintf(mqtt_publish_topic,
         sizeof(mqtt_publish_topic),
@@ -472,7 +710,7 @@ UINT azure_iot_mqtt_publish_bool_property(AZURE_IOT_MQTT* azure_iot_mqtt, CHAR*
 {
     CHAR mqtt_publish_topic[100];
 
-    printf("Sending device twin update with bool value\r\n");
+    AZURE_IOT_LOG_INFO("Sending device twin update with bool value\r\n");
 
     snprintf(mqtt_publish_topic,
         sizeof(mqtt_publish_topic),
@@ -486,7 +724,7 @@ UINT azure_iot_mqtt_publish_float_telemetry(AZURE_IOT_MQTT* azure_iot_mqtt, CHAR
 {
     CHAR mqtt_publish_topic[100];
 
-    printf("Sending telemetry with float value\r\n");
+    AZURE_IOT_LOG_INFO("Sending telemetry with float value\r\n");
 
     snprintf(mqtt_publish_topic,
         sizeof(mqtt_publish_topic),
@@ -501,7 +739,7 @@ UINT azure_iot_mqtt_publish_int_writeable_property(AZURE_IOT_MQTT* azure_iot_mqt
     CHAR mqtt_publish_topic[100];
     CHAR mqtt_publish_message[100];
 
-    printf("Reporting writeable property %s as %d\r\n", label, value);
+    AZURE_IOT_LOG_INFO("Reporting writeable property %s as %d\r\n", label, value);
 
     snprintf(mqtt_publish_topic,
         sizeof(mqtt_publish_topic),
@@ -523,7 +761,7 @@ UINT azure_iot_mqtt_respond_int_writeable_property(
     CHAR mqtt_publish_topic[100];
     CHAR mqtt_publish_message[100];
 
-    printf("Responding to writeable property %s = %d\r\n", label, value);
+    AZURE_IOT_LOG_INFO("Responding to writeable property %s = %d\r\n", label, value);
 
     snprintf(mqtt_publish_topic,
         sizeof(mqtt_publish_topic),
@@ -545,7 +783,7 @@ UINT azure_iot_mqtt_respond_direct_method(AZURE_IOT_MQTT* azure_iot_mqtt, UINT r
 {
     CHAR mqtt_publish_topic[100];
 
-    printf("Responding to direct command property with status:%d, rid:%s\r\n",
+    AZURE_IOT_LOG_INFO("Responding to direct command property with status:%d, rid:%s\r\n",
         response,
         azure_iot_mqtt->direct_command_request_id);
 
@@ -562,7 +800,7 @@ UINT azure_iot_mqtt_device_twin_request(AZURE_IOT_MQTT* azure_iot_mqtt)
 {
     CHAR mqtt_publish_topic[100];
 
-    printf("Requesting device twin model\r\n");
+    AZURE_IOT_LOG_INFO("Requesting device twin model\r\n");
 
     snprintf(mqtt_publish_topic, sizeof(mqtt_publish_topic), DEVICE_TWIN_REQUEST_TOPIC, 0);
 
@@ -582,13 +820,13 @@ UINT azure_iot_mqtt_create(AZURE_IOT_MQTT* azure_iot_mqtt,
 {
     if (azure_iot_mqtt == NULL)
     {
-        printf("ERROR: azure_iot_mqtt is NULL\r\n");
+        AZURE_IOT_LOG_ERROR("ERROR: azure_iot_mqtt is NULL\r\n");
         return NX_PTR_ERROR;
     }
 
     if (iot_hub_hostname[0] == 0 || iot_device_id[0] == 0 || iot_sas_key[0] == 0)
     {
-        printf("ERROR: IoT Hub connection configuration is empty\r\n");
+        AZURE_IOT_LOG_ERROR("ERROR: IoT Hub connection configuration is empty\r\n");
         return NX_PTR_ERROR;
     }
 
@@ -618,17 +856,17 @@ UINT azure_iot_mqtt_create_with_dps(AZURE_IOT_MQTT* azure_iot_mqtt,
 {
     UINT status;
 
-    printf("\r\nInitializing MQTT DPS client\r\n");
+    AZURE_IOT_LOG_INFO("\r\nInitializing MQTT DPS client\r\n");
 
     if (azure_iot_mqtt == NULL)
     {
-        printf("ERROR: azure_iot_mqtt is NULL\r\n");
+        AZURE_IOT_LOG_ERROR("ERROR: azure_iot_mqtt is NULL\r\n");
         return NX_PTR_ERROR;
     }
 
     if (iot_dps_id_scope[0] == 0 || iot_registration_id[0] == 0 || iot_sas_key[0] == 0)
     {
-        printf("ERROR: IoT DPS connection configuration is empty\r\n");
+        AZURE_IOT_LOG_ERROR("ERROR: IoT DPS connection configuration is empty\r\n");
         return NX_PTR_ERROR;
     }
 
@@ -646,14 +884,14 @@ UINT azure_iot_mqtt_create_with_dps(AZURE_IOT_MQTT* azure_iot_mqtt,
     status = azure_iot_dps_create(azure_iot_mqtt, nx_ip, nx_pool);
     if (status != NX_SUCCESS)
     {
-        printf("ERROR: Failed to create DPS client (0x%04x)\r\n", status);
+        AZURE_IOT_LOG_ERROR("ERROR: Failed to create DPS client (0x%04x)\r\n", status);
         return status;
     }
 
     status = azure_iot_dps_register(azure_iot_mqtt, NX_WAIT_FOREVER);
     if (status != NX_SUCCESS)
     {
-        printf("ERROR: Failed to register DPS device (0x%04x)\r\n", status);
+        AZURE_IOT_LOG_ERROR("ERROR: Failed to register DPS device (0x%04x)\r\n", status);
         azure_iot_dps_delete(azure_iot_mqtt);
         return status;
     }
@@ -661,11 +899,11 @@ UINT azure_iot_mqtt_create_with_dps(AZURE_IOT_MQTT* azure_iot_mqtt,
     status = azure_iot_dps_delete(azure_iot_mqtt);
     if (status != NX_SUCCESS)
     {
-        printf("ERROR: Failed to delete DPS client (0x%04x)\r\n", status);
+        AZURE_IOT_LOG_ERROR("ERROR: Failed to delete DPS client (0x%04x)\r\n", status);
         return status;
     }
 
-    printf("SUCCESS: MQTT DPS client initialized\r\n");
+    AZURE_IOT_LOG_INFO("SUCCESS: MQTT DPS client initialized\r\n");
 
     // call into common code
     return azure_iot_mqtt_create_common(azure_iot_mqtt, nx_ip, nx_pool);
@@ -683,11 +921,11 @@ UINT azure_iot_mqtt_connect(AZURE_IOT_MQTT* azure_iot_mqtt)
 {
     UINT status;
     CHAR mqtt_subscribe_topic[100];
-    NXD_ADDRESS server_ip;
+    ULONG connect_start = tx_time_get();
 
-    printf("\tHub hostname: %s\r\n", azure_iot_mqtt->mqtt_hub_hostname);
-    printf("\tDevice id: %s\r\n", azure_iot_mqtt->mqtt_device_id);
-    printf("\tModel id: %s\r\n", azure_iot_mqtt->mqtt_model_id);
+    AZURE_IOT_LOG_INFO("\tHub hostname: %s\r\n", azure_iot_mqtt->mqtt_hub_hostname);
+    AZURE_IOT_LOG_INFO("\tDevice id: %s\r\n", azure_iot_mqtt->mqtt_device_id);
+    AZURE_IOT_LOG_INFO("\tModel id: %s\r\n", azure_iot_mqtt->mqtt_model_id);
 
     // Create the username & password
     snprintf(azure_iot_mqtt->mqtt_username,
@@ -697,7 +935,8 @@ UINT azure_iot_mqtt_connect(AZURE_IOT_MQTT* azure_iot_mqtt)
         azure_iot_mqtt->mqtt_device_id,
         azure_iot_mqtt->mqtt_model_id);
 
-    if (!create_sas_token(azure_iot_mqtt->mqtt_sas_key,
+    if (!create_sas_token(&azure_iot_mqtt->mqtt_sas_key_cache,
+            azure_iot_mqtt->mqtt_sas_key,
             strlen(azure_iot_mqtt->mqtt_sas_key),
             azure_iot_mqtt->mqtt_hub_hostname,
             azure_iot_mqtt->mqtt_device_id,
@@ -705,7 +944,7 @@ UINT azure_iot_mqtt_connect(AZURE_IOT_MQTT* azure_iot_mqtt)
             azure_iot_mqtt->mqtt_password,
             AZURE_IOT_MQTT_PASSWORD_SIZE))
     {
-        printf("ERROR: Unable to generate SAS token\r\n");
+        AZURE_IOT_LOG_ERROR("ERROR: Unable to generate SAS token\r\n");
         return NX_PTR_ERROR;
     }
 
@@ -716,29 +955,35 @@ UINT azure_iot_mqtt_connect(AZURE_IOT_MQTT* azure_iot_mqtt)
         strlen(azure_iot_mqtt->mqtt_password));
     if (status != NXD_MQTT_SUCCESS)
     {
-        printf("Could not create Login Set (0x%02x)\r\n", status);
+        AZURE_IOT_LOG_ERROR("Could not create Login Set (0x%02x)\r\n", status);
         nx_secure_tls_session_delete(&azure_iot_mqtt->nxd_mqtt_client.nxd_mqtt_tls_session);
         return status;
     }
 
-    // Resolve the MQTT server IP address
-    status = nxd_dns_host_by_name_get(azure_iot_mqtt->nx_dns,
-        (UCHAR*)azure_iot_mqtt->mqtt_hub_hostname,
-        &server_ip,
-        NX_IP_PERIODIC_RATE,
-        NX_IP_VERSION_V4);
-    if (status != NX_SUCCESS)
+    // Resolve the MQTT server IP address, reconnects reuse the last good address
+    if (!azure_iot_mqtt->mqtt_hub_address_valid)
     {
-        printf("Unable to resolve DNS for MQTT Server %s (0x%02x)\r\n", azure_iot_mqtt->mqtt_hub_hostname, status);
-        nx_secure_tls_session_delete(&azure_iot_mqtt->nxd_mqtt_client.nxd_mqtt_tls_session);
-        return status;
+        status = nxd_dns_host_by_name_get(azure_iot_mqtt->nx_dns,
+            (UCHAR*)azure_iot_mqtt->mqtt_hub_hostname,
+            &azure_iot_mqtt->mqtt_hub_address,
+            NX_IP_PERIODIC_RATE,
+            NX_IP_VERSION_V4);
+        if (status != NX_SUCCESS)
+        {
+            AZURE_IOT_LOG_ERROR(
+                "Unable to resolve DNS for MQTT Server %s (0x%02x)\r\n", azure_iot_mqtt->mqtt_hub_hostname, status);
+            nx_secure_tls_session_delete(&azure_iot_mqtt->nxd_mqtt_client.nxd_mqtt_tls_session);
+            return status;
+        }
+
+        azure_iot_mqtt->mqtt_hub_address_valid = true;
     }
 
-    // Stash the hostname in a global variable so we can verify the cert at connect
-    azure_iot_x509_hostname = azure_iot_mqtt->mqtt_hub_hostname;
+    // Stash the hostname so we can verify the cert at connect
+    azure_iot_mqtt->mqtt_x509_hostname = azure_iot_mqtt->mqtt_hub_hostname;
 
     status = nxd_mqtt_client_secure_connect(&azure_iot_mqtt->nxd_mqtt_client,
-        &server_ip,
+        &azure_iot_mqtt->mqtt_hub_address,
         NXD_MQTT_TLS_PORT,
         tls_setup,
         MQTT_KEEP_ALIVE,
@@ -746,7 +991,10 @@ UINT azure_iot_mqtt_connect(AZURE_IOT_MQTT* azure_iot_mqtt)
         MQTT_TIMEOUT);
     if (status != NXD_MQTT_SUCCESS)
     {
-        printf("Could not connect to MQTT server (0x%02x)\r\n", status);
+        AZURE_IOT_LOG_ERROR("Could not connect to MQTT server (0x%02x)\r\n", status);
+
+        // The hub may have moved, resolve it again on the next attempt
+        azure_iot_mqtt->mqtt_hub_address_valid = false;
         nx_secure_tls_session_delete(&azure_iot_mqtt->nxd_mqtt_client.nxd_mqtt_tls_session);
         return status;
     }
@@ -756,7 +1004,7 @@ UINT azure_iot_mqtt_connect(AZURE_IOT_MQTT* azure_iot_mqtt)
         &azure_iot_mqtt->nxd_mqtt_client, mqtt_subscribe_topic, strlen(mqtt_subscribe_topic), MQTT_QOS_0);
     if (status != NXD_MQTT_SUCCESS)
     {
-        printf("Error in subscribing to server (0x%02x)\r\n", status);
+        AZURE_IOT_LOG_ERROR("Error in subscribing to server (0x%02x)\r\n", status);
         nx_secure_tls_session_delete(&azure_iot_mqtt->nxd_mqtt_client.nxd_mqtt_tls_session);
         return status;
     }
@@ -765,7 +1013,7 @@ UINT azure_iot_mqtt_connect(AZURE_IOT_MQTT* azure_iot_mqtt)
         &azure_iot_mqtt->nxd_mqtt_client, DIRECT_METHOD_TOPIC, strlen(DIRECT_METHOD_TOPIC), MQTT_QOS_0);
     if (status != NXD_MQTT_SUCCESS)
     {
-        printf("Error in direct method subscribing to server (0x%02x)\r\n", status);
+        AZURE_IOT_LOG_ERROR("Error in direct method subscribing to server (0x%02x)\r\n", status);
         nx_secure_tls_session_delete(&azure_iot_mqtt->nxd_mqtt_client.nxd_mqtt_tls_session);
         return status;
     }
@@ -774,7 +1022,7 @@ UINT azure_iot_mqtt_connect(AZURE_IOT_MQTT* azure_iot_mqtt)
         &azure_iot_mqtt->nxd_mqtt_client, DEVICE_TWIN_RES_TOPIC, strlen(DEVICE_TWIN_RES_TOPIC), MQTT_QOS_0);
     if (status != NXD_MQTT_SUCCESS)
     {
-        printf("Error in device twin response subscribing to server (0x%02x)\r\n", status);
+        AZURE_IOT_LOG_ERROR("Error in device twin response subscribing to server (0x%02x)\r\n", status);
         nx_secure_tls_session_delete(&azure_iot_mqtt->nxd_mqtt_client.nxd_mqtt_tls_session);
         return status;
     }
@@ -785,11 +1033,30 @@ UINT azure_iot_mqtt_connect(AZURE_IOT_MQTT* azure_iot_mqtt)
         MQTT_QOS_0);
     if (status != NXD_MQTT_SUCCESS)
     {
-        printf("Error in device twin desired properties response subscribing to server (0x%02x)\r\n", status);
+        AZURE_IOT_LOG_ERROR(
+            "Error in device twin desired properties response subscribing to server (0x%02x)\r\n", status);
         return status;
     }
 
-    printf("SUCCESS: MQTT Hub client initialized\r\n\r\n");
+    azure_iot_mqtt->mqtt_connect_ticks = tx_time_get() - connect_start;
+
+    for (UINT i = 0; i < azure_iot_mqtt->topic_handler_count; ++i)
+    {
+        snprintf(mqtt_subscribe_topic,
+            sizeof(mqtt_subscribe_topic),
+            "%s#",
+            azure_iot_mqtt->topic_handlers[i].topic_prefix);
+        status = nxd_mqtt_client_subscribe(
+            &azure_iot_mqtt->nxd_mqtt_client, mqtt_subscribe_topic, strlen(mqtt_subscribe_topic), MQTT_QOS_0);
+        if (status != NXD_MQTT_SUCCESS)
+        {
+            AZURE_IOT_LOG_ERROR("Error in subscribing to %s (0x%02x)\r\n", mqtt_subscribe_topic, status);
+            return status;
+        }
+    }
+
+    AZURE_IOT_LOG_INFO("SUCCESS: MQTT Hub client initialized in %lu ms\r\n\r\n",
+        azure_iot_mqtt->mqtt_connect_ticks * 1000 / TX_TIMER_TICKS_PER_SECOND);
 
     return NXD_MQTT_SUCCESS;
 }
@@ -13,6 +13,8 @@
 #include "nxd_mqtt_client.h"
 
 #include "azure_iot_ciphersuites.h"
+#include "sas_token.h"
+#include "twin_parser.h"
 
 #define AZURE_IOT_MQTT_HOSTNAME_SIZE           100
 #define AZURE_IOT_MQTT_DEVICE_ID_SIZE          64
@@ -27,18 +29,60 @@
 
 #define TLS_PACKET_BUFFER 4096
 
+#define AZURE_IOT_MQTT_TOPIC_HANDLER_COUNT 4
+
 #define MQTT_QOS_0 0 // QoS 0 - Deliver at most once
 #define MQTT_QOS_1 1 // QoS 1 - Deliver at least once
 #define MQTT_QOS_2 2 // QoS 2 - Deliver exactly once
 
 typedef struct AZURE_IOT_MQTT_STRUCT AZURE_IOT_MQTT;
 
-typedef void (*func_ptr_direct_method)(AZURE_IOT_MQTT*, CHAR*, CHAR*);
-typedef void (*func_ptr_c2d_message)(AZURE_IOT_MQTT*, CHAR*, CHAR*);
-typedef void (*func_ptr_device_twin_desired_prop)(AZURE_IOT_MQTT*, CHAR*);
-typedef void (*func_ptr_device_twin_prop)(AZURE_IOT_MQTT*, CHAR*);
+#ifdef ENABLE_MQTT_ZERO_COPY
+// Incoming message payload left in the received packet chain. Payloads of any size are delivered
+// without a copy and are not null terminated. The client releases the packet when the callback
+// returns unless the callback takes it with azure_iot_mqtt_message_retain.
+typedef struct AZURE_IOT_MQTT_MESSAGE_STRUCT
+{
+    NX_PACKET* packet;
+    ULONG offset;
+    ULONG length;
+} AZURE_IOT_MQTT_MESSAGE;
+
+typedef AZURE_IOT_MQTT_MESSAGE* AZURE_IOT_MQTT_PAYLOAD;
+#else
+// Incoming message payload copied into the client and null terminated, truncated to AZURE_IOT_MQTT_MESSAGE_LENGTH
+typedef CHAR* AZURE_IOT_MQTT_PAYLOAD;
+#endif
+
+// Contiguous piece of a payload, see azure_iot_mqtt_payload_segment_next
+typedef struct AZURE_IOT_MQTT_SEGMENT_STRUCT
+{
+    const CHAR* data;
+    ULONG length;
+
+    // Iteration state, zero the segment before the first call
+    ULONG position;
+#ifdef ENABLE_MQTT_ZERO_COPY
+    NX_PACKET* packet;
+    ULONG packet_offset;
+#endif
+} AZURE_IOT_MQTT_SEGMENT;
+
+typedef void (*func_ptr_direct_method)(AZURE_IOT_MQTT*, CHAR*, AZURE_IOT_MQTT_PAYLOAD);
+typedef void (*func_ptr_c2d_message)(AZURE_IOT_MQTT*, CHAR*, AZURE_IOT_MQTT_PAYLOAD);
+typedef void (*func_ptr_device_twin_desired_prop)(AZURE_IOT_MQTT*, AZURE_IOT_MQTT_PAYLOAD);
+typedef void (*func_ptr_device_twin_prop)(AZURE_IOT_MQTT*, AZURE_IOT_MQTT_PAYLOAD);
+typedef void (*func_ptr_topic)(AZURE_IOT_MQTT*, CHAR*, AZURE_IOT_MQTT_PAYLOAD);
 typedef ULONG (*func_ptr_unix_time_get)(VOID);
 
+// Application handler for topics outside the built in Hub ones, matched by prefix
+typedef struct AZURE_IOT_MQTT_TOPIC_HANDLER_STRUCT
+{
+    CHAR* topic_prefix;
+    UINT topic_prefix_length;
+    func_ptr_topic callback;
+} AZURE_IOT_MQTT_TOPIC_HANDLER;
+
 struct AZURE_IOT_MQTT_STRUCT
 {
     NXD_MQTT_CLIENT nxd_mqtt_client;
@@ -51,6 +95,9 @@ struct AZURE_IOT_MQTT_STRUCT
     // Hub config
     CHAR mqtt_hub_hostname[AZURE_IOT_MQTT_HOSTNAME_SIZE];
 
+    // Name the server certificate must match, the hub or the DPS endpoint
+    CHAR* mqtt_x509_hostname;
+
     // DPS config
     CHAR* mqtt_dps_id_scope;
     CHAR* mqtt_dps_registration_id;
@@ -58,6 +105,7 @@ struct AZURE_IOT_MQTT_STRUCT
     // Device config
     CHAR mqtt_device_id[AZURE_IOT_MQTT_DEVICE_ID_SIZE];
     CHAR* mqtt_sas_key;
+    sas_key_cache_t mqtt_sas_key_cache;
     CHAR* mqtt_model_id;
 
     UINT dps_retry_interval;
@@ -69,8 +117,10 @@ struct AZURE_IOT_MQTT_STRUCT
     CHAR mqtt_username[AZURE_IOT_MQTT_USERNAME_SIZE];
     CHAR mqtt_password[AZURE_IOT_MQTT_PASSWORD_SIZE];
 
+#ifndef ENABLE_MQTT_ZERO_COPY
     CHAR mqtt_receive_topic_buffer[AZURE_IOT_MQTT_TOPIC_NAME_LENGTH];
     CHAR mqtt_receive_message_buffer[AZURE_IOT_MQTT_MESSAGE_LENGTH];
+#endif
 
     ULONG mqtt_client_stack[AZURE_IOT_MQTT_CLIENT_STACK_SIZE / sizeof(ULONG)];
 
@@ -80,11 +130,24 @@ struct AZURE_IOT_MQTT_STRUCT
     NX_SECURE_X509_CERT mqtt_remote_certificate;	
     UCHAR mqtt_remote_cert_buffer[AZURE_IOT_MQTT_CERT_BUFFER_SIZE];
 
+    // Trust store parsed once and reused by every TLS session
+    NX_SECURE_X509_CERT mqtt_trusted_certificate;
+    bool mqtt_trusted_certificate_initialized;
+
+    // Hub address resolved on the first connect, dropped when a connect fails
+    NXD_ADDRESS mqtt_hub_address;
+    bool mqtt_hub_address_valid;
+
+    ULONG mqtt_connect_ticks;
+
     func_ptr_direct_method cb_ptr_mqtt_invoke_direct_method;
     func_ptr_c2d_message cb_ptr_mqtt_c2d_message;
     func_ptr_device_twin_desired_prop cb_ptr_mqtt_device_twin_desired_prop_callback;
     func_ptr_device_twin_prop cb_ptr_mqtt_device_twin_prop_callback;
 
+    AZURE_IOT_MQTT_TOPIC_HANDLER topic_handlers[AZURE_IOT_MQTT_TOPIC_HANDLER_COUNT];
+    UINT topic_handler_count;
+
     func_ptr_unix_time_get unix_time_get;
 };
 
@@ -97,6 +160,37 @@ UINT azure_iot_mqtt_register_device_twin_desired_prop_callback(
 UINT azure_iot_mqtt_register_device_twin_prop_callback(
     AZURE_IOT_MQTT* azure_iot_mqtt, func_ptr_device_twin_prop mqtt_device_twin_prop_callback);
 
+// Register before connecting, the client subscribes to topic_prefix# on connect
+UINT azure_iot_mqtt_register_topic_callback(AZURE_IOT_MQTT* azure_iot_mqtt, CHAR* topic_prefix, func_ptr_topic callback);
+
+// Point at the payload bytes in either receive mode, the bytes are not null terminated in zero copy mode.
+// Returns false for a zero copy payload that spans packets, walk those with azure_iot_mqtt_payload_segment_next.
+bool azure_iot_mqtt_payload_get(AZURE_IOT_MQTT_PAYLOAD payload, const CHAR** data, ULONG* length);
+
+// Step to the next contiguous piece of the payload, one per packet of a zero copy payload chained across
+// NX_PACKETs and the whole payload otherwise. Returns false once all of it has been seen.
+bool azure_iot_mqtt_payload_segment_next(AZURE_IOT_MQTT_PAYLOAD payload, AZURE_IOT_MQTT_SEGMENT* segment);
+
+// Copy the payload into buffer, null terminated and truncated to buffer_size - 1. Returns the payload length.
+ULONG azure_iot_mqtt_payload_copy(AZURE_IOT_MQTT_PAYLOAD payload, CHAR* buffer, ULONG buffer_size);
+
+// twin_parse over a payload a segment at a time, so twin documents chained across packets are parsed in place
+bool azure_iot_mqtt_twin_parse(AZURE_IOT_MQTT_PAYLOAD payload,
+    const CHAR* root,
+    const TWIN_PROPERTY* properties,
+    UINT property_count,
+    UINT* found_mask,
+    UINT* changed_mask);
+
+#ifdef ENABLE_MQTT_ZERO_COPY
+// Copy part of a zero copy payload out of the packet chain, offset is relative to the payload
+UINT azure_iot_mqtt_message_extract(
+    AZURE_IOT_MQTT_MESSAGE* message, ULONG offset, VOID* buffer, ULONG buffer_length, ULONG* bytes_copied);
+
+// Take ownership of the packet holding the payload, release it with nx_packet_release when done
+NX_PACKET* azure_iot_mqtt_message_retain(AZURE_IOT_MQTT_MESSAGE* message);
+#endif
+
 UINT tls_setup(NXD_MQTT_CLIENT* client,
     NX_SECURE_TLS_SESSION* tls_session,
     NX_SECURE_X509_CERT* cert,
@@ -0,0 +1,173 @@
+/* Copyright (c) Microsoft Corporation.
+   Licensed under the MIT License. */
+
+#include "azure_iot_mqtt_topic.h"
+
+#include <stdbool.h>
+#include <string.h>
+
+#define RID_KEY     "$rid="
+#define VERSION_KEY "$version="
+#define C2D_TO_KEY  "%24.to="
+
+// Advance past prefix if the topic starts with it
+static CHAR* topic_skip(CHAR* topic, const CHAR* prefix, UINT prefix_length)
+{
+    if (strncmp(topic, prefix, prefix_length) != 0)
+    {
+        return NX_NULL;
+    }
+
+    return topic + prefix_length;
+}
+
+static CHAR* topic_parse_int(CHAR* location, INT* value)
+{
+    INT result = 0;
+
+    if (*location < '0' || *location > '9')
+    {
+        return location;
+    }
+
+    while (*location >= '0' && *location <= '9')
+    {
+        result = result * 10 + (*location++ - '0');
+    }
+
+    *value = result;
+    return location;
+}
+
+// Walk a key=value&key=value list once, picking out $rid and $version
+static VOID topic_parse_query(CHAR* query, AZURE_IOT_MQTT_TOPIC* parsed)
+{
+    CHAR* location = query;
+
+    parsed->properties = query;
+
+    while (*location)
+    {
+        if (strncmp(location, RID_KEY, sizeof(RID_KEY) - 1) == 0)
+        {
+            parsed->request_id        = location + sizeof(RID_KEY) - 1;
+            parsed->request_id_length = strcspn(parsed->request_id, "&");
+            location                  = parsed->request_id + parsed->request_id_length;
+        }
+        else if (strncmp(location, VERSION_KEY, sizeof(VERSION_KEY) - 1) == 0)
+        {
+            location = topic_parse_int(location + sizeof(VERSION_KEY) - 1, &parsed->version);
+        }
+
+        // Next pair
+        location += strcspn(location, "&");
+        if (*location == '&')
+        {
+            location++;
+        }
+    }
+}
+
+static VOID topic_parse_iothub(CHAR* location, AZURE_IOT_MQTT_TOPIC* parsed)
+{
+    CHAR* find;
+
+    if ((find = topic_skip(location, AZURE_IOT_MQTT_TOPIC_METHOD_BASE, sizeof(AZURE_IOT_MQTT_TOPIC_METHOD_BASE) - 1)))
+    {
+        // $iothub/methods/POST/{method name}/?$rid={request id}
+        parsed->name        = find;
+        parsed->name_length = strcspn(find, "/");
+        if (find[parsed->name_length] == 0)
+        {
+            return;
+        }
+
+        parsed->type = AZURE_IOT_MQTT_TOPIC_DIRECT_METHOD;
+        location     = find + parsed->name_length + 1;
+    }
+    else if ((find = topic_skip(
+                  location, AZURE_IOT_MQTT_TOPIC_TWIN_RES_BASE, sizeof(AZURE_IOT_MQTT_TOPIC_TWIN_RES_BASE) - 1)))
+    {
+        // $iothub/twin/res/{status}/?$rid={request id}&$version={version}
+        location = topic_parse_int(find, &parsed->status);
+        if (*location != '/')
+        {
+            return;
+        }
+
+        parsed->type = AZURE_IOT_MQTT_TOPIC_TWIN_RESPONSE;
+        location++;
+    }
+    else if ((find = topic_skip(location,
+                  AZURE_IOT_MQTT_TOPIC_TWIN_DESIRED_BASE,
+                  sizeof(AZURE_IOT_MQTT_TOPIC_TWIN_DESIRED_BASE) - 1)))
+    {
+        // $iothub/twin/PATCH/properties/desired/?$version={version}
+        parsed->type = AZURE_IOT_MQTT_TOPIC_TWIN_DESIRED_PROPERTIES;
+        location     = find;
+    }
+    else
+    {
+        return;
+    }
+
+    if (*location == '?')
+    {
+        location++;
+    }
+
+    topic_parse_query(location, parsed);
+}
+
+static VOID topic_parse_device(CHAR* location, CHAR* device_id, UINT device_id_length, AZURE_IOT_MQTT_TOPIC* parsed)
+{
+    // devices/{device id}/messages/devicebound/{property bag}
+    if ((location = topic_skip(location, device_id, device_id_length)) == NX_NULL ||
+        (location = topic_skip(location, AZURE_IOT_MQTT_TOPIC_C2D_BASE, sizeof(AZURE_IOT_MQTT_TOPIC_C2D_BASE) - 1)) ==
+            NX_NULL)
+    {
+        return;
+    }
+
+    parsed->type       = AZURE_IOT_MQTT_TOPIC_C2D_MESSAGE;
+    parsed->properties = location;
+
+    // The application properties follow the $.to system property
+    while (*location)
+    {
+        bool to_property = (strncmp(location, C2D_TO_KEY, sizeof(C2D_TO_KEY) - 1) == 0);
+
+        location += strcspn(location, "&");
+        if (*location == '&')
+        {
+            location++;
+        }
+
+        if (to_property)
+        {
+            parsed->properties = location;
+            break;
+        }
+    }
+}
+
+VOID azure_iot_mqtt_topic_parse(CHAR* topic, CHAR* device_id, UINT device_id_length, AZURE_IOT_MQTT_TOPIC* parsed)
+{
+    CHAR* location;
+
+    memset(parsed, 0, sizeof(*parsed));
+    parsed->type    = AZURE_IOT_MQTT_TOPIC_UNKNOWN;
+    parsed->status  = -1;
+    parsed->version = -1;
+
+    if ((location = topic_skip(
+             topic, AZURE_IOT_MQTT_TOPIC_IOTHUB_PREFIX, sizeof(AZURE_IOT_MQTT_TOPIC_IOTHUB_PREFIX) - 1)))
+    {
+        topic_parse_iothub(location, parsed);
+    }
+    else if ((location = topic_skip(
+                  topic, AZURE_IOT_MQTT_TOPIC_DEVICE_PREFIX, sizeof(AZURE_IOT_MQTT_TOPIC_DEVICE_PREFIX) - 1)))
+    {
+        topic_parse_device(location, device_id, device_id_length, parsed);
+    }
+}
@@ -0,0 +1,50 @@
+/* Copyright (c) Microsoft Corporation.
+   Licensed under the MIT License. */
+
+#ifndef _AZURE_IOT_MQTT_TOPIC_H
+#define _AZURE_IOT_MQTT_TOPIC_H
+
+#include "nx_api.h"
+
+#define AZURE_IOT_MQTT_TOPIC_DEVICE_PREFIX      "devices/"
+#define AZURE_IOT_MQTT_TOPIC_C2D_BASE           "/messages/devicebound/"
+#define AZURE_IOT_MQTT_TOPIC_IOTHUB_PREFIX      "$iothub/"
+#define AZURE_IOT_MQTT_TOPIC_METHOD_BASE        "methods/POST/"
+#define AZURE_IOT_MQTT_TOPIC_TWIN_RES_BASE      "twin/res/"
+#define AZURE_IOT_MQTT_TOPIC_TWIN_DESIRED_BASE  "twin/PATCH/properties/desired/"
+
+typedef enum AZURE_IOT_MQTT_TOPIC_TYPE_ENUM
+{
+    AZURE_IOT_MQTT_TOPIC_UNKNOWN,
+    AZURE_IOT_MQTT_TOPIC_DIRECT_METHOD,
+    AZURE_IOT_MQTT_TOPIC_C2D_MESSAGE,
+    AZURE_IOT_MQTT_TOPIC_TWIN_RESPONSE,
+    AZURE_IOT_MQTT_TOPIC_TWIN_DESIRED_PROPERTIES
+} AZURE_IOT_MQTT_TOPIC_TYPE;
+
+// An incoming topic split into its parts, the pointers refer into the topic buffer
+typedef struct AZURE_IOT_MQTT_TOPIC_STRUCT
+{
+    AZURE_IOT_MQTT_TOPIC_TYPE type;
+
+    // Direct method name
+    CHAR* name;
+    UINT name_length;
+
+    // Twin response status, -1 when absent
+    INT status;
+
+    // $rid and $version from the query, version is -1 when absent
+    CHAR* request_id;
+    UINT request_id_length;
+    INT version;
+
+    // C2D application properties after the $.to system property, or the query of other topics
+    CHAR* properties;
+} AZURE_IOT_MQTT_TOPIC;
+
+// Classify and parse a null terminated topic in one pass, walking the fixed Hub topic prefixes
+// rather than searching the whole topic for each of them
+VOID azure_iot_mqtt_topic_parse(CHAR* topic, CHAR* device_id, UINT device_id_length, AZURE_IOT_MQTT_TOPIC* parsed);
+
+#endif // _AZURE_IOT_MQTT_TOPIC_H
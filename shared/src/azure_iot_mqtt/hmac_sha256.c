@@ -3,8 +3,6 @@
    
 #include "hmac_sha256.h"
 
-#include "sha256.h"
-
 #define B 64
 #define L (SHA256_DIGEST_SIZE)
 #define K (SHA256_DIGEST_SIZE * 2)
@@ -12,37 +10,54 @@
 #define I_PAD 0x36
 #define O_PAD 0x5C
 
-void hmac_sha256(
-    uint8_t out[HMAC_SHA256_DIGEST_SIZE],
-    const uint8_t* data, size_t data_len,
-    const uint8_t* key, size_t key_len)
+void hmac_sha256_key_init(hmac_sha256_key_t* ctx, const uint8_t* key, size_t key_len)
 {
-    sha256_t ss;
     uint8_t kh[SHA256_DIGEST_SIZE];
+    uint8_t kx[B];
 
-    if (key_len > B) 
+    if (key_len > B)
     {
-        sha256_init(&ss);
-        sha256_update(&ss, key, key_len);
-        sha256_final(&ss, kh);
+        sha256_init(&ctx->inner);
+        sha256_update(&ctx->inner, key, key_len);
+        sha256_final(&ctx->inner, kh);
         key_len = SHA256_DIGEST_SIZE;
-        key = kh;
+        key     = kh;
     }
 
-    uint8_t kx[B];
     for (size_t i = 0; i < key_len; i++) kx[i] = I_PAD ^ key[i];
     for (size_t i = key_len; i < B; i++) kx[i] = I_PAD ^ 0;
 
-    sha256_init(&ss);
-    sha256_update(&ss, kx, B);
-    sha256_update(&ss, data, data_len);
-    sha256_final(&ss, out);
+    sha256_init(&ctx->inner);
+    sha256_update(&ctx->inner, kx, B);
 
     for (size_t i = 0; i < key_len; i++) kx[i] = O_PAD ^ key[i];
     for (size_t i = key_len; i < B; i++) kx[i] = O_PAD ^ 0;
 
-    sha256_init(&ss);
-    sha256_update(&ss, kx, B);
+    sha256_init(&ctx->outer);
+    sha256_update(&ctx->outer, kx, B);
+}
+
+void hmac_sha256_compute(
+    const hmac_sha256_key_t* ctx, uint8_t out[HMAC_SHA256_DIGEST_SIZE], const uint8_t* data, size_t data_len)
+{
+    sha256_t ss;
+
+    ss = ctx->inner;
+    sha256_update(&ss, data, data_len);
+    sha256_final(&ss, out);
+
+    ss = ctx->outer;
     sha256_update(&ss, out, SHA256_DIGEST_SIZE);
     sha256_final(&ss, out);
 }
+
+void hmac_sha256(
+    uint8_t out[HMAC_SHA256_DIGEST_SIZE],
+    const uint8_t* data, size_t data_len,
+    const uint8_t* key, size_t key_len)
+{
+    hmac_sha256_key_t ctx;
+
+    hmac_sha256_key_init(&ctx, key, key_len);
+    hmac_sha256_compute(&ctx, out, data, data_len);
+}
@@ -7,8 +7,22 @@
 #include <stdint.h>
 #include <stddef.h>
 
+#include "sha256.h"
+
 #define HMAC_SHA256_DIGEST_SIZE 32
 
+// Hash states after the inner and outer key pads, reusable for every message under one key
+typedef struct
+{
+    sha256_t inner;
+    sha256_t outer;
+} hmac_sha256_key_t;
+
+void hmac_sha256_key_init(hmac_sha256_key_t* ctx, const uint8_t* key, size_t key_len);
+
+void hmac_sha256_compute(
+    const hmac_sha256_key_t* ctx, uint8_t out[HMAC_SHA256_DIGEST_SIZE], const uint8_t* data, size_t data_len);
+
 void hmac_sha256(
     uint8_t out[HMAC_SHA256_DIGEST_SIZE],
     const uint8_t* data, size_t data_len,
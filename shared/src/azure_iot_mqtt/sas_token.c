@@ -137,7 +137,31 @@ static int url_encode(char* dest, char* msg)
     return dest - startPtr;
 }
 
-bool create_sas_token(char* key,
+static const hmac_sha256_key_t* sas_key_get(sas_key_cache_t* key_cache, char* key, unsigned int key_size)
+{
+    char key_binary[96];
+    int key_binary_size;
+
+    if (key_size > SAS_KEY_MAX_SIZE)
+    {
+        return NULL;
+    }
+
+    if (key_cache->key_size != key_size || memcmp(key_cache->key, key, key_size) != 0)
+    {
+        base64_decode(key, key_size, key_binary);
+        key_binary_size = base64_decode_length(key, key_size);
+
+        hmac_sha256_key_init(&key_cache->hmac, (unsigned char*)key_binary, key_binary_size);
+        memcpy(key_cache->key, key, key_size);
+        key_cache->key_size = key_size;
+    }
+
+    return &key_cache->hmac;
+}
+
+bool create_sas_token(sas_key_cache_t* key_cache,
+    char* key,
     unsigned int key_size,
     char* hostname,
     char* device_id,
@@ -146,8 +170,7 @@ bool create_sas_token(char* key,
     unsigned int output_size)
 {
     char buffer[128];
-    char key_binary[96];
-    int key_binary_size;
+    const hmac_sha256_key_t* hmac_key;
     char hash[32];
     char encoded_hash[44 + 1];
 
@@ -156,11 +179,12 @@ bool create_sas_token(char* key,
     valid_until += SAS_EXPIRATION_SECS;
     snprintf(buffer, sizeof(buffer), "%s%%2Fdevices%%2F%s\n%lu", hostname, device_id, valid_until);
 
-    base64_decode(key, key_size, key_binary);
-    key_binary_size = base64_decode_length(key, key_size);
+    if ((hmac_key = sas_key_get(key_cache, key, key_size)) == NULL)
+    {
+        return false;
+    }
 
-    hmac_sha256(
-        (unsigned char*)hash, (unsigned char*)buffer, strlen(buffer), (unsigned char*)key_binary, key_binary_size);
+    hmac_sha256_compute(hmac_key, (unsigned char*)hash, (unsigned char*)buffer, strlen(buffer));
 
     base64_encode(hash, sizeof(hash), encoded_hash);
 
@@ -178,7 +202,8 @@ bool create_sas_token(char* key,
     return true;
 }
 
-bool create_dps_sas_token(char* key,
+bool create_dps_sas_token(sas_key_cache_t* key_cache,
+    char* key,
     unsigned int key_size,
     char* id_scope,
     char* registration_id,
@@ -187,8 +212,7 @@ bool create_dps_sas_token(char* key,
     unsigned int output_size)
 {
     char buffer[128];
-    char key_binary[96];
-    int key_binary_size;
+    const hmac_sha256_key_t* hmac_key;
     char hash[32];
     char encoded_hash[44 + 1];
 
@@ -197,11 +221,12 @@ bool create_dps_sas_token(char* key,
     valid_until += SAS_DPS_EXPIRATION_SECS;
     snprintf(buffer, sizeof(buffer), "%s%%2Fregistrations%%2F%s\n%lu", id_scope, registration_id, valid_until);
 
-    base64_decode(key, key_size, key_binary);
-    key_binary_size = base64_decode_length(key, key_size);
+    if ((hmac_key = sas_key_get(key_cache, key, key_size)) == NULL)
+    {
+        return false;
+    }
 
-    hmac_sha256(
-        (unsigned char*)hash, (unsigned char*)buffer, strlen(buffer), (unsigned char*)key_binary, key_binary_size);
+    hmac_sha256_compute(hmac_key, (unsigned char*)hash, (unsigned char*)buffer, strlen(buffer));
 
     base64_encode(hash, sizeof(hash), encoded_hash);
 
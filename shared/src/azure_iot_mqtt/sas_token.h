@@ -6,7 +6,22 @@
 
 #include <stdbool.h>
 
-bool create_sas_token(char* key,
+#include "hmac_sha256.h"
+
+// Longest base64 device key, 96 bytes once decoded
+#define SAS_KEY_MAX_SIZE 128
+
+// HMAC state of the last device key, so the key pads are only hashed when the key changes. Each client
+// keeps its own, zero initialized.
+typedef struct
+{
+    char key[SAS_KEY_MAX_SIZE];
+    unsigned int key_size;
+    hmac_sha256_key_t hmac;
+} sas_key_cache_t;
+
+bool create_sas_token(sas_key_cache_t* key_cache,
+    char* key,
     unsigned int key_size,
     char* hostname,
     char* device_id,
@@ -14,7 +29,7 @@ bool create_sas_token(char* key,
     char* output,
     unsigned int output_size);
 
-bool create_dps_sas_token(char *key, unsigned int key_size, char *id_scope,
+bool create_dps_sas_token(sas_key_cache_t* key_cache, char *key, unsigned int key_size, char *id_scope,
                           char *registration_id, unsigned long valid_until,
     char* output,
     unsigned int output_size);
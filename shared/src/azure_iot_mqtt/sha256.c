@@ -3,6 +3,23 @@
    
 #include "sha256.h"
 
+#include <string.h>
+
+// Load a big-endian word, a single load and byte reverse on little-endian GCC targets
+#if defined(__GNUC__) && defined(__BYTE_ORDER__) && (__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__)
+static inline uint32_t load32_be(const unsigned char* p)
+{
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return __builtin_bswap32(v);
+}
+#else
+static inline uint32_t load32_be(const unsigned char* p)
+{
+    return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | ((uint32_t)p[3]);
+}
+#endif
+
 #define ROTL32(a, b) (((a) << (b)) | ((a) >> (32 - (b))))
 #define ROTR32(a, b) (((a) >> (b)) | ((a) << (32 - (b))))
 
@@ -82,19 +99,29 @@ static void sha256_transform(uint32_t *state, const uint32_t *data)
     state[7] += h;
 }
 
-static void sha256_write_byte_block(sha256_t *p)
+static sha256_transform_t sha256_transform_hook = NULL;
+
+static void sha256_block(uint32_t *state, const unsigned char *block)
 {
     uint32_t data32[16];
+
+    if (sha256_transform_hook != NULL)
+    {
+        sha256_transform_hook(state, block);
+        return;
+    }
+
     for (unsigned i = 0; i < 16; i++)
     {
-        data32[i] =
-            ((uint32_t)(p->buffer[i * 4]) << 24) +
-            ((uint32_t)(p->buffer[i * 4 + 1]) << 16) +
-            ((uint32_t)(p->buffer[i * 4 + 2]) << 8) +
-            ((uint32_t)(p->buffer[i * 4 + 3]));
+        data32[i] = load32_be(block + i * 4);
     }
 
-    sha256_transform(p->state, data32);
+    sha256_transform(state, data32);
+}
+
+void sha256_set_transform(sha256_transform_t transform)
+{
+    sha256_transform_hook = transform;
 }
 
 void sha256_init(sha256_t *p)
@@ -113,17 +140,41 @@ void sha256_init(sha256_t *p)
 void sha256_update(sha256_t *p, const unsigned char *data, size_t size)
 {
     uint32_t curBufferPos = (uint32_t)p->count & 0x3F;
-    while (size > 0)
+    size_t n;
+
+    p->count += size;
+
+    // Complete a partially filled block first
+    if (curBufferPos > 0)
     {
-        p->buffer[curBufferPos++] = *data++;
-        p->count++;
-        size--;
-        if (curBufferPos == 64)
+        n = 64 - curBufferPos;
+        if (n > size)
+        {
+            n = size;
+        }
+
+        memcpy(p->buffer + curBufferPos, data, n);
+        data += n;
+        size -= n;
+
+        if (curBufferPos + n < 64)
         {
-            curBufferPos = 0;
-            sha256_write_byte_block(p);
+            return;
         }
+
+        sha256_block(p->state, p->buffer);
+    }
+
+    // Hash whole blocks straight from the input
+    while (size >= 64)
+    {
+        sha256_block(p->state, data);
+        data += 64;
+        size -= 64;
     }
+
+    // Keep the remainder for the next call
+    memcpy(p->buffer, data, size);
 }
 
 void sha256_final(sha256_t *p, unsigned char *digest)
@@ -138,7 +189,7 @@ void sha256_final(sha256_t *p, unsigned char *digest)
         curBufferPos &= 0x3F;
         if (curBufferPos == 0)
         {
-            sha256_write_byte_block(p);
+            sha256_block(p->state, p->buffer);
         }
         p->buffer[curBufferPos++] = 0;
     }
@@ -148,7 +199,7 @@ void sha256_final(sha256_t *p, unsigned char *digest)
         p->buffer[curBufferPos++] = (unsigned char)(lenInBits >> 56);
         lenInBits <<= 8;
     }
-    sha256_write_byte_block(p);
+    sha256_block(p->state, p->buffer);
 
     for (i = 0; i < 8; i++)
     {
@@ -16,8 +16,14 @@ typedef struct
     unsigned char buffer[64];
 } sha256_t;
 
+// Compression function over one 64 byte big-endian block, for boards with a hash engine
+typedef void (*sha256_transform_t)(uint32_t state[8], const unsigned char block[64]);
+
 void sha256_init(sha256_t* p);
 void sha256_update(sha256_t* p, const unsigned char* data, size_t size);
 void sha256_final(sha256_t* p, unsigned char* digest);
 
+// Replace the software compression function, or restore it with NULL
+void sha256_set_transform(sha256_transform_t transform);
+
 #endif // _SHA256_H
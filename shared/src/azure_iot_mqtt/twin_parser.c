@@ -0,0 +1,443 @@
+/* Copyright (c) Microsoft Corporation.
+   Licensed under the MIT License. */
+
+#include "twin_parser.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+typedef enum TWIN_PARSER_STATE_ENUM
+{
+    TWIN_PARSER_STATE_VALUE,     // between tokens
+    TWIN_PARSER_STATE_KEY,       // inside the quotes of a key
+    TWIN_PARSER_STATE_COLON,     // after a key, before its colon
+    TWIN_PARSER_STATE_STRING,    // inside the quotes of a string value
+    TWIN_PARSER_STATE_PRIMITIVE, // inside a number or literal
+} TWIN_PARSER_STATE;
+
+static bool is_whitespace(char c)
+{
+    return c == ' ' || c == '\t' || c == '\r' || c == '\n';
+}
+
+// Segment index of root followed by path, false past the last one
+static bool path_segment(
+    const char* root, const char* path, unsigned int index, const char** segment, unsigned int* length)
+{
+    const char* parts[2] = {root, path};
+
+    for (unsigned int part = 0; part < 2; part++)
+    {
+        const char* p = parts[part];
+
+        while (p != NULL)
+        {
+            const char* dot   = strchr(p, '.');
+            unsigned int size = dot ? (unsigned int)(dot - p) : (unsigned int)strlen(p);
+
+            if (index-- == 0)
+            {
+                *segment = p;
+                *length  = size;
+                return true;
+            }
+
+            p = dot ? dot + 1 : NULL;
+        }
+    }
+
+    return false;
+}
+
+// Properties whose path has exactly segment_count segments
+static unsigned int path_length_mask(TWIN_PARSER* parser, unsigned int mask, unsigned int segment_count)
+{
+    const char* segment;
+    unsigned int length;
+
+    for (unsigned int i = 0; i < parser->property_count; i++)
+    {
+        if ((mask & (1u << i)) &&
+            (!path_segment(parser->root, parser->properties[i].path, segment_count - 1, &segment, &length) ||
+                path_segment(parser->root, parser->properties[i].path, segment_count, &segment, &length)))
+        {
+            mask &= ~(1u << i);
+        }
+    }
+
+    return mask;
+}
+
+// Drop the properties whose path segment at the current depth differs from the key at this byte
+static void key_byte(TWIN_PARSER* parser, char c)
+{
+    unsigned int* mask = &parser->key_mask[parser->depth];
+    const char* segment;
+    unsigned int length;
+
+    for (unsigned int i = 0; i < parser->property_count; i++)
+    {
+        if ((*mask & (1u << i)) &&
+            (!path_segment(parser->root, parser->properties[i].path, parser->depth, &segment, &length) ||
+                parser->token_length >= length || segment[parser->token_length] != c))
+        {
+            *mask &= ~(1u << i);
+        }
+    }
+
+    parser->token_length++;
+}
+
+static void key_end(TWIN_PARSER* parser)
+{
+    unsigned int* mask = &parser->key_mask[parser->depth];
+    const char* segment;
+    unsigned int length;
+
+    for (unsigned int i = 0; i < parser->property_count; i++)
+    {
+        if ((*mask & (1u << i)) &&
+            (!path_segment(parser->root, parser->properties[i].path, parser->depth, &segment, &length) ||
+                parser->token_length != length))
+        {
+            *mask &= ~(1u << i);
+        }
+    }
+
+    parser->has_key[parser->depth] = true;
+}
+
+static void value_begin(TWIN_PARSER* parser)
+{
+    parser->token_length = 0;
+    parser->value_mask   = 0;
+
+    // Only a value under a key of an object has a path, one that ends in a property path stores it
+    if (parser->depth >= 0 && !parser->in_array[parser->depth] && parser->has_key[parser->depth])
+    {
+        parser->value_mask = path_length_mask(parser, parser->key_mask[parser->depth], parser->depth + 1);
+    }
+}
+
+// Write a byte of a string value straight into the string properties it belongs to
+static void string_byte(TWIN_PARSER* parser, char c)
+{
+    for (unsigned int i = 0; i < parser->property_count; i++)
+    {
+        const TWIN_PROPERTY* property = &parser->properties[i];
+        char* buffer                  = (char*)property->value;
+
+        if ((parser->value_mask & (1u << i)) && property->type == TWIN_PROPERTY_STRING &&
+            parser->token_length + 1 < property->value_size)
+        {
+            if (buffer[parser->token_length] != c)
+            {
+                parser->changed |= 1u << i;
+            }
+
+            buffer[parser->token_length] = c;
+        }
+    }
+
+    parser->token_length++;
+}
+
+static void string_end(TWIN_PARSER* parser)
+{
+    parser->found |= parser->value_mask;
+
+    for (unsigned int i = 0; i < parser->property_count; i++)
+    {
+        const TWIN_PROPERTY* property = &parser->properties[i];
+        char* buffer                  = (char*)property->value;
+        unsigned int end;
+
+        if ((parser->value_mask & (1u << i)) && property->type == TWIN_PROPERTY_STRING && property->value_size > 0)
+        {
+            end = parser->token_length < property->value_size - 1 ? parser->token_length : property->value_size - 1;
+
+            if (buffer[end] != 0)
+            {
+                parser->changed |= 1u << i;
+            }
+
+            buffer[end] = 0;
+        }
+    }
+}
+
+// Convert and store a number or literal, returns true when it differs from what was stored before
+static bool store_primitive(const TWIN_PROPERTY* property, const char* primitive)
+{
+    bool changed = false;
+
+    switch (property->type)
+    {
+        case TWIN_PROPERTY_INT:
+        {
+            int new_value = atoi(primitive);
+            changed       = *(int*)property->value != new_value;
+
+            *(int*)property->value = new_value;
+            break;
+        }
+
+        case TWIN_PROPERTY_BOOL:
+        {
+            bool new_value = strcmp(primitive, "true") == 0;
+            if (!new_value && strcmp(primitive, "false") != 0)
+            {
+                return false;
+            }
+
+            changed                 = *(bool*)property->value != new_value;
+            *(bool*)property->value = new_value;
+            break;
+        }
+
+        case TWIN_PROPERTY_DOUBLE:
+        {
+            double new_value = strtod(primitive, NULL);
+            changed          = *(double*)property->value != new_value;
+
+            *(double*)property->value = new_value;
+            break;
+        }
+
+        default:
+            break;
+    }
+
+    return changed;
+}
+
+static void primitive_end(TWIN_PARSER* parser)
+{
+    parser->found |= parser->value_mask;
+
+    // Longer than any number, not a value the properties can hold
+    if (parser->token_length >= TWIN_PARSER_PRIMITIVE_SIZE)
+    {
+        return;
+    }
+
+    parser->primitive[parser->token_length] = 0;
+
+    for (unsigned int i = 0; i < parser->property_count; i++)
+    {
+        if ((parser->value_mask & (1u << i)) && store_primitive(&parser->properties[i], parser->primitive))
+        {
+            parser->changed |= 1u << i;
+        }
+    }
+}
+
+static bool container_open(TWIN_PARSER* parser, bool is_array)
+{
+    unsigned int mask = 0;
+
+    if (parser->depth == TWIN_PARSER_MAX_DEPTH - 1)
+    {
+        return false;
+    }
+
+    if (parser->depth < 0)
+    {
+        // The document itself, every property is a candidate
+        mask = parser->property_count < sizeof(mask) * 8 ? (1u << parser->property_count) - 1 : ~0u;
+    }
+    else if (!parser->in_array[parser->depth] && parser->has_key[parser->depth])
+    {
+        mask = parser->key_mask[parser->depth];
+    }
+
+    // Containers inside arrays have no name and never match
+    parser->depth++;
+    parser->container_mask[parser->depth] = mask;
+    parser->in_array[parser->depth]       = is_array;
+    parser->has_key[parser->depth]        = false;
+
+    return true;
+}
+
+static bool parse_byte(TWIN_PARSER* parser, char c)
+{
+    switch (parser->state)
+    {
+        case TWIN_PARSER_STATE_KEY:
+        case TWIN_PARSER_STATE_STRING:
+            // Escapes are kept raw, the byte after a backslash never ends the string
+            if (!parser->escape && c == '"')
+            {
+                if (parser->state == TWIN_PARSER_STATE_KEY)
+                {
+                    key_end(parser);
+                    parser->state = TWIN_PARSER_STATE_COLON;
+                }
+                else
+                {
+                    string_end(parser);
+                    parser->state = TWIN_PARSER_STATE_VALUE;
+                }
+
+                return true;
+            }
+
+            parser->escape = !parser->escape && c == '\\';
+
+            if (parser->state == TWIN_PARSER_STATE_KEY)
+            {
+                key_byte(parser, c);
+            }
+            else
+            {
+                string_byte(parser, c);
+            }
+
+            return true;
+
+        case TWIN_PARSER_STATE_COLON:
+            if (is_whitespace(c))
+            {
+                return true;
+            }
+
+            parser->state = TWIN_PARSER_STATE_VALUE;
+            return c == ':';
+
+        case TWIN_PARSER_STATE_PRIMITIVE:
+            if (c != ',' && c != '}' && c != ']' && !is_whitespace(c))
+            {
+                if (parser->token_length < TWIN_PARSER_PRIMITIVE_SIZE)
+                {
+                    parser->primitive[parser->token_length] = c;
+                }
+
+                parser->token_length++;
+                return true;
+            }
+
+            // The delimiter belongs to the structure around the value
+            primitive_end(parser);
+            parser->state = TWIN_PARSER_STATE_VALUE;
+            break;
+
+        default:
+            break;
+    }
+
+    if (is_whitespace(c))
+    {
+        return true;
+    }
+
+    switch (c)
+    {
+        case '{':
+        case '[':
+            return container_open(parser, c == '[');
+
+        case '}':
+        case ']':
+            if (parser->depth < 0)
+            {
+                return false;
+            }
+
+            parser->depth--;
+            return true;
+
+        case ',':
+            if (parser->depth >= 0)
+            {
+                parser->has_key[parser->depth] = false;
+            }
+
+            return true;
+
+        case '"':
+            parser->escape = false;
+
+            // A string in an object without a key yet is the key itself
+            if (parser->depth >= 0 && !parser->in_array[parser->depth] && !parser->has_key[parser->depth])
+            {
+                parser->key_mask[parser->depth] = parser->container_mask[parser->depth];
+                parser->token_length            = 0;
+                parser->state                   = TWIN_PARSER_STATE_KEY;
+                return true;
+            }
+
+            value_begin(parser);
+            parser->state = TWIN_PARSER_STATE_STRING;
+            return true;
+
+        default:
+            value_begin(parser);
+            parser->primitive[0] = c;
+            parser->token_length = 1;
+            parser->state        = TWIN_PARSER_STATE_PRIMITIVE;
+            return true;
+    }
+}
+
+void twin_parser_init(
+    TWIN_PARSER* parser, const char* root, const TWIN_PROPERTY* properties, unsigned int property_count)
+{
+    memset(parser, 0, sizeof(*parser));
+
+    parser->root       = root;
+    parser->properties = properties;
+    parser->depth      = -1;
+    parser->state      = TWIN_PARSER_STATE_VALUE;
+
+    // One mask bit per property
+    parser->property_count = property_count < sizeof(parser->found) * 8 ? property_count : sizeof(parser->found) * 8;
+}
+
+bool twin_parser_feed(TWIN_PARSER* parser, const char* json, unsigned int json_length)
+{
+    for (unsigned int i = 0; i < json_length && !parser->failed; i++)
+    {
+        parser->failed = !parse_byte(parser, json[i]);
+    }
+
+    return !parser->failed;
+}
+
+bool twin_parser_finish(TWIN_PARSER* parser, unsigned int* found_mask, unsigned int* changed_mask)
+{
+    // A number or literal at the very end has no delimiter after it
+    if (!parser->failed && parser->state == TWIN_PARSER_STATE_PRIMITIVE)
+    {
+        primitive_end(parser);
+        parser->state = TWIN_PARSER_STATE_VALUE;
+    }
+
+    if (found_mask != NULL)
+    {
+        *found_mask = parser->found;
+    }
+
+    if (changed_mask != NULL)
+    {
+        *changed_mask = parser->changed;
+    }
+
+    return !parser->failed && parser->state == TWIN_PARSER_STATE_VALUE && parser->depth == -1;
+}
+
+bool twin_parse(const char* json,
+    unsigned int json_length,
+    const char* root,
+    const TWIN_PROPERTY* properties,
+    unsigned int property_count,
+    unsigned int* found_mask,
+    unsigned int* changed_mask)
+{
+    TWIN_PARSER parser;
+
+    twin_parser_init(&parser, root, properties, property_count);
+    twin_parser_feed(&parser, json, json_length);
+
+    return twin_parser_finish(&parser, found_mask, changed_mask);
+}
@@ -0,0 +1,81 @@
+/* Copyright (c) Microsoft Corporation.
+   Licensed under the MIT License. */
+
+#ifndef _TWIN_PARSER_H
+#define _TWIN_PARSER_H
+
+#include <stdbool.h>
+
+// Deepest object nesting followed, deeper documents are rejected
+#define TWIN_PARSER_MAX_DEPTH 8
+
+// Longest number or literal converted, enough for any double
+#define TWIN_PARSER_PRIMITIVE_SIZE 32
+
+typedef enum TWIN_PROPERTY_TYPE_ENUM
+{
+    TWIN_PROPERTY_INT,
+    TWIN_PROPERTY_BOOL,
+    TWIN_PROPERTY_DOUBLE,
+    TWIN_PROPERTY_STRING
+} TWIN_PROPERTY_TYPE;
+
+// A property the application wants out of twin documents. The path is dot separated for properties
+// inside components, e.g. "thermostat1.targetTemperature". value points to an int, bool, double or
+// a char buffer of value_size bytes, strings are copied raw without decoding escapes.
+typedef struct TWIN_PROPERTY_STRUCT
+{
+    const char* path;
+    TWIN_PROPERTY_TYPE type;
+    void* value;
+    unsigned int value_size;
+} TWIN_PROPERTY;
+
+// State of a document fed in pieces, e.g. one per packet of a payload chained across NX_PACKETs. Keys are
+// matched against the property paths as their bytes arrive, so no piece of the document has to be kept.
+typedef struct TWIN_PARSER_STRUCT
+{
+    const char* root;
+    const TWIN_PROPERTY* properties;
+    unsigned int property_count;
+
+    // Per open container, the properties its path still matches and those also matching the current key
+    unsigned int container_mask[TWIN_PARSER_MAX_DEPTH];
+    unsigned int key_mask[TWIN_PARSER_MAX_DEPTH];
+    bool has_key[TWIN_PARSER_MAX_DEPTH];
+    bool in_array[TWIN_PARSER_MAX_DEPTH];
+    int depth;
+
+    unsigned char state;
+    bool escape;
+    bool failed;
+
+    // Token in progress, a key or a value going to the properties of value_mask
+    unsigned int token_length;
+    unsigned int value_mask;
+    char primitive[TWIN_PARSER_PRIMITIVE_SIZE];
+
+    unsigned int found;
+    unsigned int changed;
+} TWIN_PARSER;
+
+// Walk the document once with constant stack, storing each registered property found under root
+// (NULL for the document itself, "desired" for a full twin). Bit n of found_mask and changed_mask
+// is set when properties[n] was present and when its stored value differed, either may be NULL.
+// Returns false when the document is malformed or nested deeper than TWIN_PARSER_MAX_DEPTH.
+bool twin_parse(const char* json,
+    unsigned int json_length,
+    const char* root,
+    const TWIN_PROPERTY* properties,
+    unsigned int property_count,
+    unsigned int* found_mask,
+    unsigned int* changed_mask);
+
+// The same in pieces, feed the document in order, split anywhere, then finish for the result of twin_parse.
+// Properties are stored as their values complete, a malformed document may have stored some already.
+void twin_parser_init(
+    TWIN_PARSER* parser, const char* root, const TWIN_PROPERTY* properties, unsigned int property_count);
+bool twin_parser_feed(TWIN_PARSER* parser, const char* json, unsigned int json_length);
+bool twin_parser_finish(TWIN_PARSER* parser, unsigned int* found_mask, unsigned int* changed_mask);
+
+#endif // _TWIN_PARSER_H
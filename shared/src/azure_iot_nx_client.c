@@ -11,6 +11,8 @@
 #include "azure_iot_cert.h"
 #include "azure_iot_ciphersuites.h"
 #include "azure_iot_connect.h"
+#include "azure_iot_dps_cache.h"
+#include "azure_iot_log.h"
 
 #define NX_AZURE_IOT_THREAD_PRIORITY 4
 
@@ -23,6 +25,7 @@
 #define HUB_WRITABLE_PROPERTIES_RECEIVE_EVENT 0x10
 #define HUB_PROPERTIES_COMPLETE_EVENT         0x20
 #define HUB_PERIODIC_TIMER_EVENT              0x40
+#define HUB_PUBLISH_EVENT                     0x80
 
 #define AZURE_IOT_DPS_ENDPOINT "global.azure-devices-provisioning.net"
 
@@ -33,30 +36,43 @@
 #define HUB_CONNECT_TIMEOUT_TICKS  (10 * TX_TIMER_TICKS_PER_SECOND)
 #define DPS_REGISTER_TIMEOUT_TICKS (30 * TX_TIMER_TICKS_PER_SECOND)
 
-#define DPS_PAYLOAD_SIZE       (15 + 128)
-#define TELEMETRY_BUFFER_SIZE  256
-#define PROPERTIES_BUFFER_SIZE 128
+#define DPS_PAYLOAD_SIZE (15 + 128)
+
+// ISO 8601 UTC with url-encoded colons, 2038-01-19T03%3A14%3A07Z
+#define TELEMETRY_CREATION_TIME_SIZE 25
 
 // define static strings for content type and -encoding on message property bag
 static const UCHAR content_type_property[]     = "$.ct";
 static const UCHAR content_encoding_property[] = "$.ce";
 static const UCHAR content_type_json[]         = "application%2Fjson";
+static const UCHAR content_type_cbor[]         = "application%2Fcbor";
 static const UCHAR content_encoding_utf8[]     = "utf-8";
-
-static UCHAR telemetry_buffer[TELEMETRY_BUFFER_SIZE];
-static UCHAR properties_buffer[PROPERTIES_BUFFER_SIZE];
+static const UCHAR gateway_leaf_property[]     = "leafId";
+static const UCHAR creation_time_property[]    = "$.ctime";
+
+#ifdef ENABLE_TELEMETRY_STATS
+#define telemetry_stats_now(context)                 azure_iot_telemetry_stats_now(&(context)->telemetry_stats)
+#define telemetry_stats_record(context, stage, start) \
+    azure_iot_telemetry_stats_record(&(context)->telemetry_stats, stage, start)
+#define telemetry_stats_message(context, status, length, start) \
+    azure_iot_telemetry_stats_message(&(context)->telemetry_stats, status, length, start)
+#else
+#define telemetry_stats_now(context)                            0
+#define telemetry_stats_record(context, stage, start)           ((VOID)(start))
+#define telemetry_stats_message(context, status, length, start) ((VOID)(start))
+#endif
 
 static VOID printf_packet(CHAR* prepend, NX_PACKET* packet_ptr)
 {
-    printf("%s", prepend);
+    AZURE_IOT_LOG_DEBUG("%s", prepend);
 
     while (packet_ptr != NX_NULL)
     {
-        printf("%.*s", (INT)(packet_ptr->nx_packet_length), (CHAR*)packet_ptr->nx_packet_prepend_ptr);
+        AZURE_IOT_LOG_DEBUG("%.*s", (INT)(packet_ptr->nx_packet_length), (CHAR*)packet_ptr->nx_packet_prepend_ptr);
         packet_ptr = packet_ptr->nx_packet_next;
     }
 
-    printf("\r\n");
+    AZURE_IOT_LOG_DEBUG("\r\n");
 }
 
 static VOID connection_status_callback(NX_AZURE_IOT_HUB_CLIENT* hub_client_ptr, UINT status)
@@ -122,7 +138,7 @@ static UINT iot_hub_initialize(AZURE_IOT_NX_CONTEXT* nx_context)
              sizeof(nx_context->nx_azure_iot_tls_metadata_buffer),
              &nx_context->root_ca_cert)))
     {
-        printf("Error: on nx_azure_iot_hub_client_initialize (0x%08x)\r\n", status);
+        AZURE_IOT_LOG_ERROR("Error: on nx_azure_iot_hub_client_initialize (0x%08x)\r\n", status);
         return status;
     }
 
@@ -134,7 +150,7 @@ static UINT iot_hub_initialize(AZURE_IOT_NX_CONTEXT* nx_context)
                  (UCHAR*)nx_context->azure_iot_device_sas_key,
                  nx_context->azure_iot_device_sas_key_len)))
         {
-            printf("Error: failed on nx_azure_iot_hub_client_symmetric_key_set (0x%08x)\r\n", status);
+            AZURE_IOT_LOG_ERROR("Error: failed on nx_azure_iot_hub_client_symmetric_key_set (0x%08x)\r\n", status);
         }
     }
     else if (nx_context->azure_iot_auth_mode == AZURE_IOT_AUTH_MODE_CERT)
@@ -143,25 +159,26 @@ static UINT iot_hub_initialize(AZURE_IOT_NX_CONTEXT* nx_context)
         if ((status = nx_azure_iot_hub_client_device_cert_set(
                  &nx_context->iothub_client, &nx_context->device_certificate)))
         {
-            printf("Error: failed on nx_azure_iot_hub_client_device_cert_set!: error code = 0x%08x\r\n", status);
+            AZURE_IOT_LOG_ERROR(
+                "Error: failed on nx_azure_iot_hub_client_device_cert_set!: error code = 0x%08x\r\n", status);
         }
     }
 
     if (status != NX_AZURE_IOT_SUCCESS)
     {
-        printf("Failed to set auth credentials\r\n");
+        AZURE_IOT_LOG_ERROR("Failed to set auth credentials\r\n");
     }
 
     // Add more CA certificates
     else if ((status =
                      nx_azure_iot_hub_client_trusted_cert_add(&nx_context->iothub_client, &nx_context->root_ca_cert_2)))
     {
-        printf("Failed on nx_azure_iot_hub_client_trusted_cert_add!: error code = 0x%08x\r\n", status);
+        AZURE_IOT_LOG_ERROR("Failed on nx_azure_iot_hub_client_trusted_cert_add!: error code = 0x%08x\r\n", status);
     }
     else if ((status =
                      nx_azure_iot_hub_client_trusted_cert_add(&nx_context->iothub_client, &nx_context->root_ca_cert_3)))
     {
-        printf("Failed on nx_azure_iot_hub_client_trusted_cert_add!: error code = 0x%08x\r\n", status);
+        AZURE_IOT_LOG_ERROR("Failed on nx_azure_iot_hub_client_trusted_cert_add!: error code = 0x%08x\r\n", status);
     }
 
     // Set Model id
@@ -169,26 +186,26 @@ static UINT iot_hub_initialize(AZURE_IOT_NX_CONTEXT* nx_context)
                   (UCHAR*)nx_context->azure_iot_model_id,
                   nx_context->azure_iot_model_id_len)))
     {
-        printf("Error: nx_azure_iot_hub_client_model_id_set (0x%08x)\r\n", status);
+        AZURE_IOT_LOG_ERROR("Error: nx_azure_iot_hub_client_model_id_set (0x%08x)\r\n", status);
     }
 
     // Set connection status callback
     else if ((status = nx_azure_iot_hub_client_connection_status_callback_set(
                   &nx_context->iothub_client, connection_status_callback)))
     {
-        printf("Error: failed on connection_status_callback (0x%08x)\r\n", status);
+        AZURE_IOT_LOG_ERROR("Error: failed on connection_status_callback (0x%08x)\r\n", status);
     }
 
     // Enable commands
     else if ((status = nx_azure_iot_hub_client_command_enable(&nx_context->iothub_client)))
     {
-        printf("Error: command receive enable failed (0x%08x)\r\n", status);
+        AZURE_IOT_LOG_ERROR("Error: command receive enable failed (0x%08x)\r\n", status);
     }
 
     // Enable properties
     else if ((status = nx_azure_iot_hub_client_properties_enable(&nx_context->iothub_client)))
     {
-        printf("Failed on nx_azure_iot_hub_client_properties_enable!: error code = 0x%08x\r\n", status);
+        AZURE_IOT_LOG_ERROR("Failed on nx_azure_iot_hub_client_properties_enable!: error code = 0x%08x\r\n", status);
     }
 
     // Set properties callback
@@ -197,14 +214,14 @@ static UINT iot_hub_initialize(AZURE_IOT_NX_CONTEXT* nx_context)
                   message_receive_callback_properties,
                   (VOID*)nx_context)))
     {
-        printf("Error: device twin callback set (0x%08x)\r\n", status);
+        AZURE_IOT_LOG_ERROR("Error: device twin callback set (0x%08x)\r\n", status);
     }
 
     // Set command callback
     else if ((status = nx_azure_iot_hub_client_receive_callback_set(
                   &nx_context->iothub_client, NX_AZURE_IOT_HUB_COMMAND, message_receive_command, (VOID*)nx_context)))
     {
-        printf("Error: device method callback set (0x%08x)\r\n", status);
+        AZURE_IOT_LOG_ERROR("Error: device method callback set (0x%08x)\r\n", status);
     }
 
     // Set the writable property callback
@@ -213,7 +230,7 @@ static UINT iot_hub_initialize(AZURE_IOT_NX_CONTEXT* nx_context)
                   message_receive_callback_writable_property,
                   (VOID*)nx_context)))
     {
-        printf("Error: device twin desired property callback set (0x%08x)\r\n", status);
+        AZURE_IOT_LOG_ERROR("Error: device twin desired property callback set (0x%08x)\r\n", status);
     }
 
     // Register the pnp components for receiving
@@ -223,7 +240,7 @@ static UINT iot_hub_initialize(AZURE_IOT_NX_CONTEXT* nx_context)
                  (UCHAR*)nx_context->azure_iot_components[i],
                  strlen(nx_context->azure_iot_components[i]))))
         {
-            printf("ERROR: nx_azure_iot_hub_client_component_add failed (0x%08x)\r\n", status);
+            AZURE_IOT_LOG_ERROR("ERROR: nx_azure_iot_hub_client_component_add failed (0x%08x)\r\n", status);
             break;
         }
     }
@@ -243,21 +260,28 @@ static UINT dps_initialize(AZURE_IOT_NX_CONTEXT* nx_context)
 
     if (nx_context == NULL)
     {
-        printf("ERROR: context is NULL\r\n");
+        AZURE_IOT_LOG_ERROR("ERROR: context is NULL\r\n");
         return NX_PTR_ERROR;
     }
 
     // Return error if empty credentials
     if (nx_context->azure_iot_dps_id_scope_len == 0 || nx_context->azure_iot_dps_registration_id_len == 0)
     {
-        printf("ERROR: azure_iot_nx_client_dps_entry incorrect parameters\r\n");
+        AZURE_IOT_LOG_ERROR("ERROR: azure_iot_nx_client_dps_entry incorrect parameters\r\n");
         return NX_PTR_ERROR;
     }
 
-    printf("\r\nInitializing Azure IoT DPS client\r\n");
-    printf("\tDPS endpoint: %s\r\n", AZURE_IOT_DPS_ENDPOINT);
-    printf("\tDPS ID scope: %.*s\r\n", nx_context->azure_iot_dps_id_scope_len, nx_context->azure_iot_dps_id_scope);
-    printf("\tRegistration ID: %.*s\r\n",
+    // Reconnects and reboots reuse the assignment until the hub rejects it
+    if (nx_context->azure_iot_dps_assigned)
+    {
+        return iot_hub_initialize(nx_context);
+    }
+
+    AZURE_IOT_LOG_INFO("\r\nInitializing Azure IoT DPS client\r\n");
+    AZURE_IOT_LOG_INFO("\tDPS endpoint: %s\r\n", AZURE_IOT_DPS_ENDPOINT);
+    AZURE_IOT_LOG_INFO(
+        "\tDPS ID scope: %.*s\r\n", nx_context->azure_iot_dps_id_scope_len, nx_context->azure_iot_dps_id_scope);
+    AZURE_IOT_LOG_INFO("\tRegistration ID: %.*s\r\n",
         nx_context->azure_iot_dps_registration_id_len,
         nx_context->azure_iot_dps_registration_id);
 
@@ -267,7 +291,7 @@ static UINT dps_initialize(AZURE_IOT_NX_CONTEXT* nx_context)
 
     if (snprintf(payload, sizeof(payload), DPS_PAYLOAD, nx_context->azure_iot_model_id) > DPS_PAYLOAD_SIZE - 1)
     {
-        printf("ERROR: insufficient buffer size to create DPS payload\r\n");
+        AZURE_IOT_LOG_ERROR("ERROR: insufficient buffer size to create DPS payload\r\n");
         return NX_SIZE_ERROR;
     }
 
@@ -288,7 +312,7 @@ static UINT dps_initialize(AZURE_IOT_NX_CONTEXT* nx_context)
              sizeof(nx_context->nx_azure_iot_tls_metadata_buffer),
              &nx_context->root_ca_cert)))
     {
-        printf("ERROR: nx_azure_iot_provisioning_client_initialize (0x%08x)\r\n", status);
+        AZURE_IOT_LOG_ERROR("ERROR: nx_azure_iot_provisioning_client_initialize (0x%08x)\r\n", status);
         return status;
     }
 
@@ -296,12 +320,14 @@ static UINT dps_initialize(AZURE_IOT_NX_CONTEXT* nx_context)
     else if ((status = nx_azure_iot_provisioning_client_trusted_cert_add(
                   &nx_context->dps_client, &nx_context->root_ca_cert_2)))
     {
-        printf("ERROR: nx_azure_iot_provisioning_client_trusted_cert_add!: error code = 0x%08x\r\n", status);
+        AZURE_IOT_LOG_ERROR(
+            "ERROR: nx_azure_iot_provisioning_client_trusted_cert_add!: error code = 0x%08x\r\n", status);
     }
     else if ((status = nx_azure_iot_provisioning_client_trusted_cert_add(
                   &nx_context->dps_client, &nx_context->root_ca_cert_3)))
     {
-        printf("ERROR: nx_azure_iot_provisioning_client_trusted_cert_add!: error code = 0x%08x\r\n", status);
+        AZURE_IOT_LOG_ERROR(
+            "ERROR: nx_azure_iot_provisioning_client_trusted_cert_add!: error code = 0x%08x\r\n", status);
     }
 
     else
@@ -314,7 +340,8 @@ static UINT dps_initialize(AZURE_IOT_NX_CONTEXT* nx_context)
                          (UCHAR*)nx_context->azure_iot_device_sas_key,
                          nx_context->azure_iot_device_sas_key_len)))
                 {
-                    printf("ERROR: nx_azure_iot_provisioning_client_symmetric_key_set (0x%08x)\r\n", status);
+                    AZURE_IOT_LOG_ERROR(
+                        "ERROR: nx_azure_iot_provisioning_client_symmetric_key_set (0x%08x)\r\n", status);
                 }
                 break;
 
@@ -323,7 +350,7 @@ static UINT dps_initialize(AZURE_IOT_NX_CONTEXT* nx_context)
                 if ((status = nx_azure_iot_provisioning_client_device_cert_set(
                          &nx_context->dps_client, &nx_context->device_certificate)))
                 {
-                    printf("ERROR: nx_azure_iot_provisioning_client_device_cert_set (0x%08x)\r\n", status);
+                    AZURE_IOT_LOG_ERROR("ERROR: nx_azure_iot_provisioning_client_device_cert_set (0x%08x)\r\n", status);
                 }
                 break;
         }
@@ -331,19 +358,19 @@ static UINT dps_initialize(AZURE_IOT_NX_CONTEXT* nx_context)
 
     if (status != NX_AZURE_IOT_SUCCESS)
     {
-        printf("ERROR: failed to set initialize DPS\r\n");
+        AZURE_IOT_LOG_ERROR("ERROR: failed to set initialize DPS\r\n");
     }
 
     // Set the payload containing the model Id
     else if ((status = nx_azure_iot_provisioning_client_registration_payload_set(
                   &nx_context->dps_client, (UCHAR*)payload, strlen(payload))))
     {
-        printf("ERROR: nx_azure_iot_provisioning_client_registration_payload_set (0x%08x\r\n", status);
+        AZURE_IOT_LOG_ERROR("ERROR: nx_azure_iot_provisioning_client_registration_payload_set (0x%08x\r\n", status);
     }
 
     else if ((status = nx_azure_iot_provisioning_client_register(&nx_context->dps_client, DPS_REGISTER_TIMEOUT_TICKS)))
     {
-        printf("\tERROR: nx_azure_iot_provisioning_client_register (0x%08x)\r\n", status);
+        AZURE_IOT_LOG_ERROR("\tERROR: nx_azure_iot_provisioning_client_register (0x%08x)\r\n", status);
     }
 
     // Stash IoT Hub Device info
@@ -353,7 +380,7 @@ static UINT dps_initialize(AZURE_IOT_NX_CONTEXT* nx_context)
                   (UCHAR*)nx_context->azure_iot_hub_device_id,
                   &nx_context->azure_iot_hub_device_id_len)))
     {
-        printf("ERROR: nx_azure_iot_provisioning_client_iothub_device_info_get (0x%08x)\r\n", status);
+        AZURE_IOT_LOG_ERROR("ERROR: nx_azure_iot_provisioning_client_iothub_device_info_get (0x%08x)\r\n", status);
     }
 
     // Destroy Provisioning Client
@@ -364,7 +391,15 @@ static UINT dps_initialize(AZURE_IOT_NX_CONTEXT* nx_context)
         return status;
     }
 
-    printf("SUCCESS: Azure IoT DPS client initialized\r\n");
+    AZURE_IOT_LOG_INFO("SUCCESS: Azure IoT DPS client initialized\r\n");
+
+    nx_context->azure_iot_dps_assigned = true;
+    azure_iot_dps_cache_save(nx_context);
+
+#ifdef ENABLE_PROPERTY_CACHE
+    // The assigned hub may not be the one the reported properties were sent to
+    azure_iot_property_cache_invalidate(&nx_context->property_cache);
+#endif
 
     return iot_hub_initialize(nx_context);
 }
@@ -374,37 +409,213 @@ static VOID process_connect(AZURE_IOT_NX_CONTEXT* nx_context)
     UINT status;
 
     // Request the client properties
-    if ((status = nx_azure_iot_hub_client_properties_request(&nx_context->iothub_client, NX_WAIT_FOREVER)))
+    if ((status = nx_azure_iot_hub_client_properties_request(&nx_context->iothub_client, AZURE_IOT_PUBLISH_TIMEOUT_TICKS)))
     {
-        printf("ERROR: failed to request properties (0x%08x)\r\n", status);
+        AZURE_IOT_LOG_ERROR("ERROR: failed to request properties (0x%08x)\r\n", status);
     }
 
-    // Start the periodic timer
-    if ((status = tx_timer_activate(&nx_context->periodic_timer)))
+    // Start the periodic timer, after a reconnect it is still running
+    if ((status = tx_timer_activate(&nx_context->periodic_timer)) && status != TX_ACTIVATE_ERROR)
     {
-        printf("ERROR: tx_timer_activate (0x%08x)\r\n", status);
+        AZURE_IOT_LOG_ERROR("ERROR: tx_timer_activate (0x%08x)\r\n", status);
     }
 }
 
 static VOID process_disconnect(AZURE_IOT_NX_CONTEXT* nx_context)
+{
+    AZURE_IOT_LOG_INFO("Disconnected from IoT Hub\r\n");
+
+    // The periodic timer keeps running, telemetry is queued until the connection is back
+}
+
+static VOID process_properties_complete(AZURE_IOT_NX_CONTEXT* nx_context)
+{
+    if (nx_context->properties_complete_cb)
+    {
+        nx_context->properties_complete_cb(nx_context);
+    }
+}
+
+// Defined with the reported property helpers further down
+static UINT reported_properties_begin(AZURE_IOT_NX_CONTEXT* context_ptr,
+    NX_AZURE_IOT_JSON_WRITER* json_writer,
+    NX_PACKET** packet_ptr,
+    CHAR* component_name_ptr);
+static UINT reported_properties_end(AZURE_IOT_NX_CONTEXT* nx_context,
+    NX_AZURE_IOT_JSON_WRITER* json_writer,
+    NX_PACKET** packet_ptr,
+    CHAR* component_name_ptr,
+    ULONG* version_ptr);
+
+typedef union DISPATCH_VALUE_UNION {
+    int32_t integer;
+    UINT boolean;
+    double number;
+    UINT string_length;
+} DISPATCH_VALUE;
+
+// Read the value at the reader position as the schema of the entry and pass it to its typed handler
+static UINT dispatch_value(AZURE_IOT_NX_CONTEXT* nx_context,
+    const AZURE_IOT_DISPATCH_ENTRY* entry,
+    NX_AZURE_IOT_JSON_READER* json_reader,
+    DISPATCH_VALUE* value,
+    UINT* http_status)
+{
+    UINT status = NX_AZURE_IOT_SUCCESS;
+
+    switch (entry->schema)
+    {
+        case AZURE_IOT_DISPATCH_SCHEMA_NONE:
+            *http_status = entry->handler.none(nx_context);
+            break;
+
+        case AZURE_IOT_DISPATCH_SCHEMA_INTEGER:
+            if (!(status = nx_azure_iot_json_reader_token_int32_get(json_reader, &value->integer)))
+            {
+                *http_status = entry->handler.integer(nx_context, value->integer);
+            }
+            break;
+
+        case AZURE_IOT_DISPATCH_SCHEMA_BOOLEAN:
+            if (!(status = nx_azure_iot_json_reader_token_bool_get(json_reader, &value->boolean)))
+            {
+                *http_status = entry->handler.boolean(nx_context, value->boolean != 0);
+            }
+            break;
+
+        case AZURE_IOT_DISPATCH_SCHEMA_DOUBLE:
+            if (!(status = nx_azure_iot_json_reader_token_double_get(json_reader, &value->number)))
+            {
+                *http_status = entry->handler.number(nx_context, value->number);
+            }
+            break;
+
+        case AZURE_IOT_DISPATCH_SCHEMA_STRING:
+            if (!(status = nx_azure_iot_json_reader_token_string_get(json_reader,
+                      nx_context->properties_buffer,
+                      sizeof(nx_context->properties_buffer),
+                      &value->string_length)))
+            {
+                *http_status = entry->handler.string(nx_context, nx_context->properties_buffer, value->string_length);
+            }
+            break;
+
+        default:
+            status = NX_NOT_SUCCESSFUL;
+            break;
+    }
+
+    return status;
+}
+
+static UINT dispatch_value_append(AZURE_IOT_NX_CONTEXT* nx_context,
+    NX_AZURE_IOT_JSON_WRITER* json_writer,
+    const AZURE_IOT_DISPATCH_ENTRY* entry,
+    DISPATCH_VALUE* value)
+{
+    switch (entry->schema)
+    {
+        case AZURE_IOT_DISPATCH_SCHEMA_INTEGER:
+            return nx_azure_iot_json_writer_append_int32(json_writer, value->integer);
+
+        case AZURE_IOT_DISPATCH_SCHEMA_BOOLEAN:
+            return nx_azure_iot_json_writer_append_bool(json_writer, value->boolean);
+
+        case AZURE_IOT_DISPATCH_SCHEMA_DOUBLE:
+            return nx_azure_iot_json_writer_append_double(json_writer, value->number, 2);
+
+        case AZURE_IOT_DISPATCH_SCHEMA_STRING:
+            return nx_azure_iot_json_writer_append_string(
+                json_writer, nx_context->properties_buffer, value->string_length);
+
+        default:
+            return NX_NOT_SUCCESSFUL;
+    }
+}
+
+static UINT dispatch_command(AZURE_IOT_NX_CONTEXT* nx_context,
+    const AZURE_IOT_DISPATCH_ENTRY* entry,
+    UCHAR* payload_ptr,
+    USHORT payload_length,
+    VOID* context_ptr,
+    USHORT context_length)
 {
     UINT status;
+    UINT http_status = 400;
+    DISPATCH_VALUE value;
+    NX_AZURE_IOT_JSON_READER json_reader;
+
+    if (entry->schema != AZURE_IOT_DISPATCH_SCHEMA_NONE &&
+        ((status = nx_azure_iot_json_reader_with_buffer_init(&json_reader, payload_ptr, payload_length)) ||
+            (status = nx_azure_iot_json_reader_next_token(&json_reader))))
+    {
+        AZURE_IOT_LOG_ERROR("ERROR: failed to read command payload (0x%08x)\r\n", status);
+    }
 
-    printf("Disconnected from IoT Hub\r\n");
+    else if ((status = dispatch_value(nx_context, entry, &json_reader, &value, &http_status)))
+    {
+        AZURE_IOT_LOG_ERROR("ERROR: command payload does not match the model (0x%08x)\r\n", status);
+    }
 
-    // Stop the periodic timer
-    if ((status = tx_timer_deactivate(&nx_context->periodic_timer)))
+    if ((status = nx_azure_iot_hub_client_command_message_response(&nx_context->iothub_client,
+             http_status,
+             context_ptr,
+             context_length,
+             NULL,
+             0,
+             AZURE_IOT_PUBLISH_TIMEOUT_TICKS)))
     {
-        printf("ERROR: tx_timer_deactivate (0x%08x)\r\n", status);
+        AZURE_IOT_LOG_ERROR("Direct method response failed! (0x%08x)\r\n", status);
     }
+
+    return status;
 }
 
-static VOID process_properties_complete(AZURE_IOT_NX_CONTEXT* nx_context)
+// Desired values of the full twin and of updates are both acknowledged, with the status the handler returned
+static UINT dispatch_property(AZURE_IOT_NX_CONTEXT* nx_context,
+    const AZURE_IOT_DISPATCH_ENTRY* entry,
+    NX_AZURE_IOT_JSON_READER* json_reader,
+    UINT version)
 {
-    if (nx_context->properties_complete_cb)
+    UINT status;
+    UINT http_status;
+    DISPATCH_VALUE value;
+    NX_AZURE_IOT_JSON_WRITER json_writer;
+    NX_PACKET* packet_ptr = NX_NULL;
+
+    if ((status = dispatch_value(nx_context, entry, json_reader, &value, &http_status)))
     {
-        nx_context->properties_complete_cb(nx_context);
+        AZURE_IOT_LOG_ERROR("ERROR: property %s does not match the model (0x%08x)\r\n", entry->name, status);
+        return status;
+    }
+
+    if ((status = reported_properties_begin(nx_context, &json_writer, &packet_ptr, entry->component)) ||
+
+        (status = nx_azure_iot_hub_client_reported_properties_status_begin(&nx_context->iothub_client,
+             &json_writer,
+             (const UCHAR*)entry->name,
+             entry->name_length,
+             http_status,
+             version,
+             NULL,
+             0)) ||
+
+        (status = dispatch_value_append(nx_context, &json_writer, entry, &value)) ||
+
+        (status = nx_azure_iot_hub_client_reported_properties_status_end(&nx_context->iothub_client, &json_writer)) ||
+
+        (status = reported_properties_end(nx_context, &json_writer, &packet_ptr, entry->component, NX_NULL)))
+    {
+        AZURE_IOT_LOG_ERROR("ERROR: failed to acknowledge property %s (0x%08x)\r\n", entry->name, status);
+
+        // Still ours unless the send took it
+        if (packet_ptr != NX_NULL)
+        {
+            nx_packet_release(packet_ptr);
+        }
     }
+
+    return status;
 }
 
 static VOID process_command(AZURE_IOT_NX_CONTEXT* nx_context)
@@ -419,6 +630,7 @@ static VOID process_command(AZURE_IOT_NX_CONTEXT* nx_context)
     UCHAR* payload_ptr;
     USHORT payload_length;
     NX_PACKET* packet_ptr;
+    const AZURE_IOT_DISPATCH_ENTRY* entry;
 
     while ((status = nx_azure_iot_hub_client_command_message_receive(&nx_context->iothub_client,
                 &component_name_ptr,
@@ -430,13 +642,23 @@ static VOID process_command(AZURE_IOT_NX_CONTEXT* nx_context)
                 &packet_ptr,
                 NX_NO_WAIT)) == NX_AZURE_IOT_SUCCESS)
     {
-        printf("Received command: %.*s\r\n", (INT)command_name_length, (CHAR*)command_name_ptr);
+        AZURE_IOT_LOG_INFO("Received command: %.*s\r\n", (INT)command_name_length, (CHAR*)command_name_ptr);
         printf_packet("\tPayload: ", packet_ptr);
 
         payload_ptr    = packet_ptr->nx_packet_prepend_ptr;
         payload_length = packet_ptr->nx_packet_append_ptr - packet_ptr->nx_packet_prepend_ptr;
 
-        if (nx_context->command_received_cb)
+        if ((entry = azure_iot_dispatch_lookup(nx_context->dispatch_table,
+                 AZURE_IOT_DISPATCH_COMMAND,
+                 component_name_ptr,
+                 component_name_length,
+                 command_name_ptr,
+                 command_name_length)))
+        {
+            dispatch_command(nx_context, entry, payload_ptr, payload_length, context_ptr, context_length);
+        }
+
+        else if (nx_context->command_received_cb)
         {
             nx_context->command_received_cb(nx_context,
                 component_name_ptr,
@@ -449,6 +671,18 @@ static VOID process_command(AZURE_IOT_NX_CONTEXT* nx_context)
                 context_length);
         }
 
+        // Nothing handles the command, answer so the service does not wait for its timeout
+        else if ((status = nx_azure_iot_hub_client_command_message_response(&nx_context->iothub_client,
+                      501,
+                      context_ptr,
+                      context_length,
+                      NULL,
+                      0,
+                      AZURE_IOT_PUBLISH_TIMEOUT_TICKS)))
+        {
+            AZURE_IOT_LOG_ERROR("Direct method response failed! (0x%08x)\r\n", status);
+        }
+
         // Release the received packet, as ownership was passed to the application from the middleware
         nx_packet_release(packet_ptr);
     }
@@ -456,7 +690,7 @@ static VOID process_command(AZURE_IOT_NX_CONTEXT* nx_context)
     // If we failed for anything other than no packet, then report error
     if (status != NX_AZURE_IOT_NO_PACKET)
     {
-        printf("Error: Command receive failed (0x%08x)\r\n", status);
+        AZURE_IOT_LOG_ERROR("Error: Command receive failed (0x%08x)\r\n", status);
         return;
     }
 }
@@ -475,10 +709,11 @@ static UINT process_properties_shared(AZURE_IOT_NX_CONTEXT* nx_context,
     UINT property_name_length;
     ULONG properties_version;
     NX_AZURE_IOT_JSON_READER json_reader;
+    const AZURE_IOT_DISPATCH_ENTRY* entry;
 
     if ((status = nx_azure_iot_json_reader_init(&json_reader, packet_ptr)))
     {
-        printf("Error: failed to initialize json reader (0x%08x)\r\n", status);
+        AZURE_IOT_LOG_ERROR("Error: failed to initialize json reader (0x%08x)\r\n", status);
         nx_packet_release(packet_ptr);
         return status;
     }
@@ -487,7 +722,7 @@ static UINT process_properties_shared(AZURE_IOT_NX_CONTEXT* nx_context,
     if ((status = nx_azure_iot_hub_client_properties_version_get(
              &nx_context->iothub_client, &json_reader, message_type, &properties_version)))
     {
-        printf("Error: Properties version get failed (0x%08x)\r\n", status);
+        AZURE_IOT_LOG_ERROR("Error: Properties version get failed (0x%08x)\r\n", status);
         nx_packet_release(packet_ptr);
         return status;
     }
@@ -495,7 +730,7 @@ static UINT process_properties_shared(AZURE_IOT_NX_CONTEXT* nx_context,
     // reinitialize the json reader after reading the version to reset
     if ((status = nx_azure_iot_json_reader_init(&json_reader, packet_ptr)))
     {
-        printf("Error: failed to initialize json reader (0x%08x)\r\n", status);
+        AZURE_IOT_LOG_ERROR("Error: failed to initialize json reader (0x%08x)\r\n", status);
         nx_packet_release(packet_ptr);
         return status;
     }
@@ -510,19 +745,32 @@ static UINT process_properties_shared(AZURE_IOT_NX_CONTEXT* nx_context,
         if (nx_azure_iot_json_reader_token_string_get(
                 &json_reader, scratch_buffer, scratch_buffer_len, &property_name_length))
         {
-            printf("Failed to get string property value\r\n");
+            AZURE_IOT_LOG_ERROR("Failed to get string property value\r\n");
             return NX_NOT_SUCCESSFUL;
         }
 
         nx_azure_iot_json_reader_next_token(&json_reader);
 
-        property_received_cb(nx_context,
-            component_name_ptr,
-            component_name_length,
-            scratch_buffer,
-            property_name_length,
-            &json_reader,
-            properties_version);
+        if ((entry = azure_iot_dispatch_lookup(nx_context->dispatch_table,
+                 AZURE_IOT_DISPATCH_PROPERTY,
+                 component_name_ptr,
+                 component_name_length,
+                 scratch_buffer,
+                 property_name_length)))
+        {
+            dispatch_property(nx_context, entry, &json_reader, properties_version);
+        }
+
+        else if (property_received_cb)
+        {
+            property_received_cb(nx_context,
+                component_name_ptr,
+                component_name_length,
+                scratch_buffer,
+                property_name_length,
+                &json_reader,
+                properties_version);
+        }
 
         // If we are still looking at the value, then skip over it (including if it has children)
         if (nx_azure_iot_json_reader_token_type(&json_reader) == NX_AZURE_IOT_READER_TOKEN_BEGIN_OBJECT)
@@ -543,24 +791,24 @@ static VOID process_properties(AZURE_IOT_NX_CONTEXT* nx_context)
 
     if ((status = nx_azure_iot_hub_client_properties_receive(&nx_context->iothub_client, &packet_ptr, NX_WAIT_FOREVER)))
     {
-        printf("ERROR: nx_azure_iot_hub_client_properties_receive failed (0x%08x)\r\n", status);
+        AZURE_IOT_LOG_ERROR("ERROR: nx_azure_iot_hub_client_properties_receive failed (0x%08x)\r\n", status);
         return;
     }
 
     printf_packet("Receive properties: ", packet_ptr);
 
-    if (nx_context->property_received_cb)
+    if (nx_context->property_received_cb || nx_context->dispatch_table)
     {
         // Parse the writable properties from the device twin receive receive message
         if ((status = process_properties_shared(nx_context,
                  packet_ptr,
                  NX_AZURE_IOT_HUB_PROPERTIES,
                  NX_AZURE_IOT_HUB_CLIENT_PROPERTY_WRITABLE,
-                 properties_buffer,
-                 sizeof(properties_buffer),
+                 nx_context->properties_buffer,
+                 sizeof(nx_context->properties_buffer),
                  nx_context->property_received_cb)))
         {
-            printf("Error: failed to parse properties (0x%08x)\r\n", status);
+            AZURE_IOT_LOG_ERROR("Error: failed to parse properties (0x%08x)\r\n", status);
         }
     }
 
@@ -579,24 +827,24 @@ static VOID process_writable_properties(AZURE_IOT_NX_CONTEXT* nx_context)
     if ((status = nx_azure_iot_hub_client_writable_properties_receive(
              &nx_context->iothub_client, &packet_ptr, NX_WAIT_FOREVER)))
     {
-        printf("ERROR: nx_azure_iot_hub_client_writable_properties_receive (0x%08x)\r\n", status);
+        AZURE_IOT_LOG_ERROR("ERROR: nx_azure_iot_hub_client_writable_properties_receive (0x%08x)\r\n", status);
         return;
     }
 
     printf_packet("Receive properties: ", packet_ptr);
 
-    if (nx_context->writable_property_received_cb)
+    if (nx_context->writable_property_received_cb || nx_context->dispatch_table)
     {
         // Parse the writable properties from the writable receive message
         if ((status = process_properties_shared(nx_context,
                  packet_ptr,
                  NX_AZURE_IOT_HUB_WRITABLE_PROPERTIES,
                  NX_AZURE_IOT_HUB_CLIENT_PROPERTY_WRITABLE,
-                 properties_buffer,
-                 sizeof(properties_buffer),
+                 nx_context->properties_buffer,
+                 sizeof(nx_context->properties_buffer),
                  nx_context->writable_property_received_cb)))
         {
-            printf("ERROR: failed to parse properties (0x%08x)\r\n", status);
+            AZURE_IOT_LOG_ERROR("ERROR: failed to parse properties (0x%08x)\r\n", status);
         }
     }
 
@@ -620,267 +868,1195 @@ UINT azure_nx_client_periodic_interval_set(AZURE_IOT_NX_CONTEXT* nx_context, INT
 
     if ((status = tx_timer_info_get(&nx_context->periodic_timer, NULL, &active, NULL, NULL, NULL)))
     {
-        printf("ERROR: tx_timer_deactivate (0x%08x)\r\n", status);
+        AZURE_IOT_LOG_ERROR("ERROR: tx_timer_deactivate (0x%08x)\r\n", status);
         return status;
     }
 
     if (active == TX_TRUE && (status = tx_timer_deactivate(&nx_context->periodic_timer)))
     {
-        printf("ERROR: tx_timer_deactivate (0x%08x)\r\n", status);
+        AZURE_IOT_LOG_ERROR("ERROR: tx_timer_deactivate (0x%08x)\r\n", status);
     }
 
     else if ((status = tx_timer_change(&nx_context->periodic_timer, ticks, ticks)))
     {
-        printf("ERROR: tx_timer_change (0x%08x)\r\n", status);
+        AZURE_IOT_LOG_ERROR("ERROR: tx_timer_change (0x%08x)\r\n", status);
     }
 
     else if (active == TX_TRUE && (status = tx_timer_activate(&nx_context->periodic_timer)))
     {
-        printf("ERROR: tx_timer_activate (0x%08x)\r\n", status);
+        AZURE_IOT_LOG_ERROR("ERROR: tx_timer_activate (0x%08x)\r\n", status);
     }
 
     return status;
 }
 
-UINT azure_iot_nx_client_publish_telemetry(AZURE_IOT_NX_CONTEXT* context_ptr,
+// Unix time as ISO 8601 UTC, the date from the civil_from_days algorithm of Howard Hinnant
+static UINT telemetry_creation_time_format(ULONG unix_time, CHAR* buffer, UINT buffer_size)
+{
+    ULONG days          = unix_time / 86400;
+    ULONG seconds       = unix_time % 86400;
+    ULONG shifted       = days + 719468;
+    ULONG era           = shifted / 146097;
+    ULONG day_of_era    = shifted - era * 146097;
+    ULONG year_of_era   = (day_of_era - day_of_era / 1460 + day_of_era / 36524 - day_of_era / 146096) / 365;
+    ULONG day_of_year   = day_of_era - (365 * year_of_era + year_of_era / 4 - year_of_era / 100);
+    ULONG shifted_month = (5 * day_of_year + 2) / 153;
+    ULONG day           = day_of_year - (153 * shifted_month + 2) / 5 + 1;
+    ULONG month         = shifted_month < 10 ? shifted_month + 3 : shifted_month - 9;
+    ULONG year          = year_of_era + era * 400 + (month <= 2);
+
+    return (UINT)snprintf(buffer,
+        buffer_size,
+        "%04lu-%02lu-%02luT%02lu%%3A%02lu%%3A%02luZ",
+        year,
+        month,
+        day,
+        seconds / 3600,
+        seconds / 60 % 60,
+        seconds % 60);
+}
+
+// creation_time is the unix time the telemetry was captured, sent as iothub-creation-time-utc, 0 for none
+static UINT telemetry_message_create(AZURE_IOT_NX_CONTEXT* context_ptr,
     CHAR* component_name_ptr,
-    UINT (*append_properties)(NX_AZURE_IOT_JSON_WRITER* json_builder_ptr))
+    CHAR* leaf_id_ptr,
+    UINT encoding,
+    ULONG creation_time,
+    NX_PACKET** packet_ptr,
+    UINT wait_option)
 {
     UINT status;
-    UINT telemetry_length;
-    NX_PACKET* packet_ptr;
-    NX_AZURE_IOT_JSON_WRITER json_writer;
+    CHAR creation_time_value[TELEMETRY_CREATION_TIME_SIZE];
+    UINT creation_time_length;
+
+    if ((status = nx_azure_iot_hub_client_telemetry_message_create(&context_ptr->iothub_client, packet_ptr, wait_option)))
+    {
+        return status;
+    }
 
-    if ((status = nx_azure_iot_hub_client_telemetry_message_create(
-             &context_ptr->iothub_client, &packet_ptr, NX_WAIT_FOREVER)))
+    if (creation_time != 0)
     {
-        printf("Error: nx_azure_iot_hub_client_telemetry_message_create failed (0x%08x)\r\n", status);
+        creation_time_length =
+            telemetry_creation_time_format(creation_time, creation_time_value, sizeof(creation_time_value));
+
+        if ((status = nx_azure_iot_hub_client_telemetry_property_add(*packet_ptr,
+                 creation_time_property,
+                 sizeof(creation_time_property) - 1,
+                 (UCHAR*)creation_time_value,
+                 creation_time_length,
+                 wait_option)))
+        {
+            AZURE_IOT_LOG_ERROR("Error: Cant set creation time message property (0x%08X)\r\n", status);
+            nx_azure_iot_hub_client_telemetry_message_delete(*packet_ptr);
+            return status;
+        }
     }
 
     if (component_name_ptr != NX_NULL)
     {
-        printf("appending component name: %s\r\n", component_name_ptr);
+        AZURE_IOT_LOG_DEBUG("appending component name: %s\r\n", component_name_ptr);
         if ((status = nx_azure_iot_hub_client_telemetry_component_set(
-                 packet_ptr, (UCHAR*)component_name_ptr, strlen(component_name_ptr), NX_WAIT_FOREVER)))
+                 *packet_ptr, (UCHAR*)component_name_ptr, strlen(component_name_ptr), wait_option)))
         {
-            printf("Error: nx_azure_iot_hub_client_telemetry_component_set failed (0x%08x)\r\n", status);
-            nx_azure_iot_hub_client_telemetry_message_delete(packet_ptr);
+            AZURE_IOT_LOG_ERROR("Error: nx_azure_iot_hub_client_telemetry_component_set failed (0x%08x)\r\n", status);
+            nx_azure_iot_hub_client_telemetry_message_delete(*packet_ptr);
             return status;
         }
     }
 
-    if ((status = nx_azure_iot_json_writer_with_buffer_init(&json_writer, telemetry_buffer, sizeof(telemetry_buffer))))
+    // Telemetry a gateway sends for a downstream device carries the id of that device
+    if (leaf_id_ptr != NX_NULL)
     {
-        printf("Error: Failed to initialize json writer (0x%08x)\r\n", status);
-        nx_azure_iot_hub_client_telemetry_message_delete(packet_ptr);
-        return status;
+        if ((status = nx_azure_iot_hub_client_telemetry_property_add(*packet_ptr,
+                 gateway_leaf_property,
+                 sizeof(gateway_leaf_property) - 1,
+                 (UCHAR*)leaf_id_ptr,
+                 strlen(leaf_id_ptr),
+                 wait_option)))
+        {
+            AZURE_IOT_LOG_ERROR("Error: Cant set gateway leaf message property (0x%08X)\r\n", status);
+            nx_azure_iot_hub_client_telemetry_message_delete(*packet_ptr);
+            return status;
+        }
     }
 
-    if ((status = nx_azure_iot_json_writer_append_begin_object(&json_writer)) ||
-        (status = append_properties(&json_writer)) ||
-        (status = nx_azure_iot_json_writer_append_end_object(&json_writer)))
+    // CBOR is binary, so only carries the ContentType "application/cbor" (url-encoded)
+    if (encoding == AZURE_IOT_TELEMETRY_ENCODING_CBOR)
     {
-        printf("Error: Failed to build telemetry (0x%08x)\r\n", status);
-        nx_azure_iot_hub_client_telemetry_message_delete(packet_ptr);
-        return status;
+        if ((status = nx_azure_iot_hub_client_telemetry_property_add(*packet_ptr,
+                 content_type_property,
+                 sizeof(content_type_property) - 1,
+                 content_type_cbor,
+                 sizeof(content_type_cbor) - 1,
+                 wait_option)))
+        {
+            AZURE_IOT_LOG_ERROR("Error: Cant set ContentType message property (0x%08X)\r\n", status);
+            nx_azure_iot_hub_client_telemetry_message_delete(*packet_ptr);
+            return status;
+        }
+
+        return NX_AZURE_IOT_SUCCESS;
     }
 
     // set the ContentType property on the message to "application/json" (url-encoded)
-    if ((status = nx_azure_iot_hub_client_telemetry_property_add(packet_ptr,
+    if ((status = nx_azure_iot_hub_client_telemetry_property_add(*packet_ptr,
              content_type_property,
              sizeof(content_type_property) - 1,
              content_type_json,
              sizeof(content_type_json) - 1,
-             NX_WAIT_FOREVER)))
+             wait_option)))
     {
-        printf("Error: Cant set ContentType message property (0x%08X)\r\n", status);
-        nx_azure_iot_hub_client_telemetry_message_delete(packet_ptr);
+        AZURE_IOT_LOG_ERROR("Error: Cant set ContentType message property (0x%08X)\r\n", status);
+        nx_azure_iot_hub_client_telemetry_message_delete(*packet_ptr);
         return status;
     }
 
     // set the ContentEncoding property on the message to "utf-8"
-    if ((status = nx_azure_iot_hub_client_telemetry_property_add(packet_ptr,
+    if ((status = nx_azure_iot_hub_client_telemetry_property_add(*packet_ptr,
              content_encoding_property,
              sizeof(content_encoding_property) - 1,
              content_encoding_utf8,
              sizeof(content_encoding_utf8) - 1,
-             NX_WAIT_FOREVER)))
-    {
-        printf("Error: Cant set ContentEncoding message property (0x%08X)\r\n", status);
-        nx_azure_iot_hub_client_telemetry_message_delete(packet_ptr);
-        return status;
-    }
-
-    telemetry_length = nx_azure_iot_json_writer_get_bytes_used(&json_writer);
-    if ((status = nx_azure_iot_hub_client_telemetry_send(
-             &context_ptr->iothub_client, packet_ptr, telemetry_buffer, telemetry_length, NX_WAIT_FOREVER)))
+             wait_option)))
     {
-        printf("Error: Telemetry message send failed (0x%08x)\r\n", status);
-        nx_azure_iot_hub_client_telemetry_message_delete(packet_ptr);
+        AZURE_IOT_LOG_ERROR("Error: Cant set ContentEncoding message property (0x%08X)\r\n", status);
+        nx_azure_iot_hub_client_telemetry_message_delete(*packet_ptr);
         return status;
     }
 
-    printf("Telemetry message sent: %.*s.\r\n", telemetry_length, telemetry_buffer);
-
-    return status;
+    return NX_AZURE_IOT_SUCCESS;
 }
 
-static UINT reported_properties_begin(AZURE_IOT_NX_CONTEXT* context_ptr,
-    NX_AZURE_IOT_JSON_WRITER* json_writer,
-    NX_PACKET** packet_ptr,
-    CHAR* component_name_ptr)
+static UINT telemetry_send_at(AZURE_IOT_NX_CONTEXT* context_ptr,
+    CHAR* component_name_ptr,
+    CHAR* leaf_id_ptr,
+    UINT encoding,
+    ULONG creation_time,
+    UCHAR* telemetry_ptr,
+    UINT telemetry_length)
 {
     UINT status;
+    NX_PACKET* packet_ptr;
+    ULONG start_time = telemetry_stats_now(context_ptr);
 
-    if ((status = nx_azure_iot_hub_client_reported_properties_create(
-             &context_ptr->iothub_client, packet_ptr, NX_WAIT_FOREVER)))
+    // The periodic timer keeps running while reconnecting, do not wait on a client that cannot send
+    if (context_ptr->azure_iot_connection_status != NX_SUCCESS)
     {
-        printf("Error: Failed create reported properties (0x%08x)\r\n", status);
+        AZURE_IOT_LOG_ERROR("Error: Telemetry not sent, IoT Hub is disconnected\r\n");
+        return NX_AZURE_IOT_DISCONNECTED;
     }
 
-    else if ((status = nx_azure_iot_json_writer_init(json_writer, *packet_ptr, NX_WAIT_FOREVER)))
+    if ((status = telemetry_message_create(context_ptr,
+             component_name_ptr,
+             leaf_id_ptr,
+             encoding,
+             creation_time,
+             &packet_ptr,
+             AZURE_IOT_PUBLISH_TIMEOUT_TICKS)))
     {
-        printf("Error: Failed to initialize json writer (0x%08x)\r\n", status);
+        AZURE_IOT_LOG_ERROR("Error: nx_azure_iot_hub_client_telemetry_message_create failed (0x%08x)\r\n", status);
+        return status;
     }
 
-    else if ((status = nx_azure_iot_json_writer_append_begin_object(json_writer)))
+    telemetry_stats_record(context_ptr, AZURE_IOT_TELEMETRY_STAGE_CREATE, start_time);
+    start_time = telemetry_stats_now(context_ptr);
+
+    if ((status = nx_azure_iot_hub_client_telemetry_send(&context_ptr->iothub_client,
+             packet_ptr,
+             telemetry_ptr,
+             telemetry_length,
+             AZURE_IOT_PUBLISH_TIMEOUT_TICKS)))
     {
-        printf("Error: Failed to append object begin (0x%08x)\r\n", status);
+        AZURE_IOT_LOG_ERROR("Error: Telemetry message send failed (0x%08x)\r\n", status);
+        nx_azure_iot_hub_client_telemetry_message_delete(packet_ptr);
+        return status;
     }
 
-    else if (component_name_ptr != NX_NULL &&
-             (status = nx_azure_iot_hub_client_reported_properties_component_begin(
-                  &context_ptr->iothub_client, json_writer, (UCHAR*)component_name_ptr, strlen(component_name_ptr))))
+    telemetry_stats_record(context_ptr, AZURE_IOT_TELEMETRY_STAGE_SEND, start_time);
+
+    if (encoding == AZURE_IOT_TELEMETRY_ENCODING_CBOR)
+    {
+        AZURE_IOT_LOG_INFO("Telemetry message sent: %d bytes CBOR.\r\n", telemetry_length);
+    }
+    else
     {
-        printf("Error: Failed to append component begin (0x%08x)\r\n", status);
+        AZURE_IOT_LOG_INFO("Telemetry message sent: %d bytes JSON.\r\n", telemetry_length);
+        AZURE_IOT_LOG_DEBUG("\tPayload: %.*s\r\n", telemetry_length, telemetry_ptr);
     }
 
     return status;
 }
 
-static UINT reported_properties_end(AZURE_IOT_NX_CONTEXT* nx_context,
-    NX_AZURE_IOT_JSON_WRITER* json_writer,
-    NX_PACKET** packet_ptr,
-    CHAR* component_name_ptr)
+static UINT telemetry_send(AZURE_IOT_NX_CONTEXT* context_ptr,
+    CHAR* component_name_ptr,
+    CHAR* leaf_id_ptr,
+    UINT encoding,
+    UCHAR* telemetry_ptr,
+    UINT telemetry_length)
 {
-    UINT status;
-    UINT response_status = 0;
+    return telemetry_send_at(
+        context_ptr, component_name_ptr, leaf_id_ptr, encoding, 0, telemetry_ptr, telemetry_length);
+}
 
-    if ((component_name_ptr != NX_NULL && (status = nx_azure_iot_hub_client_reported_properties_component_end(
-                                               &nx_context->iothub_client, json_writer))))
-    {
-        printf("Error: Failed to append component end (0x%08x)\r\n", status);
-        return status;
-    }
+static UINT telemetry_build(UINT (*append_properties)(NX_AZURE_IOT_JSON_WRITER* json_builder_ptr),
+    UCHAR* buffer_ptr,
+    UINT buffer_size,
+    UINT* length)
+{
+    UINT status;
+    NX_AZURE_IOT_JSON_WRITER json_writer;
 
-    if ((status = nx_azure_iot_json_writer_append_end_object(json_writer)))
+    if ((status = nx_azure_iot_json_writer_with_buffer_init(&json_writer, buffer_ptr, buffer_size)))
     {
-        printf("Error: Failed to append object end (0x%08x)\r\n", status);
+        AZURE_IOT_LOG_ERROR("Error: Failed to initialize json writer (0x%08x)\r\n", status);
         return status;
     }
 
-    printf_packet("Sending property: ", *packet_ptr);
-
-    if ((status = nx_azure_iot_hub_client_reported_properties_send(
-             &nx_context->iothub_client, *packet_ptr, NX_NULL, &response_status, NX_NULL, 5 * NX_IP_PERIODIC_RATE)))
+    if ((status = nx_azure_iot_json_writer_append_begin_object(&json_writer)) ||
+        (status = append_properties(&json_writer)) ||
+        (status = nx_azure_iot_json_writer_append_end_object(&json_writer)))
     {
-        printf("Error: nx_azure_iot_hub_client_reported_properties_send failed (0x%08x)\r\n", status);
+        AZURE_IOT_LOG_ERROR("Error: Failed to build telemetry (0x%08x)\r\n", status);
         return status;
     }
 
-    else if ((response_status < 200) || (response_status >= 300))
-    {
-        printf("Error: Property sent response status failed (%d)\r\n", response_status);
-        return NX_NOT_SUCCESSFUL;
-    }
+    *length = nx_azure_iot_json_writer_get_bytes_used(&json_writer);
 
-    return NX_SUCCESS;
+    return NX_AZURE_IOT_SUCCESS;
 }
 
-UINT azure_iot_nx_client_publish_properties(AZURE_IOT_NX_CONTEXT* nx_context,
-    CHAR* component_name_ptr,
-    UINT (*append_properties)(NX_AZURE_IOT_JSON_WRITER* json_writer_ptr))
+#ifdef ENABLE_TELEMETRY_QUEUE
+#if defined(ENABLE_GATEWAY) && AZURE_IOT_GATEWAY_LEAF_COUNT > 0x100 - AZURE_IOT_TELEMETRY_RECORD_LEAF
+#error "Queued telemetry records hold at most 128 gateway leaves."
+#endif
+
+// Queued records refer to components and gateway leaves by index so they stay valid in a spill across reboots
+static bool telemetry_component_index(
+    AZURE_IOT_NX_CONTEXT* nx_context, CHAR* component_name_ptr, CHAR* leaf_id_ptr, UCHAR* index)
 {
-    UINT status;
-    NX_PACKET* packet_ptr;
-    NX_AZURE_IOT_JSON_WRITER json_writer;
+    UINT component;
 
-    if ((status = reported_properties_begin(nx_context, &json_writer, &packet_ptr, component_name_ptr)) ||
+#ifdef ENABLE_GATEWAY
+    // Leaf telemetry is sent on the root component of the gateway
+    if (leaf_id_ptr != NX_NULL)
+    {
+        for (component = 0; component < nx_context->gateway_leaf_count; component++)
+        {
+            if (strcmp(nx_context->gateway_leaves[component].id, leaf_id_ptr) == 0)
+            {
+                *index = AZURE_IOT_TELEMETRY_RECORD_LEAF + component;
+                return true;
+            }
+        }
 
-        (status = append_properties(&json_writer)) ||
+        return false;
+    }
+#endif
 
-        (status = reported_properties_end(nx_context, &json_writer, &packet_ptr, component_name_ptr)))
+    if (component_name_ptr == NX_NULL)
     {
-        printf("ERROR: azure_iot_nx_client_publish_properties (0x%08x)", status);
-        nx_packet_release(packet_ptr);
+        *index = 0;
+        return true;
     }
 
-    return status;
+    for (component = 0; component < nx_context->azure_iot_component_count; component++)
+    {
+        if (strcmp(nx_context->azure_iot_components[component], component_name_ptr) == 0)
+        {
+            *index = component + 1;
+            return true;
+        }
+    }
+
+    return false;
 }
 
-UINT azure_iot_nx_client_publish_bool_property(
-    AZURE_IOT_NX_CONTEXT* nx_context, CHAR* component_name_ptr, CHAR* property_ptr, bool value)
+static bool telemetry_component_name(
+    AZURE_IOT_NX_CONTEXT* nx_context, UCHAR index, CHAR** component_name_ptr, CHAR** leaf_id_ptr)
 {
-    UINT status;
-    NX_AZURE_IOT_JSON_WRITER json_writer;
-    NX_PACKET* packet_ptr;
+    *leaf_id_ptr = NX_NULL;
+
+#ifdef ENABLE_GATEWAY
+    if (index >= AZURE_IOT_TELEMETRY_RECORD_LEAF)
+    {
+        if (index - AZURE_IOT_TELEMETRY_RECORD_LEAF >= nx_context->gateway_leaf_count)
+        {
+            return false;
+        }
 
-    if ((status = reported_properties_begin(nx_context, &json_writer, &packet_ptr, component_name_ptr)) ||
+        *component_name_ptr = NX_NULL;
+        *leaf_id_ptr        = nx_context->gateway_leaves[index - AZURE_IOT_TELEMETRY_RECORD_LEAF].id;
 
-        (status = nx_azure_iot_json_writer_append_property_with_bool_value(
-             &json_writer, (const UCHAR*)property_ptr, strlen(property_ptr), value)) ||
+        return true;
+    }
+#endif
 
-        (status = reported_properties_end(nx_context, &json_writer, &packet_ptr, component_name_ptr)))
+    if (index > nx_context->azure_iot_component_count)
     {
-        printf("ERROR: azure_iot_nx_client_publish_bool_property (0x%08x)", status);
-        nx_packet_release(packet_ptr);
+        return false;
     }
 
-    return status;
+    *component_name_ptr = index == 0 ? NX_NULL : nx_context->azure_iot_components[index - 1];
+
+    return true;
 }
 
-UINT azure_nx_client_respond_int_writable_property(AZURE_IOT_NX_CONTEXT* nx_context,
+static bool telemetry_queue_record(AZURE_IOT_NX_CONTEXT* nx_context,
     CHAR* component_name_ptr,
-    CHAR* property_ptr,
-    INT value,
-    INT http_status,
-    INT version)
+    CHAR* leaf_id_ptr,
+    UINT encoding,
+    UCHAR* sample,
+    UINT length)
 {
-    UINT status;
-    NX_AZURE_IOT_JSON_WRITER json_writer;
-    NX_PACKET* packet_ptr;
+    AZURE_IOT_TELEMETRY_RECORD record;
+    ULONG unix_time = 0;
 
-    if ((status = reported_properties_begin(nx_context, &json_writer, &packet_ptr, component_name_ptr)) ||
+    if (length > AZURE_IOT_TELEMETRY_QUEUE_RECORD_SIZE ||
+        !telemetry_component_index(nx_context, component_name_ptr, leaf_id_ptr, &record.component))
+    {
+        return false;
+    }
 
-        (status = nx_azure_iot_hub_client_reported_properties_status_begin(&nx_context->iothub_client,
-             &json_writer,
-             (const UCHAR*)property_ptr,
-             strlen(property_ptr),
-             http_status,
-             version,
-             NULL,
-             0)) ||
+    if (nx_context->unix_time_get != NX_NULL)
+    {
+        nx_context->unix_time_get(&unix_time);
+    }
 
-        (status = nx_azure_iot_json_writer_append_int32(&json_writer, value)) ||
+    record.timestamp = unix_time;
+    record.length    = length;
+    record.encoding  = encoding;
 
-        (status = nx_azure_iot_hub_client_reported_properties_status_end(&nx_context->iothub_client, &json_writer)) ||
+    azure_iot_telemetry_queue_push(&nx_context->telemetry_queue, &record, sample);
 
-        (status = reported_properties_end(nx_context, &json_writer, &packet_ptr, component_name_ptr)))
-    {
-        printf("ERROR: azure_nx_client_respond_int_writable_property (0x%08x)", status);
-        nx_packet_release(packet_ptr);
-    }
+    AZURE_IOT_LOG_INFO("Telemetry message queued: %d bytes.\r\n", length);
 
-    return status;
+    return true;
 }
 
-UINT azure_iot_nx_client_publish_int_writable_property(
-    AZURE_IOT_NX_CONTEXT* nx_context, CHAR* component_ptr, CHAR* property_ptr, UINT value)
+// Hold on to the sample while disconnected, and behind any backlog so samples reach the hub in order
+static bool telemetry_store_forward(AZURE_IOT_NX_CONTEXT* nx_context,
+    CHAR* component_name_ptr,
+    CHAR* leaf_id_ptr,
+    UINT encoding,
+    UCHAR* sample,
+    UINT length)
 {
-    // Pass in a version of 1, as we a reporting the writable property, not responding to a server request
+    if (nx_context->azure_iot_connection_status == NX_SUCCESS &&
+        azure_iot_telemetry_queue_empty(&nx_context->telemetry_queue))
+    {
+        return false;
+    }
+
+    return telemetry_queue_record(nx_context, component_name_ptr, leaf_id_ptr, encoding, sample, length);
+}
+#else
+// Without the queue telemetry is sent straight away, or fails while disconnected
+static bool telemetry_store_forward(AZURE_IOT_NX_CONTEXT* nx_context,
+    CHAR* component_name_ptr,
+    CHAR* leaf_id_ptr,
+    UINT encoding,
+    UCHAR* sample,
+    UINT length)
+{
+    return false;
+}
+#endif
+
+UINT azure_iot_nx_client_publish_telemetry(AZURE_IOT_NX_CONTEXT* context_ptr,
+    CHAR* component_name_ptr,
+    UINT (*append_properties)(NX_AZURE_IOT_JSON_WRITER* json_builder_ptr))
+{
+    UINT status;
+    UINT telemetry_length = 0;
+    ULONG start_time      = telemetry_stats_now(context_ptr);
+
+    if ((status = telemetry_build(append_properties,
+             context_ptr->telemetry_buffer,
+             sizeof(context_ptr->telemetry_buffer),
+             &telemetry_length)) == NX_AZURE_IOT_SUCCESS)
+    {
+        telemetry_stats_record(context_ptr, AZURE_IOT_TELEMETRY_STAGE_BUILD, start_time);
+
+        if (telemetry_store_forward(context_ptr,
+                component_name_ptr,
+                NX_NULL,
+                AZURE_IOT_TELEMETRY_ENCODING_JSON,
+                context_ptr->telemetry_buffer,
+                telemetry_length))
+        {
+            return NX_SUCCESS;
+        }
+
+        status = telemetry_send(context_ptr,
+            component_name_ptr,
+            NX_NULL,
+            AZURE_IOT_TELEMETRY_ENCODING_JSON,
+            context_ptr->telemetry_buffer,
+            telemetry_length);
+    }
+
+    telemetry_stats_message(context_ptr, status, telemetry_length, start_time);
+
+    return status;
+}
+
+UINT azure_iot_nx_client_publish_telemetry_cbor(AZURE_IOT_NX_CONTEXT* context_ptr,
+    CHAR* component_name_ptr,
+    UINT (*append_properties)(AZURE_IOT_CBOR_WRITER* cbor_writer_ptr))
+{
+    UINT status;
+    UINT telemetry_length = 0;
+    ULONG start_time      = telemetry_stats_now(context_ptr);
+    AZURE_IOT_CBOR_WRITER cbor_writer;
+
+    if ((status = azure_iot_cbor_writer_init(
+             &cbor_writer, context_ptr->telemetry_buffer, sizeof(context_ptr->telemetry_buffer))) ||
+        (status = azure_iot_cbor_writer_append_begin_map(&cbor_writer)) ||
+        (status = append_properties(&cbor_writer)) ||
+        (status = azure_iot_cbor_writer_append_end_map(&cbor_writer)))
+    {
+        AZURE_IOT_LOG_ERROR("Error: Failed to build CBOR telemetry (0x%08x)\r\n", status);
+    }
+    else
+    {
+        telemetry_length = azure_iot_cbor_writer_get_bytes_used(&cbor_writer);
+        telemetry_stats_record(context_ptr, AZURE_IOT_TELEMETRY_STAGE_BUILD, start_time);
+
+        if (telemetry_store_forward(context_ptr,
+                component_name_ptr,
+                NX_NULL,
+                AZURE_IOT_TELEMETRY_ENCODING_CBOR,
+                context_ptr->telemetry_buffer,
+                telemetry_length))
+        {
+            return NX_SUCCESS;
+        }
+
+        status = telemetry_send(context_ptr,
+            component_name_ptr,
+            NX_NULL,
+            AZURE_IOT_TELEMETRY_ENCODING_CBOR,
+            context_ptr->telemetry_buffer,
+            telemetry_length);
+    }
+
+    telemetry_stats_message(context_ptr, status, telemetry_length, start_time);
+
+    return status;
+}
+
+#ifdef ENABLE_TELEMETRY_STATS
+VOID azure_iot_nx_client_telemetry_stats_clock_set(AZURE_IOT_NX_CONTEXT* nx_context, ULONG (*clock_us)(VOID))
+{
+    azure_iot_telemetry_stats_init(&nx_context->telemetry_stats, nx_context->telemetry_stats.pool, clock_us);
+}
+
+AZURE_IOT_TELEMETRY_STATS* azure_iot_nx_client_telemetry_stats_get(AZURE_IOT_NX_CONTEXT* nx_context)
+{
+    return &nx_context->telemetry_stats;
+}
+#endif
+
+#ifdef ENABLE_PUBLISH_QUEUE
+UINT azure_iot_nx_client_publish_telemetry_async(AZURE_IOT_NX_CONTEXT* nx_context,
+    CHAR* component_name_ptr,
+    UINT (*append_properties)(NX_AZURE_IOT_JSON_WRITER* json_writer_ptr),
+    func_ptr_publish_complete complete_cb,
+    UINT* handle_ptr)
+{
+    UINT status;
+    UCHAR payload[AZURE_IOT_PUBLISH_PAYLOAD_SIZE];
+    UINT payload_length;
+    AZURE_IOT_NX_PUBLISH_QUEUE* queue = &nx_context->publish_queue;
+    AZURE_IOT_NX_PUBLISH_REQUEST* request;
+
+    // Build outside the lock, so a slow append callback does not hold up the client thread or other callers
+    if ((status = telemetry_build(append_properties, payload, sizeof(payload), &payload_length)))
+    {
+        return status;
+    }
+
+    tx_mutex_get(&queue->mutex, TX_WAIT_FOREVER);
+
+    if (queue->count == AZURE_IOT_PUBLISH_QUEUE_DEPTH)
+    {
+        tx_mutex_put(&queue->mutex);
+        return NX_AZURE_IOT_INSUFFICIENT_BUFFER_SPACE;
+    }
+
+    // The client thread only ever reads from the head, and only requests counted in
+    request = &queue->requests[(queue->head + queue->count) % AZURE_IOT_PUBLISH_QUEUE_DEPTH];
+
+    // Handle 0 is reserved so applications can use it as "no request"
+    if (++queue->next_handle == 0)
+    {
+        queue->next_handle = 1;
+    }
+
+    memcpy(request->payload, payload, payload_length);
+    request->payload_length = payload_length;
+    request->handle         = queue->next_handle;
+    request->component_name = component_name_ptr;
+    request->complete_cb    = complete_cb;
+
+    // Hand out the handle before the request is counted in, after that it may complete and its slot be reused
+    if (handle_ptr != NX_NULL)
+    {
+        *handle_ptr = request->handle;
+    }
+
+    queue->count++;
+
+    tx_mutex_put(&queue->mutex);
+
+    tx_event_flags_set(&nx_context->events, HUB_PUBLISH_EVENT, TX_OR);
+
+    return NX_SUCCESS;
+}
+#endif
+
+#ifdef ENABLE_TELEMETRY_BATCH
+UINT azure_iot_nx_client_telemetry_batch_set(
+    AZURE_IOT_NX_CONTEXT* nx_context, UINT max_batch_bytes, UINT max_latency_seconds)
+{
+    AZURE_IOT_NX_TELEMETRY_BATCH* batch = &nx_context->telemetry_batch;
+
+    // Need room for at least the array brackets and one sample
+    if (max_batch_bytes < 3 || max_batch_bytes > sizeof(batch->buffer))
+    {
+        AZURE_IOT_LOG_ERROR(
+            "ERROR: telemetry batch size must be between 3 and %d bytes\r\n", AZURE_IOT_TELEMETRY_BATCH_SIZE);
+        return NX_SIZE_ERROR;
+    }
+
+    batch->max_bytes         = max_batch_bytes;
+    batch->max_latency_ticks = max_latency_seconds * TX_TIMER_TICKS_PER_SECOND;
+
+    return NX_SUCCESS;
+}
+
+UINT azure_iot_nx_client_telemetry_flush(AZURE_IOT_NX_CONTEXT* nx_context)
+{
+    UINT status;
+    AZURE_IOT_NX_TELEMETRY_BATCH* batch = &nx_context->telemetry_batch;
+
+    if (batch->sample_count == 0)
+    {
+        return NX_SUCCESS;
+    }
+
+    // Close the JSON array, space for this is reserved on enqueue
+    batch->buffer[batch->buffer_length++] = ']';
+
+    AZURE_IOT_LOG_INFO("Flushing %d telemetry samples (%d bytes)\r\n", batch->sample_count, batch->buffer_length);
+
+    if ((status = telemetry_send(nx_context,
+             batch->component_name,
+             NX_NULL,
+             AZURE_IOT_TELEMETRY_ENCODING_JSON,
+             batch->buffer,
+             batch->buffer_length)))
+    {
+        // Keep the samples for the next flush, which closes the array again
+        batch->buffer_length--;
+
+        AZURE_IOT_LOG_ERROR(
+            "ERROR: kept %d batched telemetry samples for retry (0x%08x)\r\n", batch->sample_count, status);
+        return status;
+    }
+
+    batch->buffer_length = 0;
+    batch->sample_count  = 0;
+
+    return status;
+}
+
+static UINT telemetry_batch_append(
+    AZURE_IOT_NX_CONTEXT* nx_context, CHAR* component_name_ptr, UCHAR* sample, UINT telemetry_length)
+{
+    UINT status;
+    AZURE_IOT_NX_TELEMETRY_BATCH* batch = &nx_context->telemetry_batch;
+
+    // A sample larger than the batch can never be packed, so send it directly
+    if (telemetry_length + 2 > batch->max_bytes)
+    {
+        return telemetry_send(
+            nx_context, component_name_ptr, NX_NULL, AZURE_IOT_TELEMETRY_ENCODING_JSON, sample, telemetry_length);
+    }
+
+    // A batch is published to a single component, so flush if the component changes or the sample doesn't fit.
+    // If the batch cannot be sent it is held for a retry and the sample is left to the caller.
+    if (batch->sample_count > 0 &&
+        (batch->component_name != component_name_ptr ||
+            batch->buffer_length + 1 + telemetry_length + 1 > batch->max_bytes) &&
+        (status = azure_iot_nx_client_telemetry_flush(nx_context)))
+    {
+        return status;
+    }
+
+    if (batch->sample_count == 0)
+    {
+        batch->buffer[0]          = '[';
+        batch->buffer_length      = 1;
+        batch->component_name     = component_name_ptr;
+        batch->first_sample_ticks = tx_time_get();
+    }
+    else
+    {
+        batch->buffer[batch->buffer_length++] = ',';
+    }
+
+    memcpy(&batch->buffer[batch->buffer_length], sample, telemetry_length);
+    batch->buffer_length += telemetry_length;
+    batch->sample_count++;
+
+    // Flush now if there isn't room for another separator and closing bracket, the sample is in the batch
+    // either way as a failed flush keeps it
+    if (batch->buffer_length + 2 >= batch->max_bytes)
+    {
+        azure_iot_nx_client_telemetry_flush(nx_context);
+    }
+
+    return NX_SUCCESS;
+}
+
+UINT azure_iot_nx_client_telemetry_enqueue(AZURE_IOT_NX_CONTEXT* nx_context,
+    CHAR* component_name_ptr,
+    UINT (*append_properties)(NX_AZURE_IOT_JSON_WRITER* json_writer_ptr))
+{
+    UINT status;
+    UINT telemetry_length;
+
+    if ((status = telemetry_build(append_properties,
+             nx_context->telemetry_buffer,
+             sizeof(nx_context->telemetry_buffer),
+             &telemetry_length)))
+    {
+        return status;
+    }
+
+    if (telemetry_store_forward(nx_context,
+            component_name_ptr,
+            NX_NULL,
+            AZURE_IOT_TELEMETRY_ENCODING_JSON,
+            nx_context->telemetry_buffer,
+            telemetry_length))
+    {
+        return NX_SUCCESS;
+    }
+
+    status = telemetry_batch_append(nx_context, component_name_ptr, nx_context->telemetry_buffer, telemetry_length);
+
+#ifdef ENABLE_TELEMETRY_QUEUE
+    // The batch is held after a failed flush, wait behind it in the offline queue
+    if (status && telemetry_queue_record(nx_context,
+                      component_name_ptr,
+                      NX_NULL,
+                      AZURE_IOT_TELEMETRY_ENCODING_JSON,
+                      nx_context->telemetry_buffer,
+                      telemetry_length))
+    {
+        return NX_SUCCESS;
+    }
+#endif
+
+    return status;
+}
+#endif
+
+#ifdef ENABLE_TELEMETRY_QUEUE
+UINT azure_iot_nx_client_telemetry_spill_set(AZURE_IOT_NX_CONTEXT* nx_context, const AZURE_IOT_TELEMETRY_SPILL* spill)
+{
+    if (spill == NX_NULL || spill->push == NX_NULL || spill->peek == NX_NULL || spill->pop == NX_NULL)
+    {
+        AZURE_IOT_LOG_ERROR("ERROR: azure_iot_nx_client_telemetry_spill_set spill is incomplete\r\n");
+        return NX_PTR_ERROR;
+    }
+
+    azure_iot_telemetry_queue_spill_set(&nx_context->telemetry_queue, spill);
+
+    return NX_SUCCESS;
+}
+
+const AZURE_IOT_TELEMETRY_QUEUE* azure_iot_nx_client_telemetry_queue_get(AZURE_IOT_NX_CONTEXT* nx_context)
+{
+    return &nx_context->telemetry_queue;
+}
+#endif
+
+#ifdef ENABLE_PROPERTY_CACHE
+const AZURE_IOT_PROPERTY_CACHE* azure_iot_nx_client_property_cache_get(AZURE_IOT_NX_CONTEXT* nx_context)
+{
+    return &nx_context->property_cache;
+}
+#endif
+
+static UINT reported_properties_begin(AZURE_IOT_NX_CONTEXT* context_ptr,
+    NX_AZURE_IOT_JSON_WRITER* json_writer,
+    NX_PACKET** packet_ptr,
+    CHAR* component_name_ptr)
+{
+    UINT status;
+
+    if ((status = nx_azure_iot_hub_client_reported_properties_create(
+             &context_ptr->iothub_client, packet_ptr, AZURE_IOT_PUBLISH_TIMEOUT_TICKS)))
+    {
+        AZURE_IOT_LOG_ERROR("Error: Failed create reported properties (0x%08x)\r\n", status);
+    }
+
+    else if ((status = nx_azure_iot_json_writer_init(json_writer, *packet_ptr, AZURE_IOT_PUBLISH_TIMEOUT_TICKS)))
+    {
+        AZURE_IOT_LOG_ERROR("Error: Failed to initialize json writer (0x%08x)\r\n", status);
+    }
+
+    else if ((status = nx_azure_iot_json_writer_append_begin_object(json_writer)))
+    {
+        AZURE_IOT_LOG_ERROR("Error: Failed to append object begin (0x%08x)\r\n", status);
+    }
+
+    else if (component_name_ptr != NX_NULL &&
+             (status = nx_azure_iot_hub_client_reported_properties_component_begin(
+                  &context_ptr->iothub_client, json_writer, (UCHAR*)component_name_ptr, strlen(component_name_ptr))))
+    {
+        AZURE_IOT_LOG_ERROR("Error: Failed to append component begin (0x%08x)\r\n", status);
+    }
+
+    return status;
+}
+
+static UINT reported_properties_end(AZURE_IOT_NX_CONTEXT* nx_context,
+    NX_AZURE_IOT_JSON_WRITER* json_writer,
+    NX_PACKET** packet_ptr,
+    CHAR* component_name_ptr,
+    ULONG* version_ptr)
+{
+    UINT status;
+    UINT response_status = 0;
+
+    if ((component_name_ptr != NX_NULL && (status = nx_azure_iot_hub_client_reported_properties_component_end(
+                                               &nx_context->iothub_client, json_writer))))
+    {
+        AZURE_IOT_LOG_ERROR("Error: Failed to append component end (0x%08x)\r\n", status);
+        return status;
+    }
+
+    if ((status = nx_azure_iot_json_writer_append_end_object(json_writer)))
+    {
+        AZURE_IOT_LOG_ERROR("Error: Failed to append object end (0x%08x)\r\n", status);
+        return status;
+    }
+
+    printf_packet("Sending property: ", *packet_ptr);
+
+    if ((status = nx_azure_iot_hub_client_reported_properties_send(
+             &nx_context->iothub_client, *packet_ptr, NX_NULL, &response_status, version_ptr, AZURE_IOT_PUBLISH_TIMEOUT_TICKS)))
+    {
+        AZURE_IOT_LOG_ERROR("Error: nx_azure_iot_hub_client_reported_properties_send failed (0x%08x)\r\n", status);
+        return status;
+    }
+
+    // The send consumed the packet whatever the hub answered
+    *packet_ptr = NX_NULL;
+
+    if ((response_status < 200) || (response_status >= 300))
+    {
+        AZURE_IOT_LOG_ERROR("Error: Property sent response status failed (%d)\r\n", response_status);
+        return NX_NOT_SUCCESSFUL;
+    }
+
+    return NX_SUCCESS;
+}
+
+#ifdef ENABLE_PROPERTY_CACHE
+// Hash of the group members written to the PATCH from offset on, what the hub is sent rather than what was staged
+static ULONG group_sent_hash(const AZURE_IOT_PROPERTY* property, NX_PACKET* packet_ptr, ULONG offset)
+{
+    ULONG hash = azure_iot_property_cache_hash(property, NX_NULL, 0);
+    UCHAR chunk[32];
+    ULONG copied;
+
+    // The comma the writer puts between the group and what came before it is not a member
+    if (nx_packet_data_extract_offset(packet_ptr, offset, chunk, 1, &copied) == NX_SUCCESS && copied == 1 &&
+        chunk[0] == ',')
+    {
+        offset++;
+    }
+
+    while (offset < packet_ptr->nx_packet_length &&
+           nx_packet_data_extract_offset(packet_ptr, offset, chunk, sizeof(chunk), &copied) == NX_SUCCESS &&
+           copied > 0)
+    {
+        hash = azure_iot_property_cache_hash_append(hash, chunk, copied);
+        offset += copied;
+    }
+
+    return hash;
+}
+#endif
+
+// Run the callback of a group, hashing the members it wrote when hash_ptr is set
+static UINT group_append(NX_AZURE_IOT_JSON_WRITER* json_writer,
+    const AZURE_IOT_PROPERTY* property,
+    NX_PACKET* packet_ptr,
+    ULONG* hash_ptr)
+{
+#ifdef ENABLE_PROPERTY_CACHE
+    ULONG offset = packet_ptr->nx_packet_length;
+#endif
+    UINT status;
+
+    if ((status = property->value.append_properties(json_writer)))
+    {
+        return status;
+    }
+
+#ifdef ENABLE_PROPERTY_CACHE
+    if (hash_ptr != NX_NULL)
+    {
+        *hash_ptr = group_sent_hash(property, packet_ptr, offset);
+    }
+#endif
+
+    return NX_SUCCESS;
+}
+
+static UINT reported_property_append(AZURE_IOT_NX_CONTEXT* nx_context,
+    NX_AZURE_IOT_JSON_WRITER* json_writer,
+    const AZURE_IOT_PROPERTY* property,
+    NX_PACKET* packet_ptr,
+    ULONG* hash_ptr)
+{
+    UINT status;
+
+    if (property->type == AZURE_IOT_PROPERTY_TYPE_GROUP && property->name == NX_NULL)
+    {
+        return group_append(json_writer, property, packet_ptr, hash_ptr);
+    }
+
+    if (property->type == AZURE_IOT_PROPERTY_TYPE_GROUP)
+    {
+        if ((status = nx_azure_iot_json_writer_append_property_name(
+                 json_writer, (const UCHAR*)property->name, strlen(property->name))) ||
+            (status = nx_azure_iot_json_writer_append_begin_object(json_writer)) ||
+            (status = group_append(json_writer, property, packet_ptr, hash_ptr)))
+        {
+            return status;
+        }
+
+        return nx_azure_iot_json_writer_append_end_object(json_writer);
+    }
+
+    if (property->ack_status != 0 &&
+        (status = nx_azure_iot_hub_client_reported_properties_status_begin(&nx_context->iothub_client,
+             json_writer,
+             (const UCHAR*)property->name,
+             strlen(property->name),
+             property->ack_status,
+             property->ack_version,
+             NULL,
+             0)))
+    {
+        return status;
+    }
+
+    if (property->ack_status == 0 &&
+        (status = nx_azure_iot_json_writer_append_property_name(
+             json_writer, (const UCHAR*)property->name, strlen(property->name))))
+    {
+        return status;
+    }
+
+    if (property->type == AZURE_IOT_PROPERTY_TYPE_BOOL)
+    {
+        status = nx_azure_iot_json_writer_append_bool(json_writer, property->value.boolean);
+    }
+    else
+    {
+        status = nx_azure_iot_json_writer_append_int32(json_writer, property->value.integer);
+    }
+
+    if (status == NX_SUCCESS && property->ack_status != 0)
+    {
+        status = nx_azure_iot_hub_client_reported_properties_status_end(&nx_context->iothub_client, json_writer);
+    }
+
+    return status;
+}
+
+// Send properties of one component in a single PATCH, returning the twin version of the update. When
+// group_hashes is set it gets the hash of the members sent for each group, at the index of the group.
+static UINT reported_properties_send(AZURE_IOT_NX_CONTEXT* nx_context,
+    CHAR* component_name_ptr,
+    const AZURE_IOT_PROPERTY** properties,
+    UINT count,
+    ULONG* version_ptr,
+    ULONG* group_hashes)
+{
+    UINT status;
+    UINT index;
+    NX_PACKET* packet_ptr = NX_NULL;
+    NX_AZURE_IOT_JSON_WRITER json_writer;
+
+    status = reported_properties_begin(nx_context, &json_writer, &packet_ptr, component_name_ptr);
+
+    for (index = 0; index < count && status == NX_SUCCESS; index++)
+    {
+        status = reported_property_append(nx_context,
+            &json_writer,
+            properties[index],
+            packet_ptr,
+            group_hashes != NX_NULL ? &group_hashes[index] : NX_NULL);
+    }
+
+    if (status || (status = reported_properties_end(
+                       nx_context, &json_writer, &packet_ptr, component_name_ptr, version_ptr)))
+    {
+        AZURE_IOT_LOG_ERROR("ERROR: failed to send reported properties (0x%08x)\r\n", status);
+
+        // Still ours unless the create failed or the send took it
+        if (packet_ptr != NX_NULL)
+        {
+            nx_packet_release(packet_ptr);
+        }
+    }
+
+    return status;
+}
+
+// Keep the latest value for process_reported_properties, json is the serialized value of a group
+static UINT reported_property_stage(
+    AZURE_IOT_NX_CONTEXT* nx_context, const AZURE_IOT_PROPERTY* property, const UCHAR* json, UINT json_length)
+{
+    ULONG version;
+#ifdef ENABLE_PROPERTY_CACHE
+    ULONG hash;
+    bool force = property->type == AZURE_IOT_PROPERTY_TYPE_GROUP && json == NX_NULL;
+
+    // Only the members between the braces, they are what group_sent_hash sees in the PATCH
+    if (json != NX_NULL)
+    {
+        hash = azure_iot_property_cache_hash(property, json + 1, json_length - 2);
+    }
+    else
+    {
+        hash = azure_iot_property_cache_hash(property, NX_NULL, 0);
+    }
+
+    if (azure_iot_property_cache_update(&nx_context->property_cache, property, hash, force) == NX_SUCCESS)
+    {
+        return NX_SUCCESS;
+    }
+#endif
+
+    // No room to track it, or no cache, send it on its own
+    return reported_properties_send(nx_context, property->component_name, &property, 1, &version, NX_NULL);
+}
+
+UINT azure_iot_nx_client_publish_properties(AZURE_IOT_NX_CONTEXT* nx_context,
+    CHAR* component_name_ptr,
+    UINT (*append_properties)(NX_AZURE_IOT_JSON_WRITER* json_writer_ptr))
+{
+    AZURE_IOT_PROPERTY property = {0};
+    UCHAR* json                 = NX_NULL;
+    UINT json_length            = 0;
+
+    property.component_name          = component_name_ptr;
+    property.type                    = AZURE_IOT_PROPERTY_TYPE_GROUP;
+    property.value.append_properties = append_properties;
+
+#ifdef ENABLE_PROPERTY_CACHE
+    // Serialize the group to compare it with the last report, a group too large is always sent
+    json = nx_context->property_cache.group_buffer;
+    if (telemetry_build(append_properties, json, AZURE_IOT_PROPERTY_CACHE_GROUP_SIZE, &json_length))
+    {
+        json = NX_NULL;
+    }
+#endif
+
+    return reported_property_stage(nx_context, &property, json, json_length);
+}
+
+UINT azure_iot_nx_client_publish_bool_property(
+    AZURE_IOT_NX_CONTEXT* nx_context, CHAR* component_name_ptr, CHAR* property_ptr, bool value)
+{
+    AZURE_IOT_PROPERTY property = {0};
+
+    property.component_name = component_name_ptr;
+    property.name           = property_ptr;
+    property.type           = AZURE_IOT_PROPERTY_TYPE_BOOL;
+    property.value.boolean  = value;
+
+    return reported_property_stage(nx_context, &property, NX_NULL, 0);
+}
+
+UINT azure_nx_client_respond_int_writable_property(AZURE_IOT_NX_CONTEXT* nx_context,
+    CHAR* component_name_ptr,
+    CHAR* property_ptr,
+    INT value,
+    INT http_status,
+    INT version)
+{
+    AZURE_IOT_PROPERTY property = {0};
+
+    property.component_name = component_name_ptr;
+    property.name           = property_ptr;
+    property.type           = AZURE_IOT_PROPERTY_TYPE_INT32;
+    property.value.integer  = value;
+    property.ack_status     = http_status;
+    property.ack_version    = version;
+
+    return reported_property_stage(nx_context, &property, NX_NULL, 0);
+}
+
+UINT azure_iot_nx_client_publish_int_writable_property(
+    AZURE_IOT_NX_CONTEXT* nx_context, CHAR* component_ptr, CHAR* property_ptr, UINT value)
+{
+    // Pass in a version of 1, as we a reporting the writable property, not responding to a server request
     return azure_nx_client_respond_int_writable_property(nx_context, component_ptr, property_ptr, value, 200, 1);
 }
 
+#ifdef ENABLE_GATEWAY
+static VOID gateway_leaf_sent(AZURE_IOT_GATEWAY_LEAF* leaf)
+{
+    leaf->sent++;
+    leaf->last_sent_ticks = tx_time_get();
+}
+
+UINT azure_iot_nx_client_gateway_leaf_add(AZURE_IOT_NX_CONTEXT* nx_context, CHAR* leaf_id, UINT* leaf_index)
+{
+    AZURE_IOT_GATEWAY_LEAF* leaf;
+    UINT leaf_id_length;
+    UINT index;
+
+    if (leaf_id == NX_NULL || leaf_index == NX_NULL)
+    {
+        AZURE_IOT_LOG_ERROR("ERROR: azure_iot_nx_client_gateway_leaf_add leaf_id or leaf_index is NULL\r\n");
+        return NX_PTR_ERROR;
+    }
+
+    if ((leaf_id_length = strlen(leaf_id)) >= AZURE_IOT_DEVICE_ID_SIZE)
+    {
+        AZURE_IOT_LOG_ERROR("ERROR: gateway leaf id %s is too long\r\n", leaf_id);
+        return NX_INVALID_PARAMETERS;
+    }
+
+    for (index = 0; index < nx_context->gateway_leaf_count; index++)
+    {
+        if (strcmp(nx_context->gateway_leaves[index].id, leaf_id) == 0)
+        {
+            *leaf_index = index;
+            return NX_SUCCESS;
+        }
+    }
+
+    if (nx_context->gateway_leaf_count >= AZURE_IOT_GATEWAY_LEAF_COUNT)
+    {
+        AZURE_IOT_LOG_ERROR("ERROR: gateway leaf table is full, %s not added\r\n", leaf_id);
+        return NX_AZURE_IOT_INSUFFICIENT_BUFFER_SPACE;
+    }
+
+    leaf = &nx_context->gateway_leaves[nx_context->gateway_leaf_count];
+    memset(leaf, 0, sizeof(AZURE_IOT_GATEWAY_LEAF));
+    memcpy(leaf->id, leaf_id, leaf_id_length + 1);
+
+    *leaf_index = nx_context->gateway_leaf_count++;
+
+    AZURE_IOT_LOG_INFO("Gateway leaf %s added\r\n", leaf_id);
+
+    return NX_SUCCESS;
+}
+
+UINT azure_iot_nx_client_gateway_publish_telemetry(AZURE_IOT_NX_CONTEXT* nx_context,
+    UINT leaf_index,
+    UINT (*append_properties)(NX_AZURE_IOT_JSON_WRITER* json_writer_ptr))
+{
+    AZURE_IOT_GATEWAY_LEAF* leaf;
+    UINT telemetry_length;
+    UINT status;
+
+    if (leaf_index >= nx_context->gateway_leaf_count)
+    {
+        return NX_INVALID_PARAMETERS;
+    }
+
+    leaf = &nx_context->gateway_leaves[leaf_index];
+
+    if ((status = telemetry_build(append_properties,
+             nx_context->telemetry_buffer,
+             sizeof(nx_context->telemetry_buffer),
+             &telemetry_length)))
+    {
+        leaf->failed++;
+        return status;
+    }
+
+    if (telemetry_store_forward(nx_context,
+            NX_NULL,
+            leaf->id,
+            AZURE_IOT_TELEMETRY_ENCODING_JSON,
+            nx_context->telemetry_buffer,
+            telemetry_length))
+    {
+        leaf->queued++;
+        return NX_SUCCESS;
+    }
+
+    if ((status = telemetry_send(nx_context,
+             NX_NULL,
+             leaf->id,
+             AZURE_IOT_TELEMETRY_ENCODING_JSON,
+             nx_context->telemetry_buffer,
+             telemetry_length)))
+    {
+        leaf->failed++;
+        return status;
+    }
+
+    gateway_leaf_sent(leaf);
+
+    return NX_SUCCESS;
+}
+
+UINT azure_iot_nx_client_gateway_publish_properties(AZURE_IOT_NX_CONTEXT* nx_context,
+    UINT leaf_index,
+    UINT (*append_properties)(NX_AZURE_IOT_JSON_WRITER* json_writer_ptr))
+{
+    AZURE_IOT_PROPERTY property = {0};
+    UCHAR* json                 = NX_NULL;
+    UINT json_length            = 0;
+
+    if (leaf_index >= nx_context->gateway_leaf_count)
+    {
+        return NX_INVALID_PARAMETERS;
+    }
+
+    // Reported as an object named by the leaf id in the twin of the gateway
+    property.name                    = nx_context->gateway_leaves[leaf_index].id;
+    property.type                    = AZURE_IOT_PROPERTY_TYPE_GROUP;
+    property.value.append_properties = append_properties;
+
+#ifdef ENABLE_PROPERTY_CACHE
+    json = nx_context->property_cache.group_buffer;
+    if (telemetry_build(append_properties, json, AZURE_IOT_PROPERTY_CACHE_GROUP_SIZE, &json_length))
+    {
+        json = NX_NULL;
+    }
+#endif
+
+    return reported_property_stage(nx_context, &property, json, json_length);
+}
+
+const AZURE_IOT_GATEWAY_LEAF* azure_iot_nx_client_gateway_leaf_get(AZURE_IOT_NX_CONTEXT* nx_context, UINT leaf_index)
+{
+    if (leaf_index >= nx_context->gateway_leaf_count)
+    {
+        return NX_NULL;
+    }
+
+    return &nx_context->gateway_leaves[leaf_index];
+}
+#endif
+
 UINT azure_iot_nx_client_register_command_callback(AZURE_IOT_NX_CONTEXT* nx_context, func_ptr_command_received callback)
 {
     if (nx_context == NULL || nx_context->command_received_cb != NULL)
@@ -943,6 +2119,18 @@ UINT azure_iot_nx_client_register_timer_callback(
     return NX_SUCCESS;
 }
 
+UINT azure_iot_nx_client_register_dispatch_table(
+    AZURE_IOT_NX_CONTEXT* nx_context, const AZURE_IOT_DISPATCH_TABLE* table)
+{
+    if (nx_context == NULL || table == NULL || nx_context->dispatch_table != NULL)
+    {
+        return NX_PTR_ERROR;
+    }
+
+    nx_context->dispatch_table = table;
+    return NX_SUCCESS;
+}
+
 UINT azure_iot_nx_client_add_component(AZURE_IOT_NX_CONTEXT* nx_context, CHAR* component_name)
 {
     if (nx_context == NULL || component_name == NULL)
@@ -964,7 +2152,7 @@ UINT azure_iot_nx_client_sas_set(AZURE_IOT_NX_CONTEXT* context, CHAR* device_sas
 {
     if (device_sas_key[0] == 0)
     {
-        printf("Error: azure_iot_nx_client_sas_set device_sas_key is null\r\n");
+        AZURE_IOT_LOG_ERROR("Error: azure_iot_nx_client_sas_set device_sas_key is null\r\n");
         return NX_PTR_ERROR;
     }
 
@@ -985,7 +2173,7 @@ UINT azure_iot_nx_client_cert_set(AZURE_IOT_NX_CONTEXT* nx_context,
 
     if (device_x509_cert_len == 0 || device_x509_key_len == 0)
     {
-        printf("ERROR: azure_iot_nx_client_cert_set cert/key is null\r\n");
+        AZURE_IOT_LOG_ERROR("ERROR: azure_iot_nx_client_cert_set cert/key is null\r\n");
         return NX_PTR_ERROR;
     }
 
@@ -1001,9 +2189,22 @@ UINT azure_iot_nx_client_cert_set(AZURE_IOT_NX_CONTEXT* nx_context,
              (USHORT)device_x509_key_len,
              NX_SECURE_X509_KEY_TYPE_RSA_PKCS1_DER)))
     {
-        printf("ERROR: nx_secure_x509_certificate_initialize (0x%08x)\r\n", status);
+        AZURE_IOT_LOG_ERROR("ERROR: nx_secure_x509_certificate_initialize (0x%08x)\r\n", status);
+    }
+
+    return NX_SUCCESS;
+}
+
+UINT azure_iot_nx_client_store_set(AZURE_IOT_NX_CONTEXT* context, const AZURE_IOT_STORE* store)
+{
+    if (store == NX_NULL || store->read == NX_NULL || store->write == NX_NULL || store->erase == NX_NULL)
+    {
+        AZURE_IOT_LOG_ERROR("ERROR: azure_iot_nx_client_store_set store is incomplete\r\n");
+        return NX_PTR_ERROR;
     }
 
+    context->azure_iot_store = store;
+
     return NX_SUCCESS;
 }
 
@@ -1019,7 +2220,7 @@ UINT azure_iot_nx_client_create(AZURE_IOT_NX_CONTEXT* nx_context,
 
     if (iot_model_id_len == 0)
     {
-        printf("ERROR: azure_iot_nx_client_create_new empty model_id\r\n");
+        AZURE_IOT_LOG_ERROR("ERROR: azure_iot_nx_client_create_new empty model_id\r\n");
         return NX_PTR_ERROR;
     }
 
@@ -1031,6 +2232,25 @@ UINT azure_iot_nx_client_create(AZURE_IOT_NX_CONTEXT* nx_context,
     nx_context->azure_iot_nx_ip             = nx_ip;
     nx_context->azure_iot_model_id          = iot_model_id;
     nx_context->azure_iot_model_id_len      = iot_model_id_len;
+    nx_context->unix_time_get               = unix_time_callback;
+
+#ifdef ENABLE_TELEMETRY_QUEUE
+    azure_iot_telemetry_queue_init(&nx_context->telemetry_queue);
+#endif
+
+#ifdef ENABLE_PROPERTY_CACHE
+    azure_iot_property_cache_init(&nx_context->property_cache);
+#endif
+
+#ifdef ENABLE_TELEMETRY_BATCH
+    // Default the telemetry batch to the full buffer
+    nx_context->telemetry_batch.max_bytes         = AZURE_IOT_TELEMETRY_BATCH_SIZE;
+    nx_context->telemetry_batch.max_latency_ticks = AZURE_IOT_TELEMETRY_BATCH_LATENCY_SEC * TX_TIMER_TICKS_PER_SECOND;
+#endif
+
+#ifdef ENABLE_TELEMETRY_STATS
+    azure_iot_telemetry_stats_init(&nx_context->telemetry_stats, nx_pool, NX_NULL);
+#endif
 
     // Initialize CA root certificates
     if ((status = nx_secure_x509_certificate_initialize(&nx_context->root_ca_cert,
@@ -1042,7 +2262,7 @@ UINT azure_iot_nx_client_create(AZURE_IOT_NX_CONTEXT* nx_context,
              0,
              NX_SECURE_X509_KEY_TYPE_NONE)))
     {
-        printf("ERROR: nx_secure_x509_certificate_initialize (0x%08x)\r\n", status);
+        AZURE_IOT_LOG_ERROR("ERROR: nx_secure_x509_certificate_initialize (0x%08x)\r\n", status);
     }
 
     else if ((status = nx_secure_x509_certificate_initialize(&nx_context->root_ca_cert_2,
@@ -1054,7 +2274,7 @@ UINT azure_iot_nx_client_create(AZURE_IOT_NX_CONTEXT* nx_context,
                   0,
                   NX_SECURE_X509_KEY_TYPE_NONE)))
     {
-        printf("ERROR: nx_secure_x509_certificate_initialize (0x%08x)\r\n", status);
+        AZURE_IOT_LOG_ERROR("ERROR: nx_secure_x509_certificate_initialize (0x%08x)\r\n", status);
     }
 
     else if ((status = nx_secure_x509_certificate_initialize(&nx_context->root_ca_cert_3,
@@ -1066,12 +2286,12 @@ UINT azure_iot_nx_client_create(AZURE_IOT_NX_CONTEXT* nx_context,
                   0,
                   NX_SECURE_X509_KEY_TYPE_NONE)))
     {
-        printf("ERROR: nx_secure_x509_certificate_initialize (0x%08x)\r\n", status);
+        AZURE_IOT_LOG_ERROR("ERROR: nx_secure_x509_certificate_initialize (0x%08x)\r\n", status);
     }
 
     if ((status = tx_event_flags_create(&nx_context->events, "nx_client")))
     {
-        printf("ERROR: tx_event_flags_creates (0x%08x)\r\n", status);
+        AZURE_IOT_LOG_ERROR("ERROR: tx_event_flags_creates (0x%08x)\r\n", status);
     }
 
     else if ((status = tx_timer_create(&nx_context->periodic_timer,
@@ -1082,7 +2302,7 @@ UINT azure_iot_nx_client_create(AZURE_IOT_NX_CONTEXT* nx_context,
                   60 * NX_IP_PERIODIC_RATE,
                   TX_NO_ACTIVATE)))
     {
-        printf("ERROR: tx_timer_create (0x%08x)\r\n", status);
+        AZURE_IOT_LOG_ERROR("ERROR: tx_timer_create (0x%08x)\r\n", status);
         tx_event_flags_delete(&nx_context->events);
     }
 
@@ -1097,14 +2317,260 @@ UINT azure_iot_nx_client_create(AZURE_IOT_NX_CONTEXT* nx_context,
                   NX_AZURE_IOT_THREAD_PRIORITY,
                   unix_time_callback)))
     {
-        printf("ERROR: failed on nx_azure_iot_create (0x%08x)\r\n", status);
+        AZURE_IOT_LOG_ERROR("ERROR: failed on nx_azure_iot_create (0x%08x)\r\n", status);
+        tx_event_flags_delete(&nx_context->events);
+        tx_timer_delete(&nx_context->periodic_timer);
+    }
+
+#ifdef ENABLE_PUBLISH_QUEUE
+    else if ((status = tx_mutex_create(&nx_context->publish_queue.mutex, "publish_queue", TX_INHERIT)))
+    {
+        AZURE_IOT_LOG_ERROR("ERROR: tx_mutex_create (0x%08x)\r\n", status);
+        nx_azure_iot_delete(&nx_context->nx_azure_iot);
         tx_event_flags_delete(&nx_context->events);
         tx_timer_delete(&nx_context->periodic_timer);
     }
+#endif
 
     return status;
 }
 
+#ifdef ENABLE_PUBLISH_QUEUE
+static VOID process_publish_queue(AZURE_IOT_NX_CONTEXT* nx_context)
+{
+    UINT status;
+    NX_PACKET* packet_ptr;
+    AZURE_IOT_NX_PUBLISH_QUEUE* queue = &nx_context->publish_queue;
+    AZURE_IOT_NX_PUBLISH_REQUEST* request;
+
+    while (queue->count > 0 && nx_context->azure_iot_connection_status == NX_SUCCESS)
+    {
+        request = &queue->requests[queue->head];
+
+        // Leave the request queued if the packet pool is exhausted, it is retried on the next loop
+        if (telemetry_message_create(nx_context,
+                request->component_name,
+                NX_NULL,
+                AZURE_IOT_TELEMETRY_ENCODING_JSON,
+                0,
+                &packet_ptr,
+                NX_NO_WAIT))
+        {
+            break;
+        }
+
+        if ((status = nx_azure_iot_hub_client_telemetry_send(&nx_context->iothub_client,
+                 packet_ptr,
+                 request->payload,
+                 request->payload_length,
+                 NX_NO_WAIT)))
+        {
+            AZURE_IOT_LOG_ERROR("Error: Telemetry message send failed (0x%08x)\r\n", status);
+            nx_azure_iot_hub_client_telemetry_message_delete(packet_ptr);
+        }
+        else
+        {
+            AZURE_IOT_LOG_INFO("Telemetry message sent: %d bytes.\r\n", request->payload_length);
+            AZURE_IOT_LOG_DEBUG("\tPayload: %.*s\r\n", request->payload_length, request->payload);
+        }
+
+        if (request->complete_cb)
+        {
+            request->complete_cb(nx_context, request->handle, status);
+        }
+
+        tx_mutex_get(&queue->mutex, TX_WAIT_FOREVER);
+        queue->head = (queue->head + 1) % AZURE_IOT_PUBLISH_QUEUE_DEPTH;
+        queue->count--;
+        tx_mutex_put(&queue->mutex);
+    }
+}
+#endif
+
+#ifdef ENABLE_TELEMETRY_BATCH
+static VOID process_telemetry_batch(AZURE_IOT_NX_CONTEXT* nx_context)
+{
+    AZURE_IOT_NX_TELEMETRY_BATCH* batch = &nx_context->telemetry_batch;
+
+    // Hold samples while disconnected, they are flushed on size once the batch fills up
+    if (batch->sample_count == 0 || nx_context->azure_iot_connection_status != NX_SUCCESS)
+    {
+        return;
+    }
+
+    if ((tx_time_get() - batch->first_sample_ticks) >= batch->max_latency_ticks)
+    {
+        azure_iot_nx_client_telemetry_flush(nx_context);
+    }
+}
+#endif
+
+#ifdef ENABLE_TELEMETRY_QUEUE
+static VOID process_telemetry_queue(AZURE_IOT_NX_CONTEXT* nx_context)
+{
+    AZURE_IOT_TELEMETRY_QUEUE* queue = &nx_context->telemetry_queue;
+    AZURE_IOT_TELEMETRY_RECORD record;
+    CHAR* component_name;
+    CHAR* leaf_id;
+    UINT count;
+
+    if (nx_context->azure_iot_connection_status != NX_SUCCESS || azure_iot_telemetry_queue_empty(queue))
+    {
+        return;
+    }
+
+    // Pace the backlog so a long outage does not flood the hub and the packet pool on reconnect
+    if ((tx_time_get() - nx_context->telemetry_queue_drain_ticks) < TX_TIMER_TICKS_PER_SECOND)
+    {
+        return;
+    }
+
+    nx_context->telemetry_queue_drain_ticks = tx_time_get();
+
+#ifdef ENABLE_TELEMETRY_BATCH
+    // Batched samples were published before anything in the queue
+    if (azure_iot_nx_client_telemetry_flush(nx_context))
+    {
+        return;
+    }
+#endif
+
+    // A message carries one creation time, so each record is sent on its own with the time it was captured
+    for (count = 0; count < AZURE_IOT_TELEMETRY_QUEUE_DRAIN_RATE; count++)
+    {
+        if (azure_iot_telemetry_queue_peek(queue, &record, nx_context->telemetry_buffer))
+        {
+            break;
+        }
+
+        if (!telemetry_component_name(nx_context, record.component, &component_name, &leaf_id))
+        {
+            AZURE_IOT_LOG_ERROR("ERROR: dropping queued telemetry of unknown component\r\n");
+        }
+        else if (telemetry_send_at(nx_context,
+                     component_name,
+                     leaf_id,
+                     record.encoding,
+                     record.timestamp,
+                     nx_context->telemetry_buffer,
+                     record.length))
+        {
+            // The record stays at the head of the queue for a retry
+            break;
+        }
+#ifdef ENABLE_GATEWAY
+        else if (leaf_id != NX_NULL)
+        {
+            gateway_leaf_sent(&nx_context->gateway_leaves[record.component - AZURE_IOT_TELEMETRY_RECORD_LEAF]);
+        }
+#endif
+
+        azure_iot_telemetry_queue_pop(queue);
+    }
+
+    if (azure_iot_telemetry_queue_empty(queue))
+    {
+        AZURE_IOT_LOG_INFO("Telemetry queue drained: %lu queued, %lu sent, %lu dropped\r\n",
+            queue->queued,
+            queue->drained,
+            queue->dropped);
+    }
+}
+#endif
+
+#ifdef ENABLE_PROPERTY_CACHE
+static VOID process_reported_properties(AZURE_IOT_NX_CONTEXT* nx_context)
+{
+    AZURE_IOT_PROPERTY_CACHE* cache = &nx_context->property_cache;
+    AZURE_IOT_PROPERTY_CACHE_ENTRY* entries[AZURE_IOT_PROPERTY_CACHE_SIZE];
+    const AZURE_IOT_PROPERTY* properties[AZURE_IOT_PROPERTY_CACHE_SIZE];
+    ULONG group_hashes[AZURE_IOT_PROPERTY_CACHE_SIZE];
+    CHAR* component_name;
+    ULONG version = 0;
+    ULONG now     = tx_time_get();
+    UINT status;
+    UINT count;
+    UINT index;
+    UINT next;
+
+    // Changes made while disconnected wait for the connection, only their latest value is sent
+    if (nx_context->azure_iot_connection_status != NX_SUCCESS)
+    {
+        return;
+    }
+
+    for (index = 0; index < cache->count; index++)
+    {
+        if (!azure_iot_property_cache_due(&cache->entries[index], now))
+        {
+            continue;
+        }
+
+        // Coalesce the due values of this component into one PATCH
+        component_name = cache->entries[index].property.component_name;
+        count          = 0;
+
+        for (next = index; next < cache->count; next++)
+        {
+            if (azure_iot_property_cache_due(&cache->entries[next], now) &&
+                azure_iot_property_cache_same_component(cache->entries[next].property.component_name, component_name))
+            {
+                entries[count]    = &cache->entries[next];
+                properties[count] = &cache->entries[next].property;
+                count++;
+            }
+        }
+
+        status = reported_properties_send(nx_context, component_name, properties, count, &version, group_hashes);
+
+        // Too much for one packet, send the first half now and leave the rest for the next PATCH
+        while (status == NX_AZURE_IOT_INSUFFICIENT_BUFFER_SPACE && count > 1)
+        {
+            count /= 2;
+            status = reported_properties_send(nx_context, component_name, properties, count, &version, group_hashes);
+        }
+
+        cache->patches++;
+
+        if (status != NX_SUCCESS && status != NX_AZURE_IOT_INSUFFICIENT_BUFFER_SPACE)
+        {
+            AZURE_IOT_LOG_ERROR("ERROR: kept %d reported properties for retry (0x%08x)\r\n", count, status);
+        }
+
+        for (next = 0; next < count; next++)
+        {
+            // A group reads its values again when the PATCH is built, the hub has those rather than the staged ones
+            if (status == NX_SUCCESS && entries[next]->property.type == AZURE_IOT_PROPERTY_TYPE_GROUP)
+            {
+                entries[next]->hash = group_hashes[next];
+            }
+
+            azure_iot_property_cache_sent(cache, entries[next], status, version, now);
+        }
+    }
+}
+#endif
+
+// Sleep while reconnecting, still running the periodic timer so telemetry is queued through the outage
+static VOID connection_wait(AZURE_IOT_NX_CONTEXT* nx_context, ULONG ticks)
+{
+    ULONG start = tx_time_get();
+    ULONG elapsed;
+    ULONG app_events;
+
+    while ((elapsed = tx_time_get() - start) < ticks)
+    {
+        app_events = 0;
+        tx_event_flags_get(
+            &nx_context->events, HUB_PERIODIC_TIMER_EVENT, TX_OR_CLEAR, &app_events, ticks - elapsed);
+
+        if (app_events & HUB_PERIODIC_TIMER_EVENT)
+        {
+            process_timer_event(nx_context);
+        }
+    }
+}
+
 static UINT client_run(
     AZURE_IOT_NX_CONTEXT* nx_context, UINT (*iot_initialize)(AZURE_IOT_NX_CONTEXT*), UINT (*network_connect)())
 {
@@ -1150,8 +2616,28 @@ static UINT client_run(
             process_writable_properties(nx_context);
         }
 
+#ifdef ENABLE_PUBLISH_QUEUE
+        // Drain queued publishes, this also retries any that were held back by packet pool pressure
+        process_publish_queue(nx_context);
+#endif
+
+#ifdef ENABLE_TELEMETRY_BATCH
+        // Publish any batched telemetry that has reached its latency limit
+        process_telemetry_batch(nx_context);
+#endif
+
+#ifdef ENABLE_TELEMETRY_QUEUE
+        // Catch up on telemetry queued while disconnected
+        process_telemetry_queue(nx_context);
+#endif
+
+#ifdef ENABLE_PROPERTY_CACHE
+        // Send reported properties that changed, one PATCH per component
+        process_reported_properties(nx_context);
+#endif
+
         // Monitor and reconnect where possible
-        connection_monitor(nx_context, iot_initialize, network_connect);
+        connection_monitor(nx_context, iot_initialize, network_connect, connection_wait);
     }
 
     return NX_SUCCESS;
@@ -1162,13 +2648,13 @@ UINT azure_iot_nx_client_hub_run(
 {
     if (iot_hub_hostname == 0 || iot_hub_device_id == 0)
     {
-        printf("ERROR: azure_iot_nx_client_hub_run hub config is null\r\n");
+        AZURE_IOT_LOG_ERROR("ERROR: azure_iot_nx_client_hub_run hub config is null\r\n");
         return NX_PTR_ERROR;
     }
 
     if (strlen(iot_hub_hostname) > AZURE_IOT_HOST_NAME_SIZE || strlen(iot_hub_device_id) > AZURE_IOT_DEVICE_ID_SIZE)
     {
-        printf("ERROR: azure_iot_nx_client_hub_run hub config exceeds buffer size\r\n");
+        AZURE_IOT_LOG_ERROR("ERROR: azure_iot_nx_client_hub_run hub config exceeds buffer size\r\n");
         return NX_SIZE_ERROR;
     }
 
@@ -1186,7 +2672,7 @@ UINT azure_iot_nx_client_dps_run(
 {
     if (dps_id_scope == 0 || dps_registration_id == 0)
     {
-        printf("ERROR: azure_iot_nx_client_dps_run dps config is null\r\n");
+        AZURE_IOT_LOG_ERROR("ERROR: azure_iot_nx_client_dps_run dps config is null\r\n");
         return NX_PTR_ERROR;
     }
 
@@ -1196,5 +2682,12 @@ UINT azure_iot_nx_client_dps_run(
     nx_context->azure_iot_dps_id_scope_len        = strlen(dps_id_scope);
     nx_context->azure_iot_dps_registration_id_len = strlen(dps_registration_id);
 
+    // Start from the assignment of an earlier boot, this is only read once so a rejected one is not retried
+    if (azure_iot_dps_cache_load(nx_context) == NX_SUCCESS)
+    {
+        AZURE_IOT_LOG_INFO("Using the stored DPS assignment\r\n");
+        nx_context->azure_iot_dps_assigned = true;
+    }
+
     return client_run(nx_context, dps_initialize, network_connect);
 }
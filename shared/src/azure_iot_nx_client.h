@@ -11,17 +11,80 @@
 #include "nx_azure_iot_json_writer.h"
 #include "nx_azure_iot_provisioning_client.h"
 
+#include "azure_iot_cbor.h"
 #include "azure_iot_ciphersuites.h"
+#include "azure_iot_dispatch.h"
+#include "azure_iot_property_cache.h"
+#include "azure_iot_store.h"
+#include "azure_iot_telemetry_queue.h"
+#include "azure_iot_telemetry_stats.h"
 
 #define NX_AZURE_IOT_STACK_SIZE  (2 * 1024)
 #define AZURE_IOT_STACK_SIZE     (3 * 1024)
 #define AZURE_IOT_HOST_NAME_SIZE 128
 #define AZURE_IOT_DEVICE_ID_SIZE 64
 
+// Scratch buffers of each context for building telemetry and parsing properties, the properties buffer also
+// holds string values of the dispatch table
+#define AZURE_IOT_TELEMETRY_BUFFER_SIZE  256
+#define AZURE_IOT_PROPERTIES_BUFFER_SIZE 128
+
+// Gateway mode, downstream devices without a connection of their own publish over the one of this context.
+// The leaf table is static in the context and holds a copy of each leaf id of AZURE_IOT_DEVICE_ID_SIZE bytes,
+// so this bounds the leaves and the RAM they take. At most 128 with ENABLE_TELEMETRY_QUEUE. How much RAM and
+// handshake time the shared connection saves against a context per device has not been measured, check the
+// map file of the board build before sizing for a leaf count.
+#ifndef AZURE_IOT_GATEWAY_LEAF_COUNT
+#define AZURE_IOT_GATEWAY_LEAF_COUNT 32
+#endif
+
+// The telemetry batch, publish queue, telemetry queue and property cache cost RAM in every context, so each
+// is only built when its board enables it in CMake, ENABLE_TELEMETRY_BATCH, ENABLE_PUBLISH_QUEUE,
+// ENABLE_TELEMETRY_QUEUE and ENABLE_PROPERTY_CACHE. The board also sets the sizes below.
+
+// Telemetry batching defaults
+#ifndef AZURE_IOT_TELEMETRY_BATCH_SIZE
+#define AZURE_IOT_TELEMETRY_BATCH_SIZE 1024
+#endif
+#define AZURE_IOT_TELEMETRY_BATCH_LATENCY_SEC 30
+
+// Store and forward of telemetry published while disconnected, records per second sent after a reconnect
+#define AZURE_IOT_TELEMETRY_QUEUE_DRAIN_RATE 10
+
+// Asynchronous publish queue
+#ifndef AZURE_IOT_PUBLISH_QUEUE_DEPTH
+#define AZURE_IOT_PUBLISH_QUEUE_DEPTH 4
+#endif
+#ifndef AZURE_IOT_PUBLISH_PAYLOAD_SIZE
+#define AZURE_IOT_PUBLISH_PAYLOAD_SIZE 256
+#endif
+
+// Upper bound for the synchronous publish helpers to wait for packets and the send
+#define AZURE_IOT_PUBLISH_TIMEOUT_TICKS (5 * TX_TIMER_TICKS_PER_SECOND)
+
+// SAS token renewal, reconnect ahead of the token expiring rather than waiting for the hub to drop us.
+// The jitter spreads the renewal of a fleet of devices that connected at the same time.
+#define AZURE_IOT_SAS_TOKEN_RENEW_MARGIN_SEC (5 * 60)
+#define AZURE_IOT_SAS_TOKEN_RENEW_JITTER_SEC (5 * 60)
+
+// Failed connects in a row to a hub DPS assigned before it is provisioned again, the hub may have been moved or
+// deleted without the device being told
+#ifndef AZURE_IOT_DPS_MAX_CONNECT_FAILURES
+#define AZURE_IOT_DPS_MAX_CONNECT_FAILURES 5
+#endif
+
+#define AZURE_IOT_TELEMETRY_ENCODING_JSON 0
+#define AZURE_IOT_TELEMETRY_ENCODING_CBOR 1
+
 #define AZURE_IOT_AUTH_MODE_UNKNOWN 0
 #define AZURE_IOT_AUTH_MODE_SAS     1
 #define AZURE_IOT_AUTH_MODE_CERT    2
 
+// All state of a hub connection lives in its context, so several can run in one image, e.g. a primary
+// and a failover hub. Each context is driven by its own client thread from azure_iot_nx_client_hub_run or
+// azure_iot_nx_client_dps_run, and its callbacks run on that thread. Other than
+// azure_iot_nx_client_publish_telemetry_async, the publish and property functions use the scratch buffers
+// of the context and must be called from its callbacks. Contexts share the NX_IP, packet pool and DNS.
 typedef struct AZURE_IOT_NX_CONTEXT_STRUCT AZURE_IOT_NX_CONTEXT;
 
 typedef void (*func_ptr_command_received)(
@@ -32,9 +95,60 @@ typedef void (*func_ptr_property_received)(
     AZURE_IOT_NX_CONTEXT*, const UCHAR*, UINT, UCHAR*, UINT, NX_AZURE_IOT_JSON_READER*, UINT);
 typedef void (*func_ptr_properties_complete)(AZURE_IOT_NX_CONTEXT*);
 typedef void (*func_ptr_timer)(AZURE_IOT_NX_CONTEXT*);
+typedef void (*func_ptr_publish_complete)(AZURE_IOT_NX_CONTEXT*, UINT, UINT);
 
 typedef ULONG (*func_ptr_unix_time_get)(VOID);
 
+#ifdef ENABLE_TELEMETRY_BATCH
+// Outbox that packs multiple telemetry samples into a single JSON array message
+typedef struct AZURE_IOT_NX_TELEMETRY_BATCH_STRUCT
+{
+    UCHAR buffer[AZURE_IOT_TELEMETRY_BATCH_SIZE];
+    UINT buffer_length;
+    UINT sample_count;
+    CHAR* component_name;
+    ULONG first_sample_ticks;
+
+    UINT max_bytes;
+    ULONG max_latency_ticks;
+} AZURE_IOT_NX_TELEMETRY_BATCH;
+#endif
+
+#ifdef ENABLE_PUBLISH_QUEUE
+// A telemetry message waiting to be sent by the client thread
+typedef struct AZURE_IOT_NX_PUBLISH_REQUEST_STRUCT
+{
+    UINT handle;
+    CHAR* component_name;
+    UCHAR payload[AZURE_IOT_PUBLISH_PAYLOAD_SIZE];
+    UINT payload_length;
+    func_ptr_publish_complete complete_cb;
+} AZURE_IOT_NX_PUBLISH_REQUEST;
+
+typedef struct AZURE_IOT_NX_PUBLISH_QUEUE_STRUCT
+{
+    AZURE_IOT_NX_PUBLISH_REQUEST requests[AZURE_IOT_PUBLISH_QUEUE_DEPTH];
+    UINT head;
+    UINT count;
+    UINT next_handle;
+    TX_MUTEX mutex;
+} AZURE_IOT_NX_PUBLISH_QUEUE;
+#endif
+
+#ifdef ENABLE_GATEWAY
+// A downstream device of the gateway, the id is copied in by azure_iot_nx_client_gateway_leaf_add
+typedef struct AZURE_IOT_GATEWAY_LEAF_STRUCT
+{
+    CHAR id[AZURE_IOT_DEVICE_ID_SIZE];
+    ULONG sent;
+    ULONG failed;
+    ULONG last_sent_ticks;
+
+    // Telemetry held in the telemetry queue, it is counted in sent as well once the queue delivered it
+    ULONG queued;
+} AZURE_IOT_GATEWAY_LEAF;
+#endif
+
 struct AZURE_IOT_NX_CONTEXT_STRUCT
 {
     NX_SECURE_X509_CERT root_ca_cert;
@@ -74,14 +188,65 @@ struct AZURE_IOT_NX_CONTEXT_STRUCT
     CHAR azure_iot_hub_device_id[AZURE_IOT_DEVICE_ID_SIZE];
     UINT azure_iot_hub_device_id_len;
 
+    // the hub config came from DPS, kept across reconnects and in the store until the hub rejects it or cannot be
+    // reached AZURE_IOT_DPS_MAX_CONNECT_FAILURES times in a row
+    bool azure_iot_dps_assigned;
+    UINT azure_iot_dps_connect_failures;
+    const AZURE_IOT_STORE* azure_iot_store;
+
     TX_THREAD azure_iot_thread;
     TX_EVENT_FLAGS_GROUP events;
     TX_TIMER periodic_timer;
 
+#ifdef ENABLE_TELEMETRY_BATCH
+    AZURE_IOT_NX_TELEMETRY_BATCH telemetry_batch;
+#endif
+
+#ifdef ENABLE_PUBLISH_QUEUE
+    AZURE_IOT_NX_PUBLISH_QUEUE publish_queue;
+#endif
+
+#ifdef ENABLE_TELEMETRY_QUEUE
+    // telemetry held while disconnected, timestamped with the unix time callback
+    AZURE_IOT_TELEMETRY_QUEUE telemetry_queue;
+    ULONG telemetry_queue_drain_ticks;
+#endif
+    UINT (*unix_time_get)(ULONG* unix_time);
+
+    // scratch buffers of the client thread
+    UCHAR telemetry_buffer[AZURE_IOT_TELEMETRY_BUFFER_SIZE];
+    UCHAR properties_buffer[AZURE_IOT_PROPERTIES_BUFFER_SIZE];
+
+#ifdef ENABLE_PROPERTY_CACHE
+    // reported properties, the last value the hub accepted and changes waiting to be sent
+    AZURE_IOT_PROPERTY_CACHE property_cache;
+#endif
+
+#ifdef ENABLE_TELEMETRY_STATS
+    AZURE_IOT_TELEMETRY_STATS telemetry_stats;
+#endif
+
+#ifdef ENABLE_GATEWAY
+    AZURE_IOT_GATEWAY_LEAF gateway_leaves[AZURE_IOT_GATEWAY_LEAF_COUNT];
+    UINT gateway_leaf_count;
+#endif
+
     NX_AZURE_IOT nx_azure_iot;
 
     UINT azure_iot_connection_status;
 
+    // connection attempts since the last success, drives the exponential backoff
+    UINT azure_iot_retry_count;
+
+    // planned SAS token renewal, measured from the last successful connect
+    ULONG sas_token_connect_ticks;
+    ULONG sas_token_renew_ticks;
+
+    // reconnect timing, the handshake alone and the whole outage from disconnect to connected
+    ULONG azure_iot_disconnect_ticks;
+    ULONG azure_iot_connect_ticks;
+    ULONG azure_iot_outage_ticks;
+
     // union DPS and Hub as they are used consecutively and will save space
     union CLIENT_UNION {
         NX_AZURE_IOT_HUB_CLIENT iothub;
@@ -96,6 +261,9 @@ struct AZURE_IOT_NX_CONTEXT_STRUCT
     func_ptr_property_received property_received_cb;
     func_ptr_properties_complete properties_complete_cb;
     func_ptr_timer timer_cb;
+
+    // generated from the device model, takes precedence over the command and property callbacks
+    const AZURE_IOT_DISPATCH_TABLE* dispatch_table;
 };
 
 UINT azure_nx_client_periodic_interval_set(AZURE_IOT_NX_CONTEXT* nx_context, INT interval);
@@ -104,6 +272,56 @@ UINT azure_iot_nx_client_publish_telemetry(AZURE_IOT_NX_CONTEXT* nx_context,
     CHAR* component_name_ptr,
     UINT (*append_properties)(NX_AZURE_IOT_JSON_WRITER* json_writer_ptr));
 
+// Publish telemetry as a CBOR map with content type application/cbor. Keys are integers, by convention the
+// index of the telemetry in the contents of the DTDL model, which makes messages several times smaller.
+UINT azure_iot_nx_client_publish_telemetry_cbor(AZURE_IOT_NX_CONTEXT* nx_context,
+    CHAR* component_name_ptr,
+    UINT (*append_properties)(AZURE_IOT_CBOR_WRITER* cbor_writer_ptr));
+
+#ifdef ENABLE_PUBLISH_QUEUE
+// Queue telemetry for sending on the client thread. Returns immediately with a handle that is passed to
+// complete_cb once the message has been sent or has failed, or NX_AZURE_IOT_INSUFFICIENT_BUFFER_SPACE if the
+// queue is full. Safe to call from any thread, the payload is built on the stack of the caller, which needs
+// room for AZURE_IOT_PUBLISH_PAYLOAD_SIZE bytes.
+UINT azure_iot_nx_client_publish_telemetry_async(AZURE_IOT_NX_CONTEXT* nx_context,
+    CHAR* component_name_ptr,
+    UINT (*append_properties)(NX_AZURE_IOT_JSON_WRITER* json_writer_ptr),
+    func_ptr_publish_complete complete_cb,
+    UINT* handle_ptr);
+#endif
+
+#ifdef ENABLE_TELEMETRY_BATCH
+// Samples are packed into one JSON array per message, flushed on size, age or an explicit call. A batch that
+// fails to send is kept and retried, samples that no longer fit wait in the offline queue behind it.
+UINT azure_iot_nx_client_telemetry_batch_set(
+    AZURE_IOT_NX_CONTEXT* nx_context, UINT max_batch_bytes, UINT max_latency_seconds);
+UINT azure_iot_nx_client_telemetry_enqueue(AZURE_IOT_NX_CONTEXT* nx_context,
+    CHAR* component_name_ptr,
+    UINT (*append_properties)(NX_AZURE_IOT_JSON_WRITER* json_writer_ptr));
+UINT azure_iot_nx_client_telemetry_flush(AZURE_IOT_NX_CONTEXT* nx_context);
+#endif
+
+#ifdef ENABLE_TELEMETRY_QUEUE
+// JSON telemetry published while disconnected is queued with the time it was captured. Once reconnected each
+// record is sent as it was published, with that time in the iothub-creation-time-utc message property, at
+// AZURE_IOT_TELEMETRY_QUEUE_DRAIN_RATE records per second. The spill takes the oldest records
+// when the RAM queue is full, without one they are dropped. Samples of unregistered components are not queued.
+UINT azure_iot_nx_client_telemetry_spill_set(AZURE_IOT_NX_CONTEXT* nx_context, const AZURE_IOT_TELEMETRY_SPILL* spill);
+const AZURE_IOT_TELEMETRY_QUEUE* azure_iot_nx_client_telemetry_queue_get(AZURE_IOT_NX_CONTEXT* nx_context);
+#endif
+
+#ifdef ENABLE_TELEMETRY_STATS
+// Per stage latency, size and packet pool statistics of azure_iot_nx_client_publish_telemetry. The clock
+// should be a free running microsecond counter, NULL falls back to the ThreadX tick.
+VOID azure_iot_nx_client_telemetry_stats_clock_set(AZURE_IOT_NX_CONTEXT* nx_context, ULONG (*clock_us)(VOID));
+AZURE_IOT_TELEMETRY_STATS* azure_iot_nx_client_telemetry_stats_get(AZURE_IOT_NX_CONTEXT* nx_context);
+#endif
+
+// With ENABLE_PROPERTY_CACHE reported properties are queued on the client thread and sent once connected,
+// changes to the properties of a component are coalesced into one PATCH and values the hub already accepted
+// are not sent again. They return once queued, failures to send are logged. Groups from an append callback
+// are compared by their JSON, those beyond AZURE_IOT_PROPERTY_CACHE_GROUP_SIZE are always sent. Without it
+// each call sends its PATCH and returns the outcome.
 UINT azure_iot_nx_client_publish_properties(AZURE_IOT_NX_CONTEXT* nx_context,
     CHAR* component_name_ptr,
     UINT (*append_properties)(NX_AZURE_IOT_JSON_WRITER* json_writer_ptr));
@@ -118,6 +336,26 @@ UINT azure_nx_client_respond_int_writable_property(AZURE_IOT_NX_CONTEXT* nx_cont
     INT version);
 UINT azure_iot_nx_client_publish_int_writable_property(
     AZURE_IOT_NX_CONTEXT* nx_context, CHAR* component_ptr, CHAR* property_ptr, UINT value);
+#ifdef ENABLE_PROPERTY_CACHE
+const AZURE_IOT_PROPERTY_CACHE* azure_iot_nx_client_property_cache_get(AZURE_IOT_NX_CONTEXT* nx_context);
+#endif
+
+#ifdef ENABLE_GATEWAY
+// Leaf devices share the connection, TLS session, buffers and packet pool of the gateway context. Their
+// telemetry is sent as the gateway with a leafId message property for routing, their reported properties
+// are an object named by the leaf id in the twin of the gateway. With ENABLE_TELEMETRY_QUEUE leaf telemetry
+// is queued while disconnected like that of the gateway. Queued records name the leaf by its index, so a
+// spill is only delivered to the right leaves when they are added in the same order at every start. Leaf
+// properties beyond AZURE_IOT_PROPERTY_CACHE_SIZE are sent every time.
+UINT azure_iot_nx_client_gateway_leaf_add(AZURE_IOT_NX_CONTEXT* nx_context, CHAR* leaf_id, UINT* leaf_index);
+UINT azure_iot_nx_client_gateway_publish_telemetry(AZURE_IOT_NX_CONTEXT* nx_context,
+    UINT leaf_index,
+    UINT (*append_properties)(NX_AZURE_IOT_JSON_WRITER* json_writer_ptr));
+UINT azure_iot_nx_client_gateway_publish_properties(AZURE_IOT_NX_CONTEXT* nx_context,
+    UINT leaf_index,
+    UINT (*append_properties)(NX_AZURE_IOT_JSON_WRITER* json_writer_ptr));
+const AZURE_IOT_GATEWAY_LEAF* azure_iot_nx_client_gateway_leaf_get(AZURE_IOT_NX_CONTEXT* nx_context, UINT leaf_index);
+#endif
 
 UINT azure_iot_nx_client_register_command_callback(
     AZURE_IOT_NX_CONTEXT* nx_context, func_ptr_command_received callback);
@@ -130,6 +368,11 @@ UINT azure_iot_nx_client_register_properties_complete_callback(
 UINT azure_iot_nx_client_register_timer_callback(
     AZURE_IOT_NX_CONTEXT* nx_context, func_ptr_timer callback, int32_t interval);
 
+// Route commands and writable properties of the model through its generated table (see shared/model/dtdl_dispatch.py).
+// Names the table does not know still go to the registered callbacks.
+UINT azure_iot_nx_client_register_dispatch_table(
+    AZURE_IOT_NX_CONTEXT* nx_context, const AZURE_IOT_DISPATCH_TABLE* table);
+
 UINT azure_iot_nx_client_add_component(AZURE_IOT_NX_CONTEXT* nx_context, CHAR* component_name);
 
 UINT azure_iot_nx_client_sas_set(AZURE_IOT_NX_CONTEXT* context, CHAR* device_sas_key);
@@ -139,6 +382,9 @@ UINT azure_iot_nx_client_cert_set(AZURE_IOT_NX_CONTEXT* context,
     UCHAR* device_x509_key,
     UINT device_x509_key_len);
 
+// Persist the DPS assignment so a reboot skips provisioning, without a store it is kept until reboot
+UINT azure_iot_nx_client_store_set(AZURE_IOT_NX_CONTEXT* context, const AZURE_IOT_STORE* store);
+
 UINT azure_iot_nx_client_create(AZURE_IOT_NX_CONTEXT* context,
     NX_IP* nx_ip,
     NX_PACKET_POOL* nx_pool,
@@ -0,0 +1,186 @@
+/* Copyright (c) Microsoft Corporation.
+   Licensed under the MIT License. */
+
+#include "azure_iot_property_cache.h"
+
+#include <string.h>
+
+#include "nx_azure_iot.h"
+
+#define FNV_OFFSET_BASIS 2166136261u
+#define FNV_PRIME        16777619u
+
+static ULONG fnv1a(ULONG hash, const VOID* data, UINT length)
+{
+    const UCHAR* bytes = data;
+
+    while (length--)
+    {
+        hash = (hash ^ *bytes++) * FNV_PRIME;
+    }
+
+    return hash;
+}
+
+static bool same_name(const CHAR* name, const CHAR* other_name)
+{
+    if (name == NX_NULL || other_name == NX_NULL)
+    {
+        return name == other_name;
+    }
+
+    return strcmp(name, other_name) == 0;
+}
+
+static bool same_property(const AZURE_IOT_PROPERTY* property, const AZURE_IOT_PROPERTY* other)
+{
+    if (property->type != other->type || !same_name(property->component_name, other->component_name) ||
+        !same_name(property->name, other->name))
+    {
+        return false;
+    }
+
+    // Groups are also told apart by their callback
+    return property->type != AZURE_IOT_PROPERTY_TYPE_GROUP ||
+           property->value.append_properties == other->value.append_properties;
+}
+
+VOID azure_iot_property_cache_init(AZURE_IOT_PROPERTY_CACHE* cache)
+{
+    memset(cache, 0, sizeof(AZURE_IOT_PROPERTY_CACHE));
+}
+
+ULONG azure_iot_property_cache_hash(const AZURE_IOT_PROPERTY* property, const UCHAR* json, UINT json_length)
+{
+    ULONG hash = FNV_OFFSET_BASIS;
+
+    hash = fnv1a(hash, &property->type, sizeof(property->type));
+    hash = fnv1a(hash, &property->ack_status, sizeof(property->ack_status));
+    hash = fnv1a(hash, &property->ack_version, sizeof(property->ack_version));
+
+    switch (property->type)
+    {
+        case AZURE_IOT_PROPERTY_TYPE_GROUP:
+            hash = fnv1a(hash, json, json_length);
+            break;
+
+        case AZURE_IOT_PROPERTY_TYPE_BOOL:
+            hash = fnv1a(hash, &property->value.boolean, sizeof(property->value.boolean));
+            break;
+
+        case AZURE_IOT_PROPERTY_TYPE_INT32:
+            hash = fnv1a(hash, &property->value.integer, sizeof(property->value.integer));
+            break;
+    }
+
+    return hash;
+}
+
+ULONG azure_iot_property_cache_hash_append(ULONG hash, const UCHAR* json, UINT json_length)
+{
+    return fnv1a(hash, json, json_length);
+}
+
+UINT azure_iot_property_cache_update(
+    AZURE_IOT_PROPERTY_CACHE* cache, const AZURE_IOT_PROPERTY* property, ULONG hash, bool force)
+{
+    AZURE_IOT_PROPERTY_CACHE_ENTRY* entry = NX_NULL;
+    UINT index;
+
+    for (index = 0; index < cache->count; index++)
+    {
+        if (same_property(&cache->entries[index].property, property))
+        {
+            entry = &cache->entries[index];
+            break;
+        }
+    }
+
+    if (entry == NX_NULL)
+    {
+        if (cache->count == AZURE_IOT_PROPERTY_CACHE_SIZE)
+        {
+            return NX_AZURE_IOT_INSUFFICIENT_BUFFER_SPACE;
+        }
+
+        entry = &cache->entries[cache->count++];
+        memset(entry, 0, sizeof(AZURE_IOT_PROPERTY_CACHE_ENTRY));
+    }
+
+    // A later value replaces one still waiting to be sent
+    entry->property = *property;
+    entry->hash     = hash;
+
+    if (!force && entry->acked && entry->acked_hash == hash)
+    {
+        entry->pending  = false;
+        entry->failures = 0;
+        cache->suppressed++;
+        return NX_SUCCESS;
+    }
+
+    entry->pending = true;
+
+    return NX_SUCCESS;
+}
+
+bool azure_iot_property_cache_due(const AZURE_IOT_PROPERTY_CACHE_ENTRY* entry, ULONG now)
+{
+    // Compared as a difference so the tick counter may wrap
+    return entry->pending && (entry->failures == 0 || (LONG)(now - entry->retry_ticks) >= 0);
+}
+
+VOID azure_iot_property_cache_sent(AZURE_IOT_PROPERTY_CACHE* cache,
+    AZURE_IOT_PROPERTY_CACHE_ENTRY* entry,
+    UINT status,
+    ULONG version,
+    ULONG now)
+{
+    ULONG backoff = AZURE_IOT_PROPERTY_CACHE_RETRY_TICKS;
+    UINT failure;
+
+    if (status != NX_SUCCESS && status != NX_AZURE_IOT_INSUFFICIENT_BUFFER_SPACE)
+    {
+        entry->failures++;
+
+        for (failure = 1; failure < entry->failures && backoff < AZURE_IOT_PROPERTY_CACHE_RETRY_MAX_TICKS; failure++)
+        {
+            backoff *= 2;
+        }
+
+        entry->retry_ticks = now + (backoff < AZURE_IOT_PROPERTY_CACHE_RETRY_MAX_TICKS
+                                           ? backoff
+                                           : AZURE_IOT_PROPERTY_CACHE_RETRY_MAX_TICKS);
+        cache->retries++;
+        return;
+    }
+
+    entry->pending  = false;
+    entry->failures = 0;
+
+    if (status != NX_SUCCESS)
+    {
+        return;
+    }
+
+    entry->acked         = true;
+    entry->acked_hash    = entry->hash;
+    entry->acked_version = version;
+    cache->sent++;
+}
+
+VOID azure_iot_property_cache_invalidate(AZURE_IOT_PROPERTY_CACHE* cache)
+{
+    UINT index;
+
+    for (index = 0; index < cache->count; index++)
+    {
+        cache->entries[index].acked    = false;
+        cache->entries[index].failures = 0;
+    }
+}
+
+bool azure_iot_property_cache_same_component(const CHAR* component_name, const CHAR* other_component_name)
+{
+    return same_name(component_name, other_component_name);
+}
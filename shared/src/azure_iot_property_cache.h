@@ -0,0 +1,112 @@
+/* Copyright (c) Microsoft Corporation.
+   Licensed under the MIT License. */
+
+#ifndef _AZURE_IOT_PROPERTY_CACHE_H
+#define _AZURE_IOT_PROPERTY_CACHE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "nx_api.h"
+#include "nx_azure_iot_json_writer.h"
+
+// Reported properties tracked, properties beyond this are sent on their own every time
+#ifndef AZURE_IOT_PROPERTY_CACHE_SIZE
+#define AZURE_IOT_PROPERTY_CACHE_SIZE 16
+#endif
+
+// Largest group of properties from an append callback that can be compared with its last report
+#ifndef AZURE_IOT_PROPERTY_CACHE_GROUP_SIZE
+#define AZURE_IOT_PROPERTY_CACHE_GROUP_SIZE 512
+#endif
+
+// Wait before resending a value the hub did not accept, doubled with each failure up to the maximum
+#define AZURE_IOT_PROPERTY_CACHE_RETRY_TICKS     (2 * TX_TIMER_TICKS_PER_SECOND)
+#define AZURE_IOT_PROPERTY_CACHE_RETRY_MAX_TICKS (300 * TX_TIMER_TICKS_PER_SECOND)
+
+#define AZURE_IOT_PROPERTY_TYPE_GROUP 0
+#define AZURE_IOT_PROPERTY_TYPE_BOOL  1
+#define AZURE_IOT_PROPERTY_TYPE_INT32 2
+
+// A reported property, or a group of them written by an append callback. A named group is reported as an
+// object of that name, without a name its properties are written in place.
+typedef struct AZURE_IOT_PROPERTY_STRUCT
+{
+    CHAR* component_name;
+    CHAR* name;
+    UCHAR type;
+
+    union {
+        bool boolean;
+        int32_t integer;
+        UINT (*append_properties)(NX_AZURE_IOT_JSON_WRITER* json_writer_ptr);
+    } value;
+
+    // Writable property acknowledgement, a status of 0 reports the plain value
+    INT ack_status;
+    INT ack_version;
+} AZURE_IOT_PROPERTY;
+
+typedef struct AZURE_IOT_PROPERTY_CACHE_ENTRY_STRUCT
+{
+    AZURE_IOT_PROPERTY property;
+    ULONG hash;
+
+    // Last value the hub accepted, and the twin version of that update
+    ULONG acked_hash;
+    ULONG acked_version;
+    bool acked;
+
+    bool pending;
+
+    // Failed sends of the pending value, and the tick count it may be sent again from
+    UINT failures;
+    ULONG retry_ticks;
+} AZURE_IOT_PROPERTY_CACHE_ENTRY;
+
+typedef struct AZURE_IOT_PROPERTY_CACHE_STRUCT
+{
+    AZURE_IOT_PROPERTY_CACHE_ENTRY entries[AZURE_IOT_PROPERTY_CACHE_SIZE];
+    UINT count;
+
+    UCHAR group_buffer[AZURE_IOT_PROPERTY_CACHE_GROUP_SIZE];
+
+    // Values accepted by the hub, values not sent as the hub already had them, PATCH messages, and values
+    // kept for a retry after a failed PATCH
+    ULONG sent;
+    ULONG suppressed;
+    ULONG patches;
+    ULONG retries;
+} AZURE_IOT_PROPERTY_CACHE;
+
+VOID azure_iot_property_cache_init(AZURE_IOT_PROPERTY_CACHE* cache);
+
+// Hash of the value and acknowledgement, json is the serialized members of an AZURE_IOT_PROPERTY_TYPE_GROUP
+// without the braces around them, the bytes a PATCH carries of the group
+ULONG azure_iot_property_cache_hash(const AZURE_IOT_PROPERTY* property, const UCHAR* json, UINT json_length);
+
+// Continue the hash of a group with more of its members, for members that are not in one buffer
+ULONG azure_iot_property_cache_hash_append(ULONG hash, const UCHAR* json, UINT json_length);
+
+// Record the latest value. It is marked pending unless it matches the last acknowledged one, or always with
+// force. Returns NX_AZURE_IOT_INSUFFICIENT_BUFFER_SPACE when the property is new and the cache is full.
+UINT azure_iot_property_cache_update(
+    AZURE_IOT_PROPERTY_CACHE* cache, const AZURE_IOT_PROPERTY* property, ULONG hash, bool force);
+
+// Whether a pending value may be sent at now, false while it waits out the backoff of a failure
+bool azure_iot_property_cache_due(const AZURE_IOT_PROPERTY_CACHE_ENTRY* entry, ULONG now);
+
+// Outcome of sending a pending value. On failure it stays pending and is due again after the backoff,
+// unless it was too large for a PATCH of its own, which a retry cannot fix.
+VOID azure_iot_property_cache_sent(AZURE_IOT_PROPERTY_CACHE* cache,
+    AZURE_IOT_PROPERTY_CACHE_ENTRY* entry,
+    UINT status,
+    ULONG version,
+    ULONG now);
+
+// Forget what the hub has, e.g. after DPS moved the device to another hub, pending values are due at once
+VOID azure_iot_property_cache_invalidate(AZURE_IOT_PROPERTY_CACHE* cache);
+
+bool azure_iot_property_cache_same_component(const CHAR* component_name, const CHAR* other_component_name);
+
+#endif
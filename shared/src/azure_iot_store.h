@@ -0,0 +1,22 @@
+/* Copyright (c) Microsoft Corporation.
+   Licensed under the MIT License. */
+
+#ifndef _AZURE_IOT_STORE_H
+#define _AZURE_IOT_STORE_H
+
+#include "nx_api.h"
+
+// Longest key a store must support, including the terminator
+#define AZURE_IOT_STORE_KEY_SIZE 16
+
+// Small key value store for state that must survive a reboot, backed by flash on the boards or by files
+// on a host. Each call returns NX_SUCCESS, read returns NX_NOT_FOUND for a missing key and NX_SIZE_ERROR
+// when the value does not fit.
+typedef struct AZURE_IOT_STORE_STRUCT
+{
+    UINT (*read)(const CHAR* key, UCHAR* data, UINT size, UINT* length);
+    UINT (*write)(const CHAR* key, const UCHAR* data, UINT length);
+    UINT (*erase)(const CHAR* key);
+} AZURE_IOT_STORE;
+
+#endif
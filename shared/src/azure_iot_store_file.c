@@ -0,0 +1,113 @@
+/* Copyright (c) Microsoft Corporation.
+   Licensed under the MIT License. */
+
+#include "azure_iot_store_file.h"
+
+#include <stdio.h>
+
+#include "azure_iot_log.h"
+
+#define STORE_FILE_PATH_SIZE (sizeof(AZURE_IOT_STORE_FILE_DIR) + AZURE_IOT_STORE_KEY_SIZE + 8)
+
+static UINT store_file_path(const CHAR* key, CHAR* path)
+{
+    if (snprintf(path, STORE_FILE_PATH_SIZE, "%s/%s.dat", AZURE_IOT_STORE_FILE_DIR, key) >
+        STORE_FILE_PATH_SIZE - 1)
+    {
+        AZURE_IOT_LOG_ERROR("ERROR: store key too long\r\n");
+        return NX_SIZE_ERROR;
+    }
+
+    return NX_SUCCESS;
+}
+
+static UINT store_file_read(const CHAR* key, UCHAR* data, UINT size, UINT* length)
+{
+    CHAR path[STORE_FILE_PATH_SIZE];
+    FILE* file;
+    size_t read_length;
+    UINT status;
+
+    if ((status = store_file_path(key, path)))
+    {
+        return status;
+    }
+
+    if ((file = fopen(path, "rb")) == NULL)
+    {
+        return NX_NOT_FOUND;
+    }
+
+    // Read one byte more than asked for to catch values that do not fit
+    read_length = fread(data, 1, size, file);
+    status      = (read_length == size && fgetc(file) != EOF) ? NX_SIZE_ERROR : NX_SUCCESS;
+
+    fclose(file);
+
+    *length = (UINT)read_length;
+
+    return status;
+}
+
+static UINT store_file_write(const CHAR* key, const UCHAR* data, UINT length)
+{
+    CHAR path[STORE_FILE_PATH_SIZE];
+    CHAR temp_path[STORE_FILE_PATH_SIZE + 4];
+    FILE* file;
+    UINT status;
+
+    if ((status = store_file_path(key, path)))
+    {
+        return status;
+    }
+
+    // Write aside and rename so a crash leaves either the old or the new value
+    snprintf(temp_path, sizeof(temp_path), "%s.tmp", path);
+
+    if ((file = fopen(temp_path, "wb")) == NULL)
+    {
+        AZURE_IOT_LOG_ERROR("ERROR: failed to open %s\r\n", temp_path);
+        return NX_NOT_SUCCESSFUL;
+    }
+
+    if (fwrite(data, 1, length, file) != length)
+    {
+        status = NX_NOT_SUCCESSFUL;
+    }
+
+    if (fclose(file) != 0)
+    {
+        status = NX_NOT_SUCCESSFUL;
+    }
+
+    if (status != NX_SUCCESS || rename(temp_path, path) != 0)
+    {
+        AZURE_IOT_LOG_ERROR("ERROR: failed to write %s\r\n", path);
+        remove(temp_path);
+        return NX_NOT_SUCCESSFUL;
+    }
+
+    return NX_SUCCESS;
+}
+
+static UINT store_file_erase(const CHAR* key)
+{
+    CHAR path[STORE_FILE_PATH_SIZE];
+    UINT status;
+
+    if ((status = store_file_path(key, path)))
+    {
+        return status;
+    }
+
+    // A key that was never written is already erased
+    remove(path);
+
+    return NX_SUCCESS;
+}
+
+const AZURE_IOT_STORE azure_iot_store_file = {
+    .read  = store_file_read,
+    .write = store_file_write,
+    .erase = store_file_erase,
+};
@@ -0,0 +1,16 @@
+/* Copyright (c) Microsoft Corporation.
+   Licensed under the MIT License. */
+
+#ifndef _AZURE_IOT_STORE_FILE_H
+#define _AZURE_IOT_STORE_FILE_H
+
+#include "azure_iot_store.h"
+
+// Directory holding one file per key, for host builds without flash
+#ifndef AZURE_IOT_STORE_FILE_DIR
+#define AZURE_IOT_STORE_FILE_DIR "."
+#endif
+
+extern const AZURE_IOT_STORE azure_iot_store_file;
+
+#endif
@@ -0,0 +1,171 @@
+/* Copyright (c) Microsoft Corporation.
+   Licensed under the MIT License. */
+
+#include "azure_iot_telemetry_queue.h"
+
+#include <string.h>
+
+#include "azure_iot_log.h"
+
+#define RECORD_HEADER_SIZE sizeof(AZURE_IOT_TELEMETRY_RECORD)
+
+// head and tail are free running byte counts, the ring is indexed modulo its size
+static VOID ring_read(AZURE_IOT_TELEMETRY_QUEUE* queue, ULONG position, UCHAR* data, UINT length)
+{
+    ULONG offset = position % AZURE_IOT_TELEMETRY_QUEUE_SIZE;
+    UINT first   = length < AZURE_IOT_TELEMETRY_QUEUE_SIZE - offset ? length : AZURE_IOT_TELEMETRY_QUEUE_SIZE - offset;
+
+    memcpy(data, &queue->ring[offset], first);
+    memcpy(data + first, queue->ring, length - first);
+}
+
+static VOID ring_write(AZURE_IOT_TELEMETRY_QUEUE* queue, ULONG position, const UCHAR* data, UINT length)
+{
+    ULONG offset = position % AZURE_IOT_TELEMETRY_QUEUE_SIZE;
+    UINT first   = length < AZURE_IOT_TELEMETRY_QUEUE_SIZE - offset ? length : AZURE_IOT_TELEMETRY_QUEUE_SIZE - offset;
+
+    memcpy(&queue->ring[offset], data, first);
+    memcpy(queue->ring, data + first, length - first);
+}
+
+// Move the oldest record of the ring to the spill, or drop it
+static VOID ring_evict(AZURE_IOT_TELEMETRY_QUEUE* queue)
+{
+    AZURE_IOT_TELEMETRY_RECORD record;
+    UINT size;
+
+    ring_read(queue, queue->tail, (UCHAR*)&record, RECORD_HEADER_SIZE);
+    size = RECORD_HEADER_SIZE + record.length;
+
+    if (queue->spill != NX_NULL)
+    {
+        ring_read(queue, queue->tail, queue->scratch, size);
+
+        if (queue->spill->push(queue->scratch, size) == NX_SUCCESS)
+        {
+            queue->spill_pending = true;
+            queue->spilled++;
+            queue->tail += size;
+            return;
+        }
+    }
+
+    queue->dropped++;
+    queue->tail += size;
+}
+
+VOID azure_iot_telemetry_queue_init(AZURE_IOT_TELEMETRY_QUEUE* queue)
+{
+    memset(queue, 0, sizeof(AZURE_IOT_TELEMETRY_QUEUE));
+}
+
+VOID azure_iot_telemetry_queue_spill_set(AZURE_IOT_TELEMETRY_QUEUE* queue, const AZURE_IOT_TELEMETRY_SPILL* spill)
+{
+    queue->spill         = spill;
+    queue->spill_pending = spill != NX_NULL;
+}
+
+UINT azure_iot_telemetry_queue_push(
+    AZURE_IOT_TELEMETRY_QUEUE* queue, const AZURE_IOT_TELEMETRY_RECORD* record, const UCHAR* payload)
+{
+    UINT size = RECORD_HEADER_SIZE + record->length;
+
+    if (record->length > AZURE_IOT_TELEMETRY_QUEUE_RECORD_SIZE)
+    {
+        queue->dropped++;
+        return NX_SIZE_ERROR;
+    }
+
+    while (AZURE_IOT_TELEMETRY_QUEUE_SIZE - (queue->head - queue->tail) < size)
+    {
+        ring_evict(queue);
+    }
+
+    ring_write(queue, queue->head, (const UCHAR*)record, RECORD_HEADER_SIZE);
+    ring_write(queue, queue->head + RECORD_HEADER_SIZE, payload, record->length);
+    queue->head += size;
+    queue->queued++;
+
+    return NX_SUCCESS;
+}
+
+UINT azure_iot_telemetry_queue_peek(
+    AZURE_IOT_TELEMETRY_QUEUE* queue, AZURE_IOT_TELEMETRY_RECORD* record, UCHAR* payload)
+{
+    UINT length;
+    UINT status;
+
+    // The spill always holds the older records
+    while (queue->spill_pending)
+    {
+        if ((status = queue->spill->peek(queue->scratch, sizeof(queue->scratch), &length)) == NX_NOT_FOUND)
+        {
+            queue->spill_pending = false;
+            break;
+        }
+
+        memcpy(record, queue->scratch, RECORD_HEADER_SIZE);
+
+        // Skip anything the spill cannot give back whole, so one bad record cannot block the queue
+        if (status != NX_SUCCESS || length < RECORD_HEADER_SIZE || record->length != length - RECORD_HEADER_SIZE)
+        {
+            AZURE_IOT_LOG_ERROR("ERROR: dropping unreadable spilled telemetry record (0x%08x)\r\n", status);
+            queue->dropped++;
+
+            if (queue->spill->pop())
+            {
+                queue->spill_pending = false;
+            }
+            continue;
+        }
+
+        memcpy(payload, queue->scratch + RECORD_HEADER_SIZE, record->length);
+        queue->peeked_spill = true;
+
+        return NX_SUCCESS;
+    }
+
+    if (queue->head == queue->tail)
+    {
+        return NX_NOT_FOUND;
+    }
+
+    ring_read(queue, queue->tail, (UCHAR*)record, RECORD_HEADER_SIZE);
+    ring_read(queue, queue->tail + RECORD_HEADER_SIZE, payload, record->length);
+    queue->peeked_spill = false;
+
+    return NX_SUCCESS;
+}
+
+VOID azure_iot_telemetry_queue_pop(AZURE_IOT_TELEMETRY_QUEUE* queue)
+{
+    AZURE_IOT_TELEMETRY_RECORD record;
+
+    if (queue->peeked_spill)
+    {
+        // A spill that fails to pop would return the same record forever
+        if (queue->spill->pop())
+        {
+            AZURE_IOT_LOG_ERROR("ERROR: telemetry spill pop failed, ignoring the spill\r\n");
+            queue->spill_pending = false;
+        }
+
+        queue->peeked_spill = false;
+    }
+    else if (queue->head != queue->tail)
+    {
+        ring_read(queue, queue->tail, (UCHAR*)&record, RECORD_HEADER_SIZE);
+        queue->tail += RECORD_HEADER_SIZE + record.length;
+    }
+    else
+    {
+        return;
+    }
+
+    queue->drained++;
+}
+
+bool azure_iot_telemetry_queue_empty(AZURE_IOT_TELEMETRY_QUEUE* queue)
+{
+    return queue->head == queue->tail && !queue->spill_pending;
+}
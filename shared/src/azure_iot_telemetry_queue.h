@@ -0,0 +1,83 @@
+/* Copyright (c) Microsoft Corporation.
+   Licensed under the MIT License. */
+
+#ifndef _AZURE_IOT_TELEMETRY_QUEUE_H
+#define _AZURE_IOT_TELEMETRY_QUEUE_H
+
+#include <stdbool.h>
+
+#include "nx_api.h"
+
+// Bytes of RAM for records held while disconnected, each costs its payload plus an 8 byte header
+#ifndef AZURE_IOT_TELEMETRY_QUEUE_SIZE
+#define AZURE_IOT_TELEMETRY_QUEUE_SIZE 2048
+#endif
+
+// Largest payload a record can hold, bigger samples are not queued
+#define AZURE_IOT_TELEMETRY_QUEUE_RECORD_SIZE 256
+
+// First component value of gateway leaf records, below it are the components of the device itself
+#define AZURE_IOT_TELEMETRY_RECORD_LEAF 0x80
+
+typedef struct AZURE_IOT_TELEMETRY_RECORD_STRUCT
+{
+    // Unix time the sample was taken
+    ULONG timestamp;
+    USHORT length;
+
+    // 0 for the root component, otherwise the index of the registered component plus one, or
+    // AZURE_IOT_TELEMETRY_RECORD_LEAF plus the index of the gateway leaf the telemetry is for
+    UCHAR component;
+
+    // AZURE_IOT_TELEMETRY_ENCODING_JSON or _CBOR, spills of older firmware hold 0 which is JSON
+    UCHAR encoding;
+} AZURE_IOT_TELEMETRY_RECORD;
+
+// Second tier for the oldest records once the RAM is full, e.g. flash or a file on a host. Records are
+// opaque byte strings that must come back in the order they were pushed. push returns an error when the
+// spill is full, peek returns NX_NOT_FOUND when it is empty.
+typedef struct AZURE_IOT_TELEMETRY_SPILL_STRUCT
+{
+    UINT (*push)(const UCHAR* data, UINT length);
+    UINT (*peek)(UCHAR* data, UINT size, UINT* length);
+    UINT (*pop)(VOID);
+} AZURE_IOT_TELEMETRY_SPILL;
+
+// FIFO of timestamped telemetry samples. When it is full the oldest record moves to the spill, or is
+// dropped without one. Not thread safe, it is only used from the client thread.
+typedef struct AZURE_IOT_TELEMETRY_QUEUE_STRUCT
+{
+    UCHAR ring[AZURE_IOT_TELEMETRY_QUEUE_SIZE];
+    ULONG head;
+    ULONG tail;
+
+    const AZURE_IOT_TELEMETRY_SPILL* spill;
+    bool spill_pending;
+    bool peeked_spill;
+    UCHAR scratch[sizeof(AZURE_IOT_TELEMETRY_RECORD) + AZURE_IOT_TELEMETRY_QUEUE_RECORD_SIZE];
+
+    // Records accepted, published after a reconnect, and lost to a full queue
+    ULONG queued;
+    ULONG drained;
+    ULONG dropped;
+    ULONG spilled;
+} AZURE_IOT_TELEMETRY_QUEUE;
+
+VOID azure_iot_telemetry_queue_init(AZURE_IOT_TELEMETRY_QUEUE* queue);
+
+// Records left in the spill by an earlier boot are drained first
+VOID azure_iot_telemetry_queue_spill_set(AZURE_IOT_TELEMETRY_QUEUE* queue, const AZURE_IOT_TELEMETRY_SPILL* spill);
+
+UINT azure_iot_telemetry_queue_push(
+    AZURE_IOT_TELEMETRY_QUEUE* queue, const AZURE_IOT_TELEMETRY_RECORD* record, const UCHAR* payload);
+
+// Oldest record, payload must hold AZURE_IOT_TELEMETRY_QUEUE_RECORD_SIZE. Returns NX_NOT_FOUND when empty.
+UINT azure_iot_telemetry_queue_peek(
+    AZURE_IOT_TELEMETRY_QUEUE* queue, AZURE_IOT_TELEMETRY_RECORD* record, UCHAR* payload);
+
+// Remove the record returned by the last peek
+VOID azure_iot_telemetry_queue_pop(AZURE_IOT_TELEMETRY_QUEUE* queue);
+
+bool azure_iot_telemetry_queue_empty(AZURE_IOT_TELEMETRY_QUEUE* queue);
+
+#endif
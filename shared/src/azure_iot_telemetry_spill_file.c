@@ -0,0 +1,161 @@
+/* Copyright (c) Microsoft Corporation.
+   Licensed under the MIT License. */
+
+#include "azure_iot_telemetry_spill_file.h"
+
+#include <stdio.h>
+
+#include "azure_iot_log.h"
+
+// The file starts with the offset of the oldest unread record, records follow as a length and the data.
+// The file is removed once everything has been read, so it only grows for the length of an outage.
+typedef struct SPILL_FILE_HEADER_STRUCT
+{
+    ULONG read_offset;
+} SPILL_FILE_HEADER;
+
+static FILE* spill_open(SPILL_FILE_HEADER* header)
+{
+    FILE* file;
+
+    if ((file = fopen(AZURE_IOT_TELEMETRY_SPILL_FILE, "r+b")) == NULL)
+    {
+        return NULL;
+    }
+
+    if (fread(header, sizeof(SPILL_FILE_HEADER), 1, file) != 1)
+    {
+        fclose(file);
+        return NULL;
+    }
+
+    return file;
+}
+
+static UINT spill_file_push(const UCHAR* data, UINT length)
+{
+    SPILL_FILE_HEADER header = {sizeof(SPILL_FILE_HEADER)};
+    ULONG record_length      = length;
+    FILE* file;
+    long size;
+    UINT status = NX_SUCCESS;
+
+    if ((file = spill_open(&header)) == NULL)
+    {
+        if ((file = fopen(AZURE_IOT_TELEMETRY_SPILL_FILE, "w+b")) == NULL ||
+            fwrite(&header, sizeof(header), 1, file) != 1)
+        {
+            AZURE_IOT_LOG_ERROR("ERROR: failed to create %s\r\n", AZURE_IOT_TELEMETRY_SPILL_FILE);
+
+            if (file != NULL)
+            {
+                fclose(file);
+            }
+            return NX_NOT_SUCCESSFUL;
+        }
+    }
+
+    if (fseek(file, 0, SEEK_END) != 0 || (size = ftell(file)) < 0)
+    {
+        status = NX_NOT_SUCCESSFUL;
+    }
+    else if (size + sizeof(record_length) + length > AZURE_IOT_TELEMETRY_SPILL_FILE_SIZE)
+    {
+        status = NX_SIZE_ERROR;
+    }
+    else if (fwrite(&record_length, sizeof(record_length), 1, file) != 1 || fwrite(data, 1, length, file) != length)
+    {
+        status = NX_NOT_SUCCESSFUL;
+    }
+
+    if (fclose(file) != 0)
+    {
+        status = NX_NOT_SUCCESSFUL;
+    }
+
+    return status;
+}
+
+static UINT spill_file_peek(UCHAR* data, UINT size, UINT* length)
+{
+    SPILL_FILE_HEADER header;
+    ULONG record_length;
+    FILE* file;
+    UINT status = NX_SUCCESS;
+
+    if ((file = spill_open(&header)) == NULL)
+    {
+        return NX_NOT_FOUND;
+    }
+
+    if (fseek(file, header.read_offset, SEEK_SET) != 0 || fread(&record_length, sizeof(record_length), 1, file) != 1)
+    {
+        status = NX_NOT_FOUND;
+    }
+    else if (record_length > size)
+    {
+        status = NX_SIZE_ERROR;
+    }
+    else if (fread(data, 1, record_length, file) != record_length)
+    {
+        status = NX_NOT_SUCCESSFUL;
+    }
+
+    fclose(file);
+
+    *length = record_length;
+
+    return status;
+}
+
+static UINT spill_file_pop(VOID)
+{
+    SPILL_FILE_HEADER header;
+    ULONG record_length;
+    FILE* file;
+    long size;
+    UINT status = NX_SUCCESS;
+
+    if ((file = spill_open(&header)) == NULL)
+    {
+        return NX_SUCCESS;
+    }
+
+    if (fseek(file, header.read_offset, SEEK_SET) != 0 || fread(&record_length, sizeof(record_length), 1, file) != 1)
+    {
+        // Nothing left to read
+        fclose(file);
+        remove(AZURE_IOT_TELEMETRY_SPILL_FILE);
+        return NX_SUCCESS;
+    }
+
+    header.read_offset += sizeof(record_length) + record_length;
+
+    if (fseek(file, 0, SEEK_END) != 0 || (size = ftell(file)) < 0)
+    {
+        status = NX_NOT_SUCCESSFUL;
+    }
+    else if (header.read_offset >= (ULONG)size)
+    {
+        fclose(file);
+        remove(AZURE_IOT_TELEMETRY_SPILL_FILE);
+        return NX_SUCCESS;
+    }
+    else if (fseek(file, 0, SEEK_SET) != 0 || fwrite(&header, sizeof(header), 1, file) != 1)
+    {
+        status = NX_NOT_SUCCESSFUL;
+    }
+
+    if (fclose(file) != 0)
+    {
+        status = NX_NOT_SUCCESSFUL;
+    }
+
+    return status;
+}
+
+const AZURE_IOT_TELEMETRY_SPILL azure_iot_telemetry_spill_file = {
+    .push = spill_file_push,
+    .peek = spill_file_peek,
+    .pop  = spill_file_pop,
+};
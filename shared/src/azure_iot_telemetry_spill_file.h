@@ -0,0 +1,22 @@
+/* Copyright (c) Microsoft Corporation.
+   Licensed under the MIT License. */
+
+#ifndef _AZURE_IOT_TELEMETRY_SPILL_FILE_H
+#define _AZURE_IOT_TELEMETRY_SPILL_FILE_H
+
+#include "azure_iot_store_file.h"
+#include "azure_iot_telemetry_queue.h"
+
+// Spill queued telemetry to a file next to the store, for host builds without flash
+#ifndef AZURE_IOT_TELEMETRY_SPILL_FILE
+#define AZURE_IOT_TELEMETRY_SPILL_FILE AZURE_IOT_STORE_FILE_DIR "/telemetry.dat"
+#endif
+
+// Records beyond this are dropped rather than spilled
+#ifndef AZURE_IOT_TELEMETRY_SPILL_FILE_SIZE
+#define AZURE_IOT_TELEMETRY_SPILL_FILE_SIZE (1024 * 1024)
+#endif
+
+extern const AZURE_IOT_TELEMETRY_SPILL azure_iot_telemetry_spill_file;
+
+#endif
@@ -0,0 +1,200 @@
+/* Copyright (c) Microsoft Corporation.
+   Licensed under the MIT License. */
+
+#include "azure_iot_telemetry_stats.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#include "azure_iot_log.h"
+
+static const CHAR* stage_names[AZURE_IOT_TELEMETRY_STAGE_COUNT] = {"build", "create", "send", "total"};
+
+static ULONG tick_clock_us()
+{
+    return tx_time_get() * (1000000 / TX_TIMER_TICKS_PER_SECOND);
+}
+
+static UINT stat_bucket(ULONG value)
+{
+    UINT bucket = 0;
+
+    while (value)
+    {
+        value >>= 1;
+        bucket++;
+    }
+
+    return bucket;
+}
+
+static VOID pool_sample(AZURE_IOT_TELEMETRY_STATS* stats)
+{
+    if (stats->pool != NX_NULL && stats->pool->nx_packet_pool_available < stats->pool_available_min)
+    {
+        stats->pool_available_min = stats->pool->nx_packet_pool_available;
+    }
+}
+
+VOID azure_iot_telemetry_stats_init(
+    AZURE_IOT_TELEMETRY_STATS* stats, NX_PACKET_POOL* pool, ULONG (*clock_us)(VOID))
+{
+    stats->pool     = pool;
+    stats->clock_us = clock_us ? clock_us : tick_clock_us;
+
+    azure_iot_telemetry_stats_reset(stats);
+}
+
+VOID azure_iot_telemetry_stats_reset(AZURE_IOT_TELEMETRY_STATS* stats)
+{
+    stats->messages          = 0;
+    stats->failures          = 0;
+    stats->payload_bytes     = 0;
+    stats->payload_bytes_max = 0;
+    memset(stats->stage, 0, sizeof(stats->stage));
+
+    stats->pool_available_min = stats->pool ? stats->pool->nx_packet_pool_available : 0;
+    stats->start_us           = stats->clock_us();
+}
+
+ULONG azure_iot_telemetry_stats_now(AZURE_IOT_TELEMETRY_STATS* stats)
+{
+    return stats->clock_us();
+}
+
+VOID azure_iot_telemetry_stats_record(
+    AZURE_IOT_TELEMETRY_STATS* stats, AZURE_IOT_TELEMETRY_STAGE stage, ULONG start_us)
+{
+    AZURE_IOT_STAT* stat = &stats->stage[stage];
+    ULONG elapsed        = stats->clock_us() - start_us;
+
+    stat->count++;
+    stat->total += elapsed;
+    stat->histogram[stat_bucket(elapsed)]++;
+
+    if (elapsed > stat->max)
+    {
+        stat->max = elapsed;
+    }
+
+    // The packet is held between create and send, sample the pool at its lowest point
+    if (stage == AZURE_IOT_TELEMETRY_STAGE_CREATE)
+    {
+        pool_sample(stats);
+    }
+}
+
+VOID azure_iot_telemetry_stats_message(
+    AZURE_IOT_TELEMETRY_STATS* stats, UINT status, UINT payload_length, ULONG start_us)
+{
+    if (status != NX_SUCCESS)
+    {
+        stats->failures++;
+        return;
+    }
+
+    azure_iot_telemetry_stats_record(stats, AZURE_IOT_TELEMETRY_STAGE_TOTAL, start_us);
+
+    stats->messages++;
+    stats->payload_bytes += payload_length;
+
+    if (payload_length > stats->payload_bytes_max)
+    {
+        stats->payload_bytes_max = payload_length;
+    }
+}
+
+ULONG azure_iot_stat_percentile(const AZURE_IOT_STAT* stat, UINT percent)
+{
+    ULONG target;
+    ULONG seen = 0;
+    UINT bucket;
+
+    if (stat->count == 0)
+    {
+        return 0;
+    }
+
+    // Rank of the percentile sample, rounded up so p99 of 10 samples is the largest
+    target = (stat->count * percent + 99) / 100;
+
+    for (bucket = 0; bucket < AZURE_IOT_STAT_BUCKETS; bucket++)
+    {
+        seen += stat->histogram[bucket];
+        if (seen >= target)
+        {
+            break;
+        }
+    }
+
+    if (bucket == 0)
+    {
+        return 0;
+    }
+
+    // Bucket n holds values in [2^(n-1), 2^n), never report more than the observed maximum
+    return (bucket >= 32 || ((1UL << bucket) - 1) > stat->max) ? stat->max : ((1UL << bucket) - 1);
+}
+
+VOID azure_iot_telemetry_stats_print(AZURE_IOT_TELEMETRY_STATS* stats)
+{
+    ULONG elapsed_us = stats->clock_us() - stats->start_us;
+    UINT stage;
+
+    AZURE_IOT_LOG_INFO("\r\nTelemetry statistics\r\n");
+    AZURE_IOT_LOG_INFO("\tMessages: %lu sent, %lu failed\r\n", stats->messages, stats->failures);
+
+    if (elapsed_us > 0)
+    {
+        AZURE_IOT_LOG_INFO("\tThroughput: %lu msg/s\r\n", (ULONG)((stats->messages * 1000000ULL) / elapsed_us));
+    }
+
+    if (stats->messages > 0)
+    {
+        AZURE_IOT_LOG_INFO("\tPayload: %lu bytes average, %lu bytes max\r\n",
+            stats->payload_bytes / stats->messages,
+            stats->payload_bytes_max);
+    }
+
+    if (stats->pool != NX_NULL)
+    {
+        AZURE_IOT_LOG_INFO("\tPacket pool: %lu of %lu packets free at the low point\r\n",
+            stats->pool_available_min,
+            stats->pool->nx_packet_pool_total);
+    }
+
+    // Percentiles come from power of two buckets, each is the top of its bucket and at most twice the true value
+    AZURE_IOT_LOG_INFO("\tLatency, p50 and p99 rounded up to a power of two:\r\n");
+
+    for (stage = 0; stage < AZURE_IOT_TELEMETRY_STAGE_COUNT; stage++)
+    {
+        AZURE_IOT_STAT* stat = &stats->stage[stage];
+
+        if (stat->count == 0)
+        {
+            continue;
+        }
+
+        AZURE_IOT_LOG_INFO("\t%-6s us: avg %lu, p50 %lu, p99 %lu, max %lu\r\n",
+            stage_names[stage],
+            stat->total / stat->count,
+            azure_iot_stat_percentile(stat, 50),
+            azure_iot_stat_percentile(stat, 99),
+            stat->max);
+    }
+}
+
+UINT azure_iot_telemetry_stats_check(
+    AZURE_IOT_TELEMETRY_STATS* stats, AZURE_IOT_TELEMETRY_STAGE stage, ULONG p99_limit_us)
+{
+    ULONG p99 = azure_iot_stat_percentile(&stats->stage[stage], 99);
+
+    if (p99 > p99_limit_us)
+    {
+        AZURE_IOT_LOG_ERROR(
+            "ERROR: %s p99 latency %lu us exceeds the %lu us limit\r\n", stage_names[stage], p99, p99_limit_us);
+        return NX_NOT_SUCCESSFUL;
+    }
+
+    return NX_SUCCESS;
+}
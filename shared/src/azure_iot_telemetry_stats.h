@@ -0,0 +1,66 @@
+/* Copyright (c) Microsoft Corporation.
+   Licensed under the MIT License. */
+
+#ifndef _AZURE_IOT_TELEMETRY_STATS_H
+#define _AZURE_IOT_TELEMETRY_STATS_H
+
+#include "nx_api.h"
+
+// One bucket per power of two, enough for any 32-bit microsecond latency
+#define AZURE_IOT_STAT_BUCKETS 33
+
+typedef enum AZURE_IOT_TELEMETRY_STAGE_ENUM
+{
+    AZURE_IOT_TELEMETRY_STAGE_BUILD,  // append callback and JSON writer
+    AZURE_IOT_TELEMETRY_STAGE_CREATE, // packet allocation, component and property bag
+    AZURE_IOT_TELEMETRY_STAGE_SEND,   // MQTT publish
+    AZURE_IOT_TELEMETRY_STAGE_TOTAL,
+    AZURE_IOT_TELEMETRY_STAGE_COUNT
+} AZURE_IOT_TELEMETRY_STAGE;
+
+typedef struct AZURE_IOT_STAT_STRUCT
+{
+    ULONG count;
+    ULONG total;
+    ULONG max;
+    ULONG histogram[AZURE_IOT_STAT_BUCKETS];
+} AZURE_IOT_STAT;
+
+typedef struct AZURE_IOT_TELEMETRY_STATS_STRUCT
+{
+    // Free running microsecond clock, defaults to the ThreadX tick which is too coarse for single messages
+    ULONG (*clock_us)(VOID);
+    ULONG start_us;
+
+    NX_PACKET_POOL* pool;
+    ULONG pool_available_min;
+
+    ULONG messages;
+    ULONG failures;
+    ULONG payload_bytes;
+    ULONG payload_bytes_max;
+
+    AZURE_IOT_STAT stage[AZURE_IOT_TELEMETRY_STAGE_COUNT];
+} AZURE_IOT_TELEMETRY_STATS;
+
+VOID azure_iot_telemetry_stats_init(
+    AZURE_IOT_TELEMETRY_STATS* stats, NX_PACKET_POOL* pool, ULONG (*clock_us)(VOID));
+VOID azure_iot_telemetry_stats_reset(AZURE_IOT_TELEMETRY_STATS* stats);
+
+ULONG azure_iot_telemetry_stats_now(AZURE_IOT_TELEMETRY_STATS* stats);
+VOID azure_iot_telemetry_stats_record(
+    AZURE_IOT_TELEMETRY_STATS* stats, AZURE_IOT_TELEMETRY_STAGE stage, ULONG start_us);
+VOID azure_iot_telemetry_stats_message(
+    AZURE_IOT_TELEMETRY_STATS* stats, UINT status, UINT payload_length, ULONG start_us);
+
+// Upper bound of the histogram bucket holding the given percentile, 2^n - 1 or the maximum if lower. The true
+// percentile lies between half that and the value returned, so compare limits and runs with that in mind.
+ULONG azure_iot_stat_percentile(const AZURE_IOT_STAT* stat, UINT percent);
+
+VOID azure_iot_telemetry_stats_print(AZURE_IOT_TELEMETRY_STATS* stats);
+
+// Returns NX_NOT_SUCCESSFUL if the p99 latency of the stage exceeds the limit, for gating performance changes
+UINT azure_iot_telemetry_stats_check(
+    AZURE_IOT_TELEMETRY_STATS* stats, AZURE_IOT_TELEMETRY_STAGE stage, ULONG p99_limit_us);
+
+#endif
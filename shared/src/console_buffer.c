@@ -0,0 +1,112 @@
+/* Copyright (c) Microsoft Corporation.
+   Licensed under the MIT License. */
+
+#include "console_buffer.h"
+
+#include <string.h>
+
+// Ring of pending output. Writers and the interrupt both run with interrupts disabled, so the
+// indices need no further synchronization. head and tail grow freely and wrap on UINT overflow.
+static UCHAR console_ring[CONSOLE_BUFFER_SIZE];
+static UINT ring_head;
+static UINT ring_tail;
+static UINT in_flight;
+
+static func_ptr_console_transmit console_transmit;
+
+static ULONG dropped_bytes;
+static ULONG dropped_writes;
+
+static VOID transmit_next(VOID)
+{
+    UINT offset = ring_tail % CONSOLE_BUFFER_SIZE;
+    UINT length = ring_head - ring_tail;
+
+    if (in_flight || length == 0 || console_transmit == TX_NULL)
+    {
+        return;
+    }
+
+    // Send up to the end of the ring, the rest follows from the completion
+    if (length > CONSOLE_BUFFER_SIZE - offset)
+    {
+        length = CONSOLE_BUFFER_SIZE - offset;
+    }
+
+    in_flight = length;
+    console_transmit(&console_ring[offset], length);
+}
+
+VOID console_buffer_init(func_ptr_console_transmit transmit)
+{
+    TX_INTERRUPT_SAVE_AREA
+
+    TX_DISABLE
+
+    console_transmit = transmit;
+
+    // Output queued before the board could send it would otherwise wait for the next write
+    transmit_next();
+
+    TX_RESTORE
+}
+
+UINT console_buffer_write(const CHAR* data, UINT length)
+{
+    TX_INTERRUPT_SAVE_AREA
+    UINT offset;
+    UINT first;
+
+    TX_DISABLE
+
+    if (length > CONSOLE_BUFFER_SIZE - (ring_head - ring_tail))
+    {
+        dropped_bytes += length;
+        dropped_writes++;
+
+        TX_RESTORE
+        return 0;
+    }
+
+    offset = ring_head % CONSOLE_BUFFER_SIZE;
+    first  = length < CONSOLE_BUFFER_SIZE - offset ? length : CONSOLE_BUFFER_SIZE - offset;
+
+    memcpy(&console_ring[offset], data, first);
+    memcpy(console_ring, data + first, length - first);
+    ring_head += length;
+
+    transmit_next();
+
+    TX_RESTORE
+
+    return length;
+}
+
+VOID console_buffer_transmit_complete(VOID)
+{
+    TX_INTERRUPT_SAVE_AREA
+
+    TX_DISABLE
+
+    ring_tail += in_flight;
+    in_flight = 0;
+
+    transmit_next();
+
+    TX_RESTORE
+}
+
+UINT console_buffer_in_flight(VOID)
+{
+    return in_flight;
+}
+
+ULONG console_buffer_dropped_bytes(VOID)
+{
+    return dropped_bytes;
+}
+
+ULONG console_buffer_dropped_writes(VOID)
+{
+    return dropped_writes;
+}
@@ -0,0 +1,35 @@
+/* Copyright (c) Microsoft Corporation.
+   Licensed under the MIT License. */
+
+#ifndef _CONSOLE_BUFFER_H
+#define _CONSOLE_BUFFER_H
+
+#include "tx_api.h"
+
+// Must be a power of two
+#ifndef CONSOLE_BUFFER_SIZE
+#define CONSOLE_BUFFER_SIZE 4096
+#endif
+
+// Start sending length bytes, the board calls console_buffer_transmit_complete once they are out.
+// Called with interrupts disabled, so it may only kick off a DMA or interrupt driven transfer.
+typedef VOID (*func_ptr_console_transmit)(const UCHAR* data, UINT length);
+
+// Set the transmit function and start sending what was queued before
+VOID console_buffer_init(func_ptr_console_transmit transmit);
+
+// Queue console output, for the board's _write. Writes that do not fit are dropped whole and counted,
+// so the caller never waits for the serial line. Returns the number of bytes queued.
+UINT console_buffer_write(const CHAR* data, UINT length);
+
+// From the transmit complete interrupt of the board
+VOID console_buffer_transmit_complete(VOID);
+
+// Bytes handed to the transmit function and not yet completed, 0 when the line is idle
+UINT console_buffer_in_flight(VOID);
+
+// Bytes and writes dropped because the buffer was full
+ULONG console_buffer_dropped_bytes(VOID);
+ULONG console_buffer_dropped_writes(VOID);
+
+#endif
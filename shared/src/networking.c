@@ -10,6 +10,7 @@
 #include "nxd_dhcp_client.h"
 #include "nxd_dns.h"
 
+#include "azure_iot_log.h"
 #include "sntp_client.h"
 
 #define NETX_IP_STACK_SIZE  2048
@@ -37,7 +38,7 @@ NX_DNS nx_dns_client;
 // Print IPv4 address
 static void print_address(CHAR* preable, ULONG address)
 {
-    printf("\t%s: %d.%d.%d.%d\r\n",
+    AZURE_IOT_LOG_INFO("\t%s: %d.%d.%d.%d\r\n",
         preable,
         (uint8_t)(address >> 24),
         (uint8_t)(address >> 16 & 0xFF),
@@ -50,7 +51,7 @@ static void print_mac()
     const ULONG lsw = nx_ip.nx_ip_gateway_interface->nx_interface_physical_address_lsw;
     const ULONG msw = nx_ip.nx_ip_gateway_interface->nx_interface_physical_address_msw;
 
-    printf("\tMAC: %02X:%02X:%02X:%02X:%02X:%02X\r\n",
+    AZURE_IOT_LOG_INFO("\tMAC: %02X:%02X:%02X:%02X:%02X:%02X\r\n",
         (uint8_t)(msw >> 8 & 0xFF),
         (uint8_t)(msw & 0xFF),
         (uint8_t)(lsw >> 24 & 0xFF),
@@ -67,11 +68,11 @@ static UINT dhcp_connect()
     ULONG network_mask;
     ULONG gateway_address;
 
-    printf("\r\nInitializing DHCP\r\n");
+    AZURE_IOT_LOG_INFO("\r\nInitializing DHCP\r\n");
 
     if ((status = nx_dhcp_force_renew(&nx_dhcp_client)))
     {
-        printf("ERROR: nx_dhcp_force_renew (0x%08x\r\n", status);
+        AZURE_IOT_LOG_ERROR("ERROR: nx_dhcp_force_renew (0x%08x\r\n", status);
         return status;
     }
 
@@ -79,7 +80,7 @@ static UINT dhcp_connect()
     if ((status = nx_ip_status_check(&nx_ip, NX_IP_ADDRESS_RESOLVED, &actual_status, DHCP_WAIT_TIME_TICKS)))
     {
         // DHCP Failed...  no IP address!
-        printf("ERROR: Can't resolve DHCP address (0x%08x\r\n", status);
+        AZURE_IOT_LOG_ERROR("ERROR: Can't resolve DHCP address (0x%08x\r\n", status);
         return status;
     }
 
@@ -93,7 +94,7 @@ static UINT dhcp_connect()
     print_address("Mask", network_mask);
     print_address("Gateway", gateway_address);
 
-    printf("SUCCESS: DHCP initialized\r\n");
+    AZURE_IOT_LOG_INFO("SUCCESS: DHCP initialized\r\n");
 
     return NX_SUCCESS;
 }
@@ -104,19 +105,19 @@ static UINT dns_connect()
     ULONG dns_server_address[NETX_DNS_COUNT] = {0};
     UINT dns_server_address_size             = sizeof(UINT) * NETX_DNS_COUNT;
 
-    printf("\r\nInitializing DNS client\r\n");
+    AZURE_IOT_LOG_INFO("\r\nInitializing DNS client\r\n");
 
     // Retrieve DNS server address
     if ((status = nx_dhcp_interface_user_option_retrieve(
              &nx_dhcp_client, 0, NX_DHCP_OPTION_DNS_SVR, (UCHAR*)dns_server_address, &dns_server_address_size)))
     {
-        printf("ERROR: nx_dhcp_interface_user_option_retrieve (0x%08x)\r\n", status);
+        AZURE_IOT_LOG_ERROR("ERROR: nx_dhcp_interface_user_option_retrieve (0x%08x)\r\n", status);
         return status;
     }
 
     if ((status = nx_dns_server_remove_all(&nx_dns_client)))
     {
-        printf("ERROR: nx_dns_server_remove_all (0x%08x)\r\n", status);
+        AZURE_IOT_LOG_ERROR("ERROR: nx_dns_server_remove_all (0x%08x)\r\n", status);
         return status;
     }
 
@@ -127,12 +128,12 @@ static UINT dns_connect()
         // Add an IPv4 server address to the Client list
         if ((status = nx_dns_server_add(&nx_dns_client, dns_server_address[i])))
         {
-            printf("ERROR: nx_dns_server_add (0x%08x)\r\n", status);
+            AZURE_IOT_LOG_ERROR("ERROR: nx_dns_server_add (0x%08x)\r\n", status);
             return status;
         }
     }
 
-    printf("SUCCESS: DNS client initialized\r\n");
+    AZURE_IOT_LOG_INFO("SUCCESS: DNS client initialized\r\n");
 
     return NX_SUCCESS;
 }
@@ -147,7 +148,7 @@ UINT network_init(VOID (*ip_link_driver)(struct NX_IP_DRIVER_STRUCT*))
     // Create a packet pool.
     if ((status = nx_packet_pool_create(&nx_pool, "NetX Packet Pool", NETX_PACKET_SIZE, netx_ip_pool, NETX_POOL_SIZE)))
     {
-        printf("ERROR: nx_packet_pool_create (0x%08x)\r\n", status);
+        AZURE_IOT_LOG_ERROR("ERROR: nx_packet_pool_create (0x%08x)\r\n", status);
     }
 
     // Create an IP instance
@@ -162,7 +163,7 @@ UINT network_init(VOID (*ip_link_driver)(struct NX_IP_DRIVER_STRUCT*))
                   1)))
     {
         nx_packet_pool_delete(&nx_pool);
-        printf("ERROR: nx_ip_create (0x%08x)\r\n", status);
+        AZURE_IOT_LOG_ERROR("ERROR: nx_ip_create (0x%08x)\r\n", status);
     }
 
     // Enable ARP and supply ARP cache memory
@@ -170,7 +171,7 @@ UINT network_init(VOID (*ip_link_driver)(struct NX_IP_DRIVER_STRUCT*))
     {
         nx_ip_delete(&nx_ip);
         nx_packet_pool_delete(&nx_pool);
-        printf("ERROR: nx_arp_enable (0x%08x)\r\n", status);
+        AZURE_IOT_LOG_ERROR("ERROR: nx_arp_enable (0x%08x)\r\n", status);
     }
 
     // Enable TCP traffic
@@ -178,7 +179,7 @@ UINT network_init(VOID (*ip_link_driver)(struct NX_IP_DRIVER_STRUCT*))
     {
         nx_ip_delete(&nx_ip);
         nx_packet_pool_delete(&nx_pool);
-        printf("ERROR: nx_tcp_enable (0x%08x)\r\n", status);
+        AZURE_IOT_LOG_ERROR("ERROR: nx_tcp_enable (0x%08x)\r\n", status);
         return status;
     }
 
@@ -187,7 +188,7 @@ UINT network_init(VOID (*ip_link_driver)(struct NX_IP_DRIVER_STRUCT*))
     {
         nx_ip_delete(&nx_ip);
         nx_packet_pool_delete(&nx_pool);
-        printf("ERROR: nx_udp_enable (0x%08x)\r\n", status);
+        AZURE_IOT_LOG_ERROR("ERROR: nx_udp_enable (0x%08x)\r\n", status);
     }
 
     // Enable ICMP traffic
@@ -195,7 +196,7 @@ UINT network_init(VOID (*ip_link_driver)(struct NX_IP_DRIVER_STRUCT*))
     {
         nx_ip_delete(&nx_ip);
         nx_packet_pool_delete(&nx_pool);
-        printf("ERROR: nx_icmp_enable (0x%08x)\r\n", status);
+        AZURE_IOT_LOG_ERROR("ERROR: nx_icmp_enable (0x%08x)\r\n", status);
     }
 
     // Create the DHCP instance.
@@ -203,7 +204,7 @@ UINT network_init(VOID (*ip_link_driver)(struct NX_IP_DRIVER_STRUCT*))
     {
         nx_ip_delete(&nx_ip);
         nx_packet_pool_delete(&nx_pool);
-        printf("ERROR: nx_dhcp_create (0x%08x)\r\n", status);
+        AZURE_IOT_LOG_ERROR("ERROR: nx_dhcp_create (0x%08x)\r\n", status);
     }
 
     // Start the DHCP Client
@@ -212,7 +213,7 @@ UINT network_init(VOID (*ip_link_driver)(struct NX_IP_DRIVER_STRUCT*))
         nx_dhcp_delete(&nx_dhcp_client);
         nx_ip_delete(&nx_ip);
         nx_packet_pool_delete(&nx_pool);
-        printf("ERROR: nx_dhcp_start (0x%08x)\r\n", status);
+        AZURE_IOT_LOG_ERROR("ERROR: nx_dhcp_start (0x%08x)\r\n", status);
     }
 
     // Create DNS
@@ -221,7 +222,7 @@ UINT network_init(VOID (*ip_link_driver)(struct NX_IP_DRIVER_STRUCT*))
         nx_dhcp_delete(&nx_dhcp_client);
         nx_ip_delete(&nx_ip);
         nx_packet_pool_delete(&nx_pool);
-        printf("ERROR: nx_dns_create (0x%08x)\r\n", status);
+        AZURE_IOT_LOG_ERROR("ERROR: nx_dns_create (0x%08x)\r\n", status);
     }
 
     // Use the packet pool here
@@ -232,14 +233,14 @@ UINT network_init(VOID (*ip_link_driver)(struct NX_IP_DRIVER_STRUCT*))
         nx_dhcp_delete(&nx_dhcp_client);
         nx_ip_delete(&nx_ip);
         nx_packet_pool_delete(&nx_pool);
-        printf("ERROR: nx_dns_packet_pool_set (%0x08)\r\n", status);
+        AZURE_IOT_LOG_ERROR("ERROR: nx_dns_packet_pool_set (%0x08)\r\n", status);
     }
 #endif
 
     // Initialize the SNTP client
     else if ((status = sntp_init()))
     {
-        printf("ERROR: Failed to init the SNTP client (0x%08x)\r\n", status);
+        AZURE_IOT_LOG_ERROR("ERROR: Failed to init the SNTP client (0x%08x)\r\n", status);
     }
 
     // Initialize TLS
@@ -258,19 +259,19 @@ UINT network_connect()
     // Fetch IP details
     if ((status = dhcp_connect()))
     {
-        printf("ERROR: dhcp_connect\r\n");
+        AZURE_IOT_LOG_ERROR("ERROR: dhcp_connect\r\n");
     }
 
     // Create DNS
     else if ((status = dns_connect()))
     {
-        printf("ERROR: dns_connect\r\n");
+        AZURE_IOT_LOG_ERROR("ERROR: dns_connect\r\n");
     }
 
     // Wait for an SNTP sync
     else if ((status = sntp_sync()))
     {
-        printf("ERROR: Failed to sync SNTP time (0x%08x)\r\n", status);
+        AZURE_IOT_LOG_ERROR("ERROR: Failed to sync SNTP time (0x%08x)\r\n", status);
     }
 
     return status;
@@ -0,0 +1,545 @@
+/* Copyright (c) Microsoft Corporation.
+   Licensed under the MIT License. */
+
+#include "sensor_registry.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "nx_azure_iot.h"
+
+#include "azure_iot_log.h"
+
+// ThreadX targets are single core, so ordering the ring against the compiler is enough
+#define RING_BARRIER() __asm volatile("" ::: "memory")
+
+// Enough for one milli unit once readings are in the model unit, e.g. 1 mg as 0.001 gForce
+#define JSON_DECIMALS 3
+
+// Newton steps after the bit level estimate, each one doubles the correct bits of the 4% first guess
+#define SQRT_ITERATIONS 3
+
+typedef struct SENSOR_UNIT_STRUCT
+{
+    const CHAR* name;
+    float factor;
+    UINT quantity;
+} SENSOR_UNIT;
+
+// DTDL units the sensors report, with their factor to the first unit of the same quantity
+static const SENSOR_UNIT units[] = {
+    {"degreeCelsius", 1.0f, 0},
+    {"percent", 1.0f, 1},
+    {"pascal", 1.0f, 2},
+    {"bar", 100000.0f, 2},
+    {"gauss", 1.0f, 3},
+    {"gForce", 1.0f, 4},
+    {"degreePerSecond", 1.0f, 5},
+    {"lux", 1.0f, 6},
+};
+
+static const SENSOR_UNIT unit_prefixes[] = {
+    {"micro", 0.000001f, 0},
+    {"milli", 0.001f, 0},
+    {"centi", 0.01f, 0},
+    {"hecto", 100.0f, 0},
+    {"kilo", 1000.0f, 0},
+};
+
+static const SENSOR_UNIT* unit_find(const CHAR* name, float* factor)
+{
+    *factor = 1.0f;
+
+    for (UINT i = 0; i < sizeof(unit_prefixes) / sizeof(unit_prefixes[0]); i++)
+    {
+        UINT length = strlen(unit_prefixes[i].name);
+
+        if (strncmp(name, unit_prefixes[i].name, length) == 0)
+        {
+            name += length;
+            *factor = unit_prefixes[i].factor;
+            break;
+        }
+    }
+
+    for (UINT i = 0; i < sizeof(units) / sizeof(units[0]); i++)
+    {
+        if (strcmp(name, units[i].name) == 0)
+        {
+            *factor *= units[i].factor;
+            return &units[i];
+        }
+    }
+
+    return NX_NULL;
+}
+
+static bool unit_scale(const SENSOR_CHANNEL_DESCRIPTOR* channel, float* scale)
+{
+    const SENSOR_UNIT* unit;
+    const SENSOR_UNIT* raw_unit;
+    float unit_factor;
+    float raw_factor;
+
+    *scale = 1.0f;
+
+    if (channel->unit == NX_NULL || channel->raw_unit == NX_NULL || strcmp(channel->unit, channel->raw_unit) == 0)
+    {
+        return true;
+    }
+
+    unit     = unit_find(channel->unit, &unit_factor);
+    raw_unit = unit_find(channel->raw_unit, &raw_factor);
+    if (unit == NX_NULL || raw_unit == NX_NULL || unit->quantity != raw_unit->quantity)
+    {
+        return false;
+    }
+
+    *scale = raw_factor / unit_factor;
+
+    return true;
+}
+
+// Square root without libm, the estimate halves the exponent in the bit pattern of the float
+static float sqrt_newton(float value)
+{
+    union
+    {
+        float f;
+        uint32_t i;
+    } estimate = {value};
+
+    if (value <= 0)
+    {
+        return 0;
+    }
+
+    estimate.i = 0x1fbd1df5 + (estimate.i >> 1);
+
+    for (UINT i = 0; i < SQRT_ITERATIONS; i++)
+    {
+        estimate.f = 0.5f * (estimate.f + value / estimate.f);
+    }
+
+    return estimate.f;
+}
+
+static VOID stats_add(SENSOR_STATS* stats, float value, ULONG ticks)
+{
+    // Welford's update against the running mean of the window, stats only ever holds one window here
+    float deviation = stats->count ? value - stats->sum / stats->count : 0;
+
+    if (stats->count == 0)
+    {
+        stats->first_ticks = ticks;
+    }
+
+    if (stats->count == 0 || value < stats->min)
+    {
+        stats->min = value;
+    }
+
+    if (stats->count == 0 || value > stats->max)
+    {
+        stats->max = value;
+    }
+
+    stats->last_ticks = ticks;
+    stats->sum += value;
+    stats->count++;
+    stats->deviation_squares += deviation * (value - stats->sum / stats->count);
+}
+
+static VOID stats_merge(SENSOR_STATS* stats, const SENSOR_STATS* other)
+{
+    if (other->count == 0)
+    {
+        return;
+    }
+
+    if (stats->count == 0)
+    {
+        stats->first_ticks = other->first_ticks;
+    }
+
+    if (stats->count == 0 || other->min < stats->min)
+    {
+        stats->min = other->min;
+    }
+
+    if (stats->count == 0 || other->max > stats->max)
+    {
+        stats->max = other->max;
+    }
+
+    stats->last_ticks = other->last_ticks;
+    stats->sum += other->sum;
+    stats->deviation_squares += other->deviation_squares;
+    stats->count += other->count;
+}
+
+static const SENSOR_CHANNEL_DESCRIPTOR* channel_descriptor(SENSOR_REGISTRY* registry, UINT channel)
+{
+    for (UINT i = 0; i < registry->sensor_count; i++)
+    {
+        if (channel < registry->sensors[i].channel_count)
+        {
+            return &registry->sensors[i].channels[channel];
+        }
+
+        channel -= registry->sensors[i].channel_count;
+    }
+
+    return NX_NULL;
+}
+
+#ifdef ENABLE_SENSOR_REGISTRY_THREAD
+static VOID window_publish(SENSOR_REGISTRY* registry)
+{
+    UINT head = registry->ring_head;
+
+    // When the collector falls behind, keep extending the current window rather than dropping samples
+    if (head - registry->ring_tail == SENSOR_REGISTRY_RING_DEPTH)
+    {
+        return;
+    }
+
+    registry->ring[head % SENSOR_REGISTRY_RING_DEPTH] = registry->current;
+
+    RING_BARRIER();
+    registry->ring_head = head + 1;
+
+    memset(&registry->current, 0, sizeof(registry->current));
+}
+#else
+// The collector runs on the sampling thread, so a completed window goes straight into the aggregates
+static VOID window_publish(SENSOR_REGISTRY* registry)
+{
+    for (UINT channel = 0; channel < registry->channel_count; channel++)
+    {
+        stats_merge(&registry->collected[channel], &registry->current.channels[channel]);
+    }
+
+    registry->windows_completed++;
+
+    memset(&registry->current, 0, sizeof(registry->current));
+}
+#endif
+
+static VOID sample_sensor(SENSOR_REGISTRY* registry, UINT index, UINT first_channel, ULONG now)
+{
+    const SENSOR_DESCRIPTOR* sensor = &registry->sensors[index];
+    SENSOR_STATS* stats             = &registry->current.channels[first_channel];
+    const float* scale              = &registry->scale[first_channel];
+    UINT samples = sensor->read(registry->values, SENSOR_REGISTRY_SAMPLE_VALUES / sensor->channel_count);
+
+    // A batch drained from a FIFO was taken evenly since the previous read, the newest sample just now
+    ULONG span = registry->sampled[index] ? now - registry->last_sample_ticks[index] : 0;
+
+    for (UINT sample = 0; sample < samples; sample++)
+    {
+        float* values = &registry->values[sample * sensor->channel_count];
+        ULONG ticks   = now - span * (samples - 1 - sample) / samples;
+
+        for (UINT channel = 0; channel < sensor->channel_count; channel++)
+        {
+            stats_add(&stats[channel], values[channel] * scale[channel], ticks);
+        }
+    }
+}
+
+#ifdef ENABLE_SENSOR_REGISTRY_THREAD
+static VOID sensor_registry_thread_entry(ULONG parameter)
+{
+    SENSOR_REGISTRY* registry = (SENSOR_REGISTRY*)parameter;
+
+    while (true)
+    {
+        sensor_registry_sample(registry);
+        tx_thread_sleep(registry->poll_ticks);
+    }
+}
+#endif
+
+UINT sensor_registry_init(
+    SENSOR_REGISTRY* registry, const SENSOR_DESCRIPTOR* sensors, UINT sensor_count, ULONG window_ticks)
+{
+    UINT channel_count = 0;
+    float* scale;
+
+    if (registry == NX_NULL || sensors == NX_NULL || sensor_count > SENSOR_REGISTRY_MAX_SENSORS)
+    {
+        return NX_PTR_ERROR;
+    }
+
+    for (UINT i = 0; i < sensor_count; i++)
+    {
+        if (sensors[i].read == NX_NULL || sensors[i].channel_count == 0 ||
+            sensors[i].channel_count > SENSOR_REGISTRY_SAMPLE_VALUES)
+        {
+            return NX_PTR_ERROR;
+        }
+
+        channel_count += sensors[i].channel_count;
+    }
+
+    if (channel_count > SENSOR_REGISTRY_MAX_CHANNELS)
+    {
+        AZURE_IOT_LOG_ERROR("ERROR: %u sensor channels exceed SENSOR_REGISTRY_MAX_CHANNELS\r\n", channel_count);
+        return NX_SIZE_ERROR;
+    }
+
+    memset(registry, 0, sizeof(SENSOR_REGISTRY));
+
+    scale = registry->scale;
+    for (UINT i = 0; i < sensor_count; i++)
+    {
+        for (UINT channel = 0; channel < sensors[i].channel_count; channel++)
+        {
+            if (!unit_scale(&sensors[i].channels[channel], scale++))
+            {
+                AZURE_IOT_LOG_ERROR("ERROR: cannot convert %s from %s to %s\r\n",
+                    sensors[i].channels[channel].name,
+                    sensors[i].channels[channel].raw_unit,
+                    sensors[i].channels[channel].unit);
+                return NX_OPTION_ERROR;
+            }
+        }
+    }
+
+    registry->sensors            = sensors;
+    registry->sensor_count       = sensor_count;
+    registry->channel_count      = channel_count;
+    registry->window_ticks       = window_ticks;
+    registry->window_start_ticks = tx_time_get();
+
+    return NX_SUCCESS;
+}
+
+#ifdef ENABLE_SENSOR_REGISTRY_THREAD
+UINT sensor_registry_start(SENSOR_REGISTRY* registry, UINT priority)
+{
+    UINT status;
+
+    registry->poll_ticks = registry->window_ticks;
+    for (UINT i = 0; i < registry->sensor_count; i++)
+    {
+        if (registry->sensors[i].sample_period_ticks > 0 && registry->sensors[i].sample_period_ticks < registry->poll_ticks)
+        {
+            registry->poll_ticks = registry->sensors[i].sample_period_ticks;
+        }
+    }
+
+    if (registry->poll_ticks == 0)
+    {
+        registry->poll_ticks = 1;
+    }
+
+    if ((status = tx_mutex_create(&registry->bus_mutex, "Sensor bus", TX_INHERIT)))
+    {
+        AZURE_IOT_LOG_ERROR("ERROR: sensor bus mutex create failed (0x%08x)\r\n", status);
+        return status;
+    }
+
+    registry->bus_mutex_created = true;
+
+    if ((status = tx_thread_create(&registry->thread,
+             "Sensor Registry",
+             sensor_registry_thread_entry,
+             (ULONG)registry,
+             registry->thread_stack,
+             SENSOR_REGISTRY_STACK_SIZE,
+             priority,
+             priority,
+             TX_NO_TIME_SLICE,
+             TX_AUTO_START)))
+    {
+        AZURE_IOT_LOG_ERROR("ERROR: sensor registry thread create failed (0x%08x)\r\n", status);
+    }
+
+    return status;
+}
+#endif
+
+VOID sensor_registry_sample(SENSOR_REGISTRY* registry)
+{
+    UINT first_channel = 0;
+    ULONG now;
+
+    sensor_registry_bus_lock(registry);
+
+    for (UINT i = 0; i < registry->sensor_count; i++)
+    {
+        const SENSOR_DESCRIPTOR* sensor = &registry->sensors[i];
+
+        now = tx_time_get();
+        if (!registry->sampled[i] || now - registry->last_sample_ticks[i] >= sensor->sample_period_ticks)
+        {
+            sample_sensor(registry, i, first_channel, now);
+
+            registry->sampled[i]           = true;
+            registry->last_sample_ticks[i] = now;
+        }
+
+        first_channel += sensor->channel_count;
+    }
+
+    sensor_registry_bus_unlock(registry);
+
+    now = tx_time_get();
+    if (now - registry->window_start_ticks >= registry->window_ticks)
+    {
+        window_publish(registry);
+        registry->window_start_ticks = now;
+    }
+}
+
+UINT sensor_registry_collect(SENSOR_REGISTRY* registry)
+{
+#ifndef ENABLE_SENSOR_REGISTRY_THREAD
+    UINT windows = registry->windows_completed;
+
+    registry->windows_completed = 0;
+
+    return windows;
+#else
+    UINT head    = registry->ring_head;
+    UINT tail    = registry->ring_tail;
+    UINT windows = head - tail;
+
+    RING_BARRIER();
+
+    for (; tail != head; tail++)
+    {
+        SENSOR_WINDOW* window = &registry->ring[tail % SENSOR_REGISTRY_RING_DEPTH];
+
+        for (UINT channel = 0; channel < registry->channel_count; channel++)
+        {
+            stats_merge(&registry->collected[channel], &window->channels[channel]);
+        }
+    }
+
+    RING_BARRIER();
+    registry->ring_tail = tail;
+
+    return windows;
+#endif
+}
+
+const SENSOR_STATS* sensor_registry_stats(SENSOR_REGISTRY* registry, UINT channel)
+{
+    return channel < registry->channel_count ? &registry->collected[channel] : NX_NULL;
+}
+
+VOID sensor_registry_reset(SENSOR_REGISTRY* registry, UINT first_channel, UINT count)
+{
+    for (UINT channel = first_channel; channel < first_channel + count && channel < registry->channel_count; channel++)
+    {
+        sensor_stats_reset(&registry->collected[channel]);
+    }
+}
+
+UINT sensor_registry_append_json(
+    SENSOR_REGISTRY* registry, NX_AZURE_IOT_JSON_WRITER* json_writer, UINT first_channel, UINT count)
+{
+    UINT status;
+
+    for (UINT channel = first_channel; channel < first_channel + count && channel < registry->channel_count; channel++)
+    {
+        const SENSOR_CHANNEL_DESCRIPTOR* descriptor = channel_descriptor(registry, channel);
+
+        // Leave out channels without samples rather than report a made up zero
+        if (registry->collected[channel].count == 0)
+        {
+            continue;
+        }
+
+        if ((status = nx_azure_iot_json_writer_append_property_with_double_value(json_writer,
+                 (const UCHAR*)descriptor->name,
+                 strlen(descriptor->name),
+                 sensor_stats_mean(&registry->collected[channel]),
+                 JSON_DECIMALS)))
+        {
+            return status;
+        }
+
+        if (descriptor->rms_name &&
+            (status = nx_azure_iot_json_writer_append_property_with_double_value(json_writer,
+                 (const UCHAR*)descriptor->rms_name,
+                 strlen(descriptor->rms_name),
+                 sensor_stats_rms(&registry->collected[channel]),
+                 JSON_DECIMALS)))
+        {
+            return status;
+        }
+    }
+
+    return NX_AZURE_IOT_SUCCESS;
+}
+
+UINT sensor_registry_append_cbor(
+    SENSOR_REGISTRY* registry, AZURE_IOT_CBOR_WRITER* cbor_writer, UINT first_channel, UINT count)
+{
+    UINT status;
+
+    for (UINT channel = first_channel; channel < first_channel + count && channel < registry->channel_count; channel++)
+    {
+        const SENSOR_CHANNEL_DESCRIPTOR* descriptor = channel_descriptor(registry, channel);
+
+        if (registry->collected[channel].count == 0)
+        {
+            continue;
+        }
+
+        if ((status = azure_iot_cbor_writer_append_property_with_double_value(
+                 cbor_writer, descriptor->key, sensor_stats_mean(&registry->collected[channel]))))
+        {
+            return status;
+        }
+
+        if (descriptor->rms_name && (status = azure_iot_cbor_writer_append_property_with_double_value(cbor_writer,
+                                         descriptor->rms_key,
+                                         sensor_stats_rms(&registry->collected[channel]))))
+        {
+            return status;
+        }
+    }
+
+    return NX_AZURE_IOT_SUCCESS;
+}
+
+VOID sensor_registry_bus_lock(SENSOR_REGISTRY* registry)
+{
+#ifdef ENABLE_SENSOR_REGISTRY_THREAD
+    if (registry->bus_mutex_created)
+    {
+        tx_mutex_get(&registry->bus_mutex, TX_WAIT_FOREVER);
+    }
+#endif
+}
+
+VOID sensor_registry_bus_unlock(SENSOR_REGISTRY* registry)
+{
+#ifdef ENABLE_SENSOR_REGISTRY_THREAD
+    if (registry->bus_mutex_created)
+    {
+        tx_mutex_put(&registry->bus_mutex);
+    }
+#endif
+}
+
+VOID sensor_stats_reset(SENSOR_STATS* stats)
+{
+    memset(stats, 0, sizeof(SENSOR_STATS));
+}
+
+float sensor_stats_mean(const SENSOR_STATS* stats)
+{
+    return stats->count ? stats->sum / stats->count : 0;
+}
+
+float sensor_stats_rms(const SENSOR_STATS* stats)
+{
+    return stats->count ? sqrt_newton(stats->deviation_squares / stats->count) : 0;
+}
@@ -0,0 +1,167 @@
+/* Copyright (c) Microsoft Corporation.
+   Licensed under the MIT License. */
+
+#ifndef _SENSOR_REGISTRY_H
+#define _SENSOR_REGISTRY_H
+
+#include <stdbool.h>
+
+#include "tx_api.h"
+
+#include "nx_azure_iot_json_writer.h"
+
+#include "azure_iot_cbor.h"
+
+#define SENSOR_REGISTRY_MAX_SENSORS  8
+#define SENSOR_REGISTRY_MAX_CHANNELS 16
+
+#ifdef ENABLE_SENSOR_REGISTRY_THREAD
+// Values one read may return, channel count times samples, sized for draining an IMU FIFO
+#ifndef SENSOR_REGISTRY_SAMPLE_VALUES
+#define SENSOR_REGISTRY_SAMPLE_VALUES 576
+#endif
+
+// Completed windows waiting to be collected
+#define SENSOR_REGISTRY_RING_DEPTH 8
+
+#define SENSOR_REGISTRY_STACK_SIZE 1536
+#else
+// Sampled on the caller's thread, one sample of every channel per read
+#ifndef SENSOR_REGISTRY_SAMPLE_VALUES
+#define SENSOR_REGISTRY_SAMPLE_VALUES SENSOR_REGISTRY_MAX_CHANNELS
+#endif
+#endif
+
+typedef struct SENSOR_STATS_STRUCT
+{
+    float min;
+    float max;
+    float sum;
+
+    // Squared deviations of each sample from the mean of its window, so a static offset such as gravity drops out
+    float deviation_squares;
+    UINT count;
+
+    // Tick counts of the first and last sample
+    ULONG first_ticks;
+    ULONG last_ticks;
+} SENSOR_STATS;
+
+typedef struct SENSOR_CHANNEL_DESCRIPTOR_STRUCT
+{
+    // Telemetry name and its DTDL unit, NULL when the model gives none
+    const CHAR* name;
+    const CHAR* unit;
+
+    // Unit of the readings, converted to unit when the registry is initialized, e.g. millibar to kilopascal
+    const CHAR* raw_unit;
+
+    // CBOR key, by convention the index of the telemetry in the contents of the device model
+    UINT key;
+
+    // Telemetry name and CBOR key of the RMS about the window means, NULL for channels without one
+    const CHAR* rms_name;
+    UINT rms_key;
+} SENSOR_CHANNEL_DESCRIPTOR;
+
+// Read up to max_samples samples of every channel of the sensor into values, one sample after the
+// other. Returns the number of samples read, 0 when there was nothing to read or the read failed.
+// Samples of a batch are timestamped evenly between the previous read and this one.
+typedef UINT (*func_ptr_sensor_read)(float* values, UINT max_samples);
+
+typedef struct SENSOR_DESCRIPTOR_STRUCT
+{
+    const CHAR* name;
+    const SENSOR_CHANNEL_DESCRIPTOR* channels;
+    UINT channel_count;
+
+    // 0 reads the sensor on every sensor_registry_sample
+    ULONG sample_period_ticks;
+
+    func_ptr_sensor_read read;
+} SENSOR_DESCRIPTOR;
+
+typedef struct SENSOR_WINDOW_STRUCT
+{
+    SENSOR_STATS channels[SENSOR_REGISTRY_MAX_CHANNELS];
+} SENSOR_WINDOW;
+
+// Samples a set of sensors and aggregates them per channel. Channels are numbered in the order of the
+// sensors and their channels. With ENABLE_SENSOR_REGISTRY_THREAD the registry can sample on its own
+// thread, handing windows of statistics to the publishing side through a single producer, single
+// consumer ring. Without it, sensor_registry_sample runs on the publishing thread and windows are
+// merged as they complete.
+typedef struct SENSOR_REGISTRY_STRUCT
+{
+    const SENSOR_DESCRIPTOR* sensors;
+    UINT sensor_count;
+    UINT channel_count;
+
+    // Multiplied into every reading of a channel, from its raw_unit to its unit
+    float scale[SENSOR_REGISTRY_MAX_CHANNELS];
+
+    ULONG window_ticks;
+    ULONG window_start_ticks;
+    ULONG last_sample_ticks[SENSOR_REGISTRY_MAX_SENSORS];
+    bool sampled[SENSOR_REGISTRY_MAX_SENSORS];
+
+    float values[SENSOR_REGISTRY_SAMPLE_VALUES];
+    SENSOR_WINDOW current;
+
+#ifdef ENABLE_SENSOR_REGISTRY_THREAD
+    SENSOR_WINDOW ring[SENSOR_REGISTRY_RING_DEPTH];
+    volatile UINT ring_head;
+    volatile UINT ring_tail;
+#else
+    UINT windows_completed;
+#endif
+
+    // Aggregates since each channel was last reset, owned by the publishing side
+    SENSOR_STATS collected[SENSOR_REGISTRY_MAX_CHANNELS];
+
+#ifdef ENABLE_SENSOR_REGISTRY_THREAD
+    TX_MUTEX bus_mutex;
+    bool bus_mutex_created;
+
+    TX_THREAD thread;
+    ULONG thread_stack[SENSOR_REGISTRY_STACK_SIZE / sizeof(ULONG)];
+    ULONG poll_ticks;
+#endif
+} SENSOR_REGISTRY;
+
+// Fails with NX_OPTION_ERROR when a channel's raw_unit cannot be converted to its unit
+UINT sensor_registry_init(
+    SENSOR_REGISTRY* registry, const SENSOR_DESCRIPTOR* sensors, UINT sensor_count, ULONG window_ticks);
+
+#ifdef ENABLE_SENSOR_REGISTRY_THREAD
+// Sample on a thread of the given priority, polling at the shortest sample period of the sensors
+UINT sensor_registry_start(SENSOR_REGISTRY* registry, UINT priority);
+#endif
+
+// Read every sensor that is due, for registries driven without their own thread
+VOID sensor_registry_sample(SENSOR_REGISTRY* registry);
+
+// Merge the windows completed since the last call into the collected statistics, returns the window count.
+// Only one thread may collect.
+UINT sensor_registry_collect(SENSOR_REGISTRY* registry);
+
+const SENSOR_STATS* sensor_registry_stats(SENSOR_REGISTRY* registry, UINT channel);
+VOID sensor_registry_reset(SENSOR_REGISTRY* registry, UINT first_channel, UINT count);
+
+// Append the mean of each channel that has samples, and its RMS when it has an rms_name, by name or by CBOR key
+UINT sensor_registry_append_json(
+    SENSOR_REGISTRY* registry, NX_AZURE_IOT_JSON_WRITER* json_writer, UINT first_channel, UINT count);
+UINT sensor_registry_append_cbor(
+    SENSOR_REGISTRY* registry, AZURE_IOT_CBOR_WRITER* cbor_writer, UINT first_channel, UINT count);
+
+// For other users of the sensor bus, held by the sampling thread while it reads. No-ops without a thread.
+VOID sensor_registry_bus_lock(SENSOR_REGISTRY* registry);
+VOID sensor_registry_bus_unlock(SENSOR_REGISTRY* registry);
+
+VOID sensor_stats_reset(SENSOR_STATS* stats);
+float sensor_stats_mean(const SENSOR_STATS* stats);
+
+// Root mean square about the window means, the vibration on top of a steady reading
+float sensor_stats_rms(const SENSOR_STATS* stats);
+
+#endif
@@ -10,6 +10,7 @@
 #include "nxd_dns.h"
 #include "nxd_sntp_client.h"
 
+#include "azure_iot_log.h"
 #include "networking.h"
 
 #define SNTP_UPDATE_EVENT 1
@@ -44,6 +45,7 @@ static VOID time_update_callback(NX_SNTP_TIME_MESSAGE* time_update_ptr, NX_SNTP_
 
 static void set_sntp_time()
 {
+    TX_INTERRUPT_SAVE_AREA
     UINT status;
     ULONG seconds;
     ULONG milliseconds;
@@ -52,18 +54,20 @@ static void set_sntp_time()
     status = nx_sntp_client_get_local_time(&sntp_client, &seconds, &milliseconds, NX_NULL);
     if (status != NX_SUCCESS)
     {
-        printf("ERROR: Internal error with getting local time (0x%08x)\n", status);
+        AZURE_IOT_LOG_ERROR("ERROR: Internal error with getting local time (0x%08x)\n", status);
         return;
     }
 
-    // Stash the Unix and ThreadX times
+    // Stash the Unix and ThreadX times together, hub clients may be reading them from their threads
+    TX_DISABLE
     sntp_last_time = seconds - UNIX_TO_NTP_EPOCH_SECS;
     tx_last_ticks  = tx_time_get();
+    TX_RESTORE
 
     nx_sntp_client_utility_display_date_time(&sntp_client, time_buffer, sizeof(time_buffer));
 
-    printf("\tSNTP time update: %s\r\n", time_buffer);
-    printf("SUCCESS: SNTP initialized\r\n");
+    AZURE_IOT_LOG_INFO("\tSNTP time update: %s\r\n", time_buffer);
+    AZURE_IOT_LOG_INFO("SUCCESS: SNTP initialized\r\n");
 }
 
 static UINT sntp_client_run()
@@ -77,7 +81,7 @@ static UINT sntp_client_run()
         return NX_SNTP_SERVER_NOT_AVAILABLE;
     }
 
-    printf("\tSNTP server %s\r\n", SNTP_SERVER[sntp_server_count]);
+    AZURE_IOT_LOG_INFO("\tSNTP server %s\r\n", SNTP_SERVER[sntp_server_count]);
 
     // Stop the server in case it's already running
     nx_sntp_client_stop(&sntp_client);
@@ -89,19 +93,19 @@ static UINT sntp_client_run()
              5 * NX_IP_PERIODIC_RATE,
              NX_IP_VERSION_V4)))
     {
-        printf("ERROR: Unable to resolve SNTP IP %s (0x%08x)\r\n", SNTP_SERVER[sntp_server_count], status);
+        AZURE_IOT_LOG_ERROR("ERROR: Unable to resolve SNTP IP %s (0x%08x)\r\n", SNTP_SERVER[sntp_server_count], status);
     }
 
     // Initialize the service
     else if ((status = nxd_sntp_client_initialize_unicast(&sntp_client, &sntp_address)))
     {
-        printf("ERROR: Unable to initialize unicast SNTP client (0x%08x)\r\n", status);
+        AZURE_IOT_LOG_ERROR("ERROR: Unable to initialize unicast SNTP client (0x%08x)\r\n", status);
     }
 
     // Run Unicast client
     else if ((status = nx_sntp_client_run_unicast(&sntp_client)))
     {
-        printf("ERROR: Unable to start unicast SNTP client (0x%08x)\r\n", status);
+        AZURE_IOT_LOG_ERROR("ERROR: Unable to start unicast SNTP client (0x%08x)\r\n", status);
     }
 
     // rotate to the next SNTP service
@@ -112,11 +116,20 @@ static UINT sntp_client_run()
 
 ULONG sntp_time_get()
 {
+    TX_INTERRUPT_SAVE_AREA
+    ULONG last_time;
+    ULONG last_ticks;
+
+    TX_DISABLE
+    last_time  = sntp_last_time;
+    last_ticks = tx_last_ticks;
+    TX_RESTORE
+
     // Calculate how many seconds have elapsed since the last sync
-    ULONG tx_time_delta = (tx_time_get() - tx_last_ticks) / TX_TIMER_TICKS_PER_SECOND;
+    ULONG tx_time_delta = (tx_time_get() - last_ticks) / TX_TIMER_TICKS_PER_SECOND;
 
     // Add this to the last sync time to get the current time
-    ULONG sntp_time = sntp_last_time + tx_time_delta;
+    ULONG sntp_time = last_time + tx_time_delta;
 
     return sntp_time;
 }
@@ -134,25 +147,25 @@ UINT sntp_init()
 
     if ((status = tx_event_flags_create(&sntp_flags, "SNTP")))
     {
-        printf("ERROR: Create SNTP event flags (0x%08x)\r\n", status);
+        AZURE_IOT_LOG_ERROR("ERROR: Create SNTP event flags (0x%08x)\r\n", status);
     }
 
     else if ((status = nx_sntp_client_create(
                   &sntp_client, &nx_ip, 0, nx_ip.nx_ip_default_packet_pool, NX_NULL, NX_NULL, NULL)))
     {
-        printf("ERROR: SNTP client create failed (0x%08x)\r\n", status);
+        AZURE_IOT_LOG_ERROR("ERROR: SNTP client create failed (0x%08x)\r\n", status);
     }
 
     else if ((status = nx_sntp_client_set_local_time(&sntp_client, 0, 0)))
     {
-        printf("ERROR: Unable to set local time for SNTP client (0x%08x)\r\n", status);
+        AZURE_IOT_LOG_ERROR("ERROR: Unable to set local time for SNTP client (0x%08x)\r\n", status);
         nx_sntp_client_delete(&sntp_client);
     }
 
     // Setup time update callback function
     else if ((status = nx_sntp_client_set_time_update_notify(&sntp_client, time_update_callback)))
     {
-        printf("ERROR: nx_sntp_client_set_time_update_notify (0x%08x)\r\n", status);
+        AZURE_IOT_LOG_ERROR("ERROR: nx_sntp_client_set_time_update_notify (0x%08x)\r\n", status);
         nx_sntp_client_delete(&sntp_client);
     }
 
@@ -165,7 +178,7 @@ UINT sntp_sync()
     UINT server_status;
     ULONG events = 0;
 
-    printf("\r\nInitializing SNTP time sync\r\n");
+    AZURE_IOT_LOG_INFO("\r\nInitializing SNTP time sync\r\n");
 
     // Reset the server index so we start from the beginning
     sntp_server_count = 0;
@@ -6,6 +6,8 @@
 
 #include <tx_api.h>
 
+// One wall clock for the device, shared by every hub context. sntp_init and sntp_sync are called from a
+// single thread, the time functions from any thread.
 ULONG sntp_time_get();
 UINT sntp_time(ULONG* unix_time);
 